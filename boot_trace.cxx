@@ -0,0 +1,46 @@
+#include <stdio.h>
+
+#include "hardware/watchdog.h"
+#include "pico/stdlib.h"
+
+#include "boot_trace.h"
+#include "cdc_text.h"
+
+// the timer is reset along with everything else, so it counts from boot
+static volatile uint32_t phase_us[BOOT_PHASE_COUNT];
+
+// safe from either core, only the first call for a phase counts
+void boot_trace_mark(BootPhase phase)
+{
+  if (phase_us[phase] == 0)
+  {
+    uint32_t now = time_us_32();
+    phase_us[phase] = now != 0 ? now : 1;
+  }
+}
+
+// zero if the phase hasn't been reached
+uint32_t boot_trace_get(BootPhase phase)
+{
+  return phase < BOOT_PHASE_COUNT ? phase_us[phase] : 0;
+}
+
+void boot_trace_print()
+{
+  static const char *names[BOOT_PHASE_COUNT] = {
+    "clock", "core1 launched", "device init", "settings", "uart", "core0 ready",
+    "host init", "device mounted", "link rx", "host mounted", "first key"
+  };
+  cdc_printf("boot after %s\r\n", watchdog_enable_caused_reboot() ? "watchdog reset" : "power up");
+  for (int i = 0; i < BOOT_PHASE_COUNT; ++i)
+  {
+    if (phase_us[i] == 0)
+    {
+      cdc_printf("%-15s -\r\n", names[i]);
+    }
+    else
+    {
+      cdc_printf("%-15s %lu us\r\n", names[i], phase_us[i]);
+    }
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Time since reset at which each startup phase was first reached, to see
+// where the time to the first forwarded key goes. Phases on core0 and core1
+// overlap so they aren't necessarily reached in this order.
+
+enum BootPhase : uint8_t
+{
+  BOOT_CLOCK,           // system clock running at 120MHz
+  BOOT_CORE1_LAUNCHED,  // core1 started, host bring-up runs from here
+  BOOT_DEVICE_INIT,     // device stack started, the host can enumerate us
+  BOOT_SETTINGS,        // board number and stored settings applied
+  BOOT_UART,            // link to the other board up
+  BOOT_CORE0_READY,     // core1 released to forward input
+  BOOT_HOST_INIT,       // pio usb host stack started on core1
+  BOOT_DEVICE_MOUNTED,  // the host has configured us
+  BOOT_LINK_RX,         // first good packet from the other board
+  BOOT_HOST_MOUNTED,    // first keyboard or mouse mounted on our host port
+  BOOT_FIRST_KEY,       // first keyboard report sent to the host
+  BOOT_PHASE_COUNT
+};
+
+extern void boot_trace_mark(BootPhase phase);
+extern uint32_t boot_trace_get(BootPhase phase);
+extern void boot_trace_print();
@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "boot_trace.h"
+#include "cdc_protocol.h"
+#include "cdc_text.h"
+#include "common.h"
+#include "config_store.h"
+#include "framing.h"
+#include "host_ports.h"
+#include "input_trace.h"
+#include "latency.h"
+#include "link_pacing.h"
+#include "link_sync.h"
+#include "peer_state.h"
+#include "profile.h"
+#include "report_filter.h"
+#include "report_queue.h"
+#include "sched.h"
+#include "settings.h"
+#include "tusb.h"
+#include "uart_messages.h"
+
+// Runs as the lowest priority core0 task so input forwarding always goes
+// first. Nothing here blocks: a response is only written once the whole frame
+// fits in the cdc fifo, and no further request is read while one is waiting.
+
+static const int FRAME_BUF_SIZE = frame_encoded_size(CDC_MAX_PAYLOAD);
+typedef frame_encoder<FRAME_BUF_SIZE> cdc_frame;
+
+static frame_decoder<CDC_MAX_PAYLOAD + 1> decoder;
+static cdc_frame response;
+static bool response_pending;
+
+struct cdc_stats
+{
+  uint32_t frames;
+  uint32_t bad_frames;
+  uint32_t events_sent;
+  uint32_t events_dropped;
+};
+
+static cdc_stats stats;
+
+// input events are queued from both cores
+static const int EVENT_REPORT_SIZE = 24; // a keyboard event is a key_state
+struct input_event
+{
+  uint32_t capture_us;
+  uint8_t source;
+  uint8_t kind;
+  uint8_t len;
+  uint8_t report[EVENT_REPORT_SIZE];
+};
+
+static const uint32_t EVENT_QUEUE_SIZE = 32; // must be a power of two
+static critical_section event_cs;
+static input_event events[EVENT_QUEUE_SIZE];
+static uint32_t event_head;
+static uint32_t event_tail;
+static uint16_t events_dropped_since_sent;
+static volatile bool streaming;
+static uint8_t event_seq;
+
+void cdc_protocol_init()
+{
+  critical_section_init(&event_cs);
+}
+
+// called for every input report, from either core
+void cdc_protocol_note_input(InputSource source, InputKind kind, const void *report, int len, uint64_t capture_us)
+{
+  if (!streaming)
+  {
+    return;
+  }
+  critical_section_enter_blocking(&event_cs);
+  if (event_head - event_tail >= EVENT_QUEUE_SIZE)
+  {
+    stats.events_dropped++;
+    events_dropped_since_sent++;
+  }
+  else
+  {
+    input_event &e = events[event_head++ & (EVENT_QUEUE_SIZE - 1)];
+    e.capture_us = (uint32_t) capture_us;
+    e.source = source;
+    e.kind = kind;
+    e.len = len > EVENT_REPORT_SIZE ? EVENT_REPORT_SIZE : len;
+    memcpy(e.report, report, e.len);
+  }
+  critical_section_exit(&event_cs);
+  sched_post(TASK_CDC);
+}
+
+static void handle_text_command(char c)
+{
+  switch (c)
+  {
+    case 'l':
+      latency_print();
+      link_pacing_print();
+      break;
+    case 'L':
+      latency_reset();
+      link_pacing_reset_stats();
+      break;
+    case 'h':
+      report_queue_print();
+      break;
+    case 'H':
+      report_queue_reset_stats();
+      break;
+    case 's':
+      sched_print();
+      break;
+    case 'S':
+      sched_reset_stats();
+      break;
+    case 'p':
+      profile_print();
+      break;
+    case 'P':
+      profile_reset();
+      break;
+    case 'c':
+      config_store_print();
+      break;
+    case 'b':
+      boot_trace_print();
+      break;
+    case 'r':
+      peer_state_print();
+      report_filter_print();
+      link_sync_print();
+      uart_flow_print();
+      break;
+    case 'x':
+      uart_link_bench();
+      break;
+    case 'u':
+      host_ports_print();
+      break;
+    case 'U':
+      host_ports_reset_stats();
+      host_ports_measure_load();
+      break;
+    default:
+      break;
+  }
+}
+
+static void begin_response(uint8_t command, uint8_t seq, CdcStatus status)
+{
+  response = cdc_frame();
+  response.put_sentinel();
+  response.put(command | CDC_RESPONSE);
+  response.put(seq);
+  response.put(status);
+}
+
+static void end_response()
+{
+  response.set_crc();
+  response.put_sentinel();
+  response_pending = true;
+}
+
+static CdcStatus put_counters(uint8_t group, uint8_t index)
+{
+  switch (group)
+  {
+    case COUNTERS_LATENCY:
+    {
+      if (index >= LATENCY_SOURCE_COUNT)
+      {
+        return CDC_BAD_VALUE;
+      }
+      latency_stats s = latency_get((LatencySource) index);
+      response.put_u32(s.count);
+      response.put_u32(s.count != 0 ? s.min_us : 0);
+      response.put_u32(s.count != 0 ? (uint32_t) (s.total_us / s.count) : 0);
+      response.put_u32(s.max_us);
+      return CDC_OK;
+    }
+    case COUNTERS_HOST:
+    {
+      report_queue_stats s = report_queue_get_stats();
+      response.put_u32(s.reports);
+      response.put_u32(s.overflows);
+      response.put_u32(s.high_water);
+      response.put_u32(s.poll_gaps);
+      response.put_u32(s.max_gap_us);
+      response.put_u32(s.max_rearm_us);
+      return CDC_OK;
+    }
+    case COUNTERS_TASK:
+    {
+      sched_stats s;
+      if (index >= TASK_COUNT || !sched_get_stats((SchedTask) index, &s))
+      {
+        return CDC_BAD_VALUE;
+      }
+      response.put_u32(s.runs);
+      response.put_u32(s.avg_run_us);
+      response.put_u32(s.max_run_us);
+      response.put_u32(s.max_wait_us);
+      return CDC_OK;
+    }
+    case COUNTERS_PROBE:
+    {
+      if (index >= PROBE_COUNT)
+      {
+        return CDC_BAD_VALUE;
+      }
+      profile_probe p = *profile_get((ProfileProbe) index);
+      response.put_u32(p.count);
+      response.put_u32(p.min_cycles);
+      response.put_u32(p.count != 0 ? (uint32_t) (p.total_cycles / p.count) : 0);
+      response.put_u32(p.max_cycles);
+      return CDC_OK;
+    }
+    case COUNTERS_BOOT:
+      if (index >= BOOT_PHASE_COUNT)
+      {
+        return CDC_BAD_VALUE;
+      }
+      response.put_u32(boot_trace_get((BootPhase) index));
+      return CDC_OK;
+    case COUNTERS_CDC:
+      response.put_u32(stats.frames);
+      response.put_u32(stats.bad_frames);
+      response.put_u32(stats.events_sent);
+      response.put_u32(stats.events_dropped);
+      return CDC_OK;
+    case COUNTERS_TRACE:
+    {
+      uint32_t captured, lost, replayed;
+      input_trace_stats(&captured, &lost, &replayed);
+      response.put_u32(captured);
+      response.put_u32(lost);
+      response.put_u32(replayed);
+      return CDC_OK;
+    }
+    case COUNTERS_LINK:
+    {
+      uart_link_stats s = uart_link_get_stats();
+      response.put_u32(s.frames);
+      response.put_u32(s.bad_frames);
+      response.put_u32(s.rejected);
+      response.put_u32(s.bytes_outside);
+      return CDC_OK;
+    }
+    case COUNTERS_PORT:
+    {
+      if (index < 1 || index > HOST_PORT_COUNT)
+      {
+        return CDC_BAD_VALUE;
+      }
+      host_port_stats s = host_ports_get(index);
+      response.put_u32(s.devices);
+      response.put_u32(s.through_hub);
+      response.put_u32(s.reports);
+      return CDC_OK;
+    }
+    case COUNTERS_CORE1:
+    {
+      core1_load_stats s = host_ports_get_load();
+      response.put_u32(s.sampled_us);
+      response.put_u32(s.interrupt_us);
+      response.put_u32(s.interrupts);
+      response.put_u32(s.max_interrupt_us);
+      return CDC_OK;
+    }
+    case COUNTERS_SYNC:
+    {
+      link_sync_stats s = link_sync_get_stats();
+      response.put_u32(s.sent);
+      response.put_u32(s.received);
+      response.put_u32(s.peer_restarts);
+      response.put_u32(s.recoveries);
+      return CDC_OK;
+    }
+    case COUNTERS_PACE:
+    {
+      if (index > INPUT_CONSUMER)
+      {
+        return CDC_BAD_VALUE;
+      }
+      pace_stats s = link_pacing_get_stats((InputKind) index);
+      response.put_u32(s.paced);
+      response.put_u32(s.late);
+      response.put_u32(s.unpaced);
+      response.put_u32(link_pacing_delay());
+      return CDC_OK;
+    }
+    case COUNTERS_FILTER:
+    {
+      if (index >= FILTER_PATHS)
+      {
+        return CDC_BAD_VALUE;
+      }
+      report_filter_stats s = report_filter_get_stats((FilterPath) index);
+      response.put_u32(s.keyboard_dropped);
+      response.put_u32(s.mouse_dropped);
+      response.put_u32(s.refreshed);
+      return CDC_OK;
+    }
+    case COUNTERS_FLOW:
+    {
+      uart_flow_stats s = uart_flow_get_stats();
+      response.put_u32(s.waited);
+      response.put_u32(s.timeouts);
+      response.put_u32(s.merged);
+      response.put_u32(s.rx_full);
+      return CDC_OK;
+    }
+    case COUNTERS_STORE:
+    {
+      config_store_stats s = config_store_get_stats();
+      response.put_u32(s.appends);
+      response.put_u32(s.compactions);
+      response.put_u32(s.erases);
+      response.put_u32(s.deferred);
+      response.put_u32(s.mounted_erases);
+      return CDC_OK;
+    }
+    default:
+      return CDC_BAD_VALUE;
+  }
+}
+
+static void handle_request(const uint8_t *req, int len)
+{
+  stats.frames++;
+  if (len < 2)
+  {
+    stats.bad_frames++;
+    return;
+  }
+  uint8_t command = req[0];
+  uint8_t seq = req[1];
+  const uint8_t *args = req + 2;
+  int nargs = len - 2;
+
+  switch (command)
+  {
+    case CDC_PING:
+      begin_response(command, seq, CDC_OK);
+      response.put(CDC_PROTOCOL_VERSION);
+      response.put(get_board_number());
+      break;
+    case CDC_GET_OUTPUT_MASK:
+      begin_response(command, seq, CDC_OK);
+      response.put(get_current_output_mask());
+      break;
+    case CDC_SET_OUTPUT_MASK:
+    {
+      bool ok = nargs == 1 && settings_set(SETTING_OUTPUT_MASK, args, 1);
+      begin_response(command, seq, ok ? CDC_OK : CDC_BAD_VALUE);
+      break;
+    }
+    case CDC_GET_COUNTERS:
+    {
+      if (nargs != 2)
+      {
+        begin_response(command, seq, CDC_BAD_REQUEST);
+        break;
+      }
+      begin_response(command, seq, CDC_OK);
+      if (put_counters(args[0], args[1]) != CDC_OK)
+      {
+        begin_response(command, seq, CDC_BAD_VALUE); // starts the frame again
+      }
+      break;
+    }
+    case CDC_GET_HISTOGRAM:
+    {
+      if (nargs != 1 || args[0] >= PROBE_COUNT)
+      {
+        begin_response(command, seq, CDC_BAD_VALUE);
+        break;
+      }
+      const profile_probe *p = profile_get((ProfileProbe) args[0]);
+      begin_response(command, seq, CDC_OK);
+      response.put(args[0]);
+      for (int i = 0; i < PROFILE_BUCKETS; ++i)
+      {
+        response.put_u32(p->hist[i]);
+      }
+      break;
+    }
+    case CDC_GET_PACE_HISTOGRAM:
+    {
+      if (nargs != 1 || args[0] > INPUT_CONSUMER)
+      {
+        begin_response(command, seq, CDC_BAD_VALUE);
+        break;
+      }
+      pace_stats s = link_pacing_get_stats((InputKind) args[0]);
+      begin_response(command, seq, CDC_OK);
+      response.put(args[0]);
+      for (int i = 0; i < PACE_BUCKETS; ++i)
+      {
+        response.put_u32(s.hist[i]);
+      }
+      break;
+    }
+    case CDC_STREAM_INPUT:
+      if (nargs != 1)
+      {
+        begin_response(command, seq, CDC_BAD_REQUEST);
+        break;
+      }
+      streaming = args[0] != 0;
+      begin_response(command, seq, CDC_OK);
+      break;
+    case CDC_CONFIG_READ:
+    {
+      uint8_t value[SETTING_MAX_LEN];
+      int vlen = nargs == 1 ? settings_get(args[0], value, sizeof(value)) : -1;
+      begin_response(command, seq, vlen < 0 ? CDC_BAD_VALUE : CDC_OK);
+      for (int i = 0; i < vlen; ++i)
+      {
+        response.put(value[i]);
+      }
+      break;
+    }
+    case CDC_CONFIG_WRITE:
+    {
+      bool ok = nargs >= 1 && nargs - 1 <= SETTING_MAX_LEN && settings_set(args[0], args + 1, nargs - 1);
+      begin_response(command, seq, ok ? CDC_OK : CDC_BAD_VALUE);
+      break;
+    }
+    case CDC_RESET_COUNTERS:
+      latency_reset();
+      report_queue_reset_stats();
+      sched_reset_stats();
+      profile_reset();
+      uart_link_reset_stats();
+      host_ports_reset_stats();
+      link_sync_reset_stats();
+      link_pacing_reset_stats();
+      report_filter_reset_stats();
+      uart_flow_reset_stats();
+      memset(&stats, 0, sizeof(stats));
+      begin_response(command, seq, CDC_OK);
+      break;
+    case CDC_TRACE_CAPTURE:
+      if (nargs != 1)
+      {
+        begin_response(command, seq, CDC_BAD_REQUEST);
+        break;
+      }
+      input_trace_capture(args[0] != 0);
+      begin_response(command, seq, CDC_OK);
+      break;
+    case CDC_TRACE_REPLAY:
+      begin_response(command, seq, CDC_OK);
+      response.put_u16(input_trace_replay_feed(args, nargs));
+      break;
+    default:
+      begin_response(command, seq, CDC_UNKNOWN_COMMAND);
+      break;
+  }
+  end_response();
+}
+
+static bool send_pending_response()
+{
+  if (!response_pending)
+  {
+    return true;
+  }
+  if (tud_cdc_write_available() < (uint32_t) response.size())
+  {
+    return false;
+  }
+  tud_cdc_write(response.data(), response.size());
+  response_pending = false;
+  return true;
+}
+
+// the trace goes in whole payloads, a record may straddle two events
+static void send_trace()
+{
+  static const int TRACE_CHUNK = CDC_MAX_PAYLOAD - 2;
+  while (tud_cdc_write_available() >= (uint32_t) FRAME_BUF_SIZE)
+  {
+    uint8_t chunk[TRACE_CHUNK];
+    int n = input_trace_take(chunk, TRACE_CHUNK);
+    if (n == 0)
+    {
+      return;
+    }
+    cdc_frame f;
+    f.put_sentinel();
+    f.put(CDC_EVENT_TRACE);
+    f.put(event_seq++);
+    for (int i = 0; i < n; ++i)
+    {
+      f.put(chunk[i]);
+    }
+    f.set_crc();
+    f.put_sentinel();
+    tud_cdc_write(f.data(), f.size());
+  }
+}
+
+static void send_events()
+{
+  static const int EVENT_FRAME_SIZE = frame_encoded_size(2 + 4 + 2 + 3 + EVENT_REPORT_SIZE);
+  while (tud_cdc_write_available() >= (uint32_t) EVENT_FRAME_SIZE)
+  {
+    critical_section_enter_blocking(&event_cs);
+    if (event_head == event_tail)
+    {
+      critical_section_exit(&event_cs);
+      return;
+    }
+    input_event e = events[event_tail++ & (EVENT_QUEUE_SIZE - 1)];
+    uint16_t dropped = events_dropped_since_sent;
+    events_dropped_since_sent = 0;
+    critical_section_exit(&event_cs);
+
+    frame_encoder<EVENT_FRAME_SIZE> f;
+    f.put_sentinel();
+    f.put(CDC_EVENT_INPUT);
+    f.put(event_seq++);
+    f.put_u32(e.capture_us);
+    f.put_u16(dropped);
+    f.put(e.source);
+    f.put(e.kind);
+    f.put(e.len);
+    for (int i = 0; i < e.len; ++i)
+    {
+      f.put(e.report[i]);
+    }
+    f.set_crc();
+    f.put_sentinel();
+    tud_cdc_write(f.data(), f.size());
+    stats.events_sent++;
+  }
+}
+
+void cdc_protocol_task()
+{
+  if (!send_pending_response())
+  {
+    return; // the host isn't reading, leave further requests in the rx fifo
+  }
+
+  while (!response_pending && tud_cdc_available() > 0)
+  {
+    uint8_t b;
+    if (tud_cdc_read(&b, 1) != 1)
+    {
+      break;
+    }
+    switch (decoder.feed(b))
+    {
+      case FRAME_COMPLETE:
+        handle_request(decoder.data(), decoder.size());
+        send_pending_response();
+        break;
+      case FRAME_BAD:
+        stats.bad_frames++;
+        break;
+      case FRAME_OUTSIDE:
+        handle_text_command(b);
+        break;
+      default:
+        break;
+    }
+  }
+
+  send_events();
+  send_trace();
+  cdc_text_task();
+  tud_cdc_write_flush();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+// Binary protocol on the cdc interface, framed as in framing.h. Shared with
+// the linux client so it must not depend on the pico sdk.
+//
+// request:  command, sequence, arguments
+// response: command | CDC_RESPONSE, sequence, status, data
+// event:    event type, sequence, data, sent unasked while streaming or capturing
+//
+// Bytes outside a frame are single character text commands, see README.md.
+// All multi byte values are little endian.
+
+static const uint8_t CDC_PROTOCOL_VERSION = 7;
+
+// largest payload in either direction, the worst case encoded frame still
+// fits in the 256 byte cdc tx fifo
+static const int CDC_MAX_PAYLOAD = 112;
+
+enum CdcCommand : uint8_t
+{
+  CDC_PING = 1,          // -> u8 version, u8 board number
+  CDC_GET_OUTPUT_MASK,   // -> u8 mask
+  CDC_SET_OUTPUT_MASK,   // u8 mask ->
+  CDC_GET_COUNTERS,      // u8 group, u8 index -> u32 values, see CdcCounterGroup
+  CDC_GET_HISTOGRAM,     // u8 probe -> u8 probe, u32 count for each log2 bucket
+  CDC_STREAM_INPUT,      // u8 on ->
+  CDC_CONFIG_READ,       // u8 key -> value
+  CDC_CONFIG_WRITE,      // u8 key, value ->
+  CDC_RESET_COUNTERS,    // ->
+  CDC_TRACE_CAPTURE,     // u8 on ->
+  CDC_TRACE_REPLAY,      // trace records, see input_trace.h -> u16 bytes taken
+  CDC_GET_PACE_HISTOGRAM // u8 InputKind -> u8 kind, u32 count for each log2 us bucket of forwarded
+                         // input from capture to sent, see link_pacing.h
+};
+
+static const uint8_t CDC_RESPONSE = 0x80;
+
+enum CdcEvent : uint8_t
+{
+  CDC_EVENT_INPUT = 0x40, // u32 capture time us, u16 events dropped, u8 source, u8 kind, u8 len, report
+  CDC_EVENT_TRACE = 0x41  // the next bytes of the capture trace, records may be split between events
+};
+
+enum CdcStatus : uint8_t
+{
+  CDC_OK,
+  CDC_BAD_REQUEST,
+  CDC_UNKNOWN_COMMAND,
+  CDC_BAD_VALUE
+};
+
+enum CdcCounterGroup : uint8_t
+{
+  COUNTERS_LATENCY, // index latency source -> count, min, avg, max us
+  COUNTERS_HOST,    // -> reports, overflows, high water, poll gaps, max gap us, max rearm us
+  COUNTERS_TASK,    // index task -> runs, avg run us, max run us, max wait us
+  COUNTERS_PROBE,   // index probe -> count, min, mean, max cycles
+  COUNTERS_CDC,     // -> frames, bad frames, events sent, events dropped
+  COUNTERS_BOOT,    // index boot phase -> us since reset, 0 if not reached
+  COUNTERS_TRACE,   // -> records captured, records lost, records replayed
+  COUNTERS_LINK,    // -> uart frames, bad frames, rejected frames, bytes outside frames
+  COUNTERS_PORT,    // index usb host port from 1 -> devices, devices through a hub, reports
+  COUNTERS_CORE1,   // -> us sampled, us in interrupts, interrupts, max interrupt us
+  COUNTERS_SYNC,    // -> snapshots sent, snapshots received, peer restarts, link recoveries
+  COUNTERS_PACE,    // index InputKind -> paced, late, unpaced, current pace delay us
+  COUNTERS_FILTER,  // index FilterPath -> keyboard repeats, mouse repeats left out, repeats refreshed
+  COUNTERS_FLOW,    // -> uart frames waited for credit, credit timeouts, frames merged, receive ring full
+  COUNTERS_STORE    // -> config store appends, compactions, erases, stores deferred, erases while in use
+};
+
+enum InputSource : uint8_t
+{
+  INPUT_LOCAL,
+  INPUT_UART
+};
+
+enum InputKind : uint8_t
+{
+  INPUT_KEYBOARD, // modifier, then bit n of byte n / 8 set for usage n pressed
+  INPUT_MOUSE,    // buttons, x, y, reserved, i16 wheel and pan in 1/120 detent
+  INPUT_CONSUMER  // u16 consumer page usage, 0 when released
+};
+
+// firmware side
+extern void cdc_protocol_init();
+extern void cdc_protocol_task();
+extern void cdc_protocol_note_input(InputSource source, InputKind kind, const void *report, int len, uint64_t capture_us);
@@ -0,0 +1,60 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "cdc_text.h"
+#include "tusb.h"
+
+static const uint32_t TEXT_BUF_SIZE = 2048; // must be a power of two
+static char text_buf[TEXT_BUF_SIZE];
+static uint32_t text_head;
+static uint32_t text_tail;
+
+void cdc_printf(const char *fmt, ...)
+{
+  char line[160];
+  va_list args;
+  va_start(args, fmt);
+  int count = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (count < 0)
+  {
+    return;
+  }
+  if (count >= (int) sizeof(line))
+  {
+    count = sizeof(line) - 1;
+  }
+  if (text_head - text_tail + count > TEXT_BUF_SIZE)
+  {
+    printf("cdc text dropped\n");
+    return;
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    text_buf[text_head++ & (TEXT_BUF_SIZE - 1)] = line[i];
+  }
+}
+
+// copy as much as fits into the cdc fifo, called from the usb task
+void cdc_text_task()
+{
+  while (text_head != text_tail)
+  {
+    uint32_t space = tud_cdc_write_available();
+    if (space == 0)
+    {
+      break;
+    }
+    uint32_t start = text_tail & (TEXT_BUF_SIZE - 1);
+    uint32_t len = text_head - text_tail;
+    if (len > TEXT_BUF_SIZE - start)
+    {
+      len = TEXT_BUF_SIZE - start; // up to the end of the buffer, the rest next time round
+    }
+    if (len > space)
+    {
+      len = space;
+    }
+    text_tail += tud_cdc_write(text_buf + start, len);
+  }
+}
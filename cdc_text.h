@@ -0,0 +1,8 @@
+#pragma once
+
+// Text written to the cdc interface from core0 goes through a buffer larger
+// than the cdc fifo so a multi line dump isn't truncated, it is written out
+// as space becomes available.
+
+extern void cdc_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+extern void cdc_text_task();
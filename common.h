@@ -1,8 +1,11 @@
 #pragma once
 
+#include "key_state.h"
+#include "mouse_state.h"
 #include "tusb.h"
 
 const uint8_t NO_DEV = 0xff;
+const uint32_t WATCHDOG_TIMEOUT_MS = 100;
 
 extern uint8_t keyboard_dev_addr;
 extern uint8_t mouse_dev_addr;
@@ -11,12 +14,27 @@ extern uint8_t mouse_instance;
 
 extern bool do_connect;
 extern bool do_disconnect;
+extern volatile bool core0_ready;
+
+extern void core0_init();
+extern bool core0_poll();
+extern void core1_init();
+extern void core1_poll();
+extern void core1_main();
+extern uint8_t toggle_hotkey;
 
 extern bool should_output();
+extern bool peer_should_output();
 extern void toggle_output();
+extern void edge_switch_crossed();
 extern void set_led(bool on);
 extern void set_current_output_mask(uint8_t val);
+extern void change_output_mask(uint8_t val);
+extern bool merge_output_mask(uint8_t mask, uint16_t generation);
+extern uint8_t get_current_output_mask();
+extern uint16_t get_output_mask_generation();
+extern uint8_t get_board_number();
 
-extern void print_kbd_report(const hid_keyboard_report_t *report);
-extern void print_mouse_report(const hid_mouse_report_t *report);
-extern void check_kbd_report(const hid_keyboard_report_t *report);
+extern void print_kbd_report(const key_state *report);
+extern void print_mouse_report(const mouse_state *report);
+extern void check_kbd_report(const key_state *state);
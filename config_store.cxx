@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
+#include "pico/critical_section.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+
+#include "cdc_text.h"
+#include "common.h"
+#include "config_store.h"
+#include "cppcrc.h"
+#include "handoff.h"
+#include "tusb.h"
+
+// Each sector is a run of 16 byte slots. Slot 0 is a header with a generation
+// number and the sector with the newest good header holds the values. It is
+// written last when copying values over, so a copy cut short by a power loss
+// leaves the old sector in charge. A torn record fails its crc and the one
+// before it for the same key stays current.
+
+static const uint32_t STORE_OFFSET = PICO_FLASH_SIZE_BYTES - 2 * FLASH_SECTOR_SIZE;
+static const int RECORD_SIZE = 16;
+static const int SLOTS = FLASH_SECTOR_SIZE / RECORD_SIZE;
+static const int SLOTS_PER_PAGE = FLASH_PAGE_SIZE / RECORD_SIZE;
+
+static const uint8_t KEY_HEADER = 0;
+static const uint32_t HEADER_MAGIC = 0x7773626b; // "kbsw"
+
+static const uint32_t SETTLE_US = 1000000;     // commit once nothing has changed for this long
+static const uint32_t ERASE_IDLE_US = 2000000; // and only erase after this long without input
+static const uint32_t ERASE_MOUNTED_IDLE_US = 30000000; // or this long while the computer is using the board
+
+struct store_record
+{
+  uint8_t key;
+  uint8_t len;
+  uint8_t data[CONFIG_STORE_MAX_LEN];
+  uint8_t reserved;
+  uint8_t crc;
+};
+
+static_assert(sizeof(store_record) == RECORD_SIZE, "a record fills one slot");
+
+struct store_value
+{
+  bool valid;
+  bool dirty;
+  uint8_t len;
+  uint8_t data[CONFIG_STORE_MAX_LEN];
+};
+
+static critical_section store_cs;
+static store_value values[CONFIG_STORE_KEYS];
+static uint32_t last_change_us;
+static int active = -1; // sector holding the values, -1 before the first commit
+static uint32_t generation;
+static int next_slot;   // first free slot in the active sector
+static bool spare_erased;
+static bool erase_waiting; // a store is held back until the spare is erased
+static config_store_stats stats;
+
+static uint32_t sector_offset(int sector)
+{
+  return STORE_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
+
+static int spare_sector()
+{
+  return active == 0 ? 1 : 0;
+}
+
+// read straight from XIP
+static const store_record *sector_slots(int sector)
+{
+  return (const store_record *) (XIP_BASE + sector_offset(sector));
+}
+
+static uint8_t record_crc(const store_record *r)
+{
+  return CRC8::CRC8::calc((const uint8_t *) r, RECORD_SIZE - 1);
+}
+
+static bool record_valid(const store_record *r)
+{
+  return r->len <= CONFIG_STORE_MAX_LEN && r->crc == record_crc(r);
+}
+
+static bool blank(const void *p, int len)
+{
+  const uint8_t *b = (const uint8_t *) p;
+  for (int i = 0; i < len; ++i)
+  {
+    if (b[i] != 0xff)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static store_record make_record(uint8_t key, const uint8_t *data, int len)
+{
+  store_record r;
+  memset(&r, 0xff, sizeof(r));
+  r.key = key;
+  r.len = len;
+  memcpy(r.data, data, len);
+  r.crc = record_crc(&r);
+  return r;
+}
+
+static bool read_header(int sector, uint32_t *gen)
+{
+  const store_record *h = sector_slots(sector);
+  uint32_t magic;
+  if (h->key != KEY_HEADER || h->len != 8 || !record_valid(h))
+  {
+    return false;
+  }
+  memcpy(&magic, h->data, 4);
+  memcpy(gen, h->data + 4, 4);
+  return magic == HEADER_MAGIC;
+}
+
+static void load_sector(int sector)
+{
+  const store_record *slots = sector_slots(sector);
+  next_slot = 1;
+  for (int i = 1; i < SLOTS; ++i)
+  {
+    const store_record *r = &slots[i];
+    if (blank(r, RECORD_SIZE))
+    {
+      continue;
+    }
+    next_slot = i + 1; // a partly written slot can't be reused either
+    if (!record_valid(r) || r->key == KEY_HEADER || r->key >= CONFIG_STORE_KEYS)
+    {
+      stats.bad_records++;
+      continue;
+    }
+    store_value &v = values[r->key];
+    v.valid = true;
+    v.len = r->len;
+    memcpy(v.data, r->data, r->len);
+  }
+}
+
+void config_store_init()
+{
+  critical_section_init(&store_cs);
+  memset(values, 0, sizeof(values));
+  memset(&stats, 0, sizeof(stats));
+  active = -1;
+  generation = 0;
+  next_slot = 0;
+  erase_waiting = false;
+
+  uint32_t gen0, gen1;
+  bool ok0 = read_header(0, &gen0);
+  bool ok1 = read_header(1, &gen1);
+  if (ok0 && ok1)
+  {
+    active = (int32_t) (gen1 - gen0) > 0 ? 1 : 0;
+  }
+  else
+  {
+    active = ok0 ? 0 : ok1 ? 1 : -1;
+  }
+  if (active >= 0)
+  {
+    generation = active == 0 ? gen0 : gen1;
+    load_sector(active);
+  }
+  spare_erased = blank(sector_slots(spare_sector()), FLASH_SECTOR_SIZE);
+  printf("config store sector %d generation %lu slots used %d\n", active, generation, next_slot);
+}
+
+// returns the length of the value or -1 if there isn't one
+int config_store_get(uint8_t key, uint8_t *value, int max_len)
+{
+  int len = -1;
+  if (key == KEY_HEADER || key >= CONFIG_STORE_KEYS)
+  {
+    return -1;
+  }
+  critical_section_enter_blocking(&store_cs);
+  const store_value &v = values[key];
+  if (v.valid && v.len <= max_len)
+  {
+    len = v.len;
+    memcpy(value, v.data, len);
+  }
+  critical_section_exit(&store_cs);
+  return len;
+}
+
+// safe from either core, only updates RAM
+bool config_store_set(uint8_t key, const uint8_t *value, int len)
+{
+  if (key == KEY_HEADER || key >= CONFIG_STORE_KEYS || len < 0 || len > CONFIG_STORE_MAX_LEN)
+  {
+    return false;
+  }
+  critical_section_enter_blocking(&store_cs);
+  store_value &v = values[key];
+  if (!v.valid || v.len != len || memcmp(v.data, value, len) != 0)
+  {
+    v.valid = true;
+    v.dirty = true;
+    v.len = len;
+    memcpy(v.data, value, len);
+    last_change_us = time_us_32();
+  }
+  critical_section_exit(&store_cs);
+  return true;
+}
+
+// Core1 runs from flash too, so it's parked in RAM and interrupts are off
+// for the duration of each operation.
+static void program_page(uint32_t offset, const uint8_t *page)
+{
+  multicore_lockout_start_blocking();
+  uint32_t ints = save_and_disable_interrupts();
+  flash_range_program(offset, page, FLASH_PAGE_SIZE);
+  restore_interrupts(ints);
+  multicore_lockout_end_blocking();
+}
+
+// A sector erase can take 400 ms, longer than the watchdog allows, and
+// nothing runs meanwhile that it could catch hanging, so it is off.
+static void erase_sector(int sector)
+{
+  watchdog_disable();
+  multicore_lockout_start_blocking();
+  uint32_t ints = save_and_disable_interrupts();
+  flash_range_erase(sector_offset(sector), FLASH_SECTOR_SIZE);
+  restore_interrupts(ints);
+  multicore_lockout_end_blocking();
+  watchdog_enable(WATCHDOG_TIMEOUT_MS, 0);
+  stats.erases++;
+}
+
+// Programs records into consecutive slots a page at a time. The rest of each
+// page is programmed as 0xff which leaves what is already there unchanged.
+static void write_records(int sector, int slot, const store_record *records, int count)
+{
+  uint8_t page[FLASH_PAGE_SIZE];
+  while (count > 0)
+  {
+    int page_slot = slot - slot % SLOTS_PER_PAGE;
+    int n = page_slot + SLOTS_PER_PAGE - slot;
+    if (n > count)
+    {
+      n = count;
+    }
+    memset(page, 0xff, sizeof(page));
+    memcpy(page + (slot - page_slot) * RECORD_SIZE, records, n * RECORD_SIZE);
+    program_page(sector_offset(sector) + page_slot * RECORD_SIZE, page);
+    slot += n;
+    records += n;
+    count -= n;
+  }
+}
+
+// takes up to max values to write, all of them or just the changed ones
+static int collect(store_record *records, bool all, int max)
+{
+  int count = 0;
+  critical_section_enter_blocking(&store_cs);
+  for (int key = 1; key < CONFIG_STORE_KEYS && count < max; ++key)
+  {
+    store_value &v = values[key];
+    if (v.valid && (all || v.dirty))
+    {
+      records[count++] = make_record(key, v.data, v.len);
+      v.dirty = false;
+    }
+  }
+  critical_section_exit(&store_cs);
+  return count;
+}
+
+// copy every value to the erased spare sector and make it the active one
+static void compact()
+{
+  store_record records[CONFIG_STORE_KEYS];
+  int count = collect(records, true, CONFIG_STORE_KEYS);
+  int sector = spare_sector();
+  write_records(sector, 1, records, count);
+
+  uint32_t gen = generation + 1;
+  uint8_t header[8];
+  memcpy(header, &HEADER_MAGIC, 4);
+  memcpy(header + 4, &gen, 4);
+  store_record h = make_record(KEY_HEADER, header, sizeof(header));
+  write_records(sector, 0, &h, 1);
+
+  active = sector;
+  generation = gen;
+  next_slot = count + 1;
+  spare_erased = false;
+  stats.compactions++;
+}
+
+// low priority core0 task, does at most one erase per run
+void config_store_task()
+{
+  bool dirty = false;
+  critical_section_enter_blocking(&store_cs);
+  bool settled = time_us_32() - last_change_us >= SETTLE_US;
+  for (int key = 1; key < CONFIG_STORE_KEYS; ++key)
+  {
+    dirty |= values[key].dirty;
+  }
+  critical_section_exit(&store_cs);
+  if (!dirty || !settled)
+  {
+    return;
+  }
+
+  // whatever doesn't fit stays dirty and goes in the compacted copy
+  if (active >= 0 && next_slot < SLOTS)
+  {
+    store_record records[CONFIG_STORE_KEYS];
+    int count = collect(records, false, SLOTS - next_slot);
+    write_records(active, next_slot, records, count);
+    next_slot += count;
+    stats.appends += count;
+    return;
+  }
+
+  // Full or never written, values move to the spare sector. The erase
+  // stalls usb, so it waits for the computer to suspend or drop this board.
+  // A computer that never does that sees the endpoints NAK for the length
+  // of the erase once there has been no input for a long while.
+  if (!spare_erased)
+  {
+    bool in_use = tud_mounted() && !tud_suspended();
+    if (time_us_32() - handoff_last_input_us() < (in_use ? ERASE_MOUNTED_IDLE_US : ERASE_IDLE_US))
+    {
+      if (!erase_waiting)
+      {
+        erase_waiting = true;
+        stats.deferred++;
+      }
+      return;
+    }
+    erase_sector(spare_sector());
+    spare_erased = true;
+    erase_waiting = false;
+    stats.mounted_erases += in_use;
+    return;
+  }
+  compact();
+}
+
+config_store_stats config_store_get_stats()
+{
+  return stats;
+}
+
+void config_store_print()
+{
+  cdc_printf("config store sector %d generation %lu slots used %d of %d%s\r\n",
+    active, generation, next_slot, SLOTS, erase_waiting ? ", waiting to erase" : "");
+  cdc_printf("appends %lu compactions %lu erases %lu bad records %lu\r\n",
+    stats.appends, stats.compactions, stats.erases, stats.bad_records);
+  cdc_printf("stores deferred %lu erases while in use %lu\r\n", stats.deferred, stats.mounted_erases);
+}
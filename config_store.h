@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// Key/value store in the last two sectors of flash. Values are appended as
+// crc checked records and the latest record for a key wins. When a sector
+// fills up the live values are copied to the other one.
+//
+// Boot only reads through XIP. Writes are kept in RAM and committed by a low
+// priority task once values have settled. The erase stops both cores for up
+// to 400 ms, so a sector is erased while the computer has suspended or
+// unmounted this board and there is no input to forward, or failing that
+// after a long spell without input while it is in use. Until then values
+// that don't fit in the full sector stay in RAM.
+
+static const int CONFIG_STORE_MAX_LEN = 12;
+static const int CONFIG_STORE_KEYS = 32; // keys are 1 to CONFIG_STORE_KEYS - 1
+
+struct config_store_stats
+{
+  uint32_t appends;
+  uint32_t compactions;
+  uint32_t erases;
+  uint32_t bad_records;
+  uint32_t deferred;       // stores that had to wait for a chance to erase
+  uint32_t mounted_erases; // erases while the computer was using this board
+};
+
+extern void config_store_init();
+extern int config_store_get(uint8_t key, uint8_t *value, int max_len);
+extern bool config_store_set(uint8_t key, const uint8_t *value, int len);
+extern void config_store_task();
+extern config_store_stats config_store_get_stats();
+extern void config_store_print();
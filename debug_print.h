@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdio.h>
+
+// Prints for every report on the forwarding path. Stdio goes out on uart1 at
+// 115200 baud and blocks once the fifo is full, so one line costs more than
+// forwarding the report. Building with DEBUG_PRINTS_ENABLED=1 turns them on,
+// otherwise the compiler drops them and their arguments.
+
+#ifndef DEBUG_PRINTS_ENABLED
+#define DEBUG_PRINTS_ENABLED 0
+#endif
+
+#define debug_printf(...) \
+  do \
+  { \
+    if (DEBUG_PRINTS_ENABLED) \
+    { \
+      printf(__VA_ARGS__); \
+    } \
+  } while (0)
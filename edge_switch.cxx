@@ -0,0 +1,156 @@
+#include "edge_switch.h"
+
+// The virtual cursor follows the mouse deltas sent to the host on this board.
+// Host pointer acceleration means it drifts from the real cursor, but it is
+// clamped at the screen edges the same way so they line up again whenever the
+// user pushes against an edge.
+
+// distance from the peer edge the cursor is placed at when output arrives,
+// so a little jitter doesn't immediately bounce output back
+static const int ENTRY_INSET = 4;
+
+static bool enabled = false;
+static screen_geometry geometry = { 1920, 1080, EDGE_NONE };
+static int cursor_x;
+static int cursor_y;
+static uint32_t absolute_scale_x; // pixels to absolute units, 16.16 fixed point
+static uint32_t absolute_scale_y;
+static uint16_t entry_position; // where along the peer edge output arrives, 1/65536ths
+static bool have_entry_position;
+
+void edge_switch_configure(bool enable, const screen_geometry *geom)
+{
+  enabled = enable;
+  if (geom != nullptr && geom->width > 0 && geom->height > 0)
+  {
+    geometry = *geom;
+  }
+  cursor_x = geometry.width / 2;
+  cursor_y = geometry.height / 2;
+  // cursor * scale stays under 2^31 as the cursor is at most width - 1
+  absolute_scale_x = ((uint32_t) EDGE_SWITCH_ABSOLUTE_MAX << 16) / (geometry.width > 1 ? geometry.width - 1 : 1);
+  absolute_scale_y = ((uint32_t) EDGE_SWITCH_ABSOLUTE_MAX << 16) / (geometry.height > 1 ? geometry.height - 1 : 1);
+}
+
+bool edge_switch_enabled()
+{
+  return enabled && geometry.peer_edge != EDGE_NONE;
+}
+
+const screen_geometry *edge_switch_geometry()
+{
+  return &geometry;
+}
+
+static bool vertical_edge()
+{
+  return geometry.peer_edge == EDGE_LEFT || geometry.peer_edge == EDGE_RIGHT;
+}
+
+// a position along an edge of length len pixels as a 16 bit fraction
+static int from_fraction(uint16_t fraction, int len)
+{
+  return (int) (((uint32_t) fraction * (uint32_t) (len - 1) + 0x8000) >> 16);
+}
+
+static uint16_t to_fraction(int pos, int len)
+{
+  return len > 1 ? (uint16_t) (((uint32_t) pos * 0xffff + (len - 1) / 2) / (uint32_t) (len - 1)) : 0;
+}
+
+// output has just moved to this board, the cursor came in over the peer
+// edge at the entry position if the other board sent one
+void edge_switch_enter()
+{
+  switch (geometry.peer_edge)
+  {
+    case EDGE_LEFT:
+      cursor_x = ENTRY_INSET;
+      break;
+    case EDGE_RIGHT:
+      cursor_x = geometry.width - 1 - ENTRY_INSET;
+      break;
+    case EDGE_TOP:
+      cursor_y = ENTRY_INSET;
+      break;
+    case EDGE_BOTTOM:
+      cursor_y = geometry.height - 1 - ENTRY_INSET;
+      break;
+    default:
+      break;
+  }
+  if (have_entry_position)
+  {
+    if (vertical_edge())
+    {
+      cursor_y = from_fraction(entry_position, geometry.height);
+    }
+    else
+    {
+      cursor_x = from_fraction(entry_position, geometry.width);
+    }
+    have_entry_position = false;
+  }
+}
+
+// apply a mouse delta, returns true if it pushed the cursor over the peer edge
+bool edge_switch_motion(int dx, int dy)
+{
+  if (!enabled)
+  {
+    return false;
+  }
+
+  bool crossed = false;
+  cursor_x += dx;
+  if (cursor_x < 0)
+  {
+    cursor_x = 0;
+    crossed |= geometry.peer_edge == EDGE_LEFT;
+  }
+  else if (cursor_x >= geometry.width)
+  {
+    cursor_x = geometry.width - 1;
+    crossed |= geometry.peer_edge == EDGE_RIGHT;
+  }
+
+  cursor_y += dy;
+  if (cursor_y < 0)
+  {
+    cursor_y = 0;
+    crossed |= geometry.peer_edge == EDGE_TOP;
+  }
+  else if (cursor_y >= geometry.height)
+  {
+    cursor_y = geometry.height - 1;
+    crossed |= geometry.peer_edge == EDGE_BOTTOM;
+  }
+
+  return crossed;
+}
+
+void edge_switch_position(int *x, int *y)
+{
+  *x = cursor_x;
+  *y = cursor_y;
+}
+
+// where along the peer edge the cursor is, sent to the other board as it
+// crosses so the cursor carries on from the same point on the other screen
+uint16_t edge_switch_exit_position()
+{
+  return vertical_edge() ? to_fraction(cursor_y, geometry.height) : to_fraction(cursor_x, geometry.width);
+}
+
+void edge_switch_set_entry_position(uint16_t position)
+{
+  entry_position = position;
+  have_entry_position = true;
+}
+
+// the cursor scaled to 0 to EDGE_SWITCH_ABSOLUTE_MAX, called per report
+void edge_switch_absolute(uint16_t *x, uint16_t *y)
+{
+  *x = ((uint32_t) cursor_x * absolute_scale_x + 0x8000) >> 16;
+  *y = ((uint32_t) cursor_y * absolute_scale_y + 0x8000) >> 16;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// Switch output by pushing the mouse off a configured edge of the screen
+// attached to this board. Only integer maths so it can run per mouse report.
+//
+// The virtual cursor can also be sent to the host as an absolute position,
+// then the real cursor is always where the model says and is placed at the
+// point on the peer edge matching where it left the other screen.
+
+// absolute positions run from 0 to this on both axes
+static const int EDGE_SWITCH_ABSOLUTE_MAX = 32767;
+
+enum ScreenEdge : uint8_t
+{
+  EDGE_NONE,
+  EDGE_LEFT,
+  EDGE_RIGHT,
+  EDGE_TOP,
+  EDGE_BOTTOM
+};
+
+struct screen_geometry
+{
+  int16_t width;
+  int16_t height;
+  ScreenEdge peer_edge; // leaving the screen over this edge moves output to the other board
+};
+
+extern void edge_switch_configure(bool enabled, const screen_geometry *geom);
+extern bool edge_switch_enabled();
+extern const screen_geometry *edge_switch_geometry();
+extern void edge_switch_enter();
+extern bool edge_switch_motion(int dx, int dy);
+extern void edge_switch_position(int *x, int *y);
+extern uint16_t edge_switch_exit_position();
+extern void edge_switch_set_entry_position(uint16_t position);
+extern void edge_switch_absolute(uint16_t *x, uint16_t *y);
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cppcrc.h"
+#include "hot_path.h"
+
+// Byte stuffed framing shared by the uart link, the cdc protocol and the
+// linux client. A frame is SENTINEL, payload, crc8 of the payload, SENTINEL,
+// with any SENTINEL or ESCAPE byte inside prefixed by ESCAPE.
+
+const uint8_t SENTINEL = 0x7e;
+const uint8_t ESCAPE = 0x7d;
+
+// cppcrc's table is constexpr so it always lands in flash, this copy of it
+// can be marked to go in ram with the rest of the forwarding path
+struct frame_crc8_table
+{
+  uint8_t value[256];
+};
+
+template <size_t... indexes>
+constexpr frame_crc8_table make_frame_crc8_table(std::index_sequence<indexes...>)
+{
+  return {{CRC8::CRC8::table()[indexes]...}};
+}
+
+HOT_DATA("frame_crc8_table") inline const frame_crc8_table frame_crc8_lookup =
+  make_frame_crc8_table(std::make_index_sequence<256>());
+
+inline uint8_t HOT_FUNC(frame_crc8)(const uint8_t *bytes, size_t n, uint8_t crc = 0)
+{
+  while (n-- > 0)
+  {
+    crc = frame_crc8_lookup.value[*bytes++ ^ crc];
+  }
+  return crc;
+}
+
+template <int N>
+class frame_encoder
+{
+public:
+  void put_sentinel()
+  {
+    m_buf[m_ptr++] = SENTINEL;
+  }
+  void put(uint8_t b)
+  {
+    m_crc = frame_crc8(&b, 1, m_crc);
+    putbyte(b);
+  }
+  void put_u16(uint16_t v)
+  {
+    put(v & 0xff);
+    put(v >> 8);
+  }
+  void put_u32(uint32_t v)
+  {
+    put_u16(v & 0xffff);
+    put_u16(v >> 16);
+  }
+  void set_crc()
+  {
+    putbyte(m_crc);
+  }
+  const uint8_t *data() const
+  {
+    return m_buf;
+  }
+  int size() const
+  {
+    return m_ptr;
+  }
+private:
+  void putbyte(uint8_t b)
+  {
+    if (b == SENTINEL || b == ESCAPE)
+    {
+      m_buf[m_ptr++] = ESCAPE;
+    }
+    m_buf[m_ptr++] = b;
+  }
+  uint8_t m_crc = 0;
+  int m_ptr = 0;
+  uint8_t m_buf[N];
+};
+
+// worst case encoded size of a payload, every byte escaped
+constexpr int frame_encoded_size(int payload)
+{
+  return 2 * (payload + 1) + 2;
+}
+
+enum FrameResult : uint8_t
+{
+  FRAME_NONE,      // byte consumed, nothing complete yet
+  FRAME_COMPLETE,  // data() holds a payload with a good crc
+  FRAME_BAD,       // frame ended with a bad crc or was too long
+  FRAME_OUTSIDE    // byte arrived between frames
+};
+
+// Decodes one byte at a time. After a bad frame the closing sentinel is taken
+// as the start of the next one, so a lost sentinel costs one frame at most.
+template <int N>
+class frame_decoder
+{
+public:
+  FrameResult HOT_FUNC(feed)(uint8_t b)
+  {
+    if (b == SENTINEL && !m_escape)
+    {
+      if (!m_in_frame || m_len == 0)
+      {
+        m_in_frame = true;
+        return FRAME_NONE;
+      }
+      FrameResult r = check();
+      m_in_frame = r != FRAME_COMPLETE;
+      m_len = 0;
+      m_overflow = false;
+      return r;
+    }
+    if (!m_in_frame)
+    {
+      return FRAME_OUTSIDE;
+    }
+    if (b == ESCAPE && !m_escape)
+    {
+      m_escape = true;
+      return FRAME_NONE;
+    }
+    m_escape = false;
+    if (m_len < N)
+    {
+      m_buf[m_len++] = b;
+    }
+    else
+    {
+      m_overflow = true;
+    }
+    return FRAME_NONE;
+  }
+  void reset()
+  {
+    m_in_frame = false;
+    m_escape = false;
+    m_overflow = false;
+    m_len = 0;
+    m_size = 0;
+  }
+  bool in_frame() const
+  {
+    return m_in_frame;
+  }
+  const uint8_t *data() const
+  {
+    return m_buf;
+  }
+  // payload size, not counting the crc
+  int size() const
+  {
+    return m_size;
+  }
+private:
+  FrameResult HOT_FUNC(check)()
+  {
+    m_size = 0;
+    if (m_overflow || m_len < 2)
+    {
+      return FRAME_BAD;
+    }
+    if (frame_crc8(m_buf, m_len - 1) != m_buf[m_len - 1])
+    {
+      return FRAME_BAD;
+    }
+    m_size = m_len - 1;
+    return FRAME_COMPLETE;
+  }
+  uint8_t m_buf[N];
+  int m_len = 0;
+  int m_size = 0;
+  bool m_in_frame = false;
+  bool m_escape = false;
+  bool m_overflow = false;
+};
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+  return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "common.h"
+#include "handoff.h"
+#include "report_cache.h"
+#include "sched.h"
+#include "usb_descriptors.h"
+
+// When output moves away from this board the host gets an all released
+// keyboard and mouse report, so it doesn't see a key or button stuck down.
+// When output moves to this board the host gets whatever is held right now.
+// Only one report can be in flight on the HID endpoint so the steps are sent
+// in a fixed order, one per completed report.
+
+enum HandoffStep : uint8_t
+{
+  RELEASE_KEYBOARD = 1 << 0,
+  RELEASE_MOUSE = 1 << 1,
+  RESTORE_KEYBOARD = 1 << 2,
+  RESTORE_MOUSE = 1 << 3,
+  PUSH_LEDS = 1 << 4,
+  RELEASE_CONSUMER = 1 << 5,
+  RESTORE_CONSUMER = 1 << 6
+};
+
+static const uint8_t RELEASE_STEPS = RELEASE_KEYBOARD | RELEASE_MOUSE | RELEASE_CONSUMER;
+static const uint8_t RESTORE_STEPS = RESTORE_KEYBOARD | RESTORE_MOUSE | RESTORE_CONSUMER;
+
+static critical_section handoff_cs;
+static volatile uint8_t pending;
+static key_state held_keyboard;
+static uint8_t held_buttons;
+static volatile uint16_t held_consumer;
+static uint8_t peer_leds;
+static volatile uint32_t last_input_us;
+
+void handoff_init()
+{
+  critical_section_init(&handoff_cs);
+}
+
+static void enter()
+{
+  critical_section_enter_blocking(&handoff_cs);
+}
+
+static void leave()
+{
+  critical_section_exit(&handoff_cs);
+}
+
+static void add_pending(uint8_t steps)
+{
+  enter();
+  pending |= steps;
+  leave();
+  sched_post(TASK_HANDOFF);
+}
+
+void handoff_note_keyboard(const key_state *state)
+{
+  enter();
+  held_keyboard = *state;
+  leave();
+  last_input_us = time_us_32();
+}
+
+// The host changed protocol, or a keyboard report found the endpoint busy.
+// What is held goes out again after the report in flight, in the current
+// format.
+void handoff_resend_keyboard()
+{
+  if (should_output())
+  {
+    add_pending(RESTORE_KEYBOARD);
+  }
+}
+
+void handoff_note_mouse_buttons(uint8_t buttons)
+{
+  held_buttons = buttons;
+  last_input_us = time_us_32();
+}
+
+// A mouse report found the endpoint busy. Its motion and wheel stay in the
+// report cache and, with the buttons held, go out after the report in
+// flight, so a busy endpoint only delays them. A lost release would leave a
+// button held on the host.
+void handoff_resend_mouse()
+{
+  uint8_t sent = 0;
+  report_cache_get(report_cache_mouse_report_id(), &sent, 1);
+  if (should_output() && (sent != held_buttons || report_cache_mouse_pending()))
+  {
+    add_pending(RESTORE_MOUSE);
+  }
+}
+
+void handoff_note_consumer(uint16_t usage)
+{
+  held_consumer = usage;
+  last_input_us = time_us_32();
+}
+
+// A media key report found the endpoint busy. It goes out after the report
+// in flight, a lost release would leave the key repeating on the host.
+void handoff_resend_consumer()
+{
+  add_pending(RESTORE_CONSUMER);
+}
+
+// when a keyboard or mouse report last arrived from either board
+uint32_t handoff_last_input_us()
+{
+  return last_input_us;
+}
+
+// the host attached to this board set its LEDs, kept in the report cache
+void handoff_host_leds_changed()
+{
+  if (should_output())
+  {
+    add_pending(PUSH_LEDS);
+  }
+}
+
+// LED state requested by the host attached to the other board
+void handoff_set_peer_leds(uint8_t leds)
+{
+  peer_leds = leds;
+  if (peer_should_output())
+  {
+    add_pending(PUSH_LEDS);
+  }
+}
+
+uint8_t handoff_peer_leds()
+{
+  return peer_leds;
+}
+
+// The peer restarted or the link came back. What its keyboard and mouse
+// hold now replaces what was last forwarded from them, a release sent
+// before then may have been lost. Kept for when output comes here if it
+// isn't here now. Keys held on this board come back with its keyboard's
+// next report.
+void handoff_resync_peer(const key_state *keys, uint8_t buttons)
+{
+  enter();
+  held_keyboard = *keys;
+  held_buttons = buttons;
+  leave();
+  if (should_output())
+  {
+    add_pending(RESTORE_KEYBOARD | RESTORE_MOUSE);
+  }
+}
+
+void handoff_output_changed(bool was_output, bool is_output)
+{
+  enter();
+  if (was_output && !is_output)
+  {
+    pending = (pending & ~RESTORE_STEPS) | RELEASE_STEPS;
+  }
+  else if (!was_output && is_output)
+  {
+    pending = (pending & ~RELEASE_STEPS) | RESTORE_STEPS;
+  }
+  pending |= PUSH_LEDS;
+  leave();
+  if (!was_output && is_output)
+  {
+    // motion left from when this board last had the output is stale
+    report_cache_drop_mouse_pending();
+  }
+  sched_post(TASK_HANDOFF);
+}
+
+static void push_leds()
+{
+  // must stay valid until the control transfer completes
+  static uint8_t leds;
+  if (should_output())
+  {
+    leds = report_cache_leds();
+  }
+  else if (peer_should_output())
+  {
+    leds = peer_leds;
+  }
+  else
+  {
+    return;
+  }
+  printf("handoff leds %x\n", leds);
+  if (keyboard_dev_addr != NO_DEV)
+  {
+    tuh_hid_set_report(keyboard_dev_addr, keyboard_instance, 0, HID_REPORT_TYPE_OUTPUT, &leds, sizeof(leds));
+  }
+}
+
+static bool send_step(uint8_t step)
+{
+  static const key_state no_keys = {};
+  switch (step)
+  {
+    case RELEASE_KEYBOARD:
+      return report_cache_send_keyboard(&no_keys);
+    case RELEASE_MOUSE:
+      // nothing to release while the host only reads boot keyboard reports
+    {
+      static const mouse_state released = {};
+      return !report_cache_mouse_available() || report_cache_send_mouse(&released);
+    }
+    case RESTORE_KEYBOARD:
+    {
+      enter();
+      key_state state = held_keyboard;
+      leave();
+      return report_cache_send_keyboard(&state);
+    }
+    case RESTORE_MOUSE:
+      // also the retry, done once the motion a busy endpoint held back is out
+    {
+      mouse_state held = {};
+      held.buttons = held_buttons;
+      return !report_cache_mouse_available() || (report_cache_send_mouse(&held) && !report_cache_mouse_pending());
+    }
+    case RELEASE_CONSUMER:
+      return !report_cache_consumer_available() || report_cache_send_consumer(0);
+    case RESTORE_CONSUMER:
+      // also used to retry a report that found the endpoint busy
+      return !should_output() || !report_cache_consumer_available() || report_cache_send_consumer(held_consumer);
+    default:
+      return true;
+  }
+}
+
+// send the next outstanding step, called from the main loop and whenever
+// the device finishes sending a report
+void handoff_task()
+{
+  if (pending == 0)
+  {
+    return;
+  }
+
+  enter();
+  bool leds = (pending & PUSH_LEDS) != 0;
+  pending &= ~PUSH_LEDS;
+  if (!tud_mounted())
+  {
+    pending = 0;
+  }
+  uint8_t step = pending & -pending; // lowest set bit
+  leave();
+
+  if (leds)
+  {
+    push_leds();
+  }
+
+  if (step == 0)
+  {
+    return;
+  }
+  bool keyboard_step = (step & (RELEASE_KEYBOARD | RESTORE_KEYBOARD | RELEASE_CONSUMER | RESTORE_CONSUMER)) != 0;
+  if (!tud_hid_n_ready(keyboard_step ? HID_INSTANCE_KEYBOARD : HID_INSTANCE_MOUSE))
+  {
+    return;
+  }
+
+  if (send_step(step))
+  {
+    enter();
+    pending &= ~step;
+    leave();
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "key_state.h"
+#include "tusb.h"
+
+// Keeps the state needed to hand the keyboard and mouse cleanly from one host
+// to the other: what is held down right now and each host's LED state.
+
+extern void handoff_init();
+extern void handoff_note_keyboard(const key_state *state);
+extern void handoff_resend_keyboard();
+extern void handoff_note_mouse_buttons(uint8_t buttons);
+extern void handoff_resend_mouse();
+extern void handoff_note_consumer(uint16_t usage);
+extern void handoff_resend_consumer();
+extern uint32_t handoff_last_input_us();
+extern void handoff_host_leds_changed();
+extern void handoff_set_peer_leds(uint8_t leds);
+extern uint8_t handoff_peer_leds();
+extern void handoff_resync_peer(const key_state *keys, uint8_t buttons);
+extern void handoff_output_changed(bool was_output, bool is_output);
+extern void handoff_task();
@@ -0,0 +1,596 @@
+#include <string.h>
+
+#include "hid_parser.h"
+#include "hot_path.h"
+
+enum ItemType : uint8_t
+{
+  ITEM_MAIN,
+  ITEM_GLOBAL,
+  ITEM_LOCAL
+};
+
+static const uint8_t MAIN_INPUT = 0x8;
+static const uint8_t MAIN_COLLECTION = 0xa;
+static const uint8_t MAIN_FEATURE = 0xb;
+static const uint8_t MAIN_END_COLLECTION = 0xc;
+static const uint8_t GLOBAL_USAGE_PAGE = 0x0;
+static const uint8_t GLOBAL_LOGICAL_MIN = 0x1;
+static const uint8_t GLOBAL_LOGICAL_MAX = 0x2;
+static const uint8_t GLOBAL_PHYSICAL_MIN = 0x3;
+static const uint8_t GLOBAL_PHYSICAL_MAX = 0x4;
+static const uint8_t GLOBAL_REPORT_SIZE = 0x7;
+static const uint8_t GLOBAL_REPORT_ID = 0x8;
+static const uint8_t GLOBAL_REPORT_COUNT = 0x9;
+static const uint8_t LOCAL_USAGE = 0x0;
+static const uint8_t LOCAL_USAGE_MIN = 0x1;
+static const uint8_t LOCAL_USAGE_MAX = 0x2;
+
+static const uint8_t INPUT_CONSTANT = 0x01;
+static const uint8_t INPUT_VARIABLE = 0x02;
+
+static const uint16_t USAGE_PAGE_DESKTOP = 0x01;
+static const uint16_t USAGE_PAGE_KEYBOARD = 0x07;
+static const uint16_t USAGE_PAGE_BUTTON = 0x09;
+static const uint16_t USAGE_PAGE_CONSUMER = 0x0c;
+static const uint16_t USAGE_X = 0x30;
+static const uint16_t USAGE_Y = 0x31;
+static const uint16_t USAGE_WHEEL = 0x38;
+static const uint16_t USAGE_RESOLUTION_MULTIPLIER = 0x48;
+static const uint16_t USAGE_AC_PAN = 0x238;
+static const uint8_t LONG_ITEM = 0xfe;
+
+// input or feature bits seen so far for each report id
+static const int MAX_REPORT_IDS = 8;
+struct report_bits
+{
+  uint8_t id;
+  uint16_t bits;
+};
+
+static uint16_t *bits_for(report_bits *reports, int *count, uint8_t id)
+{
+  for (int i = 0; i < *count; ++i)
+  {
+    if (reports[i].id == id)
+    {
+      return &reports[i].bits;
+    }
+  }
+  if (*count == MAX_REPORT_IDS)
+  {
+    return nullptr;
+  }
+  reports[*count].id = id;
+  reports[*count].bits = 0;
+  return &reports[(*count)++].bits;
+}
+
+// an input or feature item with the globals and locals that apply to it
+static const int MAX_LISTED_USAGES = 16;
+static const int MAX_COLLECTION_DEPTH = 8;
+struct input_item
+{
+  uint8_t main_tag;    // MAIN_INPUT or MAIN_FEATURE
+  uint8_t collection;  // numbered in the order they open, 0 outside any
+  uint16_t usage_page;
+  int32_t logical_min;
+  int32_t logical_max;
+  int32_t physical_min;
+  int32_t physical_max;
+  uint8_t report_size;
+  uint8_t report_count;
+  uint8_t report_id;
+  uint16_t bit_offset;
+  uint8_t flags;
+  uint16_t usage_min;
+  uint16_t usage_max;
+  bool have_usage_range;
+  uint8_t usage_count;  // usages listed one at a time
+  uint16_t usages[MAX_LISTED_USAGES];
+
+  // usage of entry n of the item
+  uint16_t usage(int n) const
+  {
+    if (n < usage_count)
+    {
+      return usages[n];
+    }
+    if (have_usage_range && usage_min + n <= usage_max)
+    {
+      return usage_min + n;
+    }
+    return usage_count > 0 ? usages[usage_count - 1] : 0; // the last usage repeats
+  }
+};
+
+// Calls on_item for each input and feature item. Walking stops at the end
+// of the descriptor, a truncated item or when on_item returns false.
+template <typename F>
+static void walk_items(const uint8_t *desc, int desc_len, F on_item)
+{
+  report_bits inputs[MAX_REPORT_IDS];
+  report_bits features[MAX_REPORT_IDS];
+  int input_ids = 0;
+  int feature_ids = 0;
+  uint8_t collections[MAX_COLLECTION_DEPTH];
+  int depth = 0;
+  uint8_t collection_count = 0;
+  input_item item = {};
+
+  int i = 0;
+  while (i < desc_len)
+  {
+    uint8_t prefix = desc[i++];
+    if (prefix == LONG_ITEM)
+    {
+      if (i >= desc_len)
+      {
+        break;
+      }
+      i += 2 + desc[i];
+      continue;
+    }
+    int size = prefix & 3;
+    if (size == 3)
+    {
+      size = 4;
+    }
+    if (i + size > desc_len)
+    {
+      break;
+    }
+    uint32_t value = 0;
+    for (int b = 0; b < size; ++b)
+    {
+      value |= (uint32_t) desc[i + b] << (8 * b);
+    }
+    int32_t svalue = size == 1 ? (int8_t) value : size == 2 ? (int16_t) value : (int32_t) value;
+    i += size;
+
+    uint8_t type = (prefix >> 2) & 3;
+    uint8_t tag = prefix >> 4;
+    if (type == ITEM_GLOBAL)
+    {
+      switch (tag)
+      {
+        case GLOBAL_USAGE_PAGE: item.usage_page = value; break;
+        case GLOBAL_LOGICAL_MIN: item.logical_min = svalue; break;
+        case GLOBAL_LOGICAL_MAX: item.logical_max = svalue; break;
+        case GLOBAL_PHYSICAL_MIN: item.physical_min = svalue; break;
+        case GLOBAL_PHYSICAL_MAX: item.physical_max = svalue; break;
+        case GLOBAL_REPORT_SIZE: item.report_size = value; break;
+        case GLOBAL_REPORT_ID: item.report_id = value; break;
+        case GLOBAL_REPORT_COUNT: item.report_count = value; break;
+        default: break;
+      }
+    }
+    else if (type == ITEM_LOCAL)
+    {
+      // a four byte usage carries its page in the top half, only the low
+      // half is kept
+      switch (tag)
+      {
+        case LOCAL_USAGE:
+          if (item.usage_count < MAX_LISTED_USAGES)
+          {
+            item.usages[item.usage_count++] = value;
+          }
+          break;
+        case LOCAL_USAGE_MIN:
+          item.usage_min = value;
+          item.have_usage_range = true;
+          break;
+        case LOCAL_USAGE_MAX:
+          item.usage_max = value;
+          break;
+        default:
+          break;
+      }
+    }
+    else if (type == ITEM_MAIN)
+    {
+      if (tag == MAIN_INPUT || tag == MAIN_FEATURE)
+      {
+        uint16_t *bits = tag == MAIN_INPUT ? bits_for(inputs, &input_ids, item.report_id) :
+          bits_for(features, &feature_ids, item.report_id);
+        if (bits == nullptr)
+        {
+          break;
+        }
+        item.main_tag = tag;
+        item.bit_offset = *bits;
+        item.flags = value;
+        if (!on_item(item))
+        {
+          break;
+        }
+        *bits += item.report_size * item.report_count;
+      }
+      else if (tag == MAIN_COLLECTION)
+      {
+        if (depth < MAX_COLLECTION_DEPTH)
+        {
+          collections[depth] = item.collection;
+        }
+        depth++;
+        item.collection = ++collection_count;
+      }
+      else if (tag == MAIN_END_COLLECTION && depth > 0)
+      {
+        depth--;
+        item.collection = depth < MAX_COLLECTION_DEPTH ? collections[depth] : 0;
+      }
+      // locals only last until the next main item
+      item.usage_min = 0;
+      item.usage_max = 0;
+      item.have_usage_range = false;
+      item.usage_count = 0;
+    }
+  }
+}
+
+// returns false if there are no keyboard fields the layout can hold
+bool hid_parse_keyboard(const uint8_t *desc, int desc_len, hid_keyboard_layout *layout)
+{
+  memset(layout, 0, sizeof(*layout));
+  bool found = false;
+  walk_items(desc, desc_len, [&](const input_item &item)
+  {
+    bool keys = item.main_tag == MAIN_INPUT && item.usage_page == USAGE_PAGE_KEYBOARD && (item.flags & INPUT_CONSTANT) == 0;
+    // keys from one report only
+    if (keys && found && item.report_id != layout->report_id)
+    {
+      keys = false;
+    }
+    if (keys && layout->field_count < HID_KEYBOARD_MAX_FIELDS && item.report_size >= 1 && item.report_size <= 8)
+    {
+      hid_keyboard_field &f = layout->fields[layout->field_count];
+      f.bit_offset = item.bit_offset;
+      f.size = item.report_size;
+      f.count = item.report_count;
+      f.array = (item.flags & INPUT_VARIABLE) == 0;
+      // arrays hold usage indexes counted from the logical minimum
+      f.usage_min = item.have_usage_range ? item.usage_min : 0;
+      f.logical_min = item.logical_min;
+      if (f.array || item.report_size == 1)
+      {
+        layout->field_count++;
+        layout->report_id = item.report_id;
+        found = true;
+      }
+    }
+    return true;
+  });
+  return found;
+}
+
+// Finds the consumer page input fields of the first report that has any.
+// One bit fields get each bit's usage copied into the layout, from the
+// usages listed for the field or its usage range.
+bool hid_parse_consumer(const uint8_t *desc, int desc_len, hid_consumer_layout *layout)
+{
+  memset(layout, 0, sizeof(*layout));
+  bool found = false;
+  walk_items(desc, desc_len, [&](const input_item &item)
+  {
+    if (item.main_tag != MAIN_INPUT || item.usage_page != USAGE_PAGE_CONSUMER || (item.flags & INPUT_CONSTANT) != 0)
+    {
+      return true;
+    }
+    if (found && item.report_id != layout->report_id)
+    {
+      return true;
+    }
+    if (layout->field_count == HID_CONSUMER_MAX_FIELDS || item.report_size < 1 || item.report_size > 16)
+    {
+      return true;
+    }
+    hid_consumer_field &f = layout->fields[layout->field_count];
+    f.bit_offset = item.bit_offset;
+    f.size = item.report_size;
+    f.count = item.report_count;
+    f.array = (item.flags & INPUT_VARIABLE) == 0;
+    f.logical_min = item.logical_min;
+    if (f.array)
+    {
+      f.usage_min = item.have_usage_range ? item.usage_min : 0;
+    }
+    else
+    {
+      if (item.report_size != 1 || layout->usage_count + item.report_count > HID_CONSUMER_MAX_USAGES)
+      {
+        return true;
+      }
+      f.usage_min = layout->usage_count;
+      for (int n = 0; n < item.report_count; ++n)
+      {
+        layout->usages[layout->usage_count++] = item.usage(n);
+      }
+    }
+    layout->field_count++;
+    layout->report_id = item.report_id;
+    found = true;
+    return true;
+  });
+  return found;
+}
+
+// A resolution multiplier applies to the wheels in its logical collection.
+// Setting it to its logical maximum selects its physical maximum as the
+// number of counts per detent.
+struct multiplier_item
+{
+  uint8_t report_id;
+  uint8_t collection;
+  uint16_t bit_offset;
+  uint8_t size;
+  uint32_t value;
+  uint8_t multiplier;
+};
+
+// a value field with its report id and collection, kept until the mouse
+// report is known
+struct mouse_field
+{
+  hid_value_field field;
+  uint8_t report_id;
+  uint8_t collection;
+  bool found;
+};
+
+static void set_bits(uint8_t *data, int len, int offset, int size, uint32_t value)
+{
+  for (int b = 0; b < size; ++b)
+  {
+    int bit = offset + b;
+    if ((bit >> 3) < len && (value & (1u << b)) != 0)
+    {
+      data[bit >> 3] |= 1 << (bit & 7);
+    }
+  }
+}
+
+// Takes the first report with an X axis as the mouse report. Returns false
+// if there isn't one.
+bool hid_parse_mouse(const uint8_t *desc, int desc_len, hid_mouse_layout *layout)
+{
+  memset(layout, 0, sizeof(*layout));
+  enum { BUTTONS, X, Y, WHEEL, PAN, FIELD_COUNT };
+  mouse_field fields[FIELD_COUNT] = {};
+  multiplier_item multipliers[2];
+  int multiplier_count = 0;
+  uint16_t feature_bits[2] = {};
+
+  walk_items(desc, desc_len, [&](const input_item &item)
+  {
+    if (item.main_tag == MAIN_FEATURE)
+    {
+      for (int i = 0; i < multiplier_count; ++i)
+      {
+        if (multipliers[i].report_id == item.report_id)
+        {
+          feature_bits[i] = item.bit_offset + item.report_size * item.report_count;
+        }
+      }
+      bool multiplier = item.usage_page == USAGE_PAGE_DESKTOP && item.usage(0) == USAGE_RESOLUTION_MULTIPLIER;
+      if (multiplier && (item.flags & INPUT_CONSTANT) == 0 && multiplier_count < 2 && item.report_size <= 8)
+      {
+        multiplier_item &m = multipliers[multiplier_count];
+        m.report_id = item.report_id;
+        m.collection = item.collection;
+        m.bit_offset = item.bit_offset;
+        m.size = item.report_size;
+        m.value = item.logical_max;
+        int32_t physical = item.physical_max > 0 ? item.physical_max : item.logical_max;
+        m.multiplier = physical < 1 ? 1 : physical > WHEEL_UNITS_PER_DETENT ? WHEEL_UNITS_PER_DETENT : physical;
+        feature_bits[multiplier_count] = item.bit_offset + item.report_size * item.report_count;
+        multiplier_count++;
+      }
+      return true;
+    }
+    if ((item.flags & (INPUT_CONSTANT | INPUT_VARIABLE)) != INPUT_VARIABLE || item.report_size > 16)
+    {
+      return true;
+    }
+    for (int n = 0; n < item.report_count; ++n)
+    {
+      int which = -1;
+      if (item.usage_page == USAGE_PAGE_BUTTON)
+      {
+        which = n == 0 && item.report_size == 1 ? BUTTONS : -1;
+      }
+      else if (item.usage_page == USAGE_PAGE_DESKTOP)
+      {
+        uint16_t usage = item.usage(n);
+        which = usage == USAGE_X ? X : usage == USAGE_Y ? Y : usage == USAGE_WHEEL ? WHEEL : -1;
+      }
+      else if (item.usage_page == USAGE_PAGE_CONSUMER && item.usage(n) == USAGE_AC_PAN)
+      {
+        which = PAN;
+      }
+      if (which < 0 || fields[which].found)
+      {
+        continue;
+      }
+      mouse_field &f = fields[which];
+      f.found = true;
+      f.report_id = item.report_id;
+      f.collection = item.collection;
+      f.field.bit_offset = item.bit_offset + n * item.report_size;
+      f.field.size = which == BUTTONS ? (item.report_count > 8 ? 8 : item.report_count) : item.report_size;
+      f.field.is_signed = item.logical_min < 0;
+    }
+    return true;
+  });
+
+  if (!fields[X].found)
+  {
+    return false;
+  }
+  layout->report_id = fields[X].report_id;
+  hid_value_field *out[FIELD_COUNT] = { &layout->buttons, &layout->x, &layout->y, &layout->wheel, &layout->pan };
+  for (int i = 0; i < FIELD_COUNT; ++i)
+  {
+    if (fields[i].found && fields[i].report_id == layout->report_id)
+    {
+      *out[i] = fields[i].field;
+    }
+  }
+
+  layout->wheel_multiplier = 1;
+  layout->pan_multiplier = 1;
+  if (multiplier_count == 0)
+  {
+    return true;
+  }
+  // only multipliers in the same feature report as the first are set
+  uint8_t feature_id = multipliers[0].report_id;
+  int header = feature_id != 0 ? 1 : 0;
+  int feature_len = header + (feature_bits[0] + 7) / 8;
+  if (feature_len > HID_MOUSE_FEATURE_MAX)
+  {
+    return true;
+  }
+  layout->feature_report_id = feature_id;
+  layout->feature_len = feature_len;
+  layout->feature[0] = feature_id; // overwritten by the data when there's no id
+  for (int i = 0; i < multiplier_count; ++i)
+  {
+    const multiplier_item &m = multipliers[i];
+    if (m.report_id != feature_id)
+    {
+      continue;
+    }
+    set_bits(layout->feature + header, feature_len - header, m.bit_offset, m.size, m.value);
+    if (fields[WHEEL].found && fields[WHEEL].collection == m.collection)
+    {
+      layout->wheel_multiplier = m.multiplier;
+    }
+    if (fields[PAN].found && fields[PAN].collection == m.collection)
+    {
+      layout->pan_multiplier = m.multiplier;
+    }
+  }
+  return true;
+}
+
+static uint16_t HOT_FUNC(read_bits)(const uint8_t *data, int len, int offset, int size)
+{
+  uint16_t v = 0;
+  for (int b = 0; b < size; ++b)
+  {
+    int bit = offset + b;
+    if ((bit >> 3) < len && (data[bit >> 3] & (1 << (bit & 7))) != 0)
+    {
+      v |= 1 << b;
+    }
+  }
+  return v;
+}
+
+// strips the report id, false if the report has a different one
+static bool HOT_FUNC(report_data)(uint8_t report_id, const uint8_t **report, int *len)
+{
+  if (report_id == 0)
+  {
+    return true;
+  }
+  if (*len < 1 || (*report)[0] != report_id)
+  {
+    return false;
+  }
+  (*report)++;
+  (*len)--;
+  return true;
+}
+
+// returns false for a report from some other part of the device
+bool HOT_FUNC(hid_keyboard_to_state)(const hid_keyboard_layout *layout, const uint8_t *report, int len, key_state *state)
+{
+  if (!report_data(layout->report_id, &report, &len))
+  {
+    return false;
+  }
+  key_state_clear(state);
+  for (int i = 0; i < layout->field_count; ++i)
+  {
+    const hid_keyboard_field &f = layout->fields[i];
+    for (int n = 0; n < f.count; ++n)
+    {
+      uint8_t v = read_bits(report, len, f.bit_offset + n * f.size, f.size);
+      if (f.array)
+      {
+        if (v != 0 && v >= f.logical_min)
+        {
+          key_state_press(state, f.usage_min + v - f.logical_min);
+        }
+      }
+      else if (v != 0)
+      {
+        key_state_press(state, f.usage_min + n);
+      }
+    }
+  }
+  return true;
+}
+
+// Only one consumer usage is forwarded at a time, the first one found
+// pressed, 0 when nothing is. Returns false for a report with another id.
+bool HOT_FUNC(hid_consumer_to_usage)(const hid_consumer_layout *layout, const uint8_t *report, int len, uint16_t *usage)
+{
+  if (!report_data(layout->report_id, &report, &len))
+  {
+    return false;
+  }
+  *usage = 0;
+  for (int i = 0; i < layout->field_count; ++i)
+  {
+    const hid_consumer_field &f = layout->fields[i];
+    for (int n = 0; n < f.count; ++n)
+    {
+      uint16_t v = read_bits(report, len, f.bit_offset + n * f.size, f.size);
+      if (v == 0 || (f.array && v < f.logical_min))
+      {
+        continue;
+      }
+      *usage = f.array ? f.usage_min + v - f.logical_min : layout->usages[f.usage_min + n];
+      if (*usage != 0)
+      {
+        return true;
+      }
+    }
+  }
+  return true;
+}
+
+static int32_t HOT_FUNC(read_value)(const hid_value_field &f, const uint8_t *data, int len)
+{
+  if (f.size == 0)
+  {
+    return 0;
+  }
+  int32_t v = read_bits(data, len, f.bit_offset, f.size);
+  if (f.is_signed && (v & (1 << (f.size - 1))) != 0)
+  {
+    v -= 1 << f.size;
+  }
+  return v;
+}
+
+// high_resolution once the resolution multiplier feature has been set, x
+// and y wider than 8 bits go through motion
+bool HOT_FUNC(hid_mouse_to_state)(const hid_mouse_layout *layout, const uint8_t *report, int len, bool high_resolution,
+  motion_accumulator *motion, mouse_state *state)
+{
+  if (!report_data(layout->report_id, &report, &len))
+  {
+    return false;
+  }
+  memset(state, 0, sizeof(*state));
+  state->buttons = read_bits(report, len, layout->buttons.bit_offset, layout->buttons.size);
+  motion_accumulate(motion, read_value(layout->x, report, len), read_value(layout->y, report, len), state);
+  state->wheel = wheel_to_units(read_value(layout->wheel, report, len), high_resolution ? layout->wheel_multiplier : 1);
+  state->pan = wheel_to_units(read_value(layout->pan, report, len), high_resolution ? layout->pan_multiplier : 1);
+  return true;
+}
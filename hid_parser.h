@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "key_state.h"
+#include "mouse_state.h"
+
+// Just enough of a HID report descriptor parser to read keyboards in report
+// protocol: finds the modifier and key bitmap or key array fields of the
+// first report that has keys in it, and the consumer control (media key)
+// fields of the first report that has those, and the pointer fields and
+// wheel resolution multipliers of a mouse.
+
+static const int HID_KEYBOARD_MAX_FIELDS = 4;
+
+struct hid_keyboard_field
+{
+  uint16_t bit_offset; // from the start of the report data, after any id
+  uint8_t size;        // bits per entry
+  uint8_t count;
+  uint8_t usage_min;
+  int16_t logical_min; // arrays: the entry value meaning usage_min
+  bool array;          // entries hold keycodes rather than one bit per key
+};
+
+struct hid_keyboard_layout
+{
+  uint8_t report_id;   // 0 if the device doesn't use report ids
+  uint8_t field_count;
+  hid_keyboard_field fields[HID_KEYBOARD_MAX_FIELDS];
+};
+
+static const int HID_CONSUMER_MAX_FIELDS = 4;
+static const int HID_CONSUMER_MAX_USAGES = 32;
+
+struct hid_consumer_field
+{
+  uint16_t bit_offset;
+  uint8_t size;
+  uint8_t count;
+  uint16_t usage_min;  // arrays: usage of logical_min, bits: index into usages
+  int16_t logical_min;
+  bool array;
+};
+
+struct hid_consumer_layout
+{
+  uint8_t report_id;
+  uint8_t field_count;
+  hid_consumer_field fields[HID_CONSUMER_MAX_FIELDS];
+  uint8_t usage_count;
+  uint16_t usages[HID_CONSUMER_MAX_USAGES]; // usage for each one bit entry
+};
+
+struct hid_value_field
+{
+  uint16_t bit_offset;
+  uint8_t size;        // 0 if the report doesn't have it
+  bool is_signed;
+};
+
+static const int HID_MOUSE_FEATURE_MAX = 4;
+
+struct hid_mouse_layout
+{
+  uint8_t report_id;
+  hid_value_field buttons;  // one bit per button from button 1
+  hid_value_field x;
+  hid_value_field y;
+  hid_value_field wheel;
+  hid_value_field pan;
+  uint8_t wheel_multiplier; // counts per detent once the feature is set
+  uint8_t pan_multiplier;
+  uint8_t feature_report_id;
+  uint8_t feature_len;      // 0 if the mouse has no resolution multiplier
+  uint8_t feature[HID_MOUSE_FEATURE_MAX]; // SET_REPORT data, starting with the id if there is one
+};
+
+extern bool hid_parse_keyboard(const uint8_t *desc, int desc_len, hid_keyboard_layout *layout);
+extern bool hid_keyboard_to_state(const hid_keyboard_layout *layout, const uint8_t *report, int len, key_state *state);
+extern bool hid_parse_consumer(const uint8_t *desc, int desc_len, hid_consumer_layout *layout);
+extern bool hid_consumer_to_usage(const hid_consumer_layout *layout, const uint8_t *report, int len, uint16_t *usage);
+extern bool hid_parse_mouse(const uint8_t *desc, int desc_len, hid_mouse_layout *layout);
+extern bool hid_mouse_to_state(const hid_mouse_layout *layout, const uint8_t *report, int len, bool high_resolution,
+  motion_accumulator *motion, mouse_state *state);
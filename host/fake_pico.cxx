@@ -0,0 +1,741 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "hardware/clocks.h"
+#include "hardware/flash.h"
+#include "hardware/pwm.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "hardware/watchdog.h"
+#include "pico/critical_section.h"
+#include "pico/multicore.h"
+#include "pico/stdio_uart.h"
+#include "pico/stdlib.h"
+
+#include "host_fakes.h"
+
+// Pico SDK fakes. Everything runs on the calling thread and simulated time
+// only moves forward when asked to.
+
+// The uart is timed from the baud rate and format the firmware sets. Writes
+// take a character time each through a tx fifo and block while it is full.
+// Bytes from host_uart_deliver land in an rx fifo at their time and raise
+// the interrupt as the SDK sets it up: at 4 bytes, or once the line has
+// been idle for 32 bit periods.
+//
+// With hardware flow control RTS goes up once the rx fifo reaches that same
+// level, and while host_uart_set_cts says the peer's RTS is up no byte
+// starts from the tx fifo. Bytes only go to the wire as they start, so
+// those still in the fifo wait there for CTS.
+static const int UART_FIFO_DEPTH = 32;
+static const size_t UART_RX_IRQ_LEVEL = 4;
+static const int UART_RX_TIMEOUT_BITS = 32;
+
+struct host_uart
+{
+  std::deque<uint8_t> rx;
+  std::vector<host_uart_byte> tx;
+  std::deque<host_uart_byte> wire; // delivered, not yet arrived
+  bool rx_irq;
+  uint bit_ns;
+  uint frame_bits;
+  uint64_t tx_free_ns; // when the last byte written is out
+  uint64_t last_rx_us;
+  bool rx_timeout_armed;
+  uint32_t overruns;
+  bool cts_flow;
+  bool rts_flow;
+  bool cts_held;              // the peer's RTS is up
+  std::deque<uint8_t> tx_fifo; // with CTS, written and not started
+};
+
+uart_inst_t host_uart0;
+uart_inst_t host_uart1;
+watchdog_hw_t host_watchdog;
+systick_hw_t host_systick;
+xip_ctrl_hw_t host_xip_ctrl;
+armv6m_scb_hw_t host_scb;
+uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+
+static const int GPIO_COUNT = 30;
+static const int IRQ_COUNT = 32;
+
+struct host_alarm
+{
+  alarm_id_t id;
+  uint64_t due_us;
+  alarm_callback_t callback;
+  void *user_data;
+};
+
+static uint64_t now_us;
+static bool verbose;
+static bool gpio_in[GPIO_COUNT];
+static bool gpio_out[GPIO_COUNT];
+static bool gpio_inputs_set;
+static uint32_t gpio_irq_events[GPIO_COUNT];
+static gpio_irq_callback_t gpio_irq_callback;
+static irq_handler_t irq_handlers[IRQ_COUNT];
+static bool irq_enabled[IRQ_COUNT];
+static std::vector<host_alarm> alarms;
+static alarm_id_t next_alarm_id = 1;
+
+static void uart_event(uint64_t due_us);
+static uint64_t uart_next_event_us();
+
+//--------------------------------------------------------------------+
+// time
+//--------------------------------------------------------------------+
+
+// fires alarms and uart interrupts that come due on the way
+void host_advance_us(uint64_t us)
+{
+  uint64_t end = now_us + us;
+  while (true)
+  {
+    auto next = alarms.end();
+    for (auto it = alarms.begin(); it != alarms.end(); ++it)
+    {
+      if (it->due_us <= end && (next == alarms.end() || it->due_us < next->due_us))
+      {
+        next = it;
+      }
+    }
+    uint64_t uart_due = uart_next_event_us();
+    if (uart_due <= end && (next == alarms.end() || uart_due < next->due_us))
+    {
+      uart_event(uart_due);
+      continue;
+    }
+    if (next == alarms.end())
+    {
+      break;
+    }
+    host_alarm alarm = *next;
+    alarms.erase(next);
+    if (alarm.due_us > now_us)
+    {
+      now_us = alarm.due_us;
+    }
+    int64_t again = alarm.callback(alarm.id, alarm.user_data);
+    if (again != 0)
+    {
+      // negative is from the time it was due, positive from now
+      alarm.due_us = again < 0 ? alarm.due_us - again : now_us + again;
+      alarms.push_back(alarm);
+    }
+  }
+  now_us = end;
+}
+
+void host_advance_to(uint64_t us)
+{
+  if (us > now_us)
+  {
+    host_advance_us(us - now_us);
+  }
+}
+
+uint64_t host_now_us()
+{
+  return now_us;
+}
+
+uint64_t time_us_64()
+{
+  return now_us;
+}
+
+uint32_t time_us_32()
+{
+  return (uint32_t) now_us;
+}
+
+void host_systick_count(uint32_t cycles)
+{
+  if ((host_systick.csr & 1) == 0)
+  {
+    return;
+  }
+  uint64_t period = (uint64_t) host_systick.rvr + 1;
+  uint64_t step = cycles % period;
+  host_systick.cvr = (uint32_t) (host_systick.cvr >= step ? host_systick.cvr - step : host_systick.cvr + period - step);
+}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+  return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+  return 120000000;
+}
+
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void *user_data, bool fire_if_past)
+{
+  host_alarm alarm = { next_alarm_id++, now_us + ms * 1000ull, callback, user_data };
+  alarms.push_back(alarm);
+  return alarm.id;
+}
+
+absolute_time_t from_us_since_boot(uint64_t us)
+{
+  return us;
+}
+
+// host_run decides when time moves, so a sleep returns straight away
+bool best_effort_wfe_or_timeout(absolute_time_t timeout)
+{
+  return now_us >= timeout;
+}
+
+void __wfe()
+{
+}
+
+void __sev()
+{
+}
+
+// a spin takes some time, so startup waits on the clock finish
+void tight_loop_contents()
+{
+  now_us++;
+}
+
+//--------------------------------------------------------------------+
+// gpio, pwm
+//--------------------------------------------------------------------+
+
+static void init_gpio_inputs()
+{
+  if (!gpio_inputs_set)
+  {
+    for (int i = 0; i < GPIO_COUNT; ++i)
+    {
+      gpio_in[i] = true;
+    }
+    gpio_inputs_set = true;
+  }
+}
+
+void host_gpio_set(unsigned gpio, bool level)
+{
+  init_gpio_inputs();
+  bool was = gpio_in[gpio];
+  gpio_in[gpio] = level;
+  uint32_t event = level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+  if (was != level && gpio_irq_callback != nullptr && (gpio_irq_events[gpio] & event) != 0)
+  {
+    gpio_irq_callback(gpio, event);
+  }
+}
+
+bool host_gpio_output(unsigned gpio)
+{
+  return gpio_out[gpio];
+}
+
+void gpio_init(uint gpio)
+{
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+}
+
+void gpio_put(uint gpio, bool value)
+{
+  gpio_out[gpio] = value;
+}
+
+bool gpio_get(uint gpio)
+{
+  init_gpio_inputs();
+  return gpio_in[gpio];
+}
+
+void gpio_set_pulls(uint gpio, bool up, bool down)
+{
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback)
+{
+  gpio_irq_events[gpio] = enabled ? events : 0;
+  gpio_irq_callback = callback;
+}
+
+uint pwm_gpio_to_slice_num(uint gpio)
+{
+  return (gpio >> 1) & 7;
+}
+
+pwm_config pwm_get_default_config()
+{
+  pwm_config c = { 1.0f };
+  return c;
+}
+
+void pwm_config_set_clkdiv(pwm_config *c, float div)
+{
+  c->clkdiv = div;
+}
+
+void pwm_init(uint slice_num, pwm_config *c, bool start)
+{
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level)
+{
+  gpio_out[gpio] = level != 0;
+}
+
+//--------------------------------------------------------------------+
+// uart, interrupts
+//--------------------------------------------------------------------+
+
+uint uart_init(uart_inst_t *uart, uint baud_rate)
+{
+  *uart = host_uart();
+  uart->bit_ns = 1000000000u / baud_rate;
+  uart->frame_bits = 10;
+  return baud_rate;
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts)
+{
+  uart->cts_flow = cts;
+  uart->rts_flow = rts;
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity)
+{
+  uart->frame_bits = 1 + data_bits + stop_bits + (parity != UART_PARITY_NONE ? 1 : 0);
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled)
+{
+}
+
+static void uart_rx_irq();
+
+// the interrupt is a level, one turned on over a full enough fifo fires
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data)
+{
+  uart->rx_irq = rx_has_data;
+  if (uart == &host_uart0 && rx_has_data && uart->rx.size() >= UART_RX_IRQ_LEVEL)
+  {
+    uart_rx_irq();
+  }
+}
+
+bool uart_is_readable(uart_inst_t *uart)
+{
+  return !uart->rx.empty();
+}
+
+bool uart_is_writable(uart_inst_t *uart)
+{
+  if (uart->cts_flow)
+  {
+    return uart->tx_fifo.size() < UART_FIFO_DEPTH;
+  }
+  uint64_t frame_ns = (uint64_t) uart->bit_ns * uart->frame_bits;
+  return uart->tx_free_ns <= now_us * 1000 + UART_FIFO_DEPTH * frame_ns;
+}
+
+char uart_getc(uart_inst_t *uart)
+{
+  if (uart->rx.empty())
+  {
+    return 0;
+  }
+  uint8_t c = uart->rx.front();
+  uart->rx.pop_front();
+  return (char) c;
+}
+
+// With CTS the next byte in the fifo starts once the last is out, unless
+// the peer holds RTS up. With all the whole fifo is started back to back.
+static void uart_tx_start(uart_inst_t *uart, bool all = false)
+{
+  uint64_t frame_ns = (uint64_t) uart->bit_ns * uart->frame_bits;
+  while (!uart->cts_held && !uart->tx_fifo.empty() && (all || uart->tx_free_ns <= now_us * 1000))
+  {
+    // straight after the last byte if it only just finished
+    uint64_t start = uart->tx_free_ns + 1000 > now_us * 1000 ? uart->tx_free_ns : now_us * 1000;
+    uart->tx_free_ns = start + frame_ns;
+    uart->tx.push_back(host_uart_byte { (uart->tx_free_ns + 999) / 1000, uart->tx_fifo.front() });
+    uart->tx_fifo.pop_front();
+  }
+}
+
+// each byte is stamped with when its stop bit ends, the core spins while
+// the fifo is full. A spin the peer holds up with CTS would never end here,
+// so the firmware must check uart_is_writable when flow control is on.
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len)
+{
+  uint64_t frame_ns = (uint64_t) uart->bit_ns * uart->frame_bits;
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (uart->cts_flow)
+    {
+      if (uart->tx_fifo.size() >= UART_FIFO_DEPTH)
+      {
+        fprintf(stderr, "uart write blocked on a full tx fifo held by CTS\n");
+        abort();
+      }
+      uart->tx_fifo.push_back(src[i]);
+      uart_tx_start(uart);
+      continue;
+    }
+    uint64_t fifo_free_ns = uart->tx_free_ns - std::min(uart->tx_free_ns, UART_FIFO_DEPTH * frame_ns);
+    if (fifo_free_ns > now_us * 1000)
+    {
+      host_advance_to((fifo_free_ns + 999) / 1000);
+    }
+    uart->tx_free_ns = std::max(uart->tx_free_ns, now_us * 1000) + frame_ns;
+    uart->tx.push_back(host_uart_byte { (uart->tx_free_ns + 999) / 1000, src[i] });
+  }
+}
+
+void uart_putc_raw(uart_inst_t *uart, char c)
+{
+  uart_write_blocking(uart, (const uint8_t *) &c, 1);
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+  irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+  irq_enabled[num] = enabled;
+}
+
+static void uart_rx_irq()
+{
+  if (host_uart0.rx_irq && irq_enabled[UART0_IRQ] && irq_handlers[UART0_IRQ] != nullptr)
+  {
+    irq_handlers[UART0_IRQ]();
+  }
+}
+
+// the rx fifo has no size limit here, the interrupt fires once per call
+void host_uart_receive(const uint8_t *data, int len)
+{
+  host_uart0.rx.insert(host_uart0.rx.end(), data, data + len);
+  uart_rx_irq();
+}
+
+void host_uart_deliver(const std::vector<host_uart_byte> &bytes)
+{
+  host_uart0.wire.insert(host_uart0.wire.end(), bytes.begin(), bytes.end());
+}
+
+bool host_uart_rts()
+{
+  return host_uart0.rts_flow && host_uart0.rx.size() >= UART_RX_IRQ_LEVEL;
+}
+
+void host_uart_set_cts(bool held)
+{
+  host_uart0.cts_held = held;
+  uart_tx_start(&host_uart0);
+}
+
+uint32_t host_uart_overruns()
+{
+  return host_uart0.overruns;
+}
+
+static uint64_t uart_rx_timeout_us()
+{
+  return host_uart0.last_rx_us + ((uint64_t) UART_RX_TIMEOUT_BITS * host_uart0.bit_ns + 999) / 1000;
+}
+
+// the next byte to arrive or the idle timeout, UINT64_MAX if neither
+static uint64_t uart_next_event_us()
+{
+  uint64_t due = UINT64_MAX;
+  if (!host_uart0.wire.empty())
+  {
+    due = std::max(host_uart0.wire.front().time_us, now_us);
+  }
+  if (host_uart0.rx_timeout_armed && !host_uart0.rx.empty())
+  {
+    due = std::min(due, std::max(uart_rx_timeout_us(), now_us));
+  }
+  if (!host_uart0.cts_held && !host_uart0.tx_fifo.empty())
+  {
+    due = std::min(due, std::max((host_uart0.tx_free_ns + 999) / 1000, now_us));
+  }
+  return due;
+}
+
+// The timeout interrupt fires once per burst here. On the part it stays up
+// until the fifo is read, which the firmware always does.
+static void uart_event(uint64_t due_us)
+{
+  now_us = due_us;
+  if (!host_uart0.cts_held && !host_uart0.tx_fifo.empty() && host_uart0.tx_free_ns <= now_us * 1000)
+  {
+    uart_tx_start(&host_uart0);
+    return;
+  }
+  if (!host_uart0.wire.empty() && host_uart0.wire.front().time_us <= now_us)
+  {
+    uint8_t c = host_uart0.wire.front().value;
+    host_uart0.wire.pop_front();
+    host_uart0.last_rx_us = now_us;
+    host_uart0.rx_timeout_armed = true;
+    if (host_uart0.rx.size() >= UART_FIFO_DEPTH)
+    {
+      host_uart0.overruns++;
+      return;
+    }
+    host_uart0.rx.push_back(c);
+    if (host_uart0.rx.size() >= UART_RX_IRQ_LEVEL)
+    {
+      uart_rx_irq();
+    }
+    return;
+  }
+  host_uart0.rx_timeout_armed = false;
+  uart_rx_irq();
+}
+
+std::vector<host_uart_byte> host_uart_take_sent_timed()
+{
+  std::vector<host_uart_byte> sent;
+  sent.swap(host_uart0.tx);
+  return sent;
+}
+
+// as if the test waited for the fifo to empty, unless CTS is held
+std::vector<uint8_t> host_uart_take_sent()
+{
+  uart_tx_start(&host_uart0, true);
+  std::vector<uint8_t> sent;
+  for (const host_uart_byte &b : host_uart0.tx)
+  {
+    sent.push_back(b.value);
+  }
+  host_uart0.tx.clear();
+  return sent;
+}
+
+static uart_inst_t *stdio_uart;
+
+void stdio_uart_init_full(uart_inst_t *uart, uint baud_rate, int tx_pin, int rx_pin)
+{
+  uart_init(uart, baud_rate);
+  stdio_uart = uart;
+}
+
+uint32_t save_and_disable_interrupts()
+{
+  return 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+}
+
+//--------------------------------------------------------------------+
+// cores, watchdog, flash
+//--------------------------------------------------------------------+
+
+void critical_section_init(critical_section_t *cs)
+{
+  cs->depth = 0;
+}
+
+void critical_section_enter_blocking(critical_section_t *cs)
+{
+  cs->depth++;
+}
+
+void critical_section_exit(critical_section_t *cs)
+{
+  cs->depth--;
+}
+
+void multicore_reset_core1()
+{
+}
+
+void multicore_launch_core1(void (*entry)())
+{
+}
+
+void multicore_lockout_victim_init()
+{
+}
+
+void multicore_lockout_start_blocking()
+{
+}
+
+void multicore_lockout_end_blocking()
+{
+}
+
+// load holds the timeout in ms here
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug)
+{
+  host_watchdog.ctrl = 1;
+  host_watchdog.load = delay_ms;
+}
+
+void watchdog_disable()
+{
+  host_watchdog.ctrl = 0;
+}
+
+void watchdog_update()
+{
+}
+
+static bool watchdog_rebooted;
+
+bool watchdog_enable_caused_reboot()
+{
+  return watchdog_rebooted;
+}
+
+void host_watchdog_set_rebooted(bool rebooted)
+{
+  watchdog_rebooted = rebooted;
+}
+
+static int flash_ops_whole = -1;
+static bool flash_power_cut;
+
+void host_flash_erase_all()
+{
+  memset(host_flash, 0xff, sizeof(host_flash));
+}
+
+void host_flash_cut_power_after(int ops)
+{
+  flash_ops_whole = ops;
+  flash_power_cut = false;
+}
+
+bool host_flash_power_was_cut()
+{
+  return flash_power_cut;
+}
+
+// how much of an operation reaches the flash before the power goes
+static size_t flash_op_len(size_t count)
+{
+  if (flash_power_cut)
+  {
+    return 0;
+  }
+  if (flash_ops_whole < 0 || flash_ops_whole-- > 0)
+  {
+    return count;
+  }
+  flash_power_cut = true;
+  return count / 2;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+  memset(host_flash + flash_offs, 0xff, flash_op_len(count));
+}
+
+// programming can only clear bits, as on the real part
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+  count = flash_op_len(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    host_flash[flash_offs + i] &= data[i];
+  }
+}
+
+//--------------------------------------------------------------------+
+// printf, wrapped at link time like the SDK does
+//--------------------------------------------------------------------+
+
+void host_set_verbose(bool on)
+{
+  verbose = on;
+}
+
+extern "C" int __real_puts(const char *s);
+extern "C" int __real_putchar(int c);
+
+// Text goes out on the stdio uart as on the part, a character time each
+// through the fifo with the core spinning while it is full and a \r added
+// before each \n, whether it is shown or not. So a print left on the
+// forwarding path costs the benches what it would cost the board.
+static void stdio_write(const char *s, size_t len)
+{
+  if (stdio_uart == nullptr)
+  {
+    return;
+  }
+  static const uint8_t cr = '\r';
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (s[i] == '\n')
+    {
+      uart_write_blocking(stdio_uart, &cr, 1);
+    }
+    uart_write_blocking(stdio_uart, (const uint8_t *) s + i, 1);
+  }
+  stdio_uart->tx.clear();
+}
+
+extern "C" int __wrap_printf(const char *format, ...)
+{
+  char text[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  if (n < 0)
+  {
+    return n;
+  }
+  size_t len = std::min((size_t) n, sizeof(text) - 1);
+  if (verbose)
+  {
+    fwrite(text, 1, len, stdout);
+  }
+  stdio_write(text, len);
+  return n;
+}
+
+extern "C" int __wrap_puts(const char *s)
+{
+  stdio_write(s, strlen(s));
+  stdio_write("\n", 1);
+  return verbose ? __real_puts(s) : 0;
+}
+
+extern "C" int __wrap_putchar(int c)
+{
+  char ch = (char) c;
+  stdio_write(&ch, 1);
+  return verbose ? __real_putchar(c) : c;
+}
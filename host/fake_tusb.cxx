@@ -0,0 +1,412 @@
+#include <string.h>
+
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "host/hcd.h"
+#include "pio_usb.h"
+#include "tusb.h"
+
+#include "host_fakes.h"
+
+// TinyUSB fakes. The device side records reports and completes each one at
+// the next poll of the endpoint, as the computer reading it would.
+// The host side keeps the attached interfaces and answers set protocol and
+// set report requests from tuh_task, like the real stack. Devices are on
+// root port 1 unless host_device_set_port says otherwise.
+
+static const uint64_t POLL_US = HID_POLL_INTERVAL_MS * 1000;
+
+struct device_hid
+{
+  uint8_t protocol = HID_PROTOCOL_REPORT;
+  bool busy;
+  uint64_t done_us;
+  std::vector<uint8_t> in_flight;
+};
+
+struct attached_hid
+{
+  uint8_t itf_protocol;
+  uint8_t protocol;
+};
+
+static bool mounted;
+static bool suspended;
+static bool connected = true;
+static device_hid device_itf[CFG_TUD_HID];
+static std::vector<host_usb_report> usb_reports;
+static std::deque<uint8_t> cdc_rx;
+static std::vector<uint8_t> cdc_tx;
+static bool cdc_reading = true;
+
+static std::map<std::pair<uint8_t, uint8_t>, attached_hid> attached;
+static std::vector<host_device_request> device_requests;
+static std::vector<host_device_request> device_pending; // completed by tuh_task
+static int root_ports = 1;
+static std::map<uint8_t, hcd_devtree_info_t> device_tree;
+
+//--------------------------------------------------------------------+
+// device stack
+//--------------------------------------------------------------------+
+
+bool tud_init(uint8_t rhport)
+{
+  return true;
+}
+
+// completes the reports the computer has read by now
+void tud_task(void)
+{
+  for (uint8_t i = 0; i < CFG_TUD_HID; ++i)
+  {
+    device_hid &itf = device_itf[i];
+    if (itf.busy && host_now_us() >= itf.done_us)
+    {
+      itf.busy = false;
+      std::vector<uint8_t> report;
+      report.swap(itf.in_flight);
+      tud_hid_report_complete_cb(i, report.data(), (uint16_t) report.size());
+    }
+  }
+}
+
+bool tud_task_event_ready(void)
+{
+  for (const device_hid &itf : device_itf)
+  {
+    if (itf.busy && host_now_us() >= itf.done_us)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool tud_mounted(void)
+{
+  return mounted;
+}
+
+bool tud_suspended(void)
+{
+  return suspended;
+}
+
+bool tud_connect(void)
+{
+  connected = true;
+  return true;
+}
+
+bool tud_disconnect(void)
+{
+  connected = false;
+  return true;
+}
+
+bool tud_hid_n_ready(uint8_t instance)
+{
+  return mounted && !suspended && connected && !device_itf[instance].busy;
+}
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len)
+{
+  if (!tud_hid_n_ready(instance))
+  {
+    return false;
+  }
+  device_hid &itf = device_itf[instance];
+  itf.in_flight.clear();
+  if (report_id != 0)
+  {
+    itf.in_flight.push_back(report_id);
+  }
+  const uint8_t *p = (const uint8_t *) report;
+  itf.in_flight.insert(itf.in_flight.end(), p, p + len);
+  itf.busy = true;
+  itf.done_us = (host_now_us() / POLL_US + 1) * POLL_US;
+  usb_reports.push_back(host_usb_report { host_now_us(), instance, itf.in_flight });
+  return true;
+}
+
+uint8_t tud_hid_n_get_protocol(uint8_t instance)
+{
+  return device_itf[instance].protocol;
+}
+
+uint32_t tud_cdc_available(void)
+{
+  return (uint32_t) cdc_rx.size();
+}
+
+uint32_t tud_cdc_read(void *buffer, uint32_t bufsize)
+{
+  uint32_t n = 0;
+  uint8_t *p = (uint8_t *) buffer;
+  while (n < bufsize && !cdc_rx.empty())
+  {
+    p[n++] = cdc_rx.front();
+    cdc_rx.pop_front();
+  }
+  return n;
+}
+
+uint32_t tud_cdc_write(void const *buffer, uint32_t bufsize)
+{
+  uint32_t available = tud_cdc_write_available();
+  if (bufsize > available)
+  {
+    bufsize = available;
+  }
+  const uint8_t *p = (const uint8_t *) buffer;
+  cdc_tx.insert(cdc_tx.end(), p, p + bufsize);
+  return bufsize;
+}
+
+uint32_t tud_cdc_write_str(char const *str)
+{
+  return tud_cdc_write(str, (uint32_t) strlen(str));
+}
+
+uint32_t tud_cdc_write_flush(void)
+{
+  return 0;
+}
+
+// the computer reads everything as soon as it is written, unless it stopped
+// reading and the fifo filled up
+uint32_t tud_cdc_write_available(void)
+{
+  if (cdc_reading)
+  {
+    return CFG_TUD_CDC_TX_BUFSIZE;
+  }
+  return cdc_tx.size() < CFG_TUD_CDC_TX_BUFSIZE ? CFG_TUD_CDC_TX_BUFSIZE - (uint32_t) cdc_tx.size() : 0;
+}
+
+void host_usb_mount()
+{
+  mounted = true;
+  suspended = false;
+  for (device_hid &itf : device_itf)
+  {
+    itf = device_hid();
+  }
+  tud_mount_cb();
+}
+
+void host_usb_unmount()
+{
+  mounted = false;
+  suspended = false;
+  tud_umount_cb();
+}
+
+void host_usb_suspend(bool on)
+{
+  if (on == suspended)
+  {
+    return;
+  }
+  suspended = on;
+  if (on)
+  {
+    tud_suspend_cb(false);
+  }
+  else
+  {
+    tud_resume_cb();
+  }
+}
+
+void host_usb_set_protocol(uint8_t instance, uint8_t protocol)
+{
+  device_itf[instance].protocol = protocol;
+  tud_hid_set_protocol_cb(instance, protocol);
+}
+
+void host_usb_set_report(uint8_t instance, uint8_t report_id, uint8_t report_type, const uint8_t *data, uint16_t len)
+{
+  tud_hid_set_report_cb(instance, report_id, (hid_report_type_t) report_type, data, len);
+}
+
+std::vector<uint8_t> host_usb_get_report(uint8_t instance, uint8_t report_id, uint8_t report_type, uint16_t len)
+{
+  std::vector<uint8_t> report(len);
+  report.resize(tud_hid_get_report_cb(instance, report_id, (hid_report_type_t) report_type, report.data(), len));
+  return report;
+}
+
+const std::vector<host_usb_report> &host_usb_reports()
+{
+  return usb_reports;
+}
+
+void host_usb_clear_reports()
+{
+  usb_reports.clear();
+}
+
+void host_cdc_receive(const uint8_t *data, int len)
+{
+  cdc_rx.insert(cdc_rx.end(), data, data + len);
+  tud_cdc_rx_cb(0);
+}
+
+std::vector<uint8_t> host_cdc_take_sent()
+{
+  std::vector<uint8_t> sent;
+  sent.swap(cdc_tx);
+  return sent;
+}
+
+void host_cdc_set_reading(bool on)
+{
+  cdc_reading = on;
+  if (on)
+  {
+    tud_cdc_tx_complete_cb(0);
+  }
+}
+
+//--------------------------------------------------------------------+
+// host stack
+//--------------------------------------------------------------------+
+
+// the firmware's startup adds any root ports past the first, and devices
+// are plugged in afresh
+bool tuh_init(uint8_t rhport)
+{
+  root_ports = 1;
+  device_tree.clear();
+  return true;
+}
+
+// answers the requests made since the last call
+void tuh_task(void)
+{
+  std::vector<host_device_request> done;
+  done.swap(device_pending);
+  for (const host_device_request &r : done)
+  {
+    if (r.kind == host_device_request::SET_PROTOCOL)
+    {
+      tuh_hid_set_protocol_complete_cb(r.dev_addr, r.instance, r.data[0]);
+    }
+    else
+    {
+      tuh_hid_set_report_complete_cb(r.dev_addr, r.instance, r.report_id, r.report_type, (uint16_t) r.data.size());
+    }
+  }
+}
+
+bool tuh_configure(uint8_t rhport, uint32_t cfg_id, const void *cfg_param)
+{
+  return true;
+}
+
+int pio_usb_host_add_port(uint8_t pin_dp, PIO_USB_PINOUT pinout)
+{
+  root_ports++;
+  return 0;
+}
+
+void hcd_devtree_get_info(uint8_t dev_addr, hcd_devtree_info_t *devtree_info)
+{
+  auto it = device_tree.find(dev_addr);
+  *devtree_info = it != device_tree.end() ? it->second : hcd_devtree_info_t { 1, 0, 0, 0 };
+}
+
+bool tuh_vid_pid_get(uint8_t dev_addr, uint16_t *vid, uint16_t *pid)
+{
+  *vid = 0;
+  *pid = 0;
+  return attached.lower_bound(std::make_pair(dev_addr, (uint8_t) 0)) != attached.end();
+}
+
+uint8_t tuh_hid_interface_protocol(uint8_t dev_addr, uint8_t instance)
+{
+  auto it = attached.find(std::make_pair(dev_addr, instance));
+  return it != attached.end() ? it->second.itf_protocol : HID_ITF_PROTOCOL_NONE;
+}
+
+uint8_t tuh_hid_get_protocol(uint8_t dev_addr, uint8_t instance)
+{
+  auto it = attached.find(std::make_pair(dev_addr, instance));
+  return it != attached.end() ? it->second.protocol : HID_PROTOCOL_BOOT;
+}
+
+bool tuh_hid_set_protocol(uint8_t dev_addr, uint8_t instance, uint8_t protocol)
+{
+  auto it = attached.find(std::make_pair(dev_addr, instance));
+  if (it == attached.end())
+  {
+    return false;
+  }
+  it->second.protocol = protocol;
+  host_device_request r = { host_now_us(), host_device_request::SET_PROTOCOL, dev_addr, instance, 0, 0, { protocol } };
+  device_requests.push_back(r);
+  device_pending.push_back(r);
+  return true;
+}
+
+bool tuh_hid_set_report(uint8_t dev_addr, uint8_t instance, uint8_t report_id, uint8_t report_type, void *report, uint16_t len)
+{
+  if (attached.find(std::make_pair(dev_addr, instance)) == attached.end())
+  {
+    return false;
+  }
+  const uint8_t *p = (const uint8_t *) report;
+  host_device_request r = { host_now_us(), host_device_request::SET_REPORT, dev_addr, instance, report_id, report_type,
+    std::vector<uint8_t>(p, p + len) };
+  device_requests.push_back(r);
+  device_pending.push_back(r);
+  return true;
+}
+
+bool tuh_hid_receive_report(uint8_t dev_addr, uint8_t instance)
+{
+  return attached.find(std::make_pair(dev_addr, instance)) != attached.end();
+}
+
+// the boot protocol is selected until the firmware asks otherwise, as the
+// host stack does for boot interfaces
+void host_device_attach(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, const uint8_t *desc, uint16_t desc_len)
+{
+  attached[std::make_pair(dev_addr, instance)] = attached_hid { itf_protocol, HID_PROTOCOL_BOOT };
+  tuh_hid_mount_cb(dev_addr, instance, desc, desc_len);
+}
+
+void host_device_set_port(uint8_t dev_addr, uint8_t rhport, uint8_t hub_addr)
+{
+  device_tree[dev_addr] = hcd_devtree_info_t { rhport, hub_addr, (uint8_t) (hub_addr != 0 ? 1 : 0), 0 };
+}
+
+int host_usb_host_ports()
+{
+  return root_ports;
+}
+
+void host_device_detach(uint8_t dev_addr, uint8_t instance)
+{
+  attached.erase(std::make_pair(dev_addr, instance));
+  tuh_hid_umount_cb(dev_addr, instance);
+}
+
+void host_device_report(uint8_t dev_addr, uint8_t instance, const uint8_t *report, uint16_t len)
+{
+  tuh_hid_report_received_cb(dev_addr, instance, report, len);
+}
+
+const std::vector<host_device_request> &host_device_requests()
+{
+  return device_requests;
+}
+
+void host_device_clear_requests()
+{
+  device_requests.clear();
+}
@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "hardware/watchdog.h"
+
+#include "common.h"
+#include "handoff.h"
+#include "peer_state.h"
+#include "report_cache.h"
+#include "uart_messages.h"
+
+#include "host_fakes.h"
+
+// SENSE_PIN in main_device.cxx, grounded on board one
+static const unsigned SENSE_PIN = 13;
+
+// starts with an empty config store, the same as a new board
+void host_board_init(int board_number)
+{
+  host_flash_erase_all();
+  host_gpio_set(SENSE_PIN, board_number == 0);
+  core0_init();
+  core1_init();
+}
+
+host_board_state host_board_save()
+{
+  host_board_state saved;
+  saved.flash.assign(host_flash, host_flash + PICO_FLASH_SIZE_BYTES);
+  for (int i = 0; i < 8; ++i)
+  {
+    saved.scratch[i] = watchdog_hw->scratch[i];
+  }
+  return saved;
+}
+
+// the scratch registers are cleared by anything but the watchdog
+void host_board_reboot(int board_number, const host_board_state &saved, bool watchdog)
+{
+  memcpy(host_flash, saved.flash.data(), PICO_FLASH_SIZE_BYTES);
+  for (int i = 0; i < 8; ++i)
+  {
+    watchdog_hw->scratch[i] = watchdog ? saved.scratch[i] : 0;
+  }
+  host_watchdog_set_rebooted(watchdog);
+  host_gpio_set(SENSE_PIN, board_number == 0);
+  core0_init();
+  core1_init();
+}
+
+// Runs both cores' loops until core0 has nothing left to do. Core1 goes
+// first as it hands reports to core0. Returns false if still busy after
+// max_passes, which points at a task posting itself forever.
+bool host_run(int max_passes)
+{
+  for (int i = 0; i < max_passes; ++i)
+  {
+    core1_poll();
+    if (!core0_poll())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+extern "C" const host_board_api *host_board_get_api()
+{
+  static const host_board_api api = {
+    host_board_init,
+    host_run,
+    host_advance_to,
+    host_now_us,
+    host_set_verbose,
+    toggle_output,
+    init_uart,
+    host_usb_mount,
+    host_usb_reports,
+    host_usb_clear_reports,
+    host_device_attach,
+    host_device_report,
+    host_uart_deliver,
+    host_uart_overruns,
+    host_uart_rts,
+    host_uart_set_cts,
+    host_uart_take_sent_timed,
+    uart_flow_get_stats,
+    uart_link_get_stats,
+    host_usb_set_report,
+    host_board_save,
+    host_board_reboot,
+    get_current_output_mask,
+    peer_state_local_flags,
+    peer_state_flags,
+    report_cache_leds,
+    handoff_peer_leds
+  };
+  return &api;
+}
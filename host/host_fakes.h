@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "uart_flow.h"
+#include "uart_messages.h"
+
+// Drives the firmware built for Linux and records what it does. One process
+// is one board: the firmware's own globals hold its state and so do these
+// fakes. Time is simulated, it only moves when host_advance_us is called or
+// the firmware spins in tight_loop_contents.
+//
+// A test sets up a board with host_board_init, then attaches devices,
+// feeds input and uart bytes, calls host_run to let both cores' loops run
+// until they are idle and checks the recorded calls.
+
+// a report the firmware queued on one of its device HID interfaces, with
+// the report id in front as it goes over usb
+struct host_usb_report
+{
+  uint64_t time_us;
+  uint8_t instance;
+  std::vector<uint8_t> data;
+};
+
+// a request the firmware made to a device on its usb host port
+struct host_device_request
+{
+  enum Kind : uint8_t
+  {
+    SET_PROTOCOL,
+    SET_REPORT
+  };
+  uint64_t time_us;
+  Kind kind;
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t report_id;
+  uint8_t report_type;
+  std::vector<uint8_t> data; // the protocol for SET_PROTOCOL
+};
+
+// a byte on the uart, with the time its stop bit ends
+struct host_uart_byte
+{
+  uint64_t time_us;
+  uint8_t value;
+};
+
+// simulated time
+extern void host_advance_us(uint64_t us);
+extern void host_advance_to(uint64_t us);
+extern uint64_t host_now_us();
+// SysTick counts down and round from its reload value as on the part, but
+// only by the cycles given here, apart from the simulated clock
+extern void host_systick_count(uint32_t cycles);
+
+// printf from the firmware is dropped unless this is set
+extern void host_set_verbose(bool verbose);
+
+// runs the firmware's startup with an empty config store
+extern void host_board_init(int board_number);
+extern bool host_run(int max_passes = 1000);
+
+// usb device side, the computer this board is plugged into
+extern void host_usb_mount();
+extern void host_usb_unmount();
+extern void host_usb_suspend(bool suspended);
+extern void host_usb_set_protocol(uint8_t instance, uint8_t protocol);
+extern void host_usb_set_report(uint8_t instance, uint8_t report_id, uint8_t report_type, const uint8_t *data, uint16_t len);
+// the report without its id, empty when the request stalls
+extern std::vector<uint8_t> host_usb_get_report(uint8_t instance, uint8_t report_id, uint8_t report_type, uint16_t len);
+extern const std::vector<host_usb_report> &host_usb_reports();
+extern void host_usb_clear_reports();
+
+// usb host side, the keyboard and mouse plugged into this board. A device
+// is on root port 1 unless host_device_set_port, called before attaching
+// it, puts it on another or behind a hub.
+extern void host_device_set_port(uint8_t dev_addr, uint8_t rhport, uint8_t hub_addr);
+extern int host_usb_host_ports();
+extern void host_device_attach(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, const uint8_t *desc, uint16_t desc_len);
+extern void host_device_detach(uint8_t dev_addr, uint8_t instance);
+extern void host_device_report(uint8_t dev_addr, uint8_t instance, const uint8_t *report, uint16_t len);
+extern const std::vector<host_device_request> &host_device_requests();
+extern void host_device_clear_requests();
+
+// uart0, the link to the other board. host_uart_receive hands bytes
+// straight to the interrupt, host_uart_deliver queues them to arrive at
+// their time through the rx fifo, which drops them when full.
+extern void host_uart_receive(const uint8_t *data, int len);
+extern void host_uart_deliver(const std::vector<host_uart_byte> &bytes);
+extern uint32_t host_uart_overruns();
+// With RTS/CTS built in: this board's RTS, up while its rx fifo is too full
+// to take more, and the peer's RTS on this board's CTS, which holds back
+// what is in the tx fifo.
+extern bool host_uart_rts();
+extern void host_uart_set_cts(bool held);
+extern std::vector<uint8_t> host_uart_take_sent();
+extern std::vector<host_uart_byte> host_uart_take_sent_timed();
+
+// the cdc serial port
+extern void host_cdc_receive(const uint8_t *data, int len);
+extern std::vector<uint8_t> host_cdc_take_sent();
+// While the computer isn't reading, writes stop once the 256 byte fifo holds
+// what wasn't taken. Reading again completes the transfer.
+extern void host_cdc_set_reading(bool on);
+
+// the config store's flash, erased by host_board_init. After ops more
+// erases or programs the power is cut: the next one gets half way and none
+// after it reach the flash, until this is called again. -1 for never.
+extern void host_flash_erase_all();
+extern void host_flash_cut_power_after(int ops);
+extern bool host_flash_power_was_cut();
+
+// What a board keeps over a reset: its flash, and the watchdog scratch
+// registers if the watchdog caused it.
+struct host_board_state
+{
+  std::vector<uint8_t> flash;
+  uint32_t scratch[8];
+};
+
+// host_board_reboot runs the firmware's startup again as after a reset,
+// which needs the firmware's globals to start again, so a fresh module
+extern host_board_state host_board_save();
+extern void host_board_reboot(int board_number, const host_board_state &saved, bool watchdog);
+extern void host_watchdog_set_rebooted(bool rebooted);
+
+// gpio inputs, pulled up unless set
+extern void host_gpio_set(unsigned gpio, bool level);
+extern bool host_gpio_output(unsigned gpio);
+
+// The above for one board built as a module, see host/CMakeLists.txt. Each
+// module loaded has its own firmware and fakes, so one process can run two
+// boards and join their uarts.
+struct host_board_api
+{
+  void (*board_init)(int board_number);
+  bool (*run)(int max_passes);
+  void (*advance_to)(uint64_t us);
+  uint64_t (*now_us)();
+  void (*set_verbose)(bool verbose);
+  void (*toggle_output)();
+  void (*init_uart)(uint32_t baud_rate); // both boards must match
+  void (*usb_mount)();
+  const std::vector<host_usb_report> &(*usb_reports)();
+  void (*usb_clear_reports)();
+  void (*device_attach)(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, const uint8_t *desc, uint16_t desc_len);
+  void (*device_report)(uint8_t dev_addr, uint8_t instance, const uint8_t *report, uint16_t len);
+  void (*uart_deliver)(const std::vector<host_uart_byte> &bytes);
+  uint32_t (*uart_overruns)();
+  bool (*uart_rts)();
+  void (*uart_set_cts)(bool held);
+  std::vector<host_uart_byte> (*uart_take_sent_timed)();
+  uart_flow_stats (*uart_flow)();
+  uart_link_stats (*uart_link)();
+  void (*usb_set_report)(uint8_t instance, uint8_t report_id, uint8_t report_type, const uint8_t *data, uint16_t len);
+  host_board_state (*board_save)();
+  void (*board_reboot)(int board_number, const host_board_state &saved, bool watchdog);
+  uint8_t (*output_mask)();
+  uint8_t (*local_flags)(); // PeerFlag
+  uint8_t (*peer_flags)();
+  uint8_t (*host_leds)();   // as set by this board's host
+  uint8_t (*peer_leds)();   // as this board last heard from the other
+};
+
+extern "C" const host_board_api *host_board_get_api();
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+// Checks and a runner for the unit tests in host/test_*.cxx, each its own
+// program run by ctest. The tests in one program share its board, so each
+// sets up what it needs. A failed check prints where and the test carries
+// on, the program fails at the end. Given test names, only those run.
+
+struct host_test_case
+{
+  const char *name;
+  void (*run)();
+};
+
+inline int host_test_failures;
+
+inline bool host_test_check(bool ok, const char *expr, const char *file, int line)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    host_test_failures++;
+  }
+  return ok;
+}
+
+inline bool host_test_check_eq(long long a, long long b, const char *expr, const char *file, int line)
+{
+  if (a != b)
+  {
+    fprintf(stderr, "%s:%d: check failed: %s, %lld != %lld\n", file, line, expr, a, b);
+    host_test_failures++;
+  }
+  return a == b;
+}
+
+#define CHECK(cond) host_test_check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) host_test_check_eq((long long) (a), (long long) (b), #a " == " #b, __FILE__, __LINE__)
+
+template <size_t N> int host_test_main(const host_test_case (&cases)[N], int argc, char **argv)
+{
+  int ran = 0;
+  for (const host_test_case &c : cases)
+  {
+    bool wanted = argc < 2;
+    for (int i = 1; i < argc; ++i)
+    {
+      wanted |= strcmp(argv[i], c.name) == 0;
+    }
+    if (!wanted)
+    {
+      continue;
+    }
+    int before = host_test_failures;
+    c.run();
+    fprintf(stdout, "%-32s %s\n", c.name, host_test_failures == before ? "ok" : "FAIL");
+    ran++;
+  }
+  if (ran == 0)
+  {
+    fprintf(stderr, "no such test\n");
+    return 2;
+  }
+  return host_test_failures == 0 ? 0 : 1;
+}
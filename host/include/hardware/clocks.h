@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+enum clock_index
+{
+  clk_sys = 5
+};
+
+extern uint32_t clock_get_hz(enum clock_index clk_index);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+// offsets are from the start of host_flash
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+extern void flash_range_erase(uint32_t flash_offs, size_t count);
+extern void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
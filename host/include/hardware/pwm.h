@@ -0,0 +1,14 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct
+{
+  float clkdiv;
+} pwm_config;
+
+extern uint pwm_gpio_to_slice_num(uint gpio);
+extern pwm_config pwm_get_default_config();
+extern void pwm_config_set_clkdiv(pwm_config *c, float div);
+extern void pwm_init(uint slice_num, pwm_config *c, bool start);
+extern void pwm_set_gpio_level(uint gpio, uint16_t level);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct
+{
+  volatile uint32_t cpuid;
+  volatile uint32_t icsr;
+  volatile uint32_t vtor;
+  volatile uint32_t aircr;
+  volatile uint32_t scr;
+} armv6m_scb_hw_t;
+
+extern armv6m_scb_hw_t host_scb;
+#define scb_hw (&host_scb)
+
+#define M0PLUS_SCR_SEVONPEND_BITS 0x00000010
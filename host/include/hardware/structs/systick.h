@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// only counts when a test moves it with host_systick_count, so the probes
+// record zero cycles on the host otherwise
+typedef struct
+{
+  volatile uint32_t csr;
+  volatile uint32_t rvr;
+  volatile uint32_t cvr;
+  volatile uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t host_systick;
+#define systick_hw (&host_systick)
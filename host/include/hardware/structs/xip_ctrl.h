@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// there is no cache to flush on the host
+typedef struct
+{
+  volatile uint32_t ctrl;
+  volatile uint32_t flush;
+  volatile uint32_t stat;
+  volatile uint32_t ctr_hit;
+  volatile uint32_t ctr_acc;
+  volatile uint32_t stream_addr;
+  volatile uint32_t stream_ctr;
+  volatile uint32_t stream_fifo;
+} xip_ctrl_hw_t;
+
+extern xip_ctrl_hw_t host_xip_ctrl;
+#define xip_ctrl_hw (&host_xip_ctrl)
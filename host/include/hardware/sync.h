@@ -0,0 +1,6 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+extern uint32_t save_and_disable_interrupts();
+extern void restore_interrupts(uint32_t status);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+// uart0 is the link to the other board, what is written is kept for the
+// test to read and received bytes are fed in with host_uart_receive
+
+typedef struct host_uart uart_inst_t;
+
+extern uart_inst_t host_uart0;
+extern uart_inst_t host_uart1;
+#define uart0 (&host_uart0)
+#define uart1 (&host_uart1)
+
+#define UART0_IRQ 20
+#define UART1_IRQ 21
+
+typedef enum
+{
+  UART_PARITY_NONE,
+  UART_PARITY_EVEN,
+  UART_PARITY_ODD
+} uart_parity_t;
+
+typedef void (*irq_handler_t)();
+
+extern uint uart_init(uart_inst_t *uart, uint baud_rate);
+extern void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+extern void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity);
+extern void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+extern void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+extern bool uart_is_readable(uart_inst_t *uart);
+extern bool uart_is_writable(uart_inst_t *uart);
+extern char uart_getc(uart_inst_t *uart);
+extern void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+extern void uart_putc_raw(uart_inst_t *uart, char c);
+
+extern void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+extern void irq_set_enabled(uint num, bool enabled);
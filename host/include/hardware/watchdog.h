@@ -0,0 +1,19 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct
+{
+  uint32_t ctrl;
+  uint32_t load;
+  uint32_t reason;
+  volatile uint32_t scratch[8];
+} watchdog_hw_t;
+
+extern watchdog_hw_t host_watchdog;
+#define watchdog_hw (&host_watchdog)
+
+extern void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+extern void watchdog_disable();
+extern void watchdog_update();
+extern bool watchdog_enable_caused_reboot();
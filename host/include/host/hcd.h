@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// where a device sits on the usb host bus, set up with host_device_set_port
+
+typedef struct
+{
+  uint8_t rhport;
+  uint8_t hub_addr;
+  uint8_t hub_port;
+  uint8_t speed;
+} hcd_devtree_info_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void hcd_devtree_get_info(uint8_t dev_addr, hcd_devtree_info_t *devtree_info);
+
+#ifdef __cplusplus
+}
+#endif
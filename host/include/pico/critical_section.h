@@ -0,0 +1,14 @@
+#pragma once
+
+// the host build runs both cores' loops on one thread, nothing to lock
+
+struct critical_section
+{
+  int depth;
+};
+
+typedef struct critical_section critical_section_t;
+
+extern void critical_section_init(critical_section_t *cs);
+extern void critical_section_enter_blocking(critical_section_t *cs);
+extern void critical_section_exit(critical_section_t *cs);
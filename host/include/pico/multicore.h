@@ -0,0 +1,11 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+// core1 isn't started, the test or benchmark calls core1_init and
+// core1_poll itself
+extern void multicore_reset_core1();
+extern void multicore_launch_core1(void (*entry)());
+extern void multicore_lockout_victim_init();
+extern void multicore_lockout_start_blocking();
+extern void multicore_lockout_end_blocking();
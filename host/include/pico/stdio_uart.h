@@ -0,0 +1,6 @@
+#pragma once
+
+#include "hardware/uart.h"
+
+// printf goes to stdout
+extern void stdio_uart_init_full(uart_inst_t *uart, uint baud_rate, int tx_pin, int rx_pin);
@@ -0,0 +1,66 @@
+#pragma once
+
+// Host build stand-in for the parts of the Pico SDK the firmware uses. Time
+// is simulated and only moves when the test or benchmark advances it, see
+// host_fakes.h.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+
+#define PICO_DEFAULT_LED_PIN 25
+#define PICO_FLASH_SIZE_BYTES (2u * 1024 * 1024)
+
+// flash reads go through the XIP window, here a plain array
+extern uint8_t host_flash[];
+#define XIP_BASE ((uintptr_t) host_flash)
+
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+
+typedef long alarm_id_t;
+typedef uint64_t absolute_time_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t events);
+
+enum
+{
+  GPIO_IN = 0,
+  GPIO_OUT = 1
+};
+
+enum gpio_function
+{
+  GPIO_FUNC_UART = 2,
+  GPIO_FUNC_PWM = 4,
+  GPIO_FUNC_SIO = 5
+};
+
+enum
+{
+  GPIO_IRQ_LEVEL_LOW = 1,
+  GPIO_IRQ_LEVEL_HIGH = 2,
+  GPIO_IRQ_EDGE_FALL = 4,
+  GPIO_IRQ_EDGE_RISE = 8
+};
+
+extern uint64_t time_us_64();
+extern uint32_t time_us_32();
+extern bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+extern alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback, void *user_data, bool fire_if_past);
+extern absolute_time_t from_us_since_boot(uint64_t us);
+extern bool best_effort_wfe_or_timeout(absolute_time_t timeout);
+
+extern void gpio_init(uint gpio);
+extern void gpio_set_dir(uint gpio, bool out);
+extern void gpio_put(uint gpio, bool value);
+extern bool gpio_get(uint gpio);
+extern void gpio_set_pulls(uint gpio, bool up, bool down);
+extern void gpio_set_function(uint gpio, enum gpio_function fn);
+extern void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback);
+
+extern void __wfe();
+extern void __sev();
+extern void tight_loop_contents();
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+// only the configuration passed to tuh_configure and the extra root port,
+// the host stack is faked
+
+typedef struct
+{
+  uint8_t pin_dp;
+  uint8_t pio_tx_num;
+  uint8_t sm_tx;
+  uint8_t tx_ch;
+  uint8_t pio_rx_num;
+  uint8_t sm_rx;
+  uint8_t sm_eop;
+  void *alarm_pool;
+  int8_t debug_pin_rx;
+  int8_t debug_pin_eop;
+  bool skip_alarm_pool;
+} pio_usb_configuration_t;
+
+#define PIO_USB_TX_DEFAULT 0
+#define PIO_SM_USB_TX_DEFAULT 0
+#define PIO_USB_DMA_TX_DEFAULT 0
+#define PIO_USB_RX_DEFAULT 1
+#define PIO_SM_USB_RX_DEFAULT 0
+#define PIO_SM_USB_EOP_DEFAULT 1
+#define PIO_USB_DEBUG_PIN_NONE (-1)
+#ifndef PIO_USB_DP_PIN_DEFAULT
+#define PIO_USB_DP_PIN_DEFAULT 0
+#endif
+
+typedef enum
+{
+  PIO_USB_PINOUT_DPDM,
+  PIO_USB_PINOUT_DMDP
+} PIO_USB_PINOUT;
+
+int pio_usb_host_add_port(uint8_t pin_dp, PIO_USB_PINOUT pinout);
@@ -0,0 +1,482 @@
+#pragma once
+
+// Host build stand-in for the TinyUSB API the firmware uses. Types, constants
+// and descriptor macros match TinyUSB so the descriptors come out byte for
+// byte the same. The stack itself is faked in fake_tusb.cxx: reports sent to
+// the host are recorded and the usb host side is driven from host_fakes.h.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tusb_config.h"
+
+// classes tusb_config.h leaves out, as tusb_option.h defaults them
+#ifndef CFG_TUD_MSC
+#define CFG_TUD_MSC 0
+#endif
+#ifndef CFG_TUD_MIDI
+#define CFG_TUD_MIDI 0
+#endif
+#ifndef CFG_TUD_VENDOR
+#define CFG_TUD_VENDOR 0
+#endif
+
+#define OPT_OS_PICO 6
+
+#define TU_ATTR_PACKED __attribute__((packed))
+#define TU_ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+#define TU_BIT(n) (1UL << (n))
+#define TU_U16_HIGH(u16) ((uint8_t) (((u16) >> 8) & 0x00ff))
+#define TU_U16_LOW(u16) ((uint8_t) ((u16) & 0x00ff))
+#define U16_TO_U8S_LE(u16) TU_U16_LOW(u16), TU_U16_HIGH(u16)
+#define TU_U32_BYTE3(u32) ((uint8_t) ((((uint32_t) u32) >> 24) & 0x000000ff))
+#define TU_U32_BYTE2(u32) ((uint8_t) ((((uint32_t) u32) >> 16) & 0x000000ff))
+#define TU_U32_BYTE1(u32) ((uint8_t) ((((uint32_t) u32) >> 8) & 0x000000ff))
+#define TU_U32_BYTE0(u32) ((uint8_t) (((uint32_t) u32) & 0x000000ff))
+#define U32_TO_U8S_LE(u32) TU_U32_BYTE0(u32), TU_U32_BYTE1(u32), TU_U32_BYTE2(u32), TU_U32_BYTE3(u32)
+
+//--------------------------------------------------------------------+
+// Standard descriptors
+//--------------------------------------------------------------------+
+
+enum
+{
+  TUSB_DESC_DEVICE = 0x01,
+  TUSB_DESC_CONFIGURATION = 0x02,
+  TUSB_DESC_STRING = 0x03,
+  TUSB_DESC_INTERFACE = 0x04,
+  TUSB_DESC_ENDPOINT = 0x05,
+  TUSB_DESC_INTERFACE_ASSOCIATION = 0x0b,
+  TUSB_DESC_CS_INTERFACE = 0x24
+};
+
+enum
+{
+  TUSB_XFER_CONTROL = 0,
+  TUSB_XFER_ISOCHRONOUS,
+  TUSB_XFER_BULK,
+  TUSB_XFER_INTERRUPT
+};
+
+enum
+{
+  TUSB_CLASS_CDC = 2,
+  TUSB_CLASS_HID = 3,
+  TUSB_CLASS_CDC_DATA = 10,
+  TUSB_CLASS_MISC = 0xef
+};
+
+enum
+{
+  MISC_SUBCLASS_COMMON = 2
+};
+
+enum
+{
+  MISC_PROTOCOL_IAD = 1
+};
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t bDeviceClass;
+  uint8_t bDeviceSubClass;
+  uint8_t bDeviceProtocol;
+  uint8_t bMaxPacketSize0;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t iManufacturer;
+  uint8_t iProduct;
+  uint8_t iSerialNumber;
+  uint8_t bNumConfigurations;
+} tusb_desc_device_t;
+
+#define TUD_CONFIG_DESC_LEN (9)
+
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma) \
+  9, TUSB_DESC_CONFIGURATION, U16_TO_U8S_LE(_total_len), _itfcount, config_num, _stridx, TU_BIT(7) | _attribute, (_power_ma) / 2
+
+//--------------------------------------------------------------------+
+// CDC
+//--------------------------------------------------------------------+
+
+#define TUD_CDC_DESC_LEN (8 + 9 + 5 + 5 + 4 + 5 + 7 + 9 + 7 + 7)
+
+#define TUD_CDC_DESCRIPTOR(_itfnum, _stridx, _ep_notif, _ep_notif_size, _epout, _epin, _epsize) \
+  8, TUSB_DESC_INTERFACE_ASSOCIATION, _itfnum, 2, TUSB_CLASS_CDC, 2, 0, 0, \
+  9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_CDC, 2, 0, _stridx, \
+  5, TUSB_DESC_CS_INTERFACE, 0, U16_TO_U8S_LE(0x0120), \
+  5, TUSB_DESC_CS_INTERFACE, 1, 0, (uint8_t) ((_itfnum) + 1), \
+  4, TUSB_DESC_CS_INTERFACE, 2, 6, \
+  5, TUSB_DESC_CS_INTERFACE, 6, _itfnum, (uint8_t) ((_itfnum) + 1), \
+  7, TUSB_DESC_ENDPOINT, _ep_notif, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_ep_notif_size), 16, \
+  9, TUSB_DESC_INTERFACE, (uint8_t) ((_itfnum) + 1), 0, 2, TUSB_CLASS_CDC_DATA, 0, 0, 0, \
+  7, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0, \
+  7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0
+
+//--------------------------------------------------------------------+
+// HID
+//--------------------------------------------------------------------+
+
+typedef enum
+{
+  HID_ITF_PROTOCOL_NONE = 0,
+  HID_ITF_PROTOCOL_KEYBOARD = 1,
+  HID_ITF_PROTOCOL_MOUSE = 2
+} hid_interface_protocol_enum_t;
+
+enum
+{
+  HID_PROTOCOL_BOOT = 0,
+  HID_PROTOCOL_REPORT = 1
+};
+
+typedef enum
+{
+  HID_REPORT_TYPE_INVALID = 0,
+  HID_REPORT_TYPE_INPUT,
+  HID_REPORT_TYPE_OUTPUT,
+  HID_REPORT_TYPE_FEATURE
+} hid_report_type_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t modifier;
+  uint8_t reserved;
+  uint8_t keycode[6];
+} hid_keyboard_report_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t buttons;
+  int8_t x;
+  int8_t y;
+  int8_t wheel;
+  int8_t pan;
+} hid_mouse_report_t;
+
+typedef enum
+{
+  KEYBOARD_MODIFIER_LEFTCTRL = TU_BIT(0),
+  KEYBOARD_MODIFIER_LEFTSHIFT = TU_BIT(1),
+  KEYBOARD_MODIFIER_LEFTALT = TU_BIT(2),
+  KEYBOARD_MODIFIER_LEFTGUI = TU_BIT(3),
+  KEYBOARD_MODIFIER_RIGHTCTRL = TU_BIT(4),
+  KEYBOARD_MODIFIER_RIGHTSHIFT = TU_BIT(5),
+  KEYBOARD_MODIFIER_RIGHTALT = TU_BIT(6),
+  KEYBOARD_MODIFIER_RIGHTGUI = TU_BIT(7)
+} hid_keyboard_modifier_bm_t;
+
+typedef enum
+{
+  MOUSE_BUTTON_LEFT = TU_BIT(0),
+  MOUSE_BUTTON_RIGHT = TU_BIT(1),
+  MOUSE_BUTTON_MIDDLE = TU_BIT(2),
+  MOUSE_BUTTON_BACKWARD = TU_BIT(3),
+  MOUSE_BUTTON_FORWARD = TU_BIT(4)
+} hid_mouse_button_bm_t;
+
+typedef enum
+{
+  KEYBOARD_LED_NUMLOCK = TU_BIT(0),
+  KEYBOARD_LED_CAPSLOCK = TU_BIT(1),
+  KEYBOARD_LED_SCROLLLOCK = TU_BIT(2)
+} hid_keyboard_led_bm_t;
+
+#define HID_KEY_NONE 0x00
+#define HID_KEY_A 0x04
+#define HID_KEY_B 0x05
+#define HID_KEY_C 0x06
+#define HID_KEY_Z 0x1d
+#define HID_KEY_1 0x1e
+#define HID_KEY_0 0x27
+#define HID_KEY_ENTER 0x28
+#define HID_KEY_SPACE 0x2c
+#define HID_KEY_CAPS_LOCK 0x39
+#define HID_KEY_SCROLL_LOCK 0x47
+#define HID_KEY_CONTROL_LEFT 0xe0
+#define HID_KEY_SHIFT_LEFT 0xe1
+#define HID_KEY_GUI_RIGHT 0xe7
+
+// only letters, digits, enter and space, the firmware uses it for logging
+#define HID_KEYCODE_TO_ASCII \
+  {0, 0}, {0, 0}, {0, 0}, {0, 0}, \
+  {'a', 'A'}, {'b', 'B'}, {'c', 'C'}, {'d', 'D'}, {'e', 'E'}, {'f', 'F'}, {'g', 'G'}, {'h', 'H'}, \
+  {'i', 'I'}, {'j', 'J'}, {'k', 'K'}, {'l', 'L'}, {'m', 'M'}, {'n', 'N'}, {'o', 'O'}, {'p', 'P'}, \
+  {'q', 'Q'}, {'r', 'R'}, {'s', 'S'}, {'t', 'T'}, {'u', 'U'}, {'v', 'V'}, {'w', 'W'}, {'x', 'X'}, \
+  {'y', 'Y'}, {'z', 'Z'}, \
+  {'1', '!'}, {'2', '@'}, {'3', '#'}, {'4', '$'}, {'5', '%'}, {'6', '^'}, {'7', '&'}, {'8', '*'}, \
+  {'9', '('}, {'0', ')'}, \
+  {'\r', '\r'}, {0, 0}, {0, 0}, {0, 0}, {' ', ' '}
+
+// report descriptor items
+
+#define HID_REPORT_DATA_0(data)
+#define HID_REPORT_DATA_1(data) , data
+#define HID_REPORT_DATA_2(data) , U16_TO_U8S_LE(data)
+#define HID_REPORT_DATA_3(data) , U32_TO_U8S_LE(data)
+
+#define HID_REPORT_ITEM(data, tag, type, size) \
+  (((tag) << 4) | ((type) << 2) | (size)) HID_REPORT_DATA_##size(data)
+
+#define RI_TYPE_MAIN 0
+#define RI_TYPE_GLOBAL 1
+#define RI_TYPE_LOCAL 2
+
+#define RI_MAIN_INPUT 8
+#define RI_MAIN_OUTPUT 9
+#define RI_MAIN_COLLECTION 10
+#define RI_MAIN_FEATURE 11
+#define RI_MAIN_COLLECTION_END 12
+
+#define RI_GLOBAL_USAGE_PAGE 0
+#define RI_GLOBAL_LOGICAL_MIN 1
+#define RI_GLOBAL_LOGICAL_MAX 2
+#define RI_GLOBAL_PHYSICAL_MIN 3
+#define RI_GLOBAL_PHYSICAL_MAX 4
+#define RI_GLOBAL_UNIT_EXPONENT 5
+#define RI_GLOBAL_UNIT 6
+#define RI_GLOBAL_REPORT_SIZE 7
+#define RI_GLOBAL_REPORT_ID 8
+#define RI_GLOBAL_REPORT_COUNT 9
+
+#define RI_LOCAL_USAGE 0
+#define RI_LOCAL_USAGE_MIN 1
+#define RI_LOCAL_USAGE_MAX 2
+
+#define HID_INPUT(x) HID_REPORT_ITEM(x, RI_MAIN_INPUT, RI_TYPE_MAIN, 1)
+#define HID_OUTPUT(x) HID_REPORT_ITEM(x, RI_MAIN_OUTPUT, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION(x) HID_REPORT_ITEM(x, RI_MAIN_COLLECTION, RI_TYPE_MAIN, 1)
+#define HID_FEATURE(x) HID_REPORT_ITEM(x, RI_MAIN_FEATURE, RI_TYPE_MAIN, 1)
+#define HID_COLLECTION_END HID_REPORT_ITEM(x, RI_MAIN_COLLECTION_END, RI_TYPE_MAIN, 0)
+
+#define HID_USAGE_PAGE(x) HID_REPORT_ITEM(x, RI_GLOBAL_USAGE_PAGE, RI_TYPE_GLOBAL, 1)
+#define HID_USAGE_PAGE_N(x, n) HID_REPORT_ITEM(x, RI_GLOBAL_USAGE_PAGE, RI_TYPE_GLOBAL, n)
+#define HID_LOGICAL_MIN(x) HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MIN, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MIN_N(x, n) HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MIN, RI_TYPE_GLOBAL, n)
+#define HID_LOGICAL_MAX(x) HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MAX, RI_TYPE_GLOBAL, 1)
+#define HID_LOGICAL_MAX_N(x, n) HID_REPORT_ITEM(x, RI_GLOBAL_LOGICAL_MAX, RI_TYPE_GLOBAL, n)
+#define HID_PHYSICAL_MIN(x) HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MIN, RI_TYPE_GLOBAL, 1)
+#define HID_PHYSICAL_MIN_N(x, n) HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MIN, RI_TYPE_GLOBAL, n)
+#define HID_PHYSICAL_MAX(x) HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MAX, RI_TYPE_GLOBAL, 1)
+#define HID_PHYSICAL_MAX_N(x, n) HID_REPORT_ITEM(x, RI_GLOBAL_PHYSICAL_MAX, RI_TYPE_GLOBAL, n)
+#define HID_UNIT_EXPONENT(x) HID_REPORT_ITEM(x, RI_GLOBAL_UNIT_EXPONENT, RI_TYPE_GLOBAL, 1)
+#define HID_UNIT(x) HID_REPORT_ITEM(x, RI_GLOBAL_UNIT, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_SIZE(x) HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_SIZE, RI_TYPE_GLOBAL, 1)
+#define HID_REPORT_ID(x) HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_ID, RI_TYPE_GLOBAL, 1),
+#define HID_REPORT_COUNT(x) HID_REPORT_ITEM(x, RI_GLOBAL_REPORT_COUNT, RI_TYPE_GLOBAL, 1)
+
+#define HID_USAGE(x) HID_REPORT_ITEM(x, RI_LOCAL_USAGE, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_N(x, n) HID_REPORT_ITEM(x, RI_LOCAL_USAGE, RI_TYPE_LOCAL, n)
+#define HID_USAGE_MIN(x) HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MIN, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MIN_N(x, n) HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MIN, RI_TYPE_LOCAL, n)
+#define HID_USAGE_MAX(x) HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MAX, RI_TYPE_LOCAL, 1)
+#define HID_USAGE_MAX_N(x, n) HID_REPORT_ITEM(x, RI_LOCAL_USAGE_MAX, RI_TYPE_LOCAL, n)
+
+#define HID_DATA (0 << 0)
+#define HID_CONSTANT (1 << 0)
+#define HID_ARRAY (0 << 1)
+#define HID_VARIABLE (1 << 1)
+#define HID_ABSOLUTE (0 << 2)
+#define HID_RELATIVE (1 << 2)
+
+#define HID_COLLECTION_PHYSICAL 0
+#define HID_COLLECTION_APPLICATION 1
+#define HID_COLLECTION_LOGICAL 2
+
+#define HID_USAGE_PAGE_DESKTOP 0x01
+#define HID_USAGE_PAGE_KEYBOARD 0x07
+#define HID_USAGE_PAGE_LED 0x08
+#define HID_USAGE_PAGE_BUTTON 0x09
+#define HID_USAGE_PAGE_CONSUMER 0x0c
+
+#define HID_USAGE_DESKTOP_POINTER 0x01
+#define HID_USAGE_DESKTOP_MOUSE 0x02
+#define HID_USAGE_DESKTOP_KEYBOARD 0x06
+#define HID_USAGE_DESKTOP_X 0x30
+#define HID_USAGE_DESKTOP_Y 0x31
+#define HID_USAGE_DESKTOP_WHEEL 0x38
+#define HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER 0x48
+
+#define HID_USAGE_CONSUMER_CONTROL 0x0001
+#define HID_USAGE_CONSUMER_AC_PAN 0x0238
+
+#define TUD_HID_REPORT_DESC_KEYBOARD(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP ), \
+  HID_USAGE ( HID_USAGE_DESKTOP_KEYBOARD ), \
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION ), \
+    __VA_ARGS__ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD ), \
+      HID_USAGE_MIN ( 224 ), \
+      HID_USAGE_MAX ( 231 ), \
+      HID_LOGICAL_MIN ( 0 ), \
+      HID_LOGICAL_MAX ( 1 ), \
+      HID_REPORT_COUNT ( 8 ), \
+      HID_REPORT_SIZE ( 1 ), \
+      HID_INPUT ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ), \
+      HID_REPORT_COUNT ( 1 ), \
+      HID_REPORT_SIZE ( 8 ), \
+      HID_INPUT ( HID_CONSTANT ), \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_LED ), \
+      HID_USAGE_MIN ( 1 ), \
+      HID_USAGE_MAX ( 5 ), \
+      HID_REPORT_COUNT ( 5 ), \
+      HID_REPORT_SIZE ( 1 ), \
+      HID_OUTPUT ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ), \
+      HID_REPORT_COUNT ( 1 ), \
+      HID_REPORT_SIZE ( 3 ), \
+      HID_OUTPUT ( HID_CONSTANT ), \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD ), \
+      HID_USAGE_MIN ( 0 ), \
+      HID_USAGE_MAX_N ( 255, 2 ), \
+      HID_LOGICAL_MIN ( 0 ), \
+      HID_LOGICAL_MAX_N( 255, 2 ), \
+      HID_REPORT_COUNT ( 6 ), \
+      HID_REPORT_SIZE ( 8 ), \
+      HID_INPUT ( HID_DATA | HID_ARRAY | HID_ABSOLUTE ), \
+  HID_COLLECTION_END
+
+#define TUD_HID_REPORT_DESC_MOUSE(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP ), \
+  HID_USAGE ( HID_USAGE_DESKTOP_MOUSE ), \
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION ), \
+    __VA_ARGS__ \
+    HID_USAGE ( HID_USAGE_DESKTOP_POINTER ), \
+    HID_COLLECTION ( HID_COLLECTION_PHYSICAL ), \
+      HID_USAGE_PAGE ( HID_USAGE_PAGE_BUTTON ), \
+        HID_USAGE_MIN ( 1 ), \
+        HID_USAGE_MAX ( 5 ), \
+        HID_LOGICAL_MIN ( 0 ), \
+        HID_LOGICAL_MAX ( 1 ), \
+        HID_REPORT_COUNT( 5 ), \
+        HID_REPORT_SIZE ( 1 ), \
+        HID_INPUT ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ), \
+        HID_REPORT_COUNT( 1 ), \
+        HID_REPORT_SIZE ( 3 ), \
+        HID_INPUT ( HID_CONSTANT ), \
+      HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP ), \
+        HID_USAGE ( HID_USAGE_DESKTOP_X ), \
+        HID_USAGE ( HID_USAGE_DESKTOP_Y ), \
+        HID_LOGICAL_MIN ( 0x81 ), \
+        HID_LOGICAL_MAX ( 0x7f ), \
+        HID_REPORT_COUNT( 2 ), \
+        HID_REPORT_SIZE ( 8 ), \
+        HID_INPUT ( HID_DATA | HID_VARIABLE | HID_RELATIVE ), \
+        HID_USAGE ( HID_USAGE_DESKTOP_WHEEL ), \
+        HID_LOGICAL_MIN ( 0x81 ), \
+        HID_LOGICAL_MAX ( 0x7f ), \
+        HID_REPORT_COUNT( 1 ), \
+        HID_REPORT_SIZE ( 8 ), \
+        HID_INPUT ( HID_DATA | HID_VARIABLE | HID_RELATIVE ), \
+      HID_USAGE_PAGE ( HID_USAGE_PAGE_CONSUMER ), \
+        HID_USAGE_N ( HID_USAGE_CONSUMER_AC_PAN, 2 ), \
+        HID_LOGICAL_MIN ( 0x81 ), \
+        HID_LOGICAL_MAX ( 0x7f ), \
+        HID_REPORT_COUNT( 1 ), \
+        HID_REPORT_SIZE ( 8 ), \
+        HID_INPUT ( HID_DATA | HID_VARIABLE | HID_RELATIVE ), \
+    HID_COLLECTION_END, \
+  HID_COLLECTION_END
+
+#define TUD_HID_REPORT_DESC_CONSUMER(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_CONSUMER ), \
+  HID_USAGE ( HID_USAGE_CONSUMER_CONTROL ), \
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION ), \
+    __VA_ARGS__ \
+    HID_LOGICAL_MIN ( 0x00 ), \
+    HID_LOGICAL_MAX_N( 0x03ff, 2 ), \
+    HID_USAGE_MIN ( 0x00 ), \
+    HID_USAGE_MAX_N ( 0x03ff, 2 ), \
+    HID_REPORT_COUNT ( 1 ), \
+    HID_REPORT_SIZE ( 16 ), \
+    HID_INPUT ( HID_DATA | HID_ARRAY | HID_ABSOLUTE ), \
+  HID_COLLECTION_END
+
+typedef enum
+{
+  HID_DESC_TYPE_HID = 0x21,
+  HID_DESC_TYPE_REPORT = 0x22
+} hid_descriptor_enum_t;
+
+#define TUD_HID_DESC_LEN (9 + 9 + 7)
+
+#define TUD_HID_DESCRIPTOR(_itfnum, _stridx, _boot_protocol, _report_desc_len, _epin, _epsize, _ep_interval) \
+  9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_HID, (uint8_t) ((_boot_protocol) ? 1 : 0), _boot_protocol, _stridx, \
+  9, HID_DESC_TYPE_HID, U16_TO_U8S_LE(0x0111), 0, 1, HID_DESC_TYPE_REPORT, U16_TO_U8S_LE(_report_desc_len), \
+  7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_epsize), _ep_interval
+
+#define TUH_CFGID_RPI_PIO_USB_CONFIGURATION 100
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Device stack
+//--------------------------------------------------------------------+
+
+bool tud_init(uint8_t rhport);
+void tud_task(void);
+bool tud_task_event_ready(void);
+bool tud_mounted(void);
+bool tud_suspended(void);
+bool tud_connect(void);
+bool tud_disconnect(void);
+
+bool tud_hid_n_ready(uint8_t instance);
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len);
+uint8_t tud_hid_n_get_protocol(uint8_t instance);
+
+uint32_t tud_cdc_available(void);
+uint32_t tud_cdc_read(void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_write(void const *buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_str(char const *str);
+uint32_t tud_cdc_write_flush(void);
+uint32_t tud_cdc_write_available(void);
+
+// implemented by the firmware
+uint8_t const *tud_descriptor_device_cb(void);
+uint8_t const *tud_descriptor_configuration_cb(uint8_t index);
+uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance);
+void tud_mount_cb(void);
+void tud_umount_cb(void);
+void tud_suspend_cb(bool remote_wakeup_en);
+void tud_resume_cb(void);
+void tud_cdc_rx_cb(uint8_t itf);
+void tud_cdc_tx_complete_cb(uint8_t itf);
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen);
+void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const *buffer, uint16_t bufsize);
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len);
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol);
+
+//--------------------------------------------------------------------+
+// Host stack
+//--------------------------------------------------------------------+
+
+bool tuh_init(uint8_t rhport);
+void tuh_task(void);
+bool tuh_configure(uint8_t rhport, uint32_t cfg_id, const void *cfg_param);
+bool tuh_vid_pid_get(uint8_t dev_addr, uint16_t *vid, uint16_t *pid);
+
+uint8_t tuh_hid_interface_protocol(uint8_t dev_addr, uint8_t instance);
+uint8_t tuh_hid_get_protocol(uint8_t dev_addr, uint8_t instance);
+bool tuh_hid_set_protocol(uint8_t dev_addr, uint8_t instance, uint8_t protocol);
+bool tuh_hid_set_report(uint8_t dev_addr, uint8_t instance, uint8_t report_id, uint8_t report_type, void *report, uint16_t len);
+bool tuh_hid_receive_report(uint8_t dev_addr, uint8_t instance);
+
+// implemented by the firmware
+void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const *desc_report, uint16_t desc_len);
+void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance);
+void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const *report, uint16_t len);
+void tuh_hid_set_protocol_complete_cb(uint8_t dev_addr, uint8_t instance, uint8_t protocol);
+void tuh_hid_set_report_complete_cb(uint8_t dev_addr, uint8_t instance, uint8_t report_id, uint8_t report_type, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
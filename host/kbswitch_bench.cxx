@@ -0,0 +1,339 @@
+// Times the firmware's input paths on Linux, built with -DHOST_BUILD=ON.
+//
+// usage: kbswitch_bench [iterations]
+//
+// Each case runs the real firmware code against the fakes and checks the
+// reports it expects reached the computer, so a broken path shows up as
+// FAIL rather than as a fast time. Times are wall clock per operation and
+// only useful for comparing one build with another on the same machine.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "common.h"
+#include "framing.h"
+#include "host_ports.h"
+#include "key_state.h"
+#include "mouse_state.h"
+#include "report_filter.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+static const uint8_t HUB_ADDR = 3;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static bool failed;
+
+static void report(const char *name, int ops, bench_clock::duration elapsed, size_t got, size_t expected)
+{
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+  bool ok = got == expected;
+  fprintf(stdout, "%-16s %8d ops %10.1f ns/op  %s", name, ops, ns, ok ? "ok" : "FAIL");
+  if (!ok)
+  {
+    fprintf(stdout, " (%zu reports, expected %zu)", got, expected);
+    failed = true;
+  }
+  fprintf(stdout, "\n");
+}
+
+// lets the report in flight complete so the next one can be sent
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+// boot keyboard on this board, sent to the computer and over the uart
+static void bench_local_keyboard(int n)
+{
+  host_usb_clear_reports();
+  hid_keyboard_report_t down = { 0, 0, { HID_KEY_A } };
+  hid_keyboard_report_t up = {};
+  auto start = bench_clock::now();
+  for (int i = 0; i < n; ++i)
+  {
+    const hid_keyboard_report_t &r = (i & 1) == 0 ? down : up;
+    host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+    host_run();
+    host_uart_take_sent();
+    next_frame();
+  }
+  report("local keyboard", n, bench_clock::now() - start, host_usb_reports().size(), n);
+}
+
+// boot mouse on this board, back and forth so an edge switch build never
+// moves the pointer off the screen
+static void bench_local_mouse(int n)
+{
+  host_usb_clear_reports();
+  hid_mouse_report_t there = { 0, 3, -2, 0, 0 };
+  hid_mouse_report_t back = { 0, -3, 2, 0, 0 };
+  auto start = bench_clock::now();
+  for (int i = 0; i < n; ++i)
+  {
+    const hid_mouse_report_t &r = (i & 1) == 0 ? there : back;
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+    host_run();
+    host_uart_take_sent();
+    next_frame();
+  }
+  report("local mouse", n, bench_clock::now() - start, host_usb_reports().size(), n);
+}
+
+// keyboard frames from the other board, encoded by the firmware itself
+static void bench_uart_keyboard(int n)
+{
+  key_state down = {};
+  key_state_press(&down, HID_KEY_A);
+  key_state up = {};
+  send_uart_kb_report(&down, host_now_us());
+  std::vector<uint8_t> down_frame = host_uart_take_sent();
+  send_uart_kb_report(&up, host_now_us());
+  std::vector<uint8_t> up_frame = host_uart_take_sent();
+
+  host_usb_clear_reports();
+  auto start = bench_clock::now();
+  for (int i = 0; i < n; ++i)
+  {
+    const std::vector<uint8_t> &f = (i & 1) == 0 ? down_frame : up_frame;
+    host_uart_receive(f.data(), (int) f.size());
+    host_run();
+    next_frame();
+  }
+  report("uart keyboard", n, bench_clock::now() - start, host_usb_reports().size(), n);
+}
+
+// Raw bytes through the uart interrupt, read_pending and uart_task, in
+// chunks well inside the receive ring. expected_frames is the number of good
+// frames in the stream, or -1 for noise.
+static void bench_parser(const char *name, const std::vector<uint8_t> &stream, int expected_frames)
+{
+  static const size_t CHUNK = 64;
+  uart_link_stats before = uart_link_get_stats();
+  auto start = bench_clock::now();
+  for (size_t i = 0; i < stream.size(); i += CHUNK)
+  {
+    host_uart_receive(&stream[i], (int) std::min(CHUNK, stream.size() - i));
+    host_run();
+  }
+  auto elapsed = bench_clock::now() - start;
+  uart_link_stats after = uart_link_get_stats();
+  host_usb_clear_reports();
+  host_uart_take_sent();
+
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+  bool ok = expected_frames < 0 || after.frames - before.frames == (uint32_t) expected_frames;
+  fprintf(stdout, "%-16s %8zu bytes %8.1f ns/byte %6.1f MB/s  %s\n", name, stream.size(), ns / stream.size(),
+    stream.size() * 1e3 / ns, ok ? "ok" : "FAIL");
+  failed |= !ok;
+}
+
+static void bench_parsers(int n)
+{
+  std::mt19937 rng(1);
+  std::vector<uint8_t> frames;
+  for (int i = 0; i < n; ++i)
+  {
+    key_state keys = {};
+    for (int k = rng() % 8; k > 0; --k)
+    {
+      key_state_press(&keys, HID_KEY_A + rng() % 26);
+    }
+    send_uart_kb_report(&keys, host_now_us());
+    std::vector<uint8_t> f = host_uart_take_sent();
+    frames.insert(frames.end(), f.begin(), f.end());
+  }
+  bench_parser("parser frames", frames, n);
+
+  std::vector<uint8_t> noise(frames.size());
+  for (uint8_t &b : noise)
+  {
+    b = (uint8_t) rng();
+  }
+  bench_parser("parser random", noise, -1);
+  bench_parser("parser escapes", std::vector<uint8_t>(frames.size(), ESCAPE), -1);
+  bench_parser("parser sentinels", std::vector<uint8_t>(frames.size(), SENTINEL), 0);
+  for (uint8_t &b : noise)
+  {
+    b = rng() % 2 != 0 ? SENTINEL : ESCAPE;
+  }
+  bench_parser("parser 7d/7e mix", noise, -1);
+}
+
+// output to the other board and back, with the release and restore
+// reports each switch sends
+static void bench_switch(int n)
+{
+  host_usb_clear_reports();
+  auto start = bench_clock::now();
+  for (int i = 0; i < n; ++i)
+  {
+    toggle_output();
+    host_run();
+    for (int frame = 0; frame < 4; ++frame)
+    {
+      next_frame();
+    }
+    host_uart_take_sent();
+  }
+  // switching away releases the keyboard, mouse and media keys, switching
+  // back restores them
+  report("output switch", n, bench_clock::now() - start, host_usb_reports().size(), 3 * (size_t) n);
+}
+
+// drops the reports that repeat the one before
+template <typename T> static std::vector<T> changes(const std::vector<T> &v)
+{
+  std::vector<T> out;
+  for (const T &x : v)
+  {
+    if (out.empty() || memcmp(&out.back(), &x, sizeof(T)) != 0)
+    {
+      out.push_back(x);
+    }
+  }
+  return out;
+}
+
+template <typename T> static bool same(const std::vector<T> &a, const std::vector<T> &b)
+{
+  return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+// A keyboard that repeats its report while keys are held and a mouse that
+// reports without moving, a report every millisecond. Every change must
+// reach the computer in order and go out on the uart, with most of the
+// repeats left out of both.
+static void check_filter(int n)
+{
+  std::mt19937 rng(2);
+  host_usb_clear_reports();
+  host_uart_take_sent();
+  report_filter_reset_stats();
+  // both start from nothing held, as the computer last saw
+  std::vector<key_state> keys_in(1);
+  std::vector<uint8_t> buttons_in(1);
+  hid_keyboard_report_t kb = {};
+  hid_mouse_report_t mouse = {};
+  key_state last_keys = {};
+  uint8_t last_buttons = 0;
+  bool uart_ok = true;
+  for (int i = 0; i < n; ++i)
+  {
+    bool changed;
+    if ((i & 1) == 0)
+    {
+      if (rng() % 8 == 0)
+      {
+        kb.modifier = rng() % 4 == 0 ? KEYBOARD_MODIFIER_LEFTSHIFT : 0;
+        kb.keycode[0] = rng() % 3 != 0 ? HID_KEY_A + rng() % 3 : 0;
+      }
+      key_state keys;
+      key_state_from_boot(&keys, &kb);
+      changed = memcmp(&keys, &last_keys, sizeof(keys)) != 0;
+      last_keys = keys;
+      keys_in.push_back(keys);
+      host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &kb, sizeof(kb));
+    }
+    else
+    {
+      if (rng() % 8 == 0)
+      {
+        mouse.buttons = rng() % 2 != 0 ? MOUSE_BUTTON_LEFT : 0;
+      }
+      changed = mouse.buttons != last_buttons;
+      last_buttons = mouse.buttons;
+      buttons_in.push_back(mouse.buttons);
+      host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &mouse, sizeof(mouse));
+    }
+    host_run();
+    bool sent = !host_uart_take_sent().empty();
+    uart_ok &= sent || !changed;
+    next_frame();
+  }
+
+  std::vector<key_state> keys_out(1);
+  std::vector<uint8_t> buttons_out(1);
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    if (r.data.size() == 1 + sizeof(key_state) && r.data[0] == REPORT_ID_NKRO)
+    {
+      key_state k;
+      memcpy(&k, r.data.data() + 1, sizeof(k));
+      keys_out.push_back(k);
+    }
+    // the buttons come first in the absolute pointer report too
+    else if (r.data.size() >= 2 && (r.data[0] == REPORT_ID_MOUSE || r.data[0] == REPORT_ID_ABSOLUTE_POINTER))
+    {
+      buttons_out.push_back(r.data[1]);
+    }
+  }
+  report_filter_stats device = report_filter_get_stats(FILTER_DEVICE);
+  report_filter_stats uart = report_filter_get_stats(FILTER_UART);
+  uint32_t device_dropped = device.keyboard_dropped + device.mouse_dropped;
+  uint32_t uart_dropped = uart.keyboard_dropped + uart.mouse_dropped;
+  bool ok = uart_ok && same(changes(keys_in), changes(keys_out)) && same(changes(buttons_in), changes(buttons_out)) &&
+    device_dropped > (uint32_t) n / 2 && uart_dropped > (uint32_t) n / 2;
+  fprintf(stdout, "%-16s %8d reports %zu to the computer, %u repeats left out of the uart  %s\n", "repeat filter", n,
+    host_usb_reports().size(), uart_dropped, ok ? "ok" : "FAIL");
+  failed |= !ok;
+}
+
+// The mouse is on the last root port and its reports are counted there.
+// Then it moves behind a hub on the keyboard's port, and with a second port
+// built in, the firmware suggests replugging into the free one.
+static void check_ports(int n)
+{
+  int last = host_usb_host_ports();
+  bool ok = host_ports_port_of(MOUSE_ADDR) == last && host_ports_get(last).reports >= (uint32_t) n;
+
+  host_device_detach(MOUSE_ADDR, 0);
+  host_device_set_port(MOUSE_ADDR, 1, HUB_ADDR);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  host_uart_take_sent();
+  host_port_stats s = host_ports_get(1);
+  ok &= s.devices == 2 && s.through_hub == 1;
+  ok &= host_ports_suggest_port() == (last > 1 ? 2 : 0);
+  fprintf(stdout, "%-16s %d port%s  %s\n", "host ports", last, last > 1 ? "s" : "", ok ? "ok" : "FAIL");
+  failed |= !ok;
+}
+
+int main(int argc, char **argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 10000;
+  if (n <= 0 || (n & 1) != 0)
+  {
+    fprintf(stderr, "iterations must be even and positive\n");
+    return 2;
+  }
+
+  host_board_init(0);
+  host_usb_mount();
+  host_device_set_port(MOUSE_ADDR, (uint8_t) host_usb_host_ports(), 0);
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  host_uart_take_sent();
+
+  bench_local_keyboard(n);
+  bench_local_mouse(n);
+  bench_uart_keyboard(n);
+  bench_switch(n);
+  check_filter(n);
+  bench_parsers(n);
+  check_ports(n);
+  return failed ? 1 : 0;
+}
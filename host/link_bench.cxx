@@ -0,0 +1,525 @@
+// Measures input latency across the uart link, built with -DHOST_BUILD=ON.
+//
+// usage: kbswitch_link_bench [-s seconds] [-b baud] [-t step_us] [-r seed] [-k skew_us] [-d drift_ppm]
+//                            [-c consumer_us]
+//
+// Loads two boards, each its own copy of the firmware and fakes, and joins
+// their uarts. Board zero has a boot keyboard and mouse attached and its
+// output switched to board one. Typing, a 1000 Hz mouse, both together and
+// typing on a keyboard that repeats its report while keys are held are
+// replayed into board zero, and each change of input is timed from
+// tuh_hid_report_received_cb there to the report queued on board one's usb
+// device. Both boards follow one simulated clock in steps of step_us, which
+// is the resolution of the results and should be well under a character
+// time on the uart. Board one's clock can be set skew_us ahead of board
+// zero's and to run drift_ppm fast, which board one's pacing has to allow
+// for; results are on board zero's clock. With consumer_us board one's
+// loops only run that often, its uart interrupt still filling the ring
+// between, so board zero has to hold back until it catches up. Built with
+// UART_RTS_CTS each board's RTS holds the other's CTS, checked once a step,
+// and a full ring is the receiver waiting rather than loss. It exits 1 if
+// anything was lost on the uart.
+//
+// Jitter is the change in latency from one input to the next, so input
+// that arrives with its original spacing has none.
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "key_state.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+static const uint64_t SETTLE_US = 200000;
+static const uint64_t DRAIN_MAX_US = 10000000; // for a slow consumer to catch up after a trace
+
+// an input report replayed into board zero
+struct trace_event
+{
+  uint64_t time_us;
+  uint8_t dev_addr;
+  std::vector<uint8_t> report;
+};
+
+// what board one should send for each keyboard event, and the mouse
+// position after each mouse event
+struct trace
+{
+  std::vector<trace_event> events;
+  std::vector<key_state> keys;
+  std::vector<int32_t> mouse_x;
+};
+
+// the input as it was injected and as it came out of board one
+struct timed_keys
+{
+  uint64_t time_us;
+  key_state state;
+};
+
+struct timed_x
+{
+  uint64_t time_us;
+  int32_t x;
+};
+
+static const host_board_api *boards[2];
+static uint64_t now_us;
+static uint64_t step_us = 10;
+static uint64_t uart_bytes[2];
+static int64_t skew_us;
+static double drift_ppm;
+static uint64_t consumer_us;
+static uint64_t consumer_next_us;
+
+// board one's clock from the simulated one, and back
+static uint64_t board_time(int board, uint64_t us)
+{
+  if (board == 0)
+  {
+    return us;
+  }
+  return (uint64_t) std::max((int64_t) 0, (int64_t) us + skew_us + (int64_t) (us * drift_ppm / 1e6));
+}
+
+static uint64_t sim_time(int board, uint64_t us)
+{
+  return board == 0 ? us : (uint64_t) std::max(0.0, ((int64_t) us - skew_us) / (1 + drift_ppm / 1e6));
+}
+
+static const host_board_api *load_board(const char *path)
+{
+  void *module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (module == nullptr)
+  {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(2);
+  }
+  typedef const host_board_api *(*get_api_fn)();
+  get_api_fn get_api = (get_api_fn) dlsym(module, "host_board_get_api");
+  if (get_api == nullptr)
+  {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(2);
+  }
+  return get_api();
+}
+
+// Runs each board up to now_us and passes on what it wrote to the uart.
+// Bytes arrive at least a character time after they were written, so the
+// other board has not gone past them yet. A board whose loop spun on a
+// full tx fifo past now_us waits there until the other catches up.
+static void run_boards()
+{
+  bool consumed = now_us >= consumer_next_us;
+  for (int i = 0; i < 2; ++i)
+  {
+    uint64_t until = board_time(i, now_us);
+    boards[i]->uart_set_cts(boards[1 - i]->uart_rts());
+    boards[i]->advance_to(until);
+    for (int pass = 0; pass < 1000 && (i == 0 || consumed) && boards[i]->now_us() <= until; ++pass)
+    {
+      if (boards[i]->run(1))
+      {
+        break;
+      }
+    }
+    std::vector<host_uart_byte> sent = boards[i]->uart_take_sent_timed();
+    uart_bytes[i] += sent.size();
+    for (host_uart_byte &b : sent)
+    {
+      b.time_us = board_time(1 - i, sim_time(i, b.time_us));
+    }
+    boards[1 - i]->uart_deliver(sent);
+  }
+  if (consumed)
+  {
+    consumer_next_us = now_us + consumer_us;
+  }
+}
+
+static void run_for(uint64_t us)
+{
+  uint64_t end = now_us + us;
+  while (now_us < end)
+  {
+    now_us += step_us;
+    run_boards();
+  }
+}
+
+// pressed keys are held 40 to 120 ms, a new one every 50 to 250 ms, so
+// fast typing overlaps them now and then
+static void add_typing(trace *t, uint64_t start_us, uint64_t length_us, std::mt19937 *rng)
+{
+  struct key_edge
+  {
+    uint64_t time_us;
+    uint8_t keycode;
+    bool down;
+  };
+  std::vector<key_edge> edges;
+  std::uniform_int_distribution<int> key(HID_KEY_A, HID_KEY_Z);
+  std::uniform_int_distribution<uint64_t> hold(40000, 120000);
+  std::uniform_int_distribution<uint64_t> gap(50000, 250000);
+  uint64_t last_up[256] = {};
+  for (uint64_t time = start_us; time < start_us + length_us; time += gap(*rng))
+  {
+    uint8_t keycode = key(*rng);
+    if (last_up[keycode] >= time)
+    {
+      continue; // still held
+    }
+    last_up[keycode] = time + hold(*rng);
+    edges.push_back(key_edge { time, keycode, true });
+    edges.push_back(key_edge { last_up[keycode], keycode, false });
+  }
+  std::stable_sort(edges.begin(), edges.end(), [](const key_edge &a, const key_edge &b)
+    {
+      return a.time_us < b.time_us;
+    });
+
+  std::vector<uint8_t> held;
+  for (const key_edge &e : edges)
+  {
+    if (e.down)
+    {
+      held.push_back(e.keycode);
+    }
+    else
+    {
+      held.erase(std::find(held.begin(), held.end(), e.keycode));
+    }
+    hid_keyboard_report_t report = {};
+    key_state state = {};
+    for (size_t i = 0; i < held.size() && i < 6; ++i)
+    {
+      report.keycode[i] = held[i];
+      state.keys[held[i] >> 3] |= 1 << (held[i] & 7);
+    }
+    const uint8_t *p = (const uint8_t *) &report;
+    t->events.push_back(trace_event { e.time_us, KEYBOARD_ADDR, std::vector<uint8_t>(p, p + sizeof(report)) });
+    t->keys.push_back(state);
+  }
+}
+
+// a keyboard that sends its report again every interval_us while a key is
+// held, as many do
+static void add_repeats(trace *t, uint64_t interval_us)
+{
+  trace out;
+  for (size_t i = 0; i < t->events.size(); ++i)
+  {
+    const key_state &state = t->keys[i];
+    bool held = std::any_of(state.keys, state.keys + sizeof(state.keys), [](uint8_t k) { return k != 0; });
+    uint64_t end_us = i + 1 < t->events.size() ? t->events[i + 1].time_us : t->events[i].time_us;
+    for (uint64_t time = t->events[i].time_us; time < end_us && (held || time == t->events[i].time_us);
+      time += interval_us)
+    {
+      out.events.push_back(trace_event { time, KEYBOARD_ADDR, t->events[i].report });
+      out.keys.push_back(state);
+    }
+  }
+  *t = out;
+}
+
+// one count to the right per report, so lost motion is lost reports
+static void add_mouse(trace *t, uint64_t start_us, uint64_t length_us, int32_t x)
+{
+  for (uint64_t time = start_us; time < start_us + length_us; time += 1000)
+  {
+    hid_mouse_report_t report = { 0, 1, 0, 0, 0 };
+    const uint8_t *p = (const uint8_t *) &report;
+    t->events.push_back(trace_event { time, MOUSE_ADDR, std::vector<uint8_t>(p, p + sizeof(report)) });
+    t->mouse_x.push_back(++x);
+  }
+}
+
+static void print_latency(const char *name, std::vector<uint64_t> latency, size_t expected)
+{
+  size_t drops = expected - latency.size();
+  if (latency.empty())
+  {
+    printf("  %-8s %6zu events, none arrived\n", name, expected);
+    return;
+  }
+  std::vector<uint64_t> jitter;
+  for (size_t i = 1; i < latency.size(); ++i)
+  {
+    jitter.push_back(latency[i] > latency[i - 1] ? latency[i] - latency[i - 1] : latency[i - 1] - latency[i]);
+  }
+  std::sort(jitter.begin(), jitter.end());
+  std::sort(latency.begin(), latency.end());
+  size_t n = latency.size();
+  printf("  %-8s %6zu events  p50 %6llu us  p99 %6llu us  max %6llu us  jitter p99 %5llu us  dropped %zu\n", name,
+    expected, (unsigned long long) latency[n / 2], (unsigned long long) latency[std::min(n - 1, n * 99 / 100)],
+    (unsigned long long) latency.back(),
+    (unsigned long long) (jitter.empty() ? 0 : jitter[std::min(jitter.size() - 1, jitter.size() * 99 / 100)]), drops);
+}
+
+// Matches each keyboard state in order with the next report carrying it.
+// A state is dropped if the one after it turns up first.
+static std::vector<uint64_t> match_keys(const std::vector<timed_keys> &in, const std::vector<timed_keys> &out)
+{
+  std::vector<uint64_t> latency;
+  size_t next = 0;
+  for (size_t i = 0; i < in.size(); ++i)
+  {
+    for (size_t j = next; j < out.size(); ++j)
+    {
+      if (memcmp(&out[j].state, &in[i].state, sizeof(key_state)) == 0)
+      {
+        latency.push_back(out[j].time_us - in[i].time_us);
+        next = j + 1;
+        break;
+      }
+      if (i + 1 < in.size() && memcmp(&out[j].state, &in[i + 1].state, sizeof(key_state)) == 0)
+      {
+        break;
+      }
+    }
+  }
+  return latency;
+}
+
+// each mouse position arrives with the first report after it that gets that
+// far
+static std::vector<uint64_t> match_mouse(const std::vector<timed_x> &in, const std::vector<timed_x> &out)
+{
+  std::vector<uint64_t> latency;
+  size_t next = 0;
+  for (const timed_x &x : in)
+  {
+    while (next < out.size() && (out[next].x < x.x || out[next].time_us < x.time_us))
+    {
+      next++;
+    }
+    if (next == out.size())
+    {
+      break;
+    }
+    latency.push_back(out[next].time_us - x.time_us);
+  }
+  return latency;
+}
+
+// what board one sent its host since the last usb_clear_reports, x counted
+// on from first_x
+static void take_output(int32_t first_x, std::vector<timed_keys> *keys_out, std::vector<timed_x> *mouse_out)
+{
+  keys_out->clear();
+  mouse_out->clear();
+  int32_t x = first_x;
+  for (const host_usb_report &r : boards[1]->usb_reports())
+  {
+    if (r.data.size() == 1 + sizeof(key_state) && r.data[0] == REPORT_ID_NKRO)
+    {
+      timed_keys k = { sim_time(1, r.time_us) };
+      memcpy(&k.state, r.data.data() + 1, sizeof(key_state));
+      if (keys_out->empty() || memcmp(&keys_out->back().state, &k.state, sizeof(key_state)) != 0)
+      {
+        keys_out->push_back(k);
+      }
+    }
+    else if (r.data.size() >= 3 && r.data[0] == REPORT_ID_MOUSE)
+    {
+      x += (int8_t) r.data[2];
+      mouse_out->push_back(timed_x { sim_time(1, r.time_us), x });
+    }
+  }
+}
+
+// Replays t and prints how long its input took to come out of board one.
+// With a slow consumer the boards run on until it has caught up. Its usb
+// then takes a report now and then, so keys and motion drop there, but
+// nothing may go missing on the uart: returns false for an overrun, a full
+// ring without RTS/CTS or a bad frame, or if the last keys never arrived.
+static bool replay(const char *name, const trace &t)
+{
+  boards[1]->usb_clear_reports();
+  uint32_t overruns[2] = { boards[0]->uart_overruns(), boards[1]->uart_overruns() };
+  uint64_t bytes[2] = { uart_bytes[0], uart_bytes[1] };
+  uart_flow_stats flow[2] = { boards[0]->uart_flow(), boards[1]->uart_flow() };
+  uart_link_stats link[2] = { boards[0]->uart_link(), boards[1]->uart_link() };
+  uint64_t start_us = now_us;
+
+  std::vector<timed_keys> keys_in;
+  std::vector<timed_x> mouse_in;
+  size_t next_key = 0;
+  size_t next_mouse = 0;
+  size_t i = 0;
+  while (i < t.events.size())
+  {
+    now_us += step_us;
+    boards[0]->advance_to(board_time(0, now_us));
+    for (; i < t.events.size() && t.events[i].time_us <= now_us; ++i)
+    {
+      const trace_event &e = t.events[i];
+      boards[0]->device_report(e.dev_addr, 0, e.report.data(), (uint16_t) e.report.size());
+      // a repeated report is no change to time, and neither is one board
+      // one sends again
+      if (e.dev_addr == KEYBOARD_ADDR)
+      {
+        const key_state &state = t.keys[next_key++];
+        if (keys_in.empty() || memcmp(&keys_in.back().state, &state, sizeof(state)) != 0)
+        {
+          keys_in.push_back(timed_keys { now_us, state });
+        }
+      }
+      else
+      {
+        mouse_in.push_back(timed_x { now_us, t.mouse_x[next_mouse++] });
+      }
+    }
+    run_boards();
+  }
+  uint64_t length_us = now_us - start_us;
+  run_for(SETTLE_US);
+
+  std::vector<timed_keys> keys_out;
+  std::vector<timed_x> mouse_out;
+  int32_t first_x = t.mouse_x.empty() ? 0 : t.mouse_x.front() - 1;
+  take_output(first_x, &keys_out, &mouse_out);
+  uint64_t drain_end_us = now_us + DRAIN_MAX_US;
+  bool arrived = false;
+  while (true)
+  {
+    arrived = keys_in.empty() ||
+      (!keys_out.empty() && memcmp(&keys_out.back().state, &keys_in.back().state, sizeof(key_state)) == 0);
+    size_t mouse_reports = mouse_out.size();
+    if ((arrived && consumer_us == 0) || now_us >= drain_end_us)
+    {
+      break;
+    }
+    run_for(std::max(consumer_us, SETTLE_US));
+    take_output(first_x, &keys_out, &mouse_out);
+    if (arrived && mouse_out.size() == mouse_reports)
+    {
+      break;
+    }
+  }
+
+  printf("%s, %.1f s\n", name, length_us / 1e6);
+  if (!keys_in.empty())
+  {
+    print_latency("keyboard", match_keys(keys_in, keys_out), keys_in.size());
+  }
+  if (!mouse_in.empty())
+  {
+    print_latency("mouse", match_mouse(mouse_in, mouse_out), mouse_in.size());
+  }
+  if (!arrived)
+  {
+    printf("  the last keys never arrived\n");
+  }
+  printf("  uart     %llu bytes to board one, %llu back, overruns %u / %u\n",
+    (unsigned long long) (uart_bytes[0] - bytes[0]), (unsigned long long) (uart_bytes[1] - bytes[1]),
+    boards[0]->uart_overruns() - overruns[0], boards[1]->uart_overruns() - overruns[1]);
+  uart_flow_stats after[2] = { boards[0]->uart_flow(), boards[1]->uart_flow() };
+  printf("  flow     waited %u / %u timeouts %u / %u merged %u / %u ring full %u / %u\n",
+    after[0].waited - flow[0].waited, after[1].waited - flow[1].waited, after[0].timeouts - flow[0].timeouts,
+    after[1].timeouts - flow[1].timeouts, after[0].merged - flow[0].merged, after[1].merged - flow[1].merged,
+    after[0].rx_full - flow[0].rx_full, after[1].rx_full - flow[1].rx_full);
+  uart_link_stats link_after[2] = { boards[0]->uart_link(), boards[1]->uart_link() };
+  uint32_t lost = 0;
+  for (int i = 0; i < 2; ++i)
+  {
+    lost += boards[i]->uart_overruns() - overruns[i] + link_after[i].bad_frames - link[i].bad_frames;
+    if (!UART_RTS_CTS_ENABLED)
+    {
+      lost += after[i].rx_full - flow[i].rx_full;
+    }
+  }
+  return arrived && lost == 0;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: kbswitch_link_bench [-s seconds] [-b baud] [-t step_us] [-r seed] [-k skew_us] "
+    "[-d drift_ppm] [-c consumer_us]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = 10;
+  uint32_t baud = 0;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:b:t:r:k:d:c:")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': seconds = atof(optarg); break;
+      case 'b': baud = (uint32_t) atol(optarg); break;
+      case 't': step_us = (uint64_t) atol(optarg); break;
+      case 'r': seed = (unsigned) atol(optarg); break;
+      case 'k': skew_us = atoll(optarg); break;
+      case 'd': drift_ppm = atof(optarg); break;
+      case 'c': consumer_us = (uint64_t) atol(optarg); break;
+      default: usage();
+    }
+  }
+  if (seconds <= 0 || step_us == 0)
+  {
+    usage();
+  }
+
+  boards[0] = load_board(BOARD0_MODULE);
+  boards[1] = load_board(BOARD1_MODULE);
+  for (int i = 0; i < 2; ++i)
+  {
+    boards[i]->board_init(i);
+    if (baud != 0)
+    {
+      boards[i]->init_uart(baud);
+    }
+    boards[i]->usb_mount();
+  }
+  boards[0]->device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  boards[0]->device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  now_us = std::max(sim_time(0, boards[0]->now_us()), sim_time(1, boards[1]->now_us()));
+  run_for(SETTLE_US);
+  boards[0]->toggle_output();
+  run_for(SETTLE_US);
+
+  uint64_t length_us = (uint64_t) (seconds * 1e6);
+  std::mt19937 rng(seed);
+  trace typing;
+  add_typing(&typing, now_us, length_us, &rng);
+  bool ok = replay("typing", typing);
+
+  trace mouse;
+  add_mouse(&mouse, now_us, length_us, 0);
+  ok &= replay("mouse 1000 Hz", mouse);
+
+  trace both;
+  add_typing(&both, now_us, length_us, &rng);
+  add_mouse(&both, now_us, length_us, mouse.mouse_x.back());
+  std::stable_sort(both.events.begin(), both.events.end(), [](const trace_event &a, const trace_event &b)
+    {
+      return a.time_us < b.time_us;
+    });
+  ok &= replay("typing and mouse", both);
+
+  trace repeats;
+  add_typing(&repeats, now_us, length_us, &rng);
+  add_repeats(&repeats, 8000);
+  ok &= replay("typing repeated every 8 ms", repeats);
+  if (!ok)
+  {
+    printf("input was lost\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,378 @@
+// Resets the boards at random points while both are in use, built with
+// -DHOST_BUILD=ON.
+//
+// usage: kbswitch_reset_fuzz [-n rounds] [-r seed] [-v]
+//
+// Loads two boards as kbswitch_link_bench does, each with a boot keyboard
+// and mouse attached. Each round types, clicks, switches the output and sets
+// the LEDs on either host at random, and somewhere in the middle resets one
+// board, or now and then both: by the watchdog, which keeps the scratch
+// registers, or from cold. A reset board keeps its flash and is loaded
+// afresh so the firmware's globals start again, and whatever was on the
+// uart to it is lost. Keys held on its keyboard may be let go while it is
+// down, the rest are reported again once it is back.
+//
+// When the input stops both boards must come back into step within
+// RECOVERY_US: the same output mask, each knowing the other's flags and
+// LEDs, and no key or button left down on either host.
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "key_state.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+static const uint64_t STEP_US = 20;
+static const uint64_t SETTLE_US = 200000;
+static const uint64_t RECOVERY_US = 1000000;
+static const uint64_t CHECK_US = 1000;
+
+static const char *const module_paths[2] = { BOARD0_MODULE, BOARD1_MODULE };
+
+// one board as loaded, its input devices as the user holds them and what
+// its host last saw
+struct board
+{
+  void *module;
+  const host_board_api *api;
+  std::vector<uint8_t> keys;
+  uint8_t buttons;
+  uint8_t leds;
+  bool host_key_down;
+  bool host_button_down;
+};
+
+static board boards[2];
+static uint64_t now_us;
+static bool verbose;
+static std::mt19937 rng;
+
+static uint32_t rnd(uint32_t n)
+{
+  return rng() % n;
+}
+
+static void load(int i)
+{
+  board &b = boards[i];
+  b.module = dlopen(module_paths[i], RTLD_NOW | RTLD_LOCAL);
+  if (b.module == nullptr)
+  {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(2);
+  }
+  typedef const host_board_api *(*get_api_fn)();
+  get_api_fn get_api = (get_api_fn) dlsym(b.module, "host_board_get_api");
+  if (get_api == nullptr)
+  {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(2);
+  }
+  b.api = get_api();
+  b.api->set_verbose(verbose);
+  b.host_key_down = false;
+  b.host_button_down = false;
+}
+
+static void send_keys(int i)
+{
+  hid_keyboard_report_t report = {};
+  for (size_t k = 0; k < boards[i].keys.size(); ++k)
+  {
+    report.keycode[k] = boards[i].keys[k];
+  }
+  boards[i].api->device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &report, sizeof(report));
+}
+
+static void send_buttons(int i)
+{
+  hid_mouse_report_t report = { boards[i].buttons, 0, 0, 0, 0 };
+  boards[i].api->device_report(MOUSE_ADDR, 0, (const uint8_t *) &report, sizeof(report));
+}
+
+static void send_leds(int i)
+{
+  boards[i].api->usb_set_report(HID_INSTANCE_KEYBOARD, 0, HID_REPORT_TYPE_OUTPUT, &boards[i].leds, 1);
+}
+
+// the host enumerates the board again and sets its LEDs, the keyboard and
+// mouse report what is still held
+static void attach(int i)
+{
+  board &b = boards[i];
+  b.api->usb_mount();
+  b.api->device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  b.api->device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  send_leds(i);
+  if (!b.keys.empty())
+  {
+    send_keys(i);
+  }
+  if (b.buttons != 0)
+  {
+    send_buttons(i);
+  }
+}
+
+// keeps the last keyboard and mouse state each host saw
+static void take_reports(int i)
+{
+  board &b = boards[i];
+  for (const host_usb_report &r : b.api->usb_reports())
+  {
+    if (r.data.empty())
+    {
+      continue;
+    }
+    if (r.data[0] == REPORT_ID_NKRO || r.data[0] == REPORT_ID_KEYBOARD)
+    {
+      b.host_key_down = std::any_of(r.data.begin() + 1, r.data.end(), [](uint8_t v) { return v != 0; });
+    }
+    else if (r.data[0] == REPORT_ID_MOUSE && r.data.size() >= 2)
+    {
+      b.host_button_down = r.data[1] != 0;
+    }
+  }
+  b.api->usb_clear_reports();
+}
+
+static void step()
+{
+  now_us += STEP_US;
+  for (int i = 0; i < 2; ++i)
+  {
+    boards[i].api->uart_set_cts(boards[1 - i].api->uart_rts());
+    boards[i].api->advance_to(now_us);
+    boards[i].api->run(1000);
+    boards[1 - i].api->uart_deliver(boards[i].api->uart_take_sent_timed());
+    take_reports(i);
+  }
+}
+
+static void run_for(uint64_t us)
+{
+  uint64_t end = now_us + us;
+  while (now_us < end)
+  {
+    step();
+  }
+}
+
+static void reset(int i, bool watchdog)
+{
+  board &b = boards[i];
+  host_board_state saved = b.api->board_save();
+  dlclose(b.module);
+  load(i);
+  b.api->advance_to(now_us);
+  b.api->board_reboot(i, saved, watchdog);
+  // the user may let go while the board is down
+  if (rnd(2) != 0)
+  {
+    b.keys.clear();
+  }
+  if (rnd(2) != 0)
+  {
+    b.buttons = 0;
+  }
+  attach(i);
+}
+
+static void random_input()
+{
+  int i = rnd(2);
+  board &b = boards[i];
+  switch (rnd(8))
+  {
+    case 0:
+    case 1:
+    case 2:
+      if (!b.keys.empty() && (b.keys.size() == 6 || rnd(2) != 0))
+      {
+        b.keys.erase(b.keys.begin() + rnd(b.keys.size()));
+      }
+      else
+      {
+        uint8_t key = HID_KEY_A + rnd(26);
+        if (std::find(b.keys.begin(), b.keys.end(), key) == b.keys.end())
+        {
+          b.keys.push_back(key);
+        }
+      }
+      send_keys(i);
+      break;
+    case 3:
+    case 4:
+      b.buttons ^= 1 << rnd(3);
+      send_buttons(i);
+      break;
+    case 5:
+    case 6:
+      b.api->toggle_output();
+      break;
+    default:
+      b.leds = rnd(8);
+      send_leds(i);
+      break;
+  }
+}
+
+// empty if the boards are back in step
+static const char *check()
+{
+  uint8_t mask = boards[0].api->output_mask();
+  if (mask != boards[1].api->output_mask())
+  {
+    return "output masks differ";
+  }
+  if (mask != 1 && mask != 2)
+  {
+    return "bad output mask";
+  }
+  for (int i = 0; i < 2; ++i)
+  {
+    const host_board_api *self = boards[i].api;
+    const host_board_api *other = boards[1 - i].api;
+    if (self->peer_flags() != other->local_flags())
+    {
+      return "peer flags differ";
+    }
+    if (self->host_leds() != boards[i].leds || self->peer_leds() != other->host_leds())
+    {
+      return "leds differ";
+    }
+    if (boards[i].host_key_down)
+    {
+      return "key stuck down";
+    }
+    if (boards[i].host_button_down)
+    {
+      return "button stuck down";
+    }
+  }
+  return "";
+}
+
+static void release_all()
+{
+  for (int i = 0; i < 2; ++i)
+  {
+    if (!boards[i].keys.empty())
+    {
+      boards[i].keys.clear();
+      send_keys(i);
+    }
+    if (boards[i].buttons != 0)
+    {
+      boards[i].buttons = 0;
+      send_buttons(i);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  long rounds = 500;
+  unsigned seed = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': rounds = atol(optarg); break;
+      case 'r': seed = (unsigned) atol(optarg); break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, "usage: kbswitch_reset_fuzz [-n rounds] [-r seed] [-v]\n");
+        return 2;
+    }
+  }
+  rng.seed(seed);
+
+  for (int i = 0; i < 2; ++i)
+  {
+    load(i);
+    boards[i].api->board_init(i);
+    attach(i);
+  }
+  now_us = std::max(boards[0].api->now_us(), boards[1].api->now_us());
+  run_for(SETTLE_US);
+
+  long resets[2] = {};
+  uint64_t total_recovery_us = 0;
+  uint64_t max_recovery_us = 0;
+  for (long round = 0; round < rounds; ++round)
+  {
+    // input every 0 to 20 ms for up to half a second, the reset at any
+    // point in it
+    uint64_t length_us = 1000 + rnd(500000);
+    uint64_t reset_us = now_us + rnd(length_us);
+    uint64_t end_us = now_us + length_us;
+    bool both = rnd(8) == 0;
+    bool watchdog = !both && rnd(2) != 0;
+    int which = rnd(2);
+    bool done = false;
+    uint64_t next_input_us = now_us;
+    while (now_us < end_us || !done)
+    {
+      if (!done && now_us >= reset_us)
+      {
+        for (int i = 0; i < 2; ++i)
+        {
+          if (both || i == which)
+          {
+            reset(i, watchdog);
+          }
+        }
+        resets[watchdog]++;
+        done = true;
+      }
+      if (now_us >= next_input_us)
+      {
+        random_input();
+        next_input_us = now_us + rnd(20000);
+      }
+      step();
+    }
+    release_all();
+
+    uint64_t quiet_us = now_us;
+    const char *failure = check();
+    while (*failure != 0 && now_us - quiet_us < RECOVERY_US)
+    {
+      run_for(CHECK_US);
+      failure = check();
+    }
+    if (*failure != 0)
+    {
+      fprintf(stderr, "round %ld seed %u: %s after %s reset of board %s\n", round, seed, failure,
+        watchdog ? "a watchdog" : "a cold", both ? "0 and 1" : which == 0 ? "0" : "1");
+      for (int i = 0; i < 2; ++i)
+      {
+        const host_board_api *b = boards[i].api;
+        fprintf(stderr, "  board %d: mask %u local %x peer %x leds %x peer leds %x key %d button %d\n", i,
+          b->output_mask(), b->local_flags(), b->peer_flags(), b->host_leds(), b->peer_leds(),
+          boards[i].host_key_down, boards[i].host_button_down);
+      }
+      return 1;
+    }
+    uint64_t recovery_us = now_us - quiet_us;
+    total_recovery_us += recovery_us;
+    max_recovery_us = std::max(max_recovery_us, recovery_us);
+  }
+  fprintf(stdout, "%ld rounds ok: %ld watchdog resets, %ld cold, back in step after mean %llu us max %llu us\n",
+    rounds, resets[1], resets[0], (unsigned long long) (rounds != 0 ? total_recovery_us / rounds : 0),
+    (unsigned long long) max_recovery_us);
+  return 0;
+}
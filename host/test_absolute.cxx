@@ -0,0 +1,260 @@
+// Unit tests for the absolute pointer, see edge_switch.h: the virtual cursor
+// scaled to 0 to EDGE_SWITCH_ABSOLUTE_MAX in fixed point, the cursor entering
+// at the point the other board sent, and with ABSOLUTE_POINTER the report
+// that carries it to the computer for each mouse report.
+
+#include <string.h>
+
+#include <vector>
+
+#include "common.h"
+#include "edge_switch.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t MOUSE_ADDR = 2;
+static const screen_geometry right_peer = { 1920, 1080, EDGE_RIGHT };
+
+// motion in steps of at most a report's worth
+static void move(int dx, int dy)
+{
+  while (dx != 0 || dy != 0)
+  {
+    int sx = dx > 127 ? 127 : dx < -127 ? -127 : dx;
+    int sy = dy > 127 ? 127 : dy < -127 ? -127 : dy;
+    edge_switch_motion(sx, sy);
+    dx -= sx;
+    dy -= sy;
+  }
+}
+
+static void move_to(int x, int y)
+{
+  move(-40000, -40000);
+  move(x, y);
+}
+
+// the rounded exact scaling
+static int expected_absolute(int pos, int len)
+{
+  return len > 1 ? (pos * EDGE_SWITCH_ABSOLUTE_MAX + (len - 1) / 2) / (len - 1) : 0;
+}
+
+// Every pixel of each screen lands within one unit of the exact position,
+// the corners on 0 and EDGE_SWITCH_ABSOLUTE_MAX, and a step right never
+// moves the cursor left.
+static void scale_every_pixel()
+{
+  static const screen_geometry screens[] = {
+    { 1920, 1080, EDGE_RIGHT },
+    { 2560, 1440, EDGE_LEFT },
+    { 1366, 768, EDGE_TOP },
+    { 7680, 4320, EDGE_BOTTOM },
+    { 3, 1, EDGE_RIGHT },
+  };
+  for (const screen_geometry &screen : screens)
+  {
+    edge_switch_configure(true, &screen);
+    move_to(0, 0);
+    uint16_t x, y;
+    edge_switch_absolute(&x, &y);
+    CHECK(x == 0 && y == 0);
+    int last_x = 0;
+    for (int pos = 0; pos < screen.width; ++pos)
+    {
+      move_to(pos, screen.height - 1);
+      edge_switch_absolute(&x, &y);
+      int error = x - expected_absolute(pos, screen.width);
+      if (!CHECK(error >= -1 && error <= 1 && x >= last_x))
+      {
+        fprintf(stderr, "%dx%d at %d: %d\n", screen.width, screen.height, pos, x);
+        break;
+      }
+      last_x = x;
+      CHECK_EQ(y, screen.height > 1 ? EDGE_SWITCH_ABSOLUTE_MAX : 0);
+    }
+    CHECK_EQ(last_x, screen.width > 1 ? EDGE_SWITCH_ABSOLUTE_MAX : 0);
+  }
+  edge_switch_configure(false, &right_peer);
+}
+
+// leaving one screen and entering a taller one puts the cursor at the same
+// fraction of the way down in absolute units
+static void entry_position()
+{
+  edge_switch_configure(true, &right_peer);
+  move_to(1919, 810);
+  uint16_t left_x, left_y;
+  edge_switch_absolute(&left_x, &left_y);
+  uint16_t position = edge_switch_exit_position();
+
+  screen_geometry left_peer = { 2560, 1600, EDGE_LEFT };
+  edge_switch_configure(true, &left_peer);
+  edge_switch_set_entry_position(position);
+  edge_switch_enter();
+  uint16_t x, y;
+  edge_switch_absolute(&x, &y);
+  CHECK_EQ(x, expected_absolute(4, 2560));
+  int error = y - left_y;
+  CHECK(error >= -EDGE_SWITCH_ABSOLUTE_MAX / 1599 && error <= EDGE_SWITCH_ABSOLUTE_MAX / 1599);
+  edge_switch_configure(false, &right_peer);
+}
+
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+// the board gets output from the other one, whose cursor left at position
+static void board_setup(uint16_t position)
+{
+  host_board_init(0);
+  edge_switch_configure(true, &right_peer);
+  host_usb_mount();
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  if (should_output())
+  {
+    toggle_output();
+    host_run();
+  }
+  host_uart_take_sent();
+  send_uart_cursor_entry(position);
+  std::vector<uint8_t> frame = host_uart_take_sent();
+  host_uart_receive(frame.data(), (int) frame.size());
+  host_run();
+  toggle_output();
+  for (int i = 0; i < 4; ++i)
+  {
+    next_frame();
+  }
+  // on a frame boundary whatever ran before
+  host_advance_us(1000 - host_now_us() % 1000);
+  host_run();
+  host_uart_take_sent();
+  host_usb_clear_reports();
+}
+
+// the cursor enters over the peer edge at the point the other board sent
+static void entry_over_the_link()
+{
+  board_setup(0x4000);
+  CHECK(should_output());
+  int x, y;
+  edge_switch_position(&x, &y);
+  CHECK_EQ(x, 1919 - 4);
+  CHECK_EQ(y, (0x4000 * 1079 + 0x8000) >> 16);
+  edge_switch_configure(false, &right_peer);
+}
+
+// the length of an instance's report descriptor as the host reads it, from
+// its HID descriptor in the configuration
+static uint16_t report_desc_len(uint8_t instance)
+{
+  const uint8_t *desc = tud_descriptor_configuration_cb(0);
+  uint16_t total = (uint16_t) (desc[2] | desc[3] << 8);
+  int hid = -1;
+  for (uint16_t pos = 0; pos + 1 < total && desc[pos] != 0; pos += desc[pos])
+  {
+    const uint8_t *d = desc + pos;
+    if (d[1] == TUSB_DESC_INTERFACE && d[5] == TUSB_CLASS_HID)
+    {
+      hid++;
+    }
+    else if (d[1] == HID_DESC_TYPE_HID && hid == instance)
+    {
+      return (uint16_t) (d[7] | d[8] << 8);
+    }
+  }
+  return 0;
+}
+
+struct TU_ATTR_PACKED absolute_report
+{
+  uint8_t report_id;
+  uint8_t buttons;
+  uint16_t x;
+  uint16_t y;
+  int8_t wheel;
+  int8_t pan;
+};
+
+// Each mouse report at 1000 Hz goes to the computer as one report with the
+// model's position, the motion clamped at the screen edges, and the
+// descriptor declares it. Without ABSOLUTE_POINTER the mouse stays relative.
+static void reports_follow_the_model()
+{
+  board_setup(0x8000);
+  static const int REPORTS = 50;
+  for (int i = 0; i < REPORTS; ++i)
+  {
+    host_advance_us(500);
+    hid_mouse_report_t r = { (uint8_t) (i < 10 ? MOUSE_BUTTON_LEFT : 0), -100, 30, 0, 0 };
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+    host_run();
+    host_advance_us(500);
+    host_run();
+  }
+  std::vector<host_usb_report> mouse;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    uint8_t id = r.data[0];
+    if (r.instance == HID_INSTANCE_MOUSE && (id == REPORT_ID_MOUSE || id == REPORT_ID_ABSOLUTE_POINTER))
+    {
+      mouse.push_back(r);
+    }
+  }
+  CHECK_EQ(mouse.size(), REPORTS);
+
+  const uint8_t *desc = tud_hid_descriptor_report_cb(HID_INSTANCE_MOUSE);
+  uint16_t len = report_desc_len(HID_INSTANCE_MOUSE);
+  CHECK(len != 0);
+  const uint8_t report_id_item[] = { HID_REPORT_ID(REPORT_ID_ABSOLUTE_POINTER) };
+  bool declared = false;
+  for (uint16_t i = 0; i + sizeof(report_id_item) <= len; ++i)
+  {
+    declared |= memcmp(desc + i, report_id_item, sizeof(report_id_item)) == 0;
+  }
+  CHECK_EQ(declared, (bool) ABSOLUTE_POINTER);
+
+#if ABSOLUTE_POINTER
+  int x = 1919 - 4;
+  int y = (0x8000 * 1079 + 0x8000) >> 16;
+  for (int i = 0; i < (int) mouse.size(); ++i)
+  {
+    absolute_report r;
+    if (!CHECK_EQ(mouse[i].data.size(), sizeof(r)))
+    {
+      break;
+    }
+    memcpy(&r, mouse[i].data.data(), sizeof(r));
+    x = x - 100 < 0 ? 0 : x - 100;
+    y = y + 30 > 1079 ? 1079 : y + 30;
+    CHECK_EQ(r.report_id, REPORT_ID_ABSOLUTE_POINTER);
+    CHECK_EQ(r.buttons, i < 10 ? MOUSE_BUTTON_LEFT : 0);
+    CHECK(r.x >= expected_absolute(x, 1920) - 1 && r.x <= expected_absolute(x, 1920) + 1);
+    CHECK(r.y >= expected_absolute(y, 1080) - 1 && r.y <= expected_absolute(y, 1080) + 1);
+  }
+#else
+  for (const host_usb_report &r : mouse)
+  {
+    CHECK_EQ(r.data[0], REPORT_ID_MOUSE);
+  }
+#endif
+  edge_switch_configure(false, &right_peer);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "scale_every_pixel", scale_every_pixel },
+    { "entry_position", entry_position },
+    { "entry_over_the_link", entry_over_the_link },
+    { "reports_follow_the_model", reports_follow_the_model },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,110 @@
+// Unit tests for startup: core1 takes reports from the keyboard and mouse
+// while core0 is still setting up and forwards them once core0_ready is set.
+
+#include <string.h>
+
+#include <vector>
+
+#include "common.h"
+#include "key_state.h"
+#include "peer_state.h"
+#include "report_cache.h"
+#include "report_queue.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+
+// a board whose core0 hasn't reached core0_ready, with the computer there
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+    host_run();
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    host_advance_us(1000);
+    host_run();
+  }
+  host_uart_take_sent();
+  host_usb_clear_reports();
+  core0_ready = false;
+}
+
+static void press(uint8_t keycode)
+{
+  hid_keyboard_report_t r = { 0, 0, { keycode } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+  core1_poll();
+}
+
+static void move(uint8_t buttons)
+{
+  hid_mouse_report_t r = { buttons, 3, -2, 0, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+  core1_poll();
+}
+
+// The devices mount and report before core0 is ready. Nothing is forwarded
+// until it is, then the last state of each goes out and the queue never
+// overflowed on the way.
+static void held_until_ready()
+{
+  setup();
+  report_queue_reset_stats();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  for (int i = 0; i < 40; ++i)
+  {
+    press(i % 2 == 0 ? HID_KEY_A + i / 2 : 0);
+    move(i == 39 ? MOUSE_BUTTON_LEFT : 0);
+    host_advance_us(1000);
+  }
+  press(HID_KEY_Z);
+  CHECK(host_usb_reports().empty());
+  CHECK(host_uart_take_sent().empty());
+  CHECK_EQ(report_queue_get_stats().overflows, 0);
+  CHECK((peer_state_local_flags() & PEER_KEYBOARD_ATTACHED) != 0);
+
+  core0_ready = true;
+  for (int i = 0; i < 4; ++i)
+  {
+    host_run();
+    host_advance_us(1000);
+  }
+  key_state keys = {};
+  int mouse_buttons = -1;
+  int keyboard_reports = 0;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    if (r.data.size() == 1 + sizeof(key_state) && r.data[0] == REPORT_ID_NKRO)
+    {
+      memcpy(&keys, r.data.data() + 1, sizeof(keys));
+      keyboard_reports++;
+    }
+    else if (r.data.size() >= 2 && r.data[0] == report_cache_mouse_report_id())
+    {
+      mouse_buttons = r.data[1];
+    }
+  }
+  CHECK_EQ(keyboard_reports, 1);
+  CHECK(key_state_pressed(&keys, HID_KEY_Z));
+  CHECK(!key_state_pressed(&keys, HID_KEY_A));
+  CHECK_EQ(mouse_buttons, MOUSE_BUTTON_LEFT);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "held_until_ready", held_until_ready },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,244 @@
+// Unit tests for the binary protocol on the cdc port, see cdc_protocol.h,
+// run against the fake cdc pipe: requests and their errors, settings, input
+// streaming, and a computer that stops reading.
+
+#include <vector>
+
+#include "cdc_protocol.h"
+#include "common.h"
+#include "framing.h"
+#include "settings.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MASK_TO_PEER = 2; // SEND_TO_UART in main_host.cxx
+
+typedef std::vector<uint8_t> bytes;
+
+static void setup()
+{
+  host_board_init(0);
+  host_cdc_set_reading(true);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_run();
+  host_cdc_take_sent();
+  host_uart_take_sent();
+}
+
+static void send(const bytes &payload)
+{
+  frame_encoder<frame_encoded_size(CDC_MAX_PAYLOAD)> f;
+  f.put_sentinel();
+  for (uint8_t b : payload)
+  {
+    f.put(b);
+  }
+  f.set_crc();
+  f.put_sentinel();
+  host_cdc_receive(f.data(), f.size());
+  host_run();
+}
+
+// the payloads of the frames sent, text in between is skipped
+static std::vector<bytes> frames(const bytes &sent)
+{
+  std::vector<bytes> found;
+  frame_decoder<CDC_MAX_PAYLOAD + 1> decoder;
+  for (uint8_t b : sent)
+  {
+    if (decoder.feed(b) == FRAME_COMPLETE)
+    {
+      found.push_back(bytes(decoder.data(), decoder.data() + decoder.size()));
+    }
+  }
+  return found;
+}
+
+// sends a request and returns the payload of its response, empty if none
+static bytes request(const bytes &payload)
+{
+  send(payload);
+  for (const bytes &f : frames(host_cdc_take_sent()))
+  {
+    if (f.size() >= 3 && f[0] == (payload[0] | CDC_RESPONSE) && f[1] == payload[1])
+    {
+      return f;
+    }
+  }
+  return bytes();
+}
+
+static uint32_t counter(uint8_t group, uint8_t index, int n)
+{
+  bytes r = request({ CDC_GET_COUNTERS, 9, group, index });
+  if (r.size() < (size_t) 3 + 4 * (n + 1) || r[2] != CDC_OK)
+  {
+    return UINT32_MAX;
+  }
+  return get_u32(r.data() + 3 + 4 * n);
+}
+
+static void ping()
+{
+  setup();
+  bytes r = request({ CDC_PING, 42 });
+  bytes expected = { CDC_PING | CDC_RESPONSE, 42, CDC_OK, CDC_PROTOCOL_VERSION, 0 };
+  CHECK(r == expected);
+}
+
+static void output_mask()
+{
+  setup();
+  bytes r = request({ CDC_SET_OUTPUT_MASK, 1, MASK_TO_PEER });
+  CHECK(r.size() == 3 && r[2] == CDC_OK);
+  host_run();
+  r = request({ CDC_GET_OUTPUT_MASK, 2 });
+  CHECK(r.size() == 4 && r[2] == CDC_OK && r[3] == MASK_TO_PEER);
+
+  r = request({ CDC_SET_OUTPUT_MASK, 3 });
+  CHECK(r.size() == 3 && r[2] == CDC_BAD_VALUE);
+}
+
+// every request gets a response with its sequence, wrong ones a status
+// saying what was wrong, and a corrupt frame none but is counted
+static void bad_requests()
+{
+  setup();
+  bytes r = request({ 0x3f, 7 });
+  CHECK(r.size() == 3 && r[2] == CDC_UNKNOWN_COMMAND);
+  r = request({ CDC_GET_COUNTERS, 8, COUNTERS_CDC });
+  CHECK(r.size() == 3 && r[2] == CDC_BAD_REQUEST);
+  r = request({ CDC_GET_COUNTERS, 9, 0xee, 0 });
+  CHECK(r.size() == 3 && r[2] == CDC_BAD_VALUE);
+  r = request({ CDC_CONFIG_READ, 10, SETTING_COUNT });
+  CHECK(r.size() == 3 && r[2] == CDC_BAD_VALUE);
+
+  uint8_t corrupt[] = { SENTINEL, CDC_PING, 11, 0x55, SENTINEL };
+  host_cdc_receive(corrupt, sizeof(corrupt));
+  host_run();
+  CHECK(frames(host_cdc_take_sent()).empty());
+  CHECK_EQ(counter(COUNTERS_CDC, 0, 1), 1);
+}
+
+static void config_round_trip()
+{
+  setup();
+  bytes r = request({ CDC_CONFIG_WRITE, 1, SETTING_TOGGLE_HOTKEY, HID_KEY_SCROLL_LOCK });
+  CHECK(r.size() == 3 && r[2] == CDC_OK);
+  r = request({ CDC_CONFIG_READ, 2, SETTING_TOGGLE_HOTKEY });
+  bytes expected = { CDC_CONFIG_READ | CDC_RESPONSE, 2, CDC_OK, HID_KEY_SCROLL_LOCK };
+  CHECK(r == expected);
+}
+
+static void press(uint8_t keycode)
+{
+  hid_keyboard_report_t k = { 0, 0, { keycode } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &k, sizeof(k));
+  host_run();
+}
+
+// each local report is an event with its capture time, once streaming is on
+static void stream_input()
+{
+  setup();
+  press(HID_KEY_A);
+  CHECK(frames(host_cdc_take_sent()).empty());
+
+  bytes r = request({ CDC_STREAM_INPUT, 1, 1 });
+  CHECK(r.size() == 3 && r[2] == CDC_OK);
+  uint32_t capture = (uint32_t) host_now_us();
+  press(HID_KEY_Z);
+  std::vector<bytes> events = frames(host_cdc_take_sent());
+  CHECK_EQ(events.size(), 1);
+  if (events.size() == 1)
+  {
+    const bytes &e = events[0];
+    CHECK_EQ(e[0], CDC_EVENT_INPUT);
+    CHECK(get_u32(e.data() + 2) >= capture && get_u32(e.data() + 2) < capture + 1000);
+    CHECK_EQ(get_u16(e.data() + 6), 0);
+    CHECK_EQ(e[8], INPUT_LOCAL);
+    CHECK_EQ(e[9], INPUT_KEYBOARD);
+    CHECK(e[10] > HID_KEY_Z / 8 + 1 && e.size() == 11u + e[10]);
+    // after the modifier byte, a bit per usage
+    CHECK((e[11 + 1 + HID_KEY_Z / 8] & (1 << (HID_KEY_Z % 8))) != 0);
+  }
+
+  request({ CDC_STREAM_INPUT, 2, 0 });
+  press(0);
+  CHECK(frames(host_cdc_take_sent()).empty());
+}
+
+// With the computer not reading, only whole frames go in the fifo and input
+// still reaches the computer's keyboard. Once it reads again the next event
+// says how many were dropped, and the request sent meanwhile is answered.
+static void backpressure()
+{
+  setup();
+  if (!should_output())
+  {
+    toggle_output();
+    host_run();
+  }
+  request({ CDC_STREAM_INPUT, 1, 1 });
+  host_cdc_set_reading(false);
+  host_usb_clear_reports();
+  static const int PRESSES = 60;
+  for (int i = 0; i < PRESSES; ++i)
+  {
+    press(i % 2 == 0 ? HID_KEY_A : 0);
+    host_advance_us(1000);
+    host_run();
+  }
+  send({ CDC_PING, 3 });
+  bytes sent = host_cdc_take_sent();
+  CHECK(sent.size() <= CFG_TUD_CDC_TX_BUFSIZE);
+  CHECK(sent.size() > CFG_TUD_CDC_TX_BUFSIZE / 2);
+  CHECK(sent.back() == SENTINEL);
+  size_t keyboard_reports = 0;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    keyboard_reports += r.data[0] == REPORT_ID_NKRO;
+  }
+  CHECK_EQ(keyboard_reports, PRESSES);
+
+  host_cdc_set_reading(true);
+  host_run();
+  press(HID_KEY_A);
+  std::vector<bytes> all = frames(sent);
+  for (const bytes &f : frames(host_cdc_take_sent()))
+  {
+    all.push_back(f);
+  }
+  int responses = 0;
+  uint32_t dropped = 0;
+  int events = 0;
+  for (const bytes &f : all)
+  {
+    responses += f[0] == (CDC_PING | CDC_RESPONSE) && f[1] == 3;
+    if (f[0] == CDC_EVENT_INPUT)
+    {
+      dropped += get_u16(f.data() + 6);
+      events++;
+    }
+  }
+  CHECK_EQ(responses, 1);
+  CHECK(dropped > 0);
+  CHECK_EQ(events + dropped, PRESSES + 1);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "ping", ping },
+    { "output_mask", output_mask },
+    { "bad_requests", bad_requests },
+    { "config_round_trip", config_round_trip },
+    { "stream_input", stream_input },
+    { "backpressure", backpressure },
+  };
+  return host_test_main(cases, argc, argv);
+}
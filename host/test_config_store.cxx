@@ -0,0 +1,242 @@
+// Unit tests for the flash config store, see config_store.h, including
+// power cut at every flash operation of a run that fills, compacts and
+// erases both sectors.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "hardware/flash.h"
+#include "hardware/watchdog.h"
+
+#include "common.h"
+#include "config_store.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+// keys the settings don't use
+static const uint8_t KEY_A = 10;
+static const uint8_t KEY_B = 11;
+static const uint8_t KEY_FILL = 12;
+static const int FILL_KEYS = 4;
+static const uint8_t KEYBOARD_ADDR = 1;
+
+static void setup()
+{
+  host_flash_cut_power_after(-1);
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_run();
+}
+
+// a key going down or up, input the erase has to wait for
+static void type(bool down)
+{
+  hid_keyboard_report_t r = { 0, 0, { (uint8_t) (down ? HID_KEY_A : 0) } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+  host_run();
+}
+
+static void set(uint8_t key, uint32_t value)
+{
+  config_store_set(key, (const uint8_t *) &value, sizeof(value));
+}
+
+static int64_t get(uint8_t key)
+{
+  uint32_t value;
+  if (config_store_get(key, (uint8_t *) &value, sizeof(value)) != sizeof(value))
+  {
+    return -1;
+  }
+  return value;
+}
+
+// long enough for the values to settle and an erase to be followed by the
+// copy into the erased sector
+static void commit()
+{
+  for (int i = 0; i < 3; ++i)
+  {
+    host_advance_us(3000000);
+    config_store_task();
+  }
+}
+
+// the stored values as the next boot finds them
+static void restart()
+{
+  config_store_init();
+}
+
+static void survives_restart()
+{
+  setup();
+  set(KEY_A, 1);
+  set(KEY_B, 2);
+  commit();
+  set(KEY_B, 3);
+  commit();
+  restart();
+  CHECK_EQ(get(KEY_A), 1);
+  CHECK_EQ(get(KEY_B), 3);
+}
+
+// Fills both sectors, the first needing only the blank spare and the second
+// an erase, typing all the while so the erase waits.
+static const uint32_t VALUES = 600;
+
+static void fill_while_typing()
+{
+  setup();
+  set(KEY_A, 1);
+  for (uint32_t v = 1; v <= VALUES; ++v)
+  {
+    type(v % 2 != 0);
+    set(KEY_FILL, v);
+    commit();
+  }
+  type(false);
+  CHECK_EQ(get(KEY_FILL), VALUES);
+  CHECK_EQ(config_store_get_stats().deferred, 1);
+}
+
+// with input going on the erase waits until the computer suspends the board
+static void erase_waits_for_suspend()
+{
+  fill_while_typing();
+  restart();
+  int64_t stored = get(KEY_FILL);
+  CHECK(stored > 0 && stored < VALUES);
+
+  set(KEY_FILL, VALUES + 1);
+  host_usb_suspend(true);
+  commit();
+  host_usb_suspend(false);
+  CHECK(watchdog_hw->ctrl != 0);
+  CHECK_EQ(watchdog_hw->load, WATCHDOG_TIMEOUT_MS);
+  CHECK_EQ(config_store_get_stats().mounted_erases, 0);
+  restart();
+  CHECK_EQ(get(KEY_A), 1);
+  CHECK_EQ(get(KEY_FILL), VALUES + 1);
+}
+
+// A computer that never suspends the board still gets the values stored,
+// the erase going ahead once there has been no input for 30 s. The 'c'
+// status shows the store waiting and the erase done while in use.
+static void erase_when_idle_in_use()
+{
+  fill_while_typing();
+  set(KEY_FILL, VALUES + 1);
+  commit();
+  config_store_stats stats = config_store_get_stats();
+  CHECK_EQ(stats.deferred, 1);
+  host_cdc_set_reading(true);
+  host_cdc_take_sent();
+  host_cdc_receive((const uint8_t *) "c", 1);
+  host_run();
+  std::vector<uint8_t> sent = host_cdc_take_sent();
+  std::string text(sent.begin(), sent.end());
+  CHECK(text.find("waiting to erase") != std::string::npos);
+  CHECK(text.find("stores deferred 1 erases while in use 0") != std::string::npos);
+
+  // 27 s after the last key isn't long enough
+  commit();
+  commit();
+  CHECK_EQ(config_store_get_stats().erases, stats.erases);
+
+  commit();
+  stats = config_store_get_stats();
+  CHECK_EQ(stats.mounted_erases, 1);
+  CHECK_EQ(stats.deferred, 1);
+  CHECK(watchdog_hw->ctrl != 0);
+  host_cdc_receive((const uint8_t *) "c", 1);
+  host_run();
+  sent = host_cdc_take_sent();
+  text.assign(sent.begin(), sent.end());
+  CHECK(text.find("waiting to erase") == std::string::npos);
+  CHECK(text.find("erases while in use 1") != std::string::npos);
+
+  restart();
+  CHECK_EQ(get(KEY_A), 1);
+  CHECK_EQ(get(KEY_FILL), VALUES + 1);
+}
+
+// Runs until the power is cut at operation cut, returns the last value all
+// of whose records made it, or -1 if the run finished first.
+static int64_t fill_until_cut(int cut)
+{
+  setup();
+  host_usb_suspend(true);
+  set(KEY_A, 1);
+  set(KEY_B, 7);
+  commit();
+  host_flash_cut_power_after(cut);
+  static const uint32_t VALUES = 150;
+  int64_t durable = 0;
+  for (uint32_t v = 1; v <= VALUES; ++v)
+  {
+    for (int k = 0; k < FILL_KEYS; ++k)
+    {
+      set(KEY_FILL + k, v);
+    }
+    commit();
+    if (host_flash_power_was_cut())
+    {
+      return durable;
+    }
+    durable = v;
+  }
+  return -1;
+}
+
+// After a cut anywhere, each key has its last value or the one being written
+// when the power went, and the store carries on from there.
+static void power_loss()
+{
+  int cuts = 0;
+  for (int cut = 0;; ++cut)
+  {
+    int64_t durable = fill_until_cut(cut);
+    if (durable < 0)
+    {
+      break;
+    }
+    cuts++;
+    host_flash_cut_power_after(-1);
+    restart();
+    bool ok = CHECK_EQ(get(KEY_A), 1) && CHECK_EQ(get(KEY_B), 7);
+    for (int k = 0; k < FILL_KEYS; ++k)
+    {
+      int64_t v = get(KEY_FILL + k);
+      ok &= CHECK(v == durable || v == durable + 1 || (durable == 0 && v == -1));
+    }
+
+    set(KEY_B, 8);
+    commit();
+    restart();
+    ok &= CHECK_EQ(get(KEY_B), 8);
+    if (!ok)
+    {
+      fprintf(stderr, "power cut after %d flash operations\n", cut);
+      return;
+    }
+  }
+  // the run needs two compactions and an erase
+  CHECK(cuts > 2 * FLASH_SECTOR_SIZE / 16 / FILL_KEYS);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "survives_restart", survives_restart },
+    { "erase_waits_for_suspend", erase_waits_for_suspend },
+    { "erase_when_idle_in_use", erase_when_idle_in_use },
+    { "power_loss", power_loss },
+  };
+  return host_test_main(cases, argc, argv);
+}
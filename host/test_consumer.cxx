@@ -0,0 +1,197 @@
+// Unit tests for media keys: consumer control reports parsed with
+// hid_parser.h in their array and bit field forms, and forwarded to the
+// computer and over the link under REPORT_ID_CONSUMER_CONTROL.
+
+#include <vector>
+
+#include "common.h"
+#include "framing.h"
+#include "hid_parser.h"
+#include "link_pacing.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint16_t VOLUME_UP = 0xe9;
+static const uint16_t VOLUME_DOWN = 0xea;
+static const uint16_t MUTE = 0xe2;
+static const uint16_t PLAY_PAUSE = 0xcd;
+
+// one 16 bit usage, 0 to 0x3ff, in report 3
+static const uint8_t consumer_array_desc[] = {
+  0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x03,
+  0x15, 0x00, 0x26, 0xFF, 0x03, 0x19, 0x00, 0x2A, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x01, 0x81, 0x00,
+  0xC0,
+};
+
+// a bit each for four keys and four bits of padding, no report id
+static const uint8_t consumer_bits_desc[] = {
+  0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01,
+  0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x04,
+  0x09, 0xE9, 0x09, 0xEA, 0x09, 0xE2, 0x09, 0xCD, 0x81, 0x02,
+  0x95, 0x04, 0x81, 0x03,
+  0xC0,
+};
+
+// a keyboard with the boot layout in report 1 and media keys in report 2 on
+// the same interface
+static const uint8_t keyboard_and_consumer_desc[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01,
+  0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+  0x95, 0x01, 0x75, 0x08, 0x81, 0x03,
+  0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,
+  0xC0,
+  0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x02,
+  0x15, 0x00, 0x26, 0xFF, 0x03, 0x19, 0x00, 0x2A, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x01, 0x81, 0x00,
+  0xC0,
+};
+
+static void parse_array()
+{
+  hid_consumer_layout layout;
+  CHECK(hid_parse_consumer(consumer_array_desc, sizeof(consumer_array_desc), &layout));
+  CHECK_EQ(layout.report_id, 3);
+  uint16_t usage = 0xffff;
+  uint8_t down[] = { 3, VOLUME_UP, 0 };
+  CHECK(hid_consumer_to_usage(&layout, down, sizeof(down), &usage));
+  CHECK_EQ(usage, VOLUME_UP);
+  uint8_t up[] = { 3, 0, 0 };
+  CHECK(hid_consumer_to_usage(&layout, up, sizeof(up), &usage));
+  CHECK_EQ(usage, 0);
+  uint8_t other[] = { 4, VOLUME_UP, 0 };
+  CHECK(!hid_consumer_to_usage(&layout, other, sizeof(other), &usage));
+}
+
+// the first key down wins when several are
+static void parse_bits()
+{
+  hid_consumer_layout layout;
+  CHECK(hid_parse_consumer(consumer_bits_desc, sizeof(consumer_bits_desc), &layout));
+  CHECK_EQ(layout.report_id, 0);
+  CHECK_EQ(layout.usage_count, 4);
+  uint16_t usage = 0;
+  uint8_t report = 1 << 2;
+  CHECK(hid_consumer_to_usage(&layout, &report, 1, &usage));
+  CHECK_EQ(usage, MUTE);
+  report = (1 << 3) | (1 << 1);
+  hid_consumer_to_usage(&layout, &report, 1, &usage);
+  CHECK_EQ(usage, VOLUME_DOWN);
+  report = 0xf0;
+  hid_consumer_to_usage(&layout, &report, 1, &usage);
+  CHECK_EQ(usage, 0);
+}
+
+// each parser finds its own report on a shared interface, and a keyboard
+// parser takes nothing from a consumer only descriptor
+static void parse_composite()
+{
+  hid_keyboard_layout keyboard;
+  hid_consumer_layout consumer;
+  CHECK(hid_parse_keyboard(keyboard_and_consumer_desc, sizeof(keyboard_and_consumer_desc), &keyboard));
+  CHECK(hid_parse_consumer(keyboard_and_consumer_desc, sizeof(keyboard_and_consumer_desc), &consumer));
+  CHECK_EQ(keyboard.report_id, 1);
+  CHECK_EQ(consumer.report_id, 2);
+  CHECK(!hid_parse_keyboard(consumer_array_desc, sizeof(consumer_array_desc), &keyboard));
+  hid_mouse_layout mouse;
+  CHECK(!hid_parse_mouse(consumer_bits_desc, sizeof(consumer_bits_desc), &mouse));
+}
+
+static const uint8_t KEYBOARD_ADDR = 1;
+
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+static void board_setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, keyboard_and_consumer_desc,
+    sizeof(keyboard_and_consumer_desc));
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    next_frame();
+  }
+  host_uart_take_sent();
+  host_usb_clear_reports();
+}
+
+// usages of the consumer reports the computer got, in order
+static std::vector<uint16_t> consumer_reports()
+{
+  std::vector<uint16_t> usages;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    if (r.data.size() == 3 && r.data[0] == REPORT_ID_CONSUMER_CONTROL)
+    {
+      usages.push_back((uint16_t) (r.data[1] | r.data[2] << 8));
+    }
+  }
+  return usages;
+}
+
+// A media key and a key on the same interface both reach the computer, the
+// media key in its own report, and its release follows.
+static void local_to_computer()
+{
+  board_setup();
+  uint8_t media[] = { 2, PLAY_PAUSE, 0 };
+  host_device_report(KEYBOARD_ADDR, 0, media, sizeof(media));
+  uint8_t key[] = { 1, 0, 0, HID_KEY_A, 0, 0, 0, 0, 0 };
+  host_device_report(KEYBOARD_ADDR, 0, key, sizeof(key));
+  host_run();
+  next_frame();
+  next_frame();
+  uint8_t release[] = { 2, 0, 0 };
+  host_device_report(KEYBOARD_ADDR, 0, release, sizeof(release));
+  host_run();
+  next_frame();
+  std::vector<uint16_t> expected = { PLAY_PAUSE, 0 };
+  CHECK(consumer_reports() == expected);
+  bool keyboard = false;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    keyboard |= r.data[0] == REPORT_ID_NKRO;
+  }
+  CHECK(keyboard);
+}
+
+// the link message is the usage and a time stamp, and arrives as sent
+static void over_the_link()
+{
+  board_setup();
+  send_uart_consumer_report(MUTE, host_now_us());
+  std::vector<uint8_t> frame = host_uart_take_sent();
+  // type, stamp, usage, crc and the sentinels, some maybe escaped
+  CHECK(frame.size() >= 1 + 2 + 2 + 1 + 2 && frame.size() <= (size_t) frame_encoded_size(5));
+  host_uart_receive(frame.data(), (int) frame.size());
+  host_run();
+  for (uint32_t us = 0; us <= PACE_MAX_DELAY_US; us += 1000)
+  {
+    next_frame();
+  }
+  std::vector<uint16_t> expected = { MUTE };
+  CHECK(consumer_reports() == expected);
+  CHECK_EQ(uart_link_get_stats().bad_frames, 0);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "parse_array", parse_array },
+    { "parse_bits", parse_bits },
+    { "parse_composite", parse_composite },
+    { "local_to_computer", local_to_computer },
+    { "over_the_link", over_the_link },
+  };
+  return host_test_main(cases, argc, argv);
+}
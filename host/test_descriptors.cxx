@@ -0,0 +1,200 @@
+// Unit tests for the device side descriptors and the latency figures, see
+// latency.h: the HID endpoints are polled at HID_POLL_INTERVAL_MS, and a
+// report's capture to collection time is counted once, under its source.
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "debug_print.h"
+#include "hid_parser.h"
+#include "latency.h"
+#include "mouse_state.h"
+#include "tusb.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+
+struct hid_interface
+{
+  uint8_t number;
+  uint8_t protocol;
+  uint16_t report_len;
+  uint8_t ep_in;
+  uint8_t interval;
+};
+
+// the HID interfaces in the configuration descriptor, in order
+static std::vector<hid_interface> hid_interfaces(const uint8_t *desc, uint16_t total)
+{
+  std::vector<hid_interface> found;
+  bool in_hid = false;
+  for (uint16_t pos = 0; pos + 1 < total && desc[pos] != 0; pos += desc[pos])
+  {
+    const uint8_t *d = desc + pos;
+    if (d[1] == TUSB_DESC_INTERFACE)
+    {
+      in_hid = d[5] == TUSB_CLASS_HID;
+      if (in_hid)
+      {
+        found.push_back(hid_interface { d[2], d[7], 0, 0, 0 });
+      }
+    }
+    else if (in_hid && d[1] == HID_DESC_TYPE_HID)
+    {
+      found.back().report_len = (uint16_t) (d[7] | d[8] << 8);
+    }
+    else if (in_hid && d[1] == TUSB_DESC_ENDPOINT && (d[2] & 0x80) != 0)
+    {
+      found.back().ep_in = d[2];
+      found.back().interval = d[6];
+    }
+  }
+  return found;
+}
+
+// a HID interface per instance, each with its own IN endpoint polled at the
+// configured interval, and the report descriptors where the firmware looks
+static void configuration()
+{
+  host_board_init(0);
+  const uint8_t *desc = tud_descriptor_configuration_cb(0);
+  CHECK_EQ(desc[1], TUSB_DESC_CONFIGURATION);
+  uint16_t total = (uint16_t) (desc[2] | desc[3] << 8);
+  std::vector<hid_interface> hid = hid_interfaces(desc, total);
+  CHECK_EQ(hid.size(), CFG_TUD_HID);
+  for (size_t i = 0; i < hid.size(); ++i)
+  {
+    CHECK_EQ(hid[i].interval, HID_POLL_INTERVAL_MS);
+    CHECK(hid[i].ep_in != 0 && hid[i].report_len != 0);
+    for (size_t j = 0; j < i; ++j)
+    {
+      CHECK(hid[i].ep_in != hid[j].ep_in);
+    }
+  }
+  CHECK_EQ(hid[HID_INSTANCE_KEYBOARD].protocol, HID_ITF_PROTOCOL_KEYBOARD);
+
+  const uint8_t *mouse = tud_hid_descriptor_report_cb(HID_INSTANCE_MOUSE);
+  hid_mouse_layout layout;
+  CHECK(hid_parse_mouse(mouse, hid[HID_INSTANCE_MOUSE].report_len, &layout));
+  // the absolute pointer comes first when built in
+  CHECK_EQ(layout.report_id, ABSOLUTE_POINTER ? REPORT_ID_ABSOLUTE_POINTER : REPORT_ID_MOUSE);
+}
+
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    host_advance_us(1000);
+    host_run();
+  }
+  host_uart_take_sent();
+  host_usb_clear_reports();
+  latency_reset();
+}
+
+static void press(uint8_t keycode)
+{
+  hid_keyboard_report_t r = { 0, 0, { keycode } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+}
+
+// a key captured partway into a frame is counted when the host collects it
+// at the next poll
+static void local_latency()
+{
+  setup();
+  uint64_t poll_us = HID_POLL_INTERVAL_MS * 1000;
+  host_advance_us(poll_us - host_now_us() % poll_us + 300);
+  uint64_t capture = host_now_us();
+  press(HID_KEY_A);
+  host_run();
+  CHECK_EQ(host_usb_reports().size(), 1);
+  // with DEBUG_PRINTS the stdio time charged while the report is forwarded
+  // moves the capture and the queueing on, by no more than the clock did
+  uint64_t queued = host_now_us();
+  uint64_t poll = (queued / poll_us + 1) * poll_us;
+  host_advance_us(poll - queued);
+  host_run();
+  latency_stats s = latency_get(LATENCY_LOCAL);
+  CHECK_EQ(s.count, 1);
+  if (DEBUG_PRINTS_ENABLED)
+  {
+    CHECK(s.min_us >= poll - queued && s.min_us <= poll - capture);
+  }
+  else
+  {
+    CHECK_EQ(s.min_us, poll - capture);
+  }
+  CHECK_EQ(s.min_us, s.max_us);
+  CHECK_EQ(latency_get(LATENCY_UART).count, 0);
+
+  // a report that never goes out isn't counted
+  host_usb_suspend(true);
+  press(0);
+  host_run();
+  host_advance_us(poll_us);
+  host_run();
+  host_usb_suspend(false);
+  CHECK_EQ(latency_get(LATENCY_LOCAL).count, 1);
+}
+
+// a forwarded key counts from its capture on the other board, pacing
+// included, and 'l' on the cdc port prints both sources
+static void uart_latency()
+{
+  setup();
+  key_state keys = {};
+  key_state_press(&keys, HID_KEY_A);
+  uint64_t capture = host_now_us();
+  send_uart_kb_report(&keys, capture);
+  std::vector<uint8_t> frame = host_uart_take_sent();
+  host_uart_receive(frame.data(), (int) frame.size());
+  for (int i = 0; i < 4 + PACE_MAX_DELAY_US / 1000; ++i)
+  {
+    host_run();
+    host_advance_us(1000);
+  }
+  host_run();
+  latency_stats s = latency_get(LATENCY_UART);
+  CHECK_EQ(s.count, 1);
+  CHECK(s.max_us >= HID_POLL_INTERVAL_MS * 1000 / 2);
+  CHECK(s.max_us <= PACE_MAX_DELAY_US + 2 * HID_POLL_INTERVAL_MS * 1000);
+  CHECK_EQ(latency_get(LATENCY_LOCAL).count, 0);
+
+  host_cdc_take_sent();
+  host_cdc_receive((const uint8_t *) "l", 1);
+  host_run();
+  std::vector<uint8_t> sent = host_cdc_take_sent();
+  std::string text(sent.begin(), sent.end());
+  CHECK(text.find("latency local: no reports") != std::string::npos);
+  CHECK(text.find("latency uart: n 1 ") != std::string::npos);
+
+  host_cdc_receive((const uint8_t *) "L", 1);
+  host_run();
+  CHECK_EQ(latency_get(LATENCY_UART).count, 0);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "configuration", configuration },
+    { "local_latency", local_latency },
+    { "uart_latency", uart_latency },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,179 @@
+// Unit tests for edge switching, see edge_switch.h: the virtual cursor
+// against synthetic motion, and a board switching output when local or
+// forwarded motion leaves over the peer edge.
+
+#include <vector>
+
+#include "common.h"
+#include "edge_switch.h"
+#include "link_pacing.h"
+#include "mouse_state.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t MOUSE_ADDR = 2;
+static const screen_geometry right_peer = { 1920, 1080, EDGE_RIGHT };
+
+static int cursor_x()
+{
+  int x, y;
+  edge_switch_position(&x, &y);
+  return x;
+}
+
+static int cursor_y()
+{
+  int x, y;
+  edge_switch_position(&x, &y);
+  return y;
+}
+
+// motion in steps of at most a report's worth
+static bool move(int dx, int dy)
+{
+  bool crossed = false;
+  while (dx != 0 || dy != 0)
+  {
+    int sx = dx > 127 ? 127 : dx < -127 ? -127 : dx;
+    int sy = dy > 127 ? 127 : dy < -127 ? -127 : dy;
+    crossed |= edge_switch_motion(sx, sy);
+    dx -= sx;
+    dy -= sy;
+  }
+  return crossed;
+}
+
+// only the peer edge switches, the other three hold the cursor
+static void crosses_only_peer_edge()
+{
+  edge_switch_configure(true, &right_peer);
+  CHECK_EQ(cursor_x(), 960);
+  CHECK(!move(-5000, 0));
+  CHECK_EQ(cursor_x(), 0);
+  CHECK(!move(0, -5000));
+  CHECK_EQ(cursor_y(), 0);
+  CHECK(!move(0, 5000));
+  CHECK_EQ(cursor_y(), 1079);
+  CHECK(!move(1919, 0));
+  CHECK_EQ(cursor_x(), 1919);
+  CHECK(move(1, 0));
+  CHECK_EQ(cursor_x(), 1919);
+
+  edge_switch_configure(false, &right_peer);
+  CHECK(!edge_switch_enabled());
+  CHECK(!move(5000, 0));
+}
+
+// pushing against an edge lines the model up with the real cursor again
+static void clamped_then_realigns()
+{
+  screen_geometry top = { 1280, 1024, EDGE_TOP };
+  edge_switch_configure(true, &top);
+  move(-3000, 200);
+  move(100, 0);
+  CHECK_EQ(cursor_x(), 100);
+  CHECK(move(0, -2000));
+  CHECK_EQ(cursor_y(), 0);
+}
+
+// the cursor leaves one screen and enters the other at the same point along
+// the edge, whatever the two resolutions, just inside it
+static void enters_where_it_left()
+{
+  edge_switch_configure(true, &right_peer);
+  move(0, 270 - cursor_y());
+  CHECK(move(2000, 0));
+  uint16_t position = edge_switch_exit_position();
+
+  screen_geometry left_peer = { 2560, 1440, EDGE_LEFT };
+  edge_switch_configure(true, &left_peer);
+  edge_switch_set_entry_position(position);
+  edge_switch_enter();
+  CHECK_EQ(cursor_x(), 4);
+  CHECK(cursor_y() >= 359 && cursor_y() <= 361);
+
+  // without a position from the peer only the inset is set
+  move(0, 500);
+  int y = cursor_y();
+  edge_switch_enter();
+  CHECK_EQ(cursor_x(), 4);
+  CHECK_EQ(cursor_y(), y);
+}
+
+static void board_setup()
+{
+  host_board_init(0);
+  edge_switch_configure(true, &right_peer);
+  host_usb_mount();
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+    host_run();
+  }
+  // from the far edge
+  move(-5000, 0);
+  host_uart_take_sent();
+  host_usb_clear_reports();
+}
+
+// the trace from the local mouse moves output to the other board once it
+// crosses, and the other board is told where the cursor left
+static void local_motion_switches()
+{
+  board_setup();
+  int reports = 0;
+  while (should_output() && reports < 100)
+  {
+    hid_mouse_report_t r = { 0, 100, 3, 0, 0 };
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+    host_run();
+    host_advance_us(1000);
+    host_run();
+    reports++;
+  }
+  CHECK(!should_output());
+  CHECK_EQ(reports, 1920 / 100 + 1);
+  CHECK(!host_uart_take_sent().empty());
+  edge_switch_configure(false, &right_peer);
+}
+
+// motion from the other board crosses the same way once it reaches this
+// board's host
+static void forwarded_motion_switches()
+{
+  board_setup();
+  int frames = 0;
+  while (should_output() && frames < 100)
+  {
+    mouse_state m = {};
+    m.x = 120;
+    send_uart_mouse_report(&m, host_now_us());
+    std::vector<uint8_t> frame = host_uart_take_sent();
+    host_uart_receive(frame.data(), (int) frame.size());
+    host_run();
+    host_advance_us(1000);
+    host_run();
+    frames++;
+  }
+  // each waits up to the pacing delay, and the loop sends on meanwhile
+  CHECK(!should_output());
+  CHECK(frames >= 1920 / 120 && frames <= 1920 / 120 + 1 + PACE_MAX_DELAY_US / 1000);
+  edge_switch_configure(false, &right_peer);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "crosses_only_peer_edge", crosses_only_peer_edge },
+    { "clamped_then_realigns", clamped_then_realigns },
+    { "enters_where_it_left", enters_where_it_left },
+    { "local_motion_switches", local_motion_switches },
+    { "forwarded_motion_switches", forwarded_motion_switches },
+  };
+  return host_test_main(cases, argc, argv);
+}
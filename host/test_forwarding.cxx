@@ -0,0 +1,172 @@
+// Unit tests for report processing and output switching on one board: what
+// reaches the computer and what goes over the uart.
+
+#include <string.h>
+
+#include <vector>
+
+#include "common.h"
+#include "config_store.h"
+#include "key_state.h"
+#include "link_pacing.h"
+#include "settings.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+
+// the host collects the report in flight
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_run();
+  // the output mask outlives host_board_init, switching back sends the
+  // keyboard, mouse and consumer state a frame each
+  if (!should_output())
+  {
+    toggle_output();
+    for (int i = 0; i < 3; ++i)
+    {
+      next_frame();
+    }
+  }
+  host_uart_take_sent();
+  host_usb_clear_reports();
+}
+
+static void press(uint8_t keycode)
+{
+  hid_keyboard_report_t r = { 0, 0, { keycode } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+  host_run();
+  next_frame();
+}
+
+// the keys in the last keyboard report the computer got, false if none
+static bool last_keys(key_state *keys)
+{
+  const std::vector<host_usb_report> &reports = host_usb_reports();
+  for (auto r = reports.rbegin(); r != reports.rend(); ++r)
+  {
+    if (r->data.size() == 1 + sizeof(key_state) && r->data[0] == REPORT_ID_NKRO)
+    {
+      memcpy(keys, r->data.data() + 1, sizeof(key_state));
+      return true;
+    }
+  }
+  return false;
+}
+
+static void keyboard_to_computer()
+{
+  setup();
+  CHECK(should_output());
+  press(HID_KEY_A);
+  key_state keys;
+  CHECK(last_keys(&keys) && key_state_pressed(&keys, HID_KEY_A));
+  // a peer that hasn't said anything yet gets everything
+  CHECK(!host_uart_take_sent().empty());
+  press(0);
+  CHECK(last_keys(&keys) && !key_state_pressed(&keys, HID_KEY_A));
+}
+
+// switching away lets go of what is held, then input only goes over the uart
+static void switch_away()
+{
+  setup();
+  press(HID_KEY_A);
+  host_usb_clear_reports();
+  toggle_output();
+  host_run();
+  next_frame();
+  CHECK(!should_output() && peer_should_output());
+  key_state keys;
+  CHECK(last_keys(&keys) && !key_state_pressed(&keys, HID_KEY_A));
+  CHECK(!host_uart_take_sent().empty());
+
+  host_usb_clear_reports();
+  press(HID_KEY_Z);
+  CHECK(!last_keys(&keys));
+  CHECK(!host_uart_take_sent().empty());
+}
+
+// a keyboard frame from the other board reaches this board's computer
+static void uart_to_computer()
+{
+  setup();
+  key_state sent = {};
+  key_state_press(&sent, HID_KEY_Z);
+  send_uart_kb_report(&sent, host_now_us());
+  std::vector<uint8_t> frame = host_uart_take_sent();
+  host_uart_receive(frame.data(), (int) frame.size());
+  host_run();
+  // paced, it may wait up to PACE_MAX_DELAY_US
+  host_advance_us(PACE_MAX_DELAY_US);
+  host_run();
+  next_frame();
+  key_state keys;
+  CHECK(last_keys(&keys) && key_state_pressed(&keys, HID_KEY_Z));
+  uart_link_stats s = uart_link_get_stats();
+  CHECK_EQ(s.frames, 1);
+  CHECK_EQ(s.bad_frames, 0);
+}
+
+static int stored_mask()
+{
+  uint8_t mask;
+  return config_store_get(SETTING_OUTPUT_MASK, &mask, 1) == 1 ? mask : -1;
+}
+
+// switching back and forth never reaches the store, the mask it settles on
+// does once it has held
+static void mask_stored_once_settled()
+{
+  setup();
+  toggle_output();
+  host_run();
+  host_advance_us(3000000);
+  host_run();
+  uint8_t mask = get_current_output_mask();
+  CHECK_EQ(stored_mask(), mask);
+  for (int i = 0; i < 4; ++i)
+  {
+    toggle_output();
+    host_run();
+    next_frame();
+    CHECK_EQ(stored_mask(), mask);
+  }
+  host_advance_us(3000000);
+  host_run();
+  CHECK_EQ(get_current_output_mask(), mask);
+  CHECK_EQ(stored_mask(), mask);
+
+  toggle_output();
+  host_run();
+  CHECK(get_current_output_mask() != mask);
+  CHECK_EQ(stored_mask(), mask);
+  host_advance_us(3000000);
+  host_run();
+  CHECK_EQ(stored_mask(), get_current_output_mask());
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "keyboard_to_computer", keyboard_to_computer },
+    { "switch_away", switch_away },
+    { "uart_to_computer", uart_to_computer },
+    { "mask_stored_once_settled", mask_stored_once_settled },
+  };
+  return host_test_main(cases, argc, argv);
+}
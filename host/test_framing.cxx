@@ -0,0 +1,143 @@
+// Unit tests for the byte stuffed framing in framing.h, shared by the uart
+// link and the cdc protocol.
+
+#include <vector>
+
+#include "framing.h"
+
+#include "host_test.h"
+
+static const int MAX_PAYLOAD = 32;
+
+static std::vector<uint8_t> encode(const std::vector<uint8_t> &payload)
+{
+  frame_encoder<frame_encoded_size(MAX_PAYLOAD)> e;
+  e.put_sentinel();
+  for (uint8_t b : payload)
+  {
+    e.put(b);
+  }
+  e.set_crc();
+  e.put_sentinel();
+  return std::vector<uint8_t>(e.data(), e.data() + e.size());
+}
+
+// feeds the bytes and returns the results other than FRAME_NONE
+static std::vector<FrameResult> feed(frame_decoder<MAX_PAYLOAD + 1> *d, const std::vector<uint8_t> &bytes)
+{
+  std::vector<FrameResult> results;
+  for (uint8_t b : bytes)
+  {
+    FrameResult r = d->feed(b);
+    if (r != FRAME_NONE)
+    {
+      results.push_back(r);
+    }
+  }
+  return results;
+}
+
+static void round_trip()
+{
+  std::vector<uint8_t> payload = { 1, SENTINEL, 2, ESCAPE, ESCAPE, SENTINEL, 0, 0xff };
+  std::vector<uint8_t> frame = encode(payload);
+  CHECK_EQ(frame.size(), 2 + payload.size() + 4 + 1);
+  frame_decoder<MAX_PAYLOAD + 1> d;
+  std::vector<FrameResult> r = feed(&d, frame);
+  CHECK(r.size() == 1 && r[0] == FRAME_COMPLETE);
+  CHECK_EQ(d.size(), payload.size());
+  CHECK(std::vector<uint8_t>(d.data(), d.data() + d.size()) == payload);
+}
+
+static void escaped_crc()
+{
+  // find a payload whose crc needs escaping
+  for (int i = 0; i < 256; ++i)
+  {
+    std::vector<uint8_t> payload = { (uint8_t) i };
+    uint8_t crc = frame_crc8(payload.data(), 1);
+    if (crc != SENTINEL && crc != ESCAPE)
+    {
+      continue;
+    }
+    frame_decoder<MAX_PAYLOAD + 1> d;
+    std::vector<FrameResult> r = feed(&d, encode(payload));
+    CHECK(r.size() == 1 && r[0] == FRAME_COMPLETE);
+    CHECK(d.size() == 1 && d.data()[0] == i);
+  }
+}
+
+static void bad_crc()
+{
+  std::vector<uint8_t> frame = encode({ 1, 2, 3 });
+  frame[2] ^= 0x10;
+  std::vector<uint8_t> good = encode({ 4, 5 });
+  frame.insert(frame.end(), good.begin(), good.end());
+  frame_decoder<MAX_PAYLOAD + 1> d;
+  std::vector<FrameResult> r = feed(&d, frame);
+  CHECK(r.size() == 2 && r[0] == FRAME_BAD && r[1] == FRAME_COMPLETE);
+  CHECK(d.size() == 2 && d.data()[0] == 4);
+}
+
+static void too_long()
+{
+  std::vector<uint8_t> frame = encode(std::vector<uint8_t>(MAX_PAYLOAD, 0x11));
+  std::vector<uint8_t> longer = { SENTINEL };
+  longer.insert(longer.end(), MAX_PAYLOAD + 8, 0x11);
+  longer.push_back(SENTINEL);
+  longer.insert(longer.end(), frame.begin(), frame.end());
+  frame_decoder<MAX_PAYLOAD + 1> d;
+  std::vector<FrameResult> r = feed(&d, longer);
+  CHECK(r.size() == 2 && r[0] == FRAME_BAD && r[1] == FRAME_COMPLETE);
+  CHECK_EQ(d.size(), MAX_PAYLOAD);
+}
+
+// A lost closing sentinel costs the frame after it, whose opening sentinel
+// closed the one before. Bytes between frames are counted.
+static void lost_sentinel()
+{
+  std::vector<uint8_t> bytes = { 0x55 };
+  for (uint8_t v = 7; v <= 9; ++v)
+  {
+    std::vector<uint8_t> frame = encode({ v });
+    if (v == 7)
+    {
+      frame.pop_back();
+    }
+    bytes.insert(bytes.end(), frame.begin(), frame.end());
+  }
+  frame_decoder<MAX_PAYLOAD + 1> d;
+  std::vector<uint8_t> taken;
+  int outside = 0;
+  for (uint8_t b : bytes)
+  {
+    FrameResult r = d.feed(b);
+    outside += r == FRAME_OUTSIDE;
+    if (r == FRAME_COMPLETE && d.size() == 1)
+    {
+      taken.push_back(d.data()[0]);
+    }
+  }
+  CHECK(taken == std::vector<uint8_t>({ 7, 9 }));
+  CHECK_EQ(outside, 3);
+}
+
+static void byte_helpers()
+{
+  uint8_t b[4] = { 0x78, 0x56, 0x34, 0x12 };
+  CHECK_EQ(get_u16(b), 0x5678);
+  CHECK_EQ(get_u32(b), 0x12345678);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "round_trip", round_trip },
+    { "escaped_crc", escaped_crc },
+    { "bad_crc", bad_crc },
+    { "too_long", too_long },
+    { "lost_sentinel", lost_sentinel },
+    { "byte_helpers", byte_helpers },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,216 @@
+// Unit tests for GET_REPORT, see report_cache.h: answered with the last
+// report sent for the id, nothing pressed before any was, the boot report
+// while the host has the boot protocol, and the LEDs and mouse feature the
+// host set.
+
+#include <string.h>
+
+#include <vector>
+
+#include "common.h"
+#include "key_state.h"
+#include "report_cache.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+static const int MOUSE_REPORT_SIZE = 7; // buttons, x, y, i16 wheel and pan
+
+// the computer collects the report in flight
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    next_frame();
+  }
+  host_uart_take_sent();
+}
+
+static std::vector<uint8_t> get_input(uint8_t instance, uint8_t report_id, uint16_t len = 64)
+{
+  return host_usb_get_report(instance, report_id, HID_REPORT_TYPE_INPUT, len);
+}
+
+static bool all_zero(const std::vector<uint8_t> &report)
+{
+  for (uint8_t b : report)
+  {
+    if (b != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// until something is sent each input report reads as nothing pressed, an id
+// with no report stalls
+static void before_any_report()
+{
+  host_board_init(0);
+  host_usb_mount();
+  std::vector<uint8_t> keys = get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO);
+  CHECK_EQ(keys.size(), sizeof(key_state));
+  CHECK(all_zero(keys));
+  std::vector<uint8_t> mouse = get_input(HID_INSTANCE_MOUSE, REPORT_ID_MOUSE);
+  CHECK_EQ(mouse.size(), MOUSE_REPORT_SIZE);
+  CHECK(all_zero(mouse));
+  CHECK_EQ(get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_CONSUMER_CONTROL).size(), 2);
+  CHECK(get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_GAMEPAD).empty());
+  CHECK(get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_COUNT).empty());
+}
+
+// the cache follows each report sent, and a short request gets the start
+static void last_sent()
+{
+  setup();
+  hid_keyboard_report_t k = { KEYBOARD_MODIFIER_LEFTSHIFT, 0, { HID_KEY_A } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &k, sizeof(k));
+  host_run();
+  next_frame();
+  hid_mouse_report_t m = { MOUSE_BUTTON_RIGHT, 5, -3, 0, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &m, sizeof(m));
+  host_run();
+  next_frame();
+
+  std::vector<uint8_t> report = get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO);
+  key_state keys = {};
+  CHECK_EQ(report.size(), sizeof(keys));
+  memcpy(&keys, report.data(), report.size() < sizeof(keys) ? report.size() : sizeof(keys));
+  CHECK(key_state_pressed(&keys, HID_KEY_A));
+  CHECK(key_state_pressed(&keys, HID_KEY_SHIFT_LEFT));
+
+  // the absolute pointer, when built in and edge switching, has the
+  // buttons first too and is the same size
+  report = get_input(HID_INSTANCE_MOUSE, report_cache_mouse_report_id());
+  CHECK(report.size() == MOUSE_REPORT_SIZE && report[0] == MOUSE_BUTTON_RIGHT);
+  if (report_cache_mouse_report_id() == REPORT_ID_MOUSE)
+  {
+    CHECK(report.size() == MOUSE_REPORT_SIZE && (int8_t) report[1] == 5 && (int8_t) report[2] == -3);
+  }
+
+  CHECK_EQ(get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO, 3).size(), 3);
+
+  k = { 0, 0, { 0 } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &k, sizeof(k));
+  host_run();
+  next_frame();
+  CHECK(all_zero(get_input(HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO)));
+}
+
+// a BIOS asks for the boot report, which has no id
+static void boot_protocol()
+{
+  setup();
+  host_usb_set_protocol(HID_INSTANCE_KEYBOARD, HID_PROTOCOL_BOOT);
+  host_run();
+  next_frame();
+  hid_keyboard_report_t k = { 0, 0, { HID_KEY_Z } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &k, sizeof(k));
+  host_run();
+  std::vector<uint8_t> report = get_input(HID_INSTANCE_KEYBOARD, 0);
+  CHECK_EQ(report.size(), sizeof(hid_keyboard_report_t));
+  CHECK(report.size() == sizeof(hid_keyboard_report_t) && report[2] == HID_KEY_Z);
+  host_usb_set_protocol(HID_INSTANCE_KEYBOARD, HID_PROTOCOL_REPORT);
+  k = { 0, 0, { 0 } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &k, sizeof(k));
+  host_run();
+  next_frame();
+}
+
+// output and feature reports read back what the host set
+static void leds_and_feature()
+{
+  setup();
+  uint8_t leds = KEYBOARD_LED_CAPSLOCK | KEYBOARD_LED_NUMLOCK;
+  host_usb_set_report(HID_INSTANCE_KEYBOARD, REPORT_ID_KEYBOARD, HID_REPORT_TYPE_OUTPUT, &leds, 1);
+  std::vector<uint8_t> report = host_usb_get_report(HID_INSTANCE_KEYBOARD, REPORT_ID_KEYBOARD,
+    HID_REPORT_TYPE_OUTPUT, 1);
+  CHECK(report.size() == 1 && report[0] == leds);
+
+  uint8_t feature = MOUSE_FEATURE_WHEEL_HIGH_RES;
+  host_usb_set_report(HID_INSTANCE_MOUSE, REPORT_ID_MOUSE, HID_REPORT_TYPE_FEATURE, &feature, 1);
+  report = host_usb_get_report(HID_INSTANCE_MOUSE, REPORT_ID_MOUSE, HID_REPORT_TYPE_FEATURE, 1);
+  CHECK(report.size() == 1 && report[0] == MOUSE_FEATURE_WHEEL_HIGH_RES);
+
+  CHECK(host_usb_get_report(HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO, HID_REPORT_TYPE_FEATURE, 8).empty());
+}
+
+// A mouse report that finds the endpoint busy isn't lost, its motion and
+// wheel go out with the next report, and GET_REPORT has what was sent.
+static void busy_endpoint()
+{
+  setup();
+  host_usb_clear_reports();
+  hid_mouse_report_t m = { 0, 10, -4, 1, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &m, sizeof(m));
+  host_run();
+  m = { 0, 20, -6, 1, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &m, sizeof(m));
+  host_run();
+  next_frame();
+  m = { 0, 5, 0, 0, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &m, sizeof(m));
+  host_run();
+  next_frame();
+  next_frame();
+
+  int x = 0, y = 0, wheel = 0;
+  uint8_t id = report_cache_mouse_report_id();
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    if (r.instance != HID_INSTANCE_MOUSE || r.data.size() != 1 + MOUSE_REPORT_SIZE || r.data[0] != id)
+    {
+      continue;
+    }
+    if (id == REPORT_ID_MOUSE)
+    {
+      x += (int8_t) r.data[2];
+      y += (int8_t) r.data[3];
+      wheel += (int16_t) (r.data[4] | r.data[5] << 8);
+    }
+    else
+    {
+      // the absolute pointer has the position, then an int8 wheel
+      wheel += (int8_t) r.data[6];
+    }
+  }
+  CHECK_EQ(wheel, 2);
+  if (id == REPORT_ID_MOUSE)
+  {
+    CHECK_EQ(x, 35);
+    CHECK_EQ(y, -10);
+    std::vector<uint8_t> report = get_input(HID_INSTANCE_MOUSE, REPORT_ID_MOUSE);
+    CHECK(report.size() == MOUSE_REPORT_SIZE && (int8_t) report[1] != 0);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "before_any_report", before_any_report },
+    { "last_sent", last_sent },
+    { "boot_protocol", boot_protocol },
+    { "leds_and_feature", leds_and_feature },
+    { "busy_endpoint", busy_endpoint },
+  };
+  return host_test_main(cases, argc, argv);
+}
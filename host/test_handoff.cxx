@@ -0,0 +1,239 @@
+// Unit tests for the handoff on an output switch, see handoff.h: the host
+// losing the output gets everything released, the one gaining it what is
+// held, one report a frame in a fixed order, and the keyboard shows the
+// LEDs of the host it now types to.
+
+#include <string.h>
+
+#include <vector>
+
+#include "common.h"
+#include "handoff.h"
+#include "key_state.h"
+#include "report_cache.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+
+// the host collects the report in flight
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+static void settle()
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    next_frame();
+  }
+}
+
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+  }
+  settle();
+  host_uart_take_sent();
+  host_usb_clear_reports();
+  host_device_clear_requests();
+}
+
+static void hold(uint8_t keycode, uint8_t buttons)
+{
+  hid_keyboard_report_t k = { 0, 0, { keycode } };
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &k, sizeof(k));
+  hid_mouse_report_t m = { buttons, 0, 0, 0, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &m, sizeof(m));
+  host_run();
+  settle();
+}
+
+// report ids in the order the computer got them
+static std::vector<uint8_t> report_ids()
+{
+  std::vector<uint8_t> ids;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    ids.push_back(r.data[0]);
+  }
+  return ids;
+}
+
+static bool keys_held(const host_usb_report &r, uint8_t keycode)
+{
+  key_state keys;
+  if (r.data.size() != 1 + sizeof(keys) || r.data[0] != REPORT_ID_NKRO)
+  {
+    return false;
+  }
+  memcpy(&keys, r.data.data() + 1, sizeof(keys));
+  return keycode == 0 ? key_state_empty(&keys) : key_state_pressed(&keys, keycode);
+}
+
+// the LEDs last set on the keyboard, -1 if none were
+static int keyboard_leds()
+{
+  int leds = -1;
+  for (const host_device_request &r : host_device_requests())
+  {
+    if (r.kind == host_device_request::SET_REPORT && r.dev_addr == KEYBOARD_ADDR &&
+      r.report_type == HID_REPORT_TYPE_OUTPUT && r.data.size() == 1)
+    {
+      leds = r.data[0];
+    }
+  }
+  return leds;
+}
+
+// keyboard, mouse and media keys are released, a frame apart
+static void release_on_switch_away()
+{
+  setup();
+  hold(HID_KEY_A, MOUSE_BUTTON_LEFT);
+  host_usb_clear_reports();
+  toggle_output();
+  host_run();
+  for (int frame = 0; frame < 3; ++frame)
+  {
+    CHECK_EQ(host_usb_reports().size(), (size_t) frame + 1);
+    next_frame();
+  }
+  std::vector<uint8_t> expected = { REPORT_ID_NKRO, report_cache_mouse_report_id(), REPORT_ID_CONSUMER_CONTROL };
+  CHECK(report_ids() == expected);
+  const std::vector<host_usb_report> &reports = host_usb_reports();
+  CHECK(keys_held(reports[0], 0));
+  CHECK_EQ(reports[1].data[1], 0);
+  CHECK_EQ(reports[2].data[1] | reports[2].data[2], 0);
+  settle();
+  CHECK_EQ(host_usb_reports().size(), 3);
+}
+
+// what is held when output comes back goes out, including what was pressed
+// while it was away
+static void restore_on_switch_back()
+{
+  setup();
+  hold(HID_KEY_A, 0);
+  toggle_output();
+  settle();
+  hold(HID_KEY_B, MOUSE_BUTTON_RIGHT);
+  host_usb_clear_reports();
+  toggle_output();
+  host_run();
+  settle();
+  std::vector<uint8_t> expected = { REPORT_ID_NKRO, report_cache_mouse_report_id(), REPORT_ID_CONSUMER_CONTROL };
+  CHECK(report_ids() == expected);
+  const std::vector<host_usb_report> &reports = host_usb_reports();
+  CHECK(reports.size() == 3 && keys_held(reports[0], HID_KEY_B) && !keys_held(reports[0], HID_KEY_A));
+  CHECK(reports.size() == 3 && reports[1].data[1] == MOUSE_BUTTON_RIGHT);
+}
+
+// the keyboard shows this host's lock keys while it has the output and the
+// other host's after switching away
+static void leds_follow_output()
+{
+  setup();
+  uint8_t own = KEYBOARD_LED_CAPSLOCK;
+  host_usb_set_report(HID_INSTANCE_KEYBOARD, 0, HID_REPORT_TYPE_OUTPUT, &own, 1);
+  handoff_set_peer_leds(KEYBOARD_LED_NUMLOCK);
+  host_run();
+  settle();
+  CHECK_EQ(keyboard_leds(), KEYBOARD_LED_CAPSLOCK);
+
+  host_device_clear_requests();
+  toggle_output();
+  settle();
+  CHECK_EQ(keyboard_leds(), KEYBOARD_LED_NUMLOCK);
+
+  host_device_clear_requests();
+  toggle_output();
+  settle();
+  CHECK_EQ(keyboard_leds(), KEYBOARD_LED_CAPSLOCK);
+}
+
+// switching back before the releases went out restores instead
+static void switch_back_midway()
+{
+  setup();
+  hold(HID_KEY_C, 0);
+  host_usb_clear_reports();
+  toggle_output();
+  host_run();
+  toggle_output();
+  host_run();
+  settle();
+  const std::vector<host_usb_report> &reports = host_usb_reports();
+  bool last_keys_held = false;
+  for (const host_usb_report &r : reports)
+  {
+    if (r.data[0] == REPORT_ID_NKRO)
+    {
+      last_keys_held = keys_held(r, HID_KEY_C);
+    }
+  }
+  CHECK(last_keys_held);
+  CHECK(should_output());
+}
+
+// Mouse reports that find the endpoint busy are retried, a report a frame,
+// until their motion, wheel and last buttons have all reached the host,
+// with no more reports from the mouse to carry them.
+static void busy_mouse_retried()
+{
+  setup();
+  for (int i = 0; i < 3; ++i)
+  {
+    hid_mouse_report_t m = { (uint8_t) (i < 2 ? MOUSE_BUTTON_LEFT : 0), 100, -50, 1, 0 };
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &m, sizeof(m));
+    host_run();
+  }
+  settle();
+  int x = 0, y = 0, wheel = 0, reports = 0;
+  uint8_t buttons = 0xff;
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    if (r.data.size() >= 6 && r.data[0] == report_cache_mouse_report_id())
+    {
+      x += (int8_t) r.data[2];
+      y += (int8_t) r.data[3];
+      wheel += (int16_t) (r.data[4] | r.data[5] << 8);
+      buttons = r.data[1];
+      reports++;
+    }
+  }
+  CHECK_EQ(buttons, 0);
+  CHECK(!report_cache_mouse_pending());
+  if (report_cache_mouse_report_id() == REPORT_ID_MOUSE)
+  {
+    // 300 takes three reports of at most 127
+    CHECK_EQ(reports, 3);
+    CHECK_EQ(x, 300);
+    CHECK_EQ(y, -150);
+    CHECK_EQ(wheel, 3);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "release_on_switch_away", release_on_switch_away },
+    { "restore_on_switch_back", restore_on_switch_back },
+    { "leds_follow_output", leds_follow_output },
+    { "switch_back_midway", switch_back_midway },
+    { "busy_mouse_retried", busy_mouse_retried },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,117 @@
+// Unit tests for the usb host ports, see host_ports.h: devices counted on
+// the root port they came in on with their reports, and the port suggested
+// for a keyboard and mouse sharing one through a hub.
+
+#include <string>
+#include <vector>
+
+#include "host_ports.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+static const uint8_t HUB_ADDR = 3;
+
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_run();
+}
+
+static void mouse_report()
+{
+  hid_mouse_report_t r = { 0, 1, 0, 0, 0 };
+  host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+  host_run();
+}
+
+// A mouse plugged straight into root port 1 is counted there with its
+// reports, and no longer once it is unplugged.
+static void device_on_port_one()
+{
+  setup();
+  host_device_set_port(MOUSE_ADDR, 1, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  CHECK_EQ(host_ports_port_of(MOUSE_ADDR), 1);
+  for (int i = 0; i < 5; ++i)
+  {
+    mouse_report();
+  }
+  host_port_stats s = host_ports_get(1);
+  CHECK_EQ(s.devices, 1);
+  CHECK_EQ(s.through_hub, 0);
+  CHECK_EQ(s.reports, 5);
+  for (int port = 2; port <= HOST_PORT_COUNT; ++port)
+  {
+    CHECK_EQ(host_ports_get(port).devices, 0);
+  }
+  CHECK_EQ(host_ports_suggest_port(), 0);
+
+  host_device_detach(MOUSE_ADDR, 0);
+  host_run();
+  CHECK_EQ(host_ports_port_of(MOUSE_ADDR), 0);
+  CHECK_EQ(host_ports_get(1).devices, 0);
+
+  // a port the build doesn't have is taken as the first
+  host_device_set_port(MOUSE_ADDR, HOST_PORT_COUNT + 1, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  CHECK_EQ(host_ports_port_of(MOUSE_ADDR), 1);
+  host_device_detach(MOUSE_ADDR, 0);
+  host_run();
+}
+
+// A keyboard and mouse through a hub on port 1 get the empty port suggested
+// when there is one, which 'u' prints. Nothing moves, and once one of them
+// is plugged in there the suggestion goes.
+static void suggest_port()
+{
+  setup();
+  host_device_set_port(KEYBOARD_ADDR, 1, HUB_ADDR);
+  host_device_set_port(MOUSE_ADDR, 1, HUB_ADDR);
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  host_port_stats s = host_ports_get(1);
+  CHECK_EQ(s.devices, 2);
+  CHECK_EQ(s.through_hub, 2);
+  CHECK_EQ(host_ports_suggest_port(), HOST_PORT_COUNT > 1 ? 2 : 0);
+  CHECK_EQ(host_ports_port_of(MOUSE_ADDR), 1);
+
+  host_cdc_set_reading(true);
+  host_cdc_take_sent();
+  host_cdc_receive((const uint8_t *) "u", 1);
+  host_run();
+  std::vector<uint8_t> sent = host_cdc_take_sent();
+  std::string text(sent.begin(), sent.end());
+  CHECK(text.find("usb host port 1 devices 2 through hub 2") != std::string::npos);
+  CHECK_EQ(text.find("plug one into port 2") != std::string::npos, HOST_PORT_COUNT > 1);
+
+  if (HOST_PORT_COUNT > 1)
+  {
+    host_device_detach(MOUSE_ADDR, 0);
+    host_device_set_port(MOUSE_ADDR, 2, 0);
+    host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+    host_run();
+    CHECK_EQ(host_ports_port_of(MOUSE_ADDR), 2);
+    CHECK_EQ(host_ports_get(2).devices, 1);
+    CHECK_EQ(host_ports_suggest_port(), 0);
+  }
+  host_device_detach(KEYBOARD_ADDR, 0);
+  host_device_detach(MOUSE_ADDR, 0);
+  host_run();
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "device_on_port_one", device_on_port_one },
+    { "suggest_port", suggest_port },
+  };
+  return host_test_main(cases, argc, argv);
+}
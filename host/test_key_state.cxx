@@ -0,0 +1,227 @@
+// Unit tests for the keyboard state, see key_state.h: the bitmap against
+// boot reports and the uart message, from no keys to every key held.
+
+#include <string.h>
+
+#include <vector>
+
+#include "common.h"
+#include "framing.h"
+#include "key_state.h"
+#include "link_pacing.h"
+#include "uart_messages.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t ERROR_ROLLOVER = 0x01;
+static const uint8_t LAST_KEY = NKRO_KEY_COUNT - 1;
+
+// the same sets on every run
+static uint32_t random_state = 1;
+
+static uint32_t next_random()
+{
+  random_state = random_state * 1103515245 + 12345;
+  return random_state >> 16;
+}
+
+// count distinct keys from HID_KEY_A up, with any modifiers
+static key_state random_keys(int count)
+{
+  key_state state;
+  key_state_clear(&state);
+  while (key_state_count(&state) < count)
+  {
+    key_state_press(&state, (uint8_t) (HID_KEY_A + next_random() % (LAST_KEY + 1 - HID_KEY_A)));
+  }
+  state.modifier = (uint8_t) next_random();
+  return state;
+}
+
+// modifiers go in their own byte, error codes and usages past the bitmap
+// are dropped, the list comes out in order and counts past its room
+static void press_and_list()
+{
+  key_state state;
+  key_state_clear(&state);
+  CHECK(key_state_empty(&state));
+  key_state_press(&state, HID_KEY_Z);
+  key_state_press(&state, HID_KEY_A);
+  key_state_press(&state, LAST_KEY);
+  key_state_press(&state, HID_KEY_SHIFT_LEFT);
+  key_state_press(&state, ERROR_ROLLOVER);
+  key_state_press(&state, NKRO_KEY_COUNT);
+  CHECK_EQ(key_state_count(&state), 3);
+  CHECK_EQ(state.modifier, KEYBOARD_MODIFIER_LEFTSHIFT);
+  CHECK(key_state_pressed(&state, HID_KEY_SHIFT_LEFT));
+  CHECK(!key_state_pressed(&state, ERROR_ROLLOVER));
+
+  uint8_t keys[2];
+  CHECK_EQ(key_state_to_list(&state, keys, 2), 3);
+  CHECK_EQ(keys[0], HID_KEY_A);
+  CHECK_EQ(keys[1], HID_KEY_Z);
+
+  key_state all;
+  key_state_clear(&all);
+  for (int k = 0; k < 256; ++k)
+  {
+    key_state_press(&all, (uint8_t) k);
+  }
+  CHECK_EQ(key_state_count(&all), NKRO_KEY_COUNT - HID_KEY_A);
+  CHECK_EQ(all.modifier, 0xff);
+}
+
+// up to six keys survive the boot report both ways, past that every slot
+// holds the rollover error and the modifiers still go through
+static void boot_rollover()
+{
+  for (int count = 0; count <= NKRO_KEY_COUNT - HID_KEY_A; ++count)
+  {
+    key_state state = random_keys(count);
+    hid_keyboard_report_t boot;
+    key_state_to_boot(&state, &boot);
+    CHECK_EQ(boot.modifier, state.modifier);
+    if (count <= 6)
+    {
+      key_state back;
+      key_state_from_boot(&back, &boot);
+      if (!CHECK(memcmp(&back, &state, sizeof(state)) == 0))
+      {
+        fprintf(stderr, "%d keys\n", count);
+        return;
+      }
+    }
+    else
+    {
+      for (int i = 0; i < 6; ++i)
+      {
+        CHECK_EQ(boot.keycode[i], ERROR_ROLLOVER);
+      }
+      key_state back;
+      key_state_from_boot(&back, &boot);
+      CHECK_EQ(key_state_count(&back), 0);
+    }
+  }
+}
+
+static void next_frame()
+{
+  host_advance_us(1000);
+  host_run();
+}
+
+static void board_setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+    for (int i = 0; i < 3; ++i)
+    {
+      next_frame();
+    }
+  }
+  host_uart_take_sent();
+  host_usb_clear_reports();
+}
+
+// the keyboard report the computer got last, NKRO with its id or boot
+static std::vector<uint8_t> last_keyboard_report()
+{
+  bool boot = tud_hid_n_get_protocol(HID_INSTANCE_KEYBOARD) == HID_PROTOCOL_BOOT;
+  const std::vector<host_usb_report> &reports = host_usb_reports();
+  for (size_t i = reports.size(); i-- > 0;)
+  {
+    const std::vector<uint8_t> &data = reports[i].data;
+    if (reports[i].instance == HID_INSTANCE_KEYBOARD &&
+      (boot ? data.size() == sizeof(hid_keyboard_report_t) : data[0] == REPORT_ID_NKRO))
+    {
+      return reports[i].data;
+    }
+  }
+  return std::vector<uint8_t>();
+}
+
+// the other board's state over the link, paced
+static size_t receive(const key_state &state)
+{
+  host_uart_take_sent();
+  send_uart_kb_report(&state, host_now_us());
+  std::vector<uint8_t> frame = host_uart_take_sent();
+  host_uart_receive(frame.data(), (int) frame.size());
+  host_run();
+  for (uint32_t us = 0; us <= PACE_MAX_DELAY_US; us += 1000)
+  {
+    next_frame();
+  }
+  return frame.size();
+}
+
+// Any set of keys crosses the link and reaches the computer as sent, as a
+// list while that is shorter and as the bitmap after.
+static void wire_rollover()
+{
+  board_setup();
+  size_t longest = 0;
+  for (int count = 0; count <= NKRO_KEY_COUNT - HID_KEY_A; count += count < 24 ? 1 : 11)
+  {
+    key_state state = random_keys(count);
+    size_t size = receive(state);
+    longest = size > longest ? size : longest;
+    if (count < 8)
+    {
+      CHECK(size <= (size_t) frame_encoded_size(4 + count) && size >= (size_t) 2 + 4 + count);
+    }
+    std::vector<uint8_t> report = last_keyboard_report();
+    bool same = report.size() == 1 + sizeof(state) && report[0] == REPORT_ID_NKRO &&
+      memcmp(report.data() + 1, &state, sizeof(state)) == 0;
+    if (!CHECK(same))
+    {
+      fprintf(stderr, "%d keys\n", count);
+      return;
+    }
+  }
+  CHECK(longest <= (size_t) frame_encoded_size(4 + NKRO_KEY_BYTES));
+  CHECK_EQ(uart_link_get_stats().bad_frames, 0);
+}
+
+// a computer in the boot protocol gets the rollover error for too many keys
+// from the other board, and the keys once there are few enough again
+static void wire_to_boot()
+{
+  board_setup();
+  host_usb_set_protocol(HID_INSTANCE_KEYBOARD, HID_PROTOCOL_BOOT);
+  host_run();
+  next_frame();
+  key_state state = random_keys(9);
+  receive(state);
+  std::vector<uint8_t> report = last_keyboard_report();
+  CHECK_EQ(report.size(), sizeof(hid_keyboard_report_t));
+  CHECK(report.size() == sizeof(hid_keyboard_report_t) && report[0] == state.modifier &&
+    report[2] == ERROR_ROLLOVER && report[7] == ERROR_ROLLOVER);
+
+  key_state few;
+  key_state_clear(&few);
+  key_state_press(&few, HID_KEY_A);
+  key_state_press(&few, HID_KEY_Z);
+  receive(few);
+  report = last_keyboard_report();
+  CHECK(report.size() == sizeof(hid_keyboard_report_t) && report[2] == HID_KEY_A && report[3] == HID_KEY_Z &&
+    report[4] == 0);
+  host_usb_set_protocol(HID_INSTANCE_KEYBOARD, HID_PROTOCOL_REPORT);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "press_and_list", press_and_list },
+    { "boot_rollover", boot_rollover },
+    { "wire_rollover", wire_rollover },
+    { "wire_to_boot", wire_to_boot },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,288 @@
+// Unit tests for pacing forwarded input, see link_pacing.h, on simulated
+// clocks: the offset estimate from ticks through drift and a restart of the
+// peer, placing 16 bit stamps, the due times the pacer gives and the edges
+// of the latency histogram.
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "link_pacing.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+// The peer's clock on the local one, which starts just short of the 32 bit
+// wrap: offset_us ahead at the start and gaining ppm from there.
+struct peer_clock
+{
+  uint32_t offset_us;
+  int ppm;
+};
+
+static const int64_t START_US = 0xffff0000ll;
+
+static uint32_t peer_time(const peer_clock &p, int64_t local_us)
+{
+  return (uint32_t) (p.offset_us + local_us + (local_us - START_US) * p.ppm / 1000000);
+}
+
+// the offset the estimate should have at local_us
+static uint32_t true_offset(const peer_clock &p, int64_t local_us)
+{
+  return peer_time(p, local_us) - (uint32_t) local_us;
+}
+
+// One exchange: a tick sent at local_us takes out_us to reach the peer,
+// which holds it for held_us of local time and answers with a tick taking
+// back_us to arrive. Returns when the answer arrives.
+static int64_t exchange(link_clock *c, const peer_clock &p, int64_t local_us, int out_us, int held_us, int back_us)
+{
+  int64_t peer_received = local_us + out_us;
+  int64_t peer_sent = peer_received + held_us;
+  link_tick_time t;
+  t.sent_us = peer_time(p, peer_sent);
+  t.echo_us = (uint32_t) local_us;
+  t.held_us = peer_time(p, peer_sent) - peer_time(p, peer_received);
+  int64_t received = peer_sent + back_us;
+  link_clock_sample(c, &t, (uint32_t) received);
+  return received;
+}
+
+static int32_t offset_error(const link_clock &c, const peer_clock &p, int64_t local_us)
+{
+  return (int32_t) (c.offset_us - true_offset(p, local_us));
+}
+
+// With the same time on the wire each way the offset is exact, whatever the
+// peer held the tick for, and the round trip is both wire times.
+static void offset_from_ticks()
+{
+  peer_clock p = { 123456789, 0 };
+  link_clock c = {};
+  int64_t at = exchange(&c, p, START_US, 150, 2500, 150);
+  CHECK(c.valid);
+  CHECK_EQ(c.samples, 1);
+  CHECK_EQ(c.round_trip_us, 300);
+  CHECK_EQ(offset_error(c, p, at), 0);
+
+  // the wire time out and back is split evenly, so half the difference
+  link_clock skewed = {};
+  at = exchange(&skewed, p, START_US, 100, 500, 300);
+  CHECK_EQ(skewed.round_trip_us, 400);
+  CHECK_EQ(offset_error(skewed, p, at), -100);
+
+  // a longer round trip doesn't replace a recent shorter one
+  exchange(&c, p, at, 100, 500, 900);
+  CHECK_EQ(c.samples, 2);
+  CHECK_EQ(c.round_trip_us, 300 + CLOCK_AGE_US);
+  CHECK_EQ(offset_error(c, p, at), 0);
+}
+
+// ticks the estimate must not take
+static void bad_ticks_ignored()
+{
+  peer_clock p = { 5000, 0 };
+  link_clock c = {};
+  // before the peer had a tick to echo
+  link_tick_time t = { peer_time(p, START_US), 0, TICK_NO_ECHO };
+  link_clock_sample(&c, &t, (uint32_t) START_US + 100);
+  CHECK(!c.valid);
+  CHECK_EQ(c.samples, 0);
+  // held longer than the tick has been gone
+  t = { peer_time(p, START_US + 500), (uint32_t) START_US, 1000 };
+  link_clock_sample(&c, &t, (uint32_t) START_US + 600);
+  CHECK(!c.valid);
+  // an echo from before a restart, far too long ago
+  t = { peer_time(p, START_US + 30000), (uint32_t) START_US, 100 };
+  link_clock_sample(&c, &t, (uint32_t) START_US + 30000 + CLOCK_MAX_ROUND_TRIP_US);
+  CHECK(!c.valid);
+  CHECK_EQ(c.samples, 0);
+}
+
+// Clocks drifting 100 ppm apart either way move 2 ms over the 20 s of ticks
+// run here. With the wire time jittering the estimate stays within the
+// jitter and the drift over a few ticks of the true offset.
+static void follows_drift()
+{
+  static const int drifts[] = { 100, -100, 0 };
+  srand(1);
+  for (int ppm : drifts)
+  {
+    peer_clock p = { 0x80000000u, ppm };
+    link_clock c = {};
+    int64_t now = START_US;
+    int32_t worst = 0;
+    for (int i = 0; i < 2000; ++i)
+    {
+      int64_t at = exchange(&c, p, now, 100 + rand() % 200, 500 + rand() % 3000, 100 + rand() % 200);
+      int32_t error = offset_error(c, p, at);
+      worst = error > worst ? error : -error > worst ? -error : worst;
+      now += 10000;
+    }
+    if (!CHECK(worst <= 150))
+    {
+      fprintf(stderr, "%d ppm: off by %d us\n", ppm, worst);
+    }
+    CHECK_EQ(c.samples, 2000);
+  }
+}
+
+// A peer that starts again jumps its clock. Its first tick has nothing to
+// echo, and the next is taken at once however long its round trip.
+static void peer_restart()
+{
+  peer_clock p = { 40000, 0 };
+  link_clock c = {};
+  int64_t now = START_US;
+  for (int i = 0; i < 10; ++i)
+  {
+    now = exchange(&c, p, now, 100, 1000, 100) + 10000;
+  }
+  CHECK_EQ(c.round_trip_us, 200);
+
+  peer_clock restarted = { 0, 0 };
+  restarted.offset_us = (uint32_t) -START_US - 1000000;
+  link_tick_time first = { peer_time(restarted, now), 0, TICK_NO_ECHO };
+  link_clock_sample(&c, &first, (uint32_t) now + 100);
+  CHECK_EQ(offset_error(c, p, now), 0);
+
+  int64_t at = exchange(&c, restarted, now + 1000, 400, 1000, 400);
+  CHECK_EQ(c.round_trip_us, 800);
+  CHECK_EQ(offset_error(c, restarted, at), 0);
+
+  // the board itself forgets the peer's clock and its last tick
+  host_board_init(0);
+  uint32_t received = (uint32_t) host_now_us();
+  link_tick_time t = { 1000, received - 300, 0 };
+  link_pacing_tick_received(&t, received);
+  CHECK(link_pacing_clock().valid);
+  link_tick_time sent;
+  link_pacing_tick_time(&sent);
+  CHECK_EQ(sent.echo_us, 1000);
+  CHECK(sent.held_us != TICK_NO_ECHO);
+
+  link_pacing_peer_restarted();
+  CHECK(!link_pacing_clock().valid);
+  CHECK_EQ(link_pacing_clock().samples, 0);
+  link_pacing_tick_time(&sent);
+  CHECK_EQ(sent.held_us, TICK_NO_ECHO);
+}
+
+// Stamps up to half the 65 ms wrap old are placed on the local clock, and a
+// little way ahead for an estimate that is slightly off.
+static void capture_time()
+{
+  link_clock c = {};
+  uint32_t capture = 0;
+  CHECK(!link_clock_capture_time(&c, 0, 1000, &capture));
+
+  c.valid = true;
+  c.offset_us = 0x7fff1234;
+  static const uint32_t received[] = { 5000, 0xfffffff0, 0x12345678 };
+  static const int ages[] = { 0, 1, 4000, 32767, -1, -(int) PACE_AHEAD_US };
+  for (uint32_t r : received)
+  {
+    for (int age : ages)
+    {
+      uint16_t stamp = (uint16_t) (r + c.offset_us - age);
+      bool placed = link_clock_capture_time(&c, stamp, r, &capture);
+      if (!CHECK(placed && capture == r - age))
+      {
+        fprintf(stderr, "received %lx age %d\n", (unsigned long) r, age);
+      }
+    }
+    // further ahead is a bad estimate, and older than half the wrap looks ahead
+    CHECK(!link_clock_capture_time(&c, (uint16_t) (r + c.offset_us + PACE_AHEAD_US + 1), r, &capture));
+    CHECK(!link_clock_capture_time(&c, (uint16_t) (r + c.offset_us - 32768), r, &capture));
+  }
+}
+
+// The delay rises at once to the slowest crossing and falls back by a 64th
+// of the slack each report, reports never go out of order and one slower
+// than PACE_MAX_DELAY_US goes out as it arrives.
+static void pacer_due()
+{
+  link_pacer p = {};
+  bool late;
+  uint32_t capture = 0xffffff00; // across the wrap
+  CHECK_EQ(link_pacer_due(&p, capture, capture + 1000, &late), capture + 1000);
+  CHECK(!late);
+  CHECK_EQ(p.delay_us, 1000);
+
+  capture += 1000;
+  CHECK_EQ(link_pacer_due(&p, capture, capture + 200, &late), capture + 1000 - (800 >> PACE_DECAY_SHIFT));
+  CHECK_EQ(p.delay_us, 1000 - (800 >> PACE_DECAY_SHIFT));
+
+  uint32_t delay = p.delay_us;
+  capture += 1000;
+  CHECK_EQ(link_pacer_due(&p, capture, capture + PACE_MAX_DELAY_US + 1, &late), capture + PACE_MAX_DELAY_US + 1);
+  CHECK(late);
+  CHECK_EQ(p.delay_us, delay);
+
+  // right at the limit is still paced, and sets the delay
+  capture += 10000;
+  CHECK_EQ(link_pacer_due(&p, capture, capture + PACE_MAX_DELAY_US, &late), capture + PACE_MAX_DELAY_US);
+  CHECK(!late);
+  CHECK_EQ(p.delay_us, PACE_MAX_DELAY_US);
+
+  // captured earlier than the last but received after it, so held to its time
+  uint32_t last = p.last_due_us;
+  CHECK_EQ(link_pacer_due(&p, capture - 3000, capture + 1000, &late), last);
+  CHECK(!late);
+
+  // a stamp placed after it arrived counts as no time on the way
+  link_pacer fresh = {};
+  CHECK_EQ(link_pacer_due(&fresh, 5000, 4000, &late), 5000);
+  CHECK(!late);
+  CHECK_EQ(fresh.delay_us, 0);
+}
+
+// hist[n] counts latencies from 2^(n-1) up to below 2^n us, zero in hist[0]
+// and everything from 2^14 us in the last
+static void histogram_buckets()
+{
+  struct edge
+  {
+    uint32_t us;
+    int bucket;
+  };
+  static const edge edges[] = {
+    { 0, 0 },
+    { 1, 1 },
+    { 2, 2 },
+    { 3, 2 },
+    { 1023, 10 },
+    { 1024, 11 },
+    { PACE_MAX_DELAY_US, 12 },
+    { (1u << 14) - 1, 14 },
+    { 1u << 14, 15 },
+    { 1u << 15, PACE_BUCKETS - 1 },
+    { 0xffffffff, PACE_BUCKETS - 1 },
+  };
+  for (const edge &e : edges)
+  {
+    uint32_t hist[PACE_BUCKETS] = {};
+    pace_histogram_add(hist, e.us);
+    for (int b = 0; b < PACE_BUCKETS; ++b)
+    {
+      if (!CHECK_EQ(hist[b], b == e.bucket ? 1 : 0))
+      {
+        fprintf(stderr, "%lu us in bucket %d\n", (unsigned long) e.us, b);
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "offset_from_ticks", offset_from_ticks },
+    { "bad_ticks_ignored", bad_ticks_ignored },
+    { "follows_drift", follows_drift },
+    { "peer_restart", peer_restart },
+    { "capture_time", capture_time },
+    { "pacer_due", pacer_due },
+    { "histogram_buckets", histogram_buckets },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,158 @@
+// Unit tests for the mouse report conversions in mouse_state.h and
+// hid_parser.h: wheel counts to units and back at either resolution, and
+// x and y wider than a report carries.
+
+#include <string.h>
+
+#include "hid_parser.h"
+#include "mouse_state.h"
+#include "usb_descriptors.h"
+
+#include "host_test.h"
+
+// three buttons, 16 bit x and y, and a wheel with a resolution multiplier
+// of 8 counts per detent in its logical collection, no report id
+static const uint8_t wide_mouse_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01,
+  0x09, 0x01, 0xA1, 0x00,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x03, 0x81, 0x02,
+  0x75, 0x05, 0x95, 0x01, 0x81, 0x03,
+  0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, 0x81, 0x06,
+  0xA1, 0x02,
+  0x09, 0x48, 0x15, 0x00, 0x25, 0x01, 0x35, 0x01, 0x45, 0x08, 0x75, 0x08, 0x95, 0x01, 0xB1, 0x02,
+  0x35, 0x00, 0x45, 0x00,
+  0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06,
+  0xC0,
+  0xC0,
+  0xC0,
+};
+
+static void wide_report(uint8_t *report, int16_t x, int16_t y, int8_t wheel)
+{
+  report[0] = 0;
+  memcpy(report + 1, &x, 2);
+  memcpy(report + 3, &y, 2);
+  report[5] = (uint8_t) wheel;
+}
+
+static void parse_wide_mouse()
+{
+  hid_mouse_layout layout;
+  CHECK(hid_parse_mouse(wide_mouse_desc, sizeof(wide_mouse_desc), &layout));
+  CHECK_EQ(layout.report_id, 0);
+  CHECK_EQ(layout.x.size, 16);
+  CHECK(layout.x.is_signed);
+  CHECK_EQ(layout.y.bit_offset, 24);
+  CHECK_EQ(layout.wheel.bit_offset, 40);
+  CHECK_EQ(layout.wheel_multiplier, 8);
+  CHECK_EQ(layout.feature_len, 1);
+  CHECK_EQ(layout.feature[0], 1);
+}
+
+// motion past int8 goes out with the next reports, none of it lost
+static void motion_carried()
+{
+  hid_mouse_layout layout;
+  hid_parse_mouse(wide_mouse_desc, sizeof(wide_mouse_desc), &layout);
+  motion_accumulator motion = {};
+  uint8_t report[6];
+  mouse_state state;
+  int x = 0;
+  int y = 0;
+  wide_report(report, 300, -200, 0);
+  CHECK(hid_mouse_to_state(&layout, report, sizeof(report), false, &motion, &state));
+  CHECK_EQ(state.x, 127);
+  CHECK_EQ(state.y, -127);
+  x += state.x;
+  y += state.y;
+  wide_report(report, 0, 0, 0);
+  for (int i = 0; i < 2; ++i)
+  {
+    hid_mouse_to_state(&layout, report, sizeof(report), false, &motion, &state);
+    x += state.x;
+    y += state.y;
+  }
+  CHECK_EQ(x, 300);
+  CHECK_EQ(y, -200);
+  CHECK_EQ(motion.x, 0);
+  CHECK_EQ(motion.y, 0);
+
+  // small motion passes straight through
+  wide_report(report, -5, 3, 0);
+  hid_mouse_to_state(&layout, report, sizeof(report), false, &motion, &state);
+  CHECK_EQ(state.x, -5);
+  CHECK_EQ(state.y, 3);
+}
+
+// one count is a detent until the multiplier is set, then an eighth
+static void wheel_units()
+{
+  hid_mouse_layout layout;
+  hid_parse_mouse(wide_mouse_desc, sizeof(wide_mouse_desc), &layout);
+  motion_accumulator motion = {};
+  uint8_t report[6];
+  mouse_state state;
+  wide_report(report, 0, 0, 1);
+  hid_mouse_to_state(&layout, report, sizeof(report), false, &motion, &state);
+  CHECK_EQ(state.wheel, WHEEL_UNITS_PER_DETENT);
+  wide_report(report, 0, 0, -2);
+  hid_mouse_to_state(&layout, report, sizeof(report), true, &motion, &state);
+  CHECK_EQ(state.wheel, -2 * WHEEL_UNITS_PER_DETENT / 8);
+
+  hid_mouse_report_t boot = { 0, 1, 2, -1, 0 };
+  mouse_state_from_boot(&state, &boot);
+  CHECK_EQ(state.wheel, -WHEEL_UNITS_PER_DETENT);
+  CHECK_EQ(wheel_to_units(INT16_MAX, 1), INT16_MAX);
+}
+
+// a computer without high resolution scrolling gets a detent per eight
+// eighths, one with it gets each eighth as its share of its own multiplier
+static void wheel_accumulated()
+{
+  int32_t eighth = WHEEL_UNITS_PER_DETENT / 8;
+  wheel_accumulator acc = {};
+  int detents = 0;
+  for (int i = 0; i < 7; ++i)
+  {
+    detents += wheel_accumulate(&acc, eighth, 1);
+  }
+  CHECK_EQ(detents, 0);
+  CHECK_EQ(wheel_accumulate(&acc, eighth, 1), 1);
+  CHECK_EQ(acc.units, 0);
+
+  wheel_accumulator high = {};
+  CHECK_EQ(wheel_accumulate(&high, eighth, MOUSE_WHEEL_MULTIPLIER), eighth);
+  CHECK_EQ(wheel_accumulate(&high, -3 * WHEEL_UNITS_PER_DETENT, MOUSE_WHEEL_MULTIPLIER),
+    -3 * WHEEL_UNITS_PER_DETENT);
+  // a multiplier the units can't be split into is taken as none
+  CHECK_EQ(wheel_accumulate(&high, WHEEL_UNITS_PER_DETENT, 1000), 1);
+}
+
+// turning back drops the part detent instead of cancelling the first step
+static void wheel_reversed()
+{
+  int32_t eighth = WHEEL_UNITS_PER_DETENT / 8;
+  wheel_accumulator acc = {};
+  for (int i = 0; i < 5; ++i)
+  {
+    wheel_accumulate(&acc, eighth, 1);
+  }
+  int detents = 0;
+  for (int i = 0; i < 8; ++i)
+  {
+    detents += wheel_accumulate(&acc, -eighth, 1);
+  }
+  CHECK_EQ(detents, -1);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "parse_wide_mouse", parse_wide_mouse },
+    { "motion_carried", motion_carried },
+    { "wheel_units", wheel_units },
+    { "wheel_accumulated", wheel_accumulated },
+    { "wheel_reversed", wheel_reversed },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,178 @@
+// Unit tests for the loop probes, see profile.h, timed by the fake SysTick:
+// the min/max/mean and log2 histogram profile_record keeps, a scope across
+// the 24 bit wrap, and the dump and reset on the cdc port.
+
+#include <string>
+#include <vector>
+
+#include "profile.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static void setup()
+{
+  host_board_init(0);
+  host_cdc_set_reading(true);
+  host_usb_mount();
+  host_run();
+  profile_reset();
+  host_cdc_take_sent();
+}
+
+static std::string cdc_command(char c)
+{
+  host_cdc_receive((const uint8_t *) &c, 1);
+  host_run();
+  std::vector<uint8_t> sent = host_cdc_take_sent();
+  return std::string(sent.begin(), sent.end());
+}
+
+#if PROFILE_ENABLED
+
+// the probe no loop pass records without a device attached
+static const ProfileProbe PROBE = PROBE_HID_REPORT_CB;
+
+// times a scope the SysTick counts the given cycles through
+static void time_scope(uint32_t cycles)
+{
+  PROFILE_SCOPE(PROBE);
+  host_systick_count(cycles);
+}
+
+static void min_max_mean()
+{
+  setup();
+  const profile_probe *p = profile_get(PROBE);
+  CHECK_EQ(p->count, 0);
+
+  static const uint32_t times[] = { 500, 120, 9000, 121, 3000 };
+  uint64_t total = 0;
+  for (uint32_t t : times)
+  {
+    profile_record(PROBE, t);
+    total += t;
+  }
+  CHECK_EQ(p->count, 5);
+  CHECK_EQ(p->min_cycles, 120);
+  CHECK_EQ(p->max_cycles, 9000);
+  CHECK_EQ(p->total_cycles, total);
+
+  // a first time of zero is the minimum, not an unset one
+  profile_reset();
+  profile_record(PROBE, 0);
+  profile_record(PROBE, 7);
+  CHECK_EQ(p->min_cycles, 0);
+  CHECK_EQ(p->max_cycles, 7);
+}
+
+// hist[n] counts times from 2^(n-1) up to below 2^n, zero in hist[0] and the
+// longest a 24 bit SysTick can time in the last bucket
+static void histogram_buckets()
+{
+  setup();
+  const profile_probe *p = profile_get(PROBE);
+  struct edge
+  {
+    uint32_t cycles;
+    int bucket;
+  };
+  static const edge edges[] = {
+    { 0, 0 },
+    { 1, 1 },
+    { 2, 2 },
+    { 3, 2 },
+    { 4, 3 },
+    { 255, 8 },
+    { 256, 9 },
+    { (1u << 23) - 1, 23 },
+    { 1u << 23, 24 },
+    { 0xffffff, 24 },
+    { 0xffffffff, PROFILE_BUCKETS - 1 },
+  };
+  for (const edge &e : edges)
+  {
+    profile_reset();
+    profile_record(PROBE, e.cycles);
+    for (int b = 0; b < PROFILE_BUCKETS; ++b)
+    {
+      if (!CHECK_EQ(p->hist[b], b == e.bucket ? 1 : 0))
+      {
+        fprintf(stderr, "%lu cycles in bucket %d\n", (unsigned long) e.cycles, b);
+      }
+    }
+  }
+}
+
+// a scope sees the cycles the SysTick counted down through, across the
+// reload as well
+static void scope_timed_by_systick()
+{
+  setup();
+  const profile_probe *p = profile_get(PROBE);
+  time_scope(1000);
+  time_scope(3);
+  CHECK_EQ(p->count, 2);
+  CHECK_EQ(p->min_cycles, 3);
+  CHECK_EQ(p->max_cycles, 1000);
+
+  // from just above zero the count wraps to the reload value
+  host_systick_count(systick_hw->cvr - 10);
+  CHECK_EQ(systick_hw->cvr, 10);
+  time_scope(50);
+  CHECK_EQ(systick_hw->cvr, 0xffffff - 39);
+  CHECK_EQ(p->max_cycles, 1000);
+  CHECK_EQ(p->min_cycles, 3);
+  CHECK_EQ(p->total_cycles, 1053);
+  CHECK_EQ(p->hist[6], 1);
+}
+
+// 'p' prints each probe with its histogram and 'P' clears them all
+static void dump_and_reset()
+{
+  setup();
+  profile_record(PROBE, 100);
+  profile_record(PROBE, 300);
+  profile_record(PROBE, 1000);
+  std::string text = cdc_command('p');
+  CHECK(text.find("hid_report_cb n 3 min 100 mean 466 max 1000 cycles") != std::string::npos);
+  CHECK(text.find(" <2^7:1 <2^9:1 <2^10:1\r\n") != std::string::npos);
+  CHECK(text.find("uart_irq ") != std::string::npos);
+
+  cdc_command('P');
+  const profile_probe *p = profile_get(PROBE);
+  CHECK_EQ(p->count, 0);
+  CHECK_EQ(p->max_cycles, 0);
+  CHECK_EQ(p->total_cycles, 0);
+  int used = 0;
+  for (int b = 0; b < PROFILE_BUCKETS; ++b)
+  {
+    used += p->hist[b] != 0;
+  }
+  CHECK_EQ(used, 0);
+  text = cdc_command('p');
+  CHECK(text.find("hid_report_cb n 0 min 0 mean 0 max 0 cycles") != std::string::npos);
+}
+
+#else
+
+static void dump_and_reset()
+{
+  setup();
+  CHECK(cdc_command('p').find("profiling not enabled") != std::string::npos);
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+#if PROFILE_ENABLED
+    { "min_max_mean", min_max_mean },
+    { "histogram_buckets", histogram_buckets },
+    { "scope_timed_by_systick", scope_timed_by_systick },
+#endif
+    { "dump_and_reset", dump_and_reset },
+  };
+  return host_test_main(cases, argc, argv);
+}
@@ -0,0 +1,213 @@
+// Unit tests for the host report queue, see report_queue.h, and for the
+// callback timing around it: the transfer is re-armed before any processing,
+// a 1000Hz mouse loses no polls, and hid_task leaves tuh_task its turn.
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "common.h"
+#include "report_cache.h"
+#include "report_queue.h"
+#include "usb_descriptors.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+
+static void drain()
+{
+  queued_report q;
+  while (report_queue_pop(&q))
+  {
+  }
+  report_queue_reset_stats();
+}
+
+static bool push(uint8_t dev_addr, uint8_t value)
+{
+  return report_queue_push(dev_addr, 0, HID_ITF_PROTOCOL_NONE, true, &value, 1, value);
+}
+
+// first in first out, and a full queue drops the newest
+static void order_and_overflow()
+{
+  host_board_init(0);
+  drain();
+  int pushed = 0;
+  while (push(MOUSE_ADDR, (uint8_t) pushed) && pushed < 100)
+  {
+    pushed++;
+  }
+  CHECK_EQ(pushed, 16);
+  report_queue_stats s = report_queue_get_stats();
+  CHECK_EQ(s.reports, 16);
+  CHECK_EQ(s.overflows, 1);
+  CHECK_EQ(s.high_water, 16);
+  queued_report q;
+  for (int i = 0; i < pushed; ++i)
+  {
+    CHECK(report_queue_pop(&q));
+    CHECK_EQ(q.data[0], i);
+    CHECK_EQ(q.capture_us, (uint64_t) i);
+  }
+  CHECK(!report_queue_pop(&q));
+}
+
+// only the last report of each interface and report id stays, in order
+static void keep_latest()
+{
+  host_board_init(0);
+  drain();
+  push(KEYBOARD_ADDR, REPORT_ID_KEYBOARD);
+  push(MOUSE_ADDR, REPORT_ID_MOUSE);
+  push(KEYBOARD_ADDR, REPORT_ID_CONSUMER_CONTROL);
+  push(MOUSE_ADDR, REPORT_ID_MOUSE);
+  push(KEYBOARD_ADDR, REPORT_ID_KEYBOARD);
+  report_queue_keep_latest();
+  std::vector<uint8_t> kept;
+  queued_report q;
+  while (report_queue_pop(&q))
+  {
+    kept.push_back(q.dev_addr);
+    kept.push_back(q.data[0]);
+  }
+  std::vector<uint8_t> expected = { KEYBOARD_ADDR, REPORT_ID_CONSUMER_CONTROL, MOUSE_ADDR, REPORT_ID_MOUSE,
+    KEYBOARD_ADDR, REPORT_ID_KEYBOARD };
+  CHECK(kept == expected);
+}
+
+// a report more than a poll late is a gap, a device going quiet isn't
+static void poll_gaps()
+{
+  host_board_init(0);
+  drain();
+  uint64_t t = 1000000;
+  report_queue_note_poll(MOUSE_ADDR, 0, t, 5);
+  report_queue_note_poll(MOUSE_ADDR, 0, t += 1000, 5);
+  report_queue_note_poll(MOUSE_ADDR, 0, t += 1400, 5);
+  CHECK_EQ(report_queue_get_stats().poll_gaps, 0);
+  report_queue_note_poll(MOUSE_ADDR, 0, t += 3000, 40);
+  report_queue_note_poll(MOUSE_ADDR, 0, t += 50000, 5);
+  // other interfaces are timed on their own
+  report_queue_note_poll(KEYBOARD_ADDR, 0, t += 1000, 5);
+  report_queue_stats s = report_queue_get_stats();
+  CHECK_EQ(s.poll_gaps, 1);
+  CHECK_EQ(s.max_gap_us, 3000);
+  CHECK_EQ(s.max_rearm_us, 40);
+}
+
+static void board_setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  if (!should_output())
+  {
+    toggle_output();
+  }
+  for (int i = 0; i < 4; ++i)
+  {
+    host_advance_us(1000);
+    host_run();
+  }
+  host_uart_take_sent();
+  host_usb_clear_reports();
+  drain();
+}
+
+// A mouse in motion reporting every frame while the reports are forwarded
+// to the computer: each is re-armed at once and none is late. It goes right
+// and back in turns so an edge switch build keeps the pointer on screen.
+static void mouse_1000hz()
+{
+  board_setup();
+  // half way between the computer's polls of this board
+  host_advance_us(1500 - host_now_us() % 1000);
+  for (int i = 0; i < 1000; ++i)
+  {
+    uint64_t next = host_now_us() + 1000;
+    int8_t dx = i / 100 % 2 == 0 ? 3 : -3;
+    hid_mouse_report_t r = { (uint8_t) (i / 100 % 2), dx, -1, 0, 0 };
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+    host_run();
+    host_advance_us(next - 500 - host_now_us());
+    host_run();
+    host_advance_us(next - host_now_us());
+  }
+  report_queue_stats s = report_queue_get_stats();
+  CHECK_EQ(s.reports, 1000);
+  CHECK_EQ(s.overflows, 0);
+  CHECK_EQ(s.poll_gaps, 0);
+  CHECK_EQ(s.high_water, 1);
+  CHECK(s.max_rearm_us < 50);
+
+  // and all the motion reaches the computer
+  for (int i = 0; i < 4; ++i)
+  {
+    host_advance_us(1000);
+    host_run();
+  }
+  int x = 0;
+  int travel = 0;
+  for (const host_usb_report &u : host_usb_reports())
+  {
+    if (u.data.size() >= 3 && u.data[0] == REPORT_ID_MOUSE)
+    {
+      x += (int8_t) u.data[2];
+      travel += abs((int8_t) u.data[2]);
+    }
+  }
+  CHECK(should_output());
+  // the absolute pointer carries positions instead of motion
+  if (report_cache_mouse_report_id() == REPORT_ID_MOUSE)
+  {
+    CHECK_EQ(x, 0);
+    CHECK_EQ(travel, 3000);
+  }
+}
+
+// Reports that pile up while core1 was busy are processed a few per pass,
+// with tuh_task run in between, and all of them get through.
+static void bounded_passes()
+{
+  board_setup();
+  for (int i = 0; i < 10; ++i)
+  {
+    hid_keyboard_report_t r = { 0, 0, { (uint8_t) (i % 2 == 0 ? HID_KEY_A : 0) } };
+    host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &r, sizeof(r));
+  }
+  CHECK_EQ(report_queue_get_stats().high_water, 10);
+  core1_poll();
+  std::vector<queued_report> left;
+  queued_report q;
+  while (report_queue_pop(&q))
+  {
+    left.push_back(q);
+  }
+  CHECK_EQ(left.size(), 6);
+  for (const queued_report &l : left)
+  {
+    report_queue_push(l.dev_addr, l.instance, l.protocol, l.report_protocol, l.data, l.len, l.capture_us);
+  }
+  core1_poll();
+  core1_poll();
+  CHECK(!report_queue_pop(&q));
+  CHECK_EQ(report_queue_get_stats().overflows, 0);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "order_and_overflow", order_and_overflow },
+    { "keep_latest", keep_latest },
+    { "poll_gaps", poll_gaps },
+    { "mouse_1000hz", mouse_1000hz },
+    { "bounded_passes", bounded_passes },
+  };
+  return host_test_main(cases, argc, argv);
+}
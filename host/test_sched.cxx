@@ -0,0 +1,191 @@
+// Unit tests for the core0 scheduler, see sched.h: pending tasks run in task
+// order, once per post, periodic ones from their deadlines without bursts,
+// and the run and wait times are measured.
+
+#include <vector>
+
+#include "hardware/watchdog.h"
+
+#include "sched.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static std::vector<int> ran;
+
+// the board's own tasks are taken out, each test adds the ones it needs
+static void setup()
+{
+  host_board_init(0);
+  sched_init();
+  for (int id = 0; id < TASK_COUNT; ++id)
+  {
+    sched_add((SchedTask) id, "none", nullptr, 0);
+  }
+  ran.clear();
+}
+
+static void usb_task()
+{
+  ran.push_back(TASK_USB);
+}
+
+static void led_task()
+{
+  ran.push_back(TASK_LED);
+}
+
+static void uart_tx_task()
+{
+  ran.push_back(TASK_UART_TX);
+}
+
+static void watchdog_task()
+{
+  ran.push_back(TASK_WATCHDOG);
+}
+
+// posts a task before it and one after it
+static void click_task()
+{
+  ran.push_back(TASK_CLICK);
+  sched_post(TASK_USB);
+  sched_post(TASK_UART_TX);
+}
+
+static void cdc_task()
+{
+  host_advance_us(200);
+}
+
+static void config_task()
+{
+  host_advance_us(100);
+}
+
+static void add_recording()
+{
+  sched_add(TASK_USB, "usb", usb_task, 0);
+  sched_add(TASK_LED, "led", led_task, 0);
+  sched_add(TASK_UART_TX, "uart tx", uart_tx_task, 0);
+}
+
+// lower numbered tasks first, whatever order they were posted in, and a
+// task posted twice before it runs runs once
+static void priority_order()
+{
+  setup();
+  add_recording();
+  CHECK(!sched_run_pending());
+  sched_post(TASK_UART_TX);
+  sched_post(TASK_LED);
+  sched_post(TASK_USB);
+  sched_post(TASK_LED);
+  CHECK(sched_run_pending());
+  std::vector<int> expected = { TASK_USB, TASK_LED, TASK_UART_TX };
+  CHECK(ran == expected);
+  CHECK(!sched_run_pending());
+  CHECK_EQ(watchdog_hw->scratch[2], 0);
+}
+
+// a task posting another, before or after it, gets it run on the next pass
+static void posted_while_running()
+{
+  setup();
+  add_recording();
+  sched_add(TASK_CLICK, "click", click_task, 0);
+  sched_post(TASK_CLICK);
+  CHECK(sched_run_pending());
+  CHECK_EQ(ran.size(), 1);
+  CHECK(sched_run_pending());
+  std::vector<int> expected = { TASK_CLICK, TASK_USB, TASK_UART_TX };
+  CHECK(ran == expected);
+  CHECK(!sched_run_pending());
+}
+
+// a periodic task runs at each deadline, and once only after falling behind
+static void periodic()
+{
+  setup();
+  sched_add(TASK_WATCHDOG, "watchdog", watchdog_task, 1000);
+  host_advance_us(999);
+  CHECK(!sched_run_pending());
+  host_advance_us(1);
+  CHECK(sched_run_pending());
+  CHECK_EQ(ran.size(), 1);
+  host_advance_us(5500);
+  sched_run_pending();
+  CHECK(!sched_run_pending());
+  CHECK_EQ(ran.size(), 2);
+  host_advance_us(999);
+  CHECK(!sched_run_pending());
+  host_advance_us(1);
+  CHECK(sched_run_pending());
+  CHECK_EQ(ran.size(), 3);
+
+  // a period of zero stops it
+  sched_set_period(TASK_WATCHDOG, 0);
+  host_advance_us(5000);
+  CHECK(!sched_run_pending());
+}
+
+// a one off deadline keeps the earliest asked for and runs once
+static void post_at()
+{
+  setup();
+  add_recording();
+  uint64_t now = host_now_us();
+  sched_post_at(TASK_LED, now + 3000);
+  sched_post_at(TASK_LED, now + 1000);
+  sched_post_at(TASK_LED, now + 2000);
+  host_advance_us(999);
+  CHECK(!sched_run_pending());
+  host_advance_us(1);
+  CHECK(sched_run_pending());
+  host_advance_us(5000);
+  CHECK(!sched_run_pending());
+  CHECK_EQ(ran.size(), 1);
+}
+
+// run time is the task's own, wait time from its post or deadline
+static void stats()
+{
+  setup();
+  sched_add(TASK_CDC, "cdc", cdc_task, 0);
+  sched_add(TASK_CONFIG, "config", config_task, 2000);
+  sched_stats s;
+  CHECK(!sched_get_stats(TASK_USB, &s));
+
+  sched_post(TASK_CDC);
+  host_advance_us(300);
+  sched_run_pending();
+  CHECK(sched_get_stats(TASK_CDC, &s));
+  CHECK_EQ(s.runs, 1);
+  CHECK_EQ(s.avg_run_us, 200);
+  CHECK_EQ(s.max_run_us, 200);
+  CHECK_EQ(s.max_wait_us, 300);
+
+  // 500 late for its deadline, after 300 waiting and the 200 cdc ran
+  host_advance_us(2000);
+  sched_run_pending();
+  CHECK(sched_get_stats(TASK_CONFIG, &s));
+  CHECK_EQ(s.runs, 1);
+  CHECK_EQ(s.max_wait_us, 500);
+
+  sched_reset_stats();
+  CHECK(sched_get_stats(TASK_CDC, &s));
+  CHECK_EQ(s.runs, 0);
+  CHECK_EQ(s.max_wait_us, 0);
+}
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "priority_order", priority_order },
+    { "posted_while_running", posted_while_running },
+    { "periodic", periodic },
+    { "post_at", post_at },
+    { "stats", stats },
+  };
+  return host_test_main(cases, argc, argv);
+}
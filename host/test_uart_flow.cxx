@@ -0,0 +1,327 @@
+// Unit tests for the flow control on the uart, see uart_flow.h, with the
+// test playing the other board: credit, or with UART_RTS_CTS the fake uart's
+// RTS and CTS.
+
+#include <vector>
+
+#include "common.h"
+#include "framing.h"
+#include "hardware/uart.h"
+#include "uart_messages.h"
+
+#include "host_fakes.h"
+#include "host_test.h"
+
+static const uint8_t KEYBOARD_ADDR = 1;
+static const uint8_t MOUSE_ADDR = 2;
+
+// message types, as in uart_messages.cxx
+static const uint8_t MSG_KEYBOARD = 0;
+static const uint8_t MSG_MOUSE = 1;
+static const uint8_t MSG_KEYBOARD_BITMAP = 6;
+static const uint8_t MSG_MOUSE_MOTION = 11;
+static const uint8_t MSG_CREDIT = 12;
+
+static void send_credit(uint8_t flags, uint16_t bytes)
+{
+  frame_encoder<frame_encoded_size(4)> b;
+  b.put_sentinel();
+  b.put(MSG_CREDIT);
+  b.put(flags);
+  b.put_u16(bytes);
+  b.set_crc();
+  b.put_sentinel();
+  host_uart_receive(b.data(), b.size());
+  host_run();
+}
+
+// the payloads of the frames in bytes
+static std::vector<std::vector<uint8_t>> frames(const std::vector<uint8_t> &bytes)
+{
+  std::vector<std::vector<uint8_t>> out;
+  frame_decoder<32> d;
+  for (uint8_t b : bytes)
+  {
+    if (d.feed(b) == FRAME_COMPLETE)
+    {
+      out.emplace_back(d.data(), d.data() + d.size());
+    }
+  }
+  return out;
+}
+
+static void setup()
+{
+  host_board_init(0);
+  host_usb_mount();
+  host_device_attach(KEYBOARD_ADDR, 0, HID_ITF_PROTOCOL_KEYBOARD, nullptr, 0);
+  host_device_attach(MOUSE_ADDR, 0, HID_ITF_PROTOCOL_MOUSE, nullptr, 0);
+  host_run();
+  host_uart_take_sent();
+  uart_flow_reset_stats();
+}
+
+static std::vector<uint8_t> move_mouse(int moves, int8_t x, int8_t y)
+{
+  hid_mouse_report_t move = { 0, x, y, 0, 0 };
+  for (int i = 0; i < moves; ++i)
+  {
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &move, sizeof(move));
+    host_run();
+    host_advance_us(1000);
+  }
+  return host_uart_take_sent();
+}
+
+static int motion_x(const std::vector<uint8_t> &bytes)
+{
+  int x = 0;
+  for (const std::vector<uint8_t> &f : frames(bytes))
+  {
+    if ((f[0] == MSG_MOUSE || f[0] == MSG_MOUSE_MOTION) && f.size() >= 6)
+    {
+      x += (int8_t) f[4];
+    }
+  }
+  return x;
+}
+
+// A peer that keeps up never holds this board back, however much it sends.
+static void keeps_up()
+{
+  setup();
+  send_credit(CREDIT_RESET, 0);
+  std::vector<uint8_t> sent = move_mouse(100, 1, 0);
+  CHECK(sent.size() > (size_t) UART_CREDIT_WINDOW + UART_CREDIT_RESERVE);
+  CHECK_EQ(motion_x(sent), 100);
+  CHECK_EQ(uart_flow_get_stats().waited, 0);
+}
+
+#if !UART_RTS_CTS_ENABLED
+
+// Once GATE_AT bytes wait unread the board asks the peer to hold back, and
+// lets it go again when uart_task has read them all. The bytes are CREDIT
+// from a peer without a reset, which change nothing.
+static void gate_receiver()
+{
+  setup();
+  std::vector<uint8_t> bytes;
+  while (bytes.size() < (size_t) UART_CREDIT_GATE_AT)
+  {
+    frame_encoder<frame_encoded_size(4)> b;
+    b.put_sentinel();
+    b.put(MSG_CREDIT);
+    b.put(0);
+    b.put_u16(0);
+    b.set_crc();
+    b.put_sentinel();
+    bytes.insert(bytes.end(), b.data(), b.data() + b.size());
+  }
+  host_uart_receive(bytes.data(), (int) bytes.size());
+  std::vector<std::vector<uint8_t>> gate = frames(host_uart_take_sent());
+  CHECK(gate.size() == 1 && gate[0][0] == MSG_CREDIT && (gate[0][1] & CREDIT_GATE) != 0);
+
+  host_run();
+  std::vector<std::vector<uint8_t>> lifted = frames(host_uart_take_sent());
+  bool ungated = false;
+  for (const std::vector<uint8_t> &f : lifted)
+  {
+    ungated |= f[0] == MSG_CREDIT && (f[1] & CREDIT_GATE) == 0 && get_u16(&f[2]) == (uint16_t) bytes.size();
+  }
+  CHECK(ungated);
+}
+
+// A peer that stops handing back credit fills the queue. Nothing that
+// matters is lost meanwhile: motion adds up and the last keyboard state
+// goes out once credit comes back.
+static void full_queue()
+{
+  setup();
+  send_credit(CREDIT_RESET | CREDIT_GATE, 0);
+  static const int MOVES = 150;
+  hid_mouse_report_t move = { 0, 1, -1, 0, 0 };
+  for (int i = 0; i < MOVES; ++i)
+  {
+    host_device_report(MOUSE_ADDR, 0, (const uint8_t *) &move, sizeof(move));
+    host_run();
+    host_advance_us(1000);
+  }
+  hid_keyboard_report_t down = { 0, 0, { HID_KEY_A } };
+  hid_keyboard_report_t up = {};
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &down, sizeof(down));
+  host_run();
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &up, sizeof(up));
+  host_run();
+
+  std::vector<uint8_t> sent = host_uart_take_sent();
+  CHECK(sent.size() <= (size_t) UART_CREDIT_WINDOW + UART_CREDIT_RESERVE);
+  uart_flow_stats s = uart_flow_get_stats();
+  CHECK(s.merged > 0);
+  // the count of bytes taken, all of them here
+  for (int i = 0; i < 20; ++i)
+  {
+    send_credit(CREDIT_GATE, (uint16_t) sent.size());
+    std::vector<uint8_t> more = host_uart_take_sent();
+    sent.insert(sent.end(), more.begin(), more.end());
+  }
+
+  int x = 0;
+  int y = 0;
+  std::vector<uint8_t> last_keyboard;
+  for (const std::vector<uint8_t> &f : frames(sent))
+  {
+    if ((f[0] == MSG_MOUSE || f[0] == MSG_MOUSE_MOTION) && f.size() >= 6)
+    {
+      x += (int8_t) f[4];
+      y += (int8_t) f[5];
+    }
+    else if (f[0] == MSG_KEYBOARD || f[0] == MSG_KEYBOARD_BITMAP)
+    {
+      last_keyboard = f;
+    }
+  }
+  CHECK_EQ(x, MOVES);
+  CHECK_EQ(y, -MOVES);
+  // type, stamp, modifier and no keys
+  CHECK(last_keyboard.size() == 4 && last_keyboard[0] == MSG_KEYBOARD && last_keyboard[3] == 0);
+}
+
+// A lost CREDIT leaves bytes waiting. After UART_CREDIT_TIMEOUT_US the
+// board asks for the count, with no credit left for the question, and
+// the answer lets the rest go.
+static void lost_credit()
+{
+  setup();
+  send_credit(CREDIT_RESET | CREDIT_GATE, 0);
+  std::vector<uint8_t> sent = move_mouse(60, 1, 0);
+  CHECK(uart_flow_get_stats().waited > 0);
+
+  host_advance_us(UART_CREDIT_TIMEOUT_US);
+  host_run();
+  bool queried = false;
+  for (const std::vector<uint8_t> &f : frames(host_uart_take_sent()))
+  {
+    queried |= f[0] == MSG_CREDIT && f.size() == 4 && (f[1] & CREDIT_QUERY) != 0;
+  }
+  CHECK(queried);
+  CHECK_EQ(uart_flow_get_stats().timeouts, 1);
+
+  // the answer, what the test took of the first bytes, then the queue drains
+  for (int i = 0; i < 5; ++i)
+  {
+    send_credit(CREDIT_GATE, (uint16_t) sent.size());
+    std::vector<uint8_t> more = host_uart_take_sent();
+    CHECK(i > 0 || !more.empty());
+    sent.insert(sent.end(), more.begin(), more.end());
+  }
+  CHECK_EQ(motion_x(sent), 60);
+}
+
+#else
+
+// what a peer sending only CREDIT frames sends for the ring and then some
+static std::vector<uint8_t> credit_bytes(int at_least)
+{
+  std::vector<uint8_t> bytes;
+  while (bytes.size() < (size_t) at_least)
+  {
+    frame_encoder<frame_encoded_size(4)> b;
+    b.put_sentinel();
+    b.put(MSG_CREDIT);
+    b.put(0);
+    b.put_u16(0);
+    b.set_crc();
+    b.put_sentinel();
+    bytes.insert(bytes.end(), b.data(), b.data() + b.size());
+  }
+  return bytes;
+}
+
+// A full ring stops the receive interrupt and the bytes left in the fifo
+// raise RTS, with no CREDIT sent. Once uart_task has made room the
+// interrupt empties the fifo and RTS drops.
+static void rts_holds_peer()
+{
+  setup();
+  std::vector<uint8_t> bytes = credit_bytes(UART_RX_RING + 32);
+  host_uart_receive(bytes.data(), (int) bytes.size());
+  CHECK(host_uart_rts());
+  CHECK_EQ(uart_flow_get_stats().rx_full, 1);
+
+  for (int i = 0; i < 4 && host_uart_rts(); ++i)
+  {
+    host_run();
+  }
+  CHECK(!host_uart_rts());
+  for (const std::vector<uint8_t> &f : frames(host_uart_take_sent()))
+  {
+    CHECK(f[0] != MSG_CREDIT);
+  }
+  CHECK_EQ(uart_flow_get_stats().timeouts, 0);
+}
+
+// While the peer holds CTS nothing leaves, the fifo fills and the core goes
+// on without waiting for it: motion adds up in the queue and the last
+// keyboard state goes out once CTS is let go.
+static void cts_holds_tx()
+{
+  setup();
+  host_uart_set_cts(true);
+  static const int MOVES = 150;
+  std::vector<uint8_t> sent = move_mouse(MOVES, 1, -1);
+  hid_keyboard_report_t down = { 0, 0, { HID_KEY_A } };
+  hid_keyboard_report_t up = {};
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &down, sizeof(down));
+  host_run();
+  host_device_report(KEYBOARD_ADDR, 0, (const uint8_t *) &up, sizeof(up));
+  host_run();
+  CHECK(sent.empty());
+  CHECK(host_uart_take_sent().empty());
+  CHECK(!uart_is_writable(uart0));
+  CHECK(uart_flow_get_stats().merged > 0);
+
+  host_uart_set_cts(false);
+  for (int i = 0; i < 50; ++i)
+  {
+    host_advance_us(1000);
+    host_run();
+  }
+  sent = host_uart_take_sent();
+  int x = 0;
+  int y = 0;
+  std::vector<uint8_t> last_keyboard;
+  for (const std::vector<uint8_t> &f : frames(sent))
+  {
+    if ((f[0] == MSG_MOUSE || f[0] == MSG_MOUSE_MOTION) && f.size() >= 6)
+    {
+      x += (int8_t) f[4];
+      y += (int8_t) f[5];
+    }
+    else if (f[0] == MSG_KEYBOARD || f[0] == MSG_KEYBOARD_BITMAP)
+    {
+      last_keyboard = f;
+    }
+  }
+  CHECK_EQ(x, MOVES);
+  CHECK_EQ(y, -MOVES);
+  CHECK(last_keyboard.size() == 4 && last_keyboard[0] == MSG_KEYBOARD && last_keyboard[3] == 0);
+  CHECK(uart_is_writable(uart0));
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+  static const host_test_case cases[] = {
+    { "keeps_up", keeps_up },
+#if !UART_RTS_CTS_ENABLED
+    { "gate_receiver", gate_receiver },
+    { "full_queue", full_queue },
+    { "lost_credit", lost_credit },
+#else
+    { "rts_holds_peer", rts_holds_peer },
+    { "cts_holds_tx", cts_holds_tx },
+#endif
+  };
+  return host_test_main(cases, argc, argv);
+}
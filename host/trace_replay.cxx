@@ -0,0 +1,110 @@
+// Replays a trace captured with `kbswitch_ctl <tty> trace` into the host
+// build, built with -DHOST_BUILD=ON.
+//
+// usage: kbswitch_replay [-v] <trace>
+//
+// The records go in through the firmware's own replay, as they do when
+// replayed to a board, and every report queued for the computer is printed
+// with its simulated time. The output is the same from run to run, so two
+// builds can be compared by diffing it. -v shows the firmware's printf.
+//
+// No devices are attached, so report protocol records are read with the
+// boot layout. Boot keyboards and mice replay as captured.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "framing.h"
+#include "input_trace.h"
+#include "latency.h"
+
+#include "host_fakes.h"
+
+static const uint64_t STEP_US = 10;
+static const uint64_t SETTLE_US = 100000;
+
+static void print_reports()
+{
+  for (const host_usb_report &r : host_usb_reports())
+  {
+    fprintf(stdout, "%10llu %u", (unsigned long long) r.time_us, r.instance);
+    for (uint8_t b : r.data)
+    {
+      fprintf(stdout, " %02x", b);
+    }
+    fprintf(stdout, "\n");
+  }
+  host_usb_clear_reports();
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "v")) != -1)
+  {
+    if (opt == 'v')
+    {
+      host_set_verbose(true);
+    }
+    else
+    {
+      optind = argc;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    fprintf(stderr, "usage: kbswitch_replay [-v] <trace>\n");
+    return 2;
+  }
+  FILE *f = fopen(argv[optind], "rb");
+  if (f == nullptr)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  std::vector<uint8_t> trace;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    trace.insert(trace.end(), buf, buf + n);
+  }
+  fclose(f);
+  if (trace.size() < 4 || get_u32(trace.data()) != INPUT_TRACE_MAGIC)
+  {
+    fprintf(stderr, "%s is not a trace\n", argv[optind]);
+    return 1;
+  }
+
+  host_board_init(0);
+  host_usb_mount();
+  host_run();
+  host_usb_clear_reports();
+
+  size_t pos = 4;
+  uint64_t idle_since = host_now_us();
+  while (pos < trace.size() || !input_trace_replay_idle() || host_now_us() - idle_since < SETTLE_US)
+  {
+    if (pos < trace.size())
+    {
+      pos += input_trace_replay_feed(&trace[pos], (int) (trace.size() - pos));
+    }
+    if (pos < trace.size() || !input_trace_replay_idle())
+    {
+      idle_since = host_now_us();
+    }
+    host_advance_us(STEP_US);
+    host_run();
+    print_reports();
+  }
+
+  uint32_t captured, lost, replayed;
+  input_trace_stats(&captured, &lost, &replayed);
+  latency_stats s = latency_get(LATENCY_LOCAL);
+  fprintf(stderr, "%u records replayed, latency n %u min %u avg %u max %u us\n", replayed, s.count,
+    s.count != 0 ? s.min_us : 0, s.count != 0 ? (uint32_t) (s.total_us / s.count) : 0, s.max_us);
+  return 0;
+}
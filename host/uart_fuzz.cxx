@@ -0,0 +1,213 @@
+// Fuzzes the uart receive path, built with -DHOST_BUILD=ON.
+//
+// usage: kbswitch_uart_fuzz [-n inputs] [-r seed] [-w dir] [file...]
+//
+// Each input goes through the fake uart in chunks, so through the interrupt,
+// read_pending and uart_task as on the board. Then a good frame is sent
+// twice. Whatever state the input left the decoder in, the first may be
+// lost to it but the second must be taken. Build with -DHOST_SANITIZE=ON to
+// catch memory errors as well.
+//
+// With -DHOST_LIBFUZZER=ON, which needs clang, this is a libFuzzer target
+// and takes libFuzzer's arguments instead. Otherwise it runs the files given,
+// or generated inputs: random bytes, runs of escapes and sentinels and good
+// frames, whole, cut short or with a bit flipped. -w also writes each
+// generated input to a file in dir, which is how host/uart_corpus was made.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include "framing.h"
+#include "key_state.h"
+#include "uart_messages.h"
+
+#include "host_fakes.h"
+
+static const size_t CHUNK = 64; // well inside the receive ring
+
+static std::vector<uint8_t> probe;
+
+static void init_board()
+{
+  host_board_init(1);
+  host_usb_mount();
+  host_run();
+  host_uart_take_sent();
+  key_state empty = {};
+  send_uart_kb_report(&empty, host_now_us());
+  probe = host_uart_take_sent();
+}
+
+static void feed(const uint8_t *data, size_t size)
+{
+  for (size_t i = 0; i < size; i += CHUNK)
+  {
+    host_uart_receive(data + i, (int) (size - i < CHUNK ? size - i : CHUNK));
+    host_run();
+  }
+  // anything the input made the firmware send is of no interest
+  host_uart_take_sent();
+  host_cdc_take_sent();
+  host_usb_clear_reports();
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (probe.empty())
+  {
+    init_board();
+  }
+  feed(data, size);
+  feed(probe.data(), probe.size());
+  uart_link_stats before = uart_link_get_stats();
+  feed(probe.data(), probe.size());
+  uart_link_stats after = uart_link_get_stats();
+  if (after.frames != before.frames + 1 || after.rejected != before.rejected)
+  {
+    fprintf(stderr, "frame after %zu bytes of input not taken\n", size);
+    abort();
+  }
+  return 0;
+}
+
+#ifndef KBSWITCH_LIBFUZZER
+
+static std::vector<uint8_t> read_file(const char *path)
+{
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    perror(path);
+    exit(2);
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+  {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+  return data;
+}
+
+static void write_file(const char *dir, long index, const std::vector<uint8_t> &data)
+{
+  char path[256];
+  snprintf(path, sizeof(path), "%s/input%04ld.bin", dir, index);
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr || fwrite(data.data(), 1, data.size(), f) != data.size())
+  {
+    perror(path);
+    exit(2);
+  }
+  fclose(f);
+}
+
+// a few hundred bytes made of pieces picked to upset the decoder
+static std::vector<uint8_t> generate(std::mt19937 *rng)
+{
+  std::vector<uint8_t> input;
+  int pieces = (*rng)() % 8 + 1;
+  for (int p = 0; p < pieces; ++p)
+  {
+    size_t len = (*rng)() % 64 + 1;
+    switch ((*rng)() % 6)
+    {
+      case 0:
+        for (size_t i = 0; i < len; ++i)
+        {
+          input.push_back((uint8_t) (*rng)());
+        }
+        break;
+      case 1:
+        input.insert(input.end(), len, ESCAPE);
+        break;
+      case 2:
+        input.insert(input.end(), len, SENTINEL);
+        break;
+      case 3:
+        for (size_t i = 0; i < len; ++i)
+        {
+          input.push_back((*rng)() % 2 != 0 ? SENTINEL : ESCAPE);
+        }
+        break;
+      default:
+      {
+        key_state keys = {};
+        for (int i = (*rng)() % 24; i > 0; --i)
+        {
+          key_state_press(&keys, (uint8_t) ((*rng)() % NKRO_KEY_COUNT));
+        }
+        send_uart_kb_report(&keys, host_now_us());
+        std::vector<uint8_t> frame = host_uart_take_sent();
+        if ((*rng)() % 2 != 0)
+        {
+          frame.resize((*rng)() % frame.size());
+        }
+        else if ((*rng)() % 2 != 0)
+        {
+          frame[(*rng)() % frame.size()] ^= 1 << ((*rng)() % 8);
+        }
+        input.insert(input.end(), frame.begin(), frame.end());
+      }
+      break;
+    }
+  }
+  return input;
+}
+
+int main(int argc, char **argv)
+{
+  long inputs = 100000;
+  unsigned seed = 1;
+  const char *write_dir = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:w:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': inputs = atol(optarg); break;
+      case 'r': seed = (unsigned) atol(optarg); break;
+      case 'w': write_dir = optarg; break;
+      default:
+        fprintf(stderr, "usage: kbswitch_uart_fuzz [-n inputs] [-r seed] [-w dir] [file...]\n");
+        return 2;
+    }
+  }
+
+  init_board();
+  if (optind < argc)
+  {
+    for (int i = optind; i < argc; ++i)
+    {
+      std::vector<uint8_t> data = read_file(argv[i]);
+      LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    fprintf(stdout, "%d files ok\n", argc - optind);
+    return 0;
+  }
+
+  std::mt19937 rng(seed);
+  uint64_t bytes = 0;
+  for (long i = 0; i < inputs; ++i)
+  {
+    std::vector<uint8_t> data = generate(&rng);
+    bytes += data.size();
+    if (write_dir != nullptr)
+    {
+      write_file(write_dir, i, data);
+    }
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+  }
+  uart_link_stats s = uart_link_get_stats();
+  fprintf(stdout, "%ld inputs, %llu bytes ok: %u frames, %u bad, %u rejected, %u bytes outside frames\n", inputs,
+    (unsigned long long) bytes, s.frames, s.bad_frames, s.rejected, s.bytes_outside);
+  return 0;
+}
+
+#endif
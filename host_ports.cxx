@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pio_usb.h"
+
+#include "cdc_text.h"
+#include "host/hcd.h"
+#include "host_ports.h"
+#include "hot_path.h"
+#include "tusb.h"
+
+// Everything but the load figures is only touched from the host stack's
+// callbacks on core1. Core0 reads the counters for printing, which can be
+// slightly inconsistent.
+
+static const uint8_t ROLE_KEYBOARD = 0x01;
+static const uint8_t ROLE_MOUSE = 0x02;
+
+struct mounted_device
+{
+  uint8_t port;      // root port, 0 when not mounted
+  uint8_t hub_addr;  // 0 when on the root port itself
+  uint8_t instances; // bit n set for each mounted hid interface
+  uint8_t roles;
+};
+
+static mounted_device devices[HOST_PORT_DEVICE_MAX];
+static uint32_t port_reports[HOST_PORT_COUNT];
+
+// a slice is kept short as it holds up the core1 loop, a gap in the spin
+// longer than LOAD_GAP_US was an interrupt
+static const uint32_t LOAD_SLICE_US = 100;
+static const uint32_t LOAD_GAP_US = 2;
+static const uint32_t LOAD_SAMPLE_US = 1000000;
+static volatile bool measuring;
+static core1_load_stats load;
+
+void host_ports_init()
+{
+  memset(devices, 0, sizeof(devices));
+  memset(port_reports, 0, sizeof(port_reports));
+#if HOST_PORT_COUNT > 1
+  // the second port shares the first one's PIO programs and state machines
+  pio_usb_host_add_port(HOST_PORT2_DP_PIN, PIO_USB_PINOUT_DPDM);
+#endif
+  printf("%d usb host port%s\n", HOST_PORT_COUNT, HOST_PORT_COUNT > 1 ? "s" : "");
+}
+
+static int port_of_role(uint8_t role, bool *through_hub)
+{
+  for (int i = 0; i < HOST_PORT_DEVICE_MAX; ++i)
+  {
+    if (devices[i].port != 0 && (devices[i].roles & role) != 0)
+    {
+      *through_hub = devices[i].hub_addr != 0;
+      return devices[i].port;
+    }
+  }
+  return 0;
+}
+
+// A keyboard and mouse sharing a port through a hub while another port has
+// nothing on it pay for hub polling and split transactions for no reason.
+// Only a hint, nothing is moved.
+int host_ports_suggest_port()
+{
+  bool keyboard_hub = false;
+  bool mouse_hub = false;
+  int keyboard_port = port_of_role(ROLE_KEYBOARD, &keyboard_hub);
+  int mouse_port = port_of_role(ROLE_MOUSE, &mouse_hub);
+  if (keyboard_port == 0 || keyboard_port != mouse_port || !(keyboard_hub || mouse_hub))
+  {
+    return 0;
+  }
+  for (int port = 1; port <= HOST_PORT_COUNT; ++port)
+  {
+    if (host_ports_get(port).devices == 0)
+    {
+      return port;
+    }
+  }
+  return 0;
+}
+
+void host_ports_mount(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol)
+{
+  if (dev_addr >= HOST_PORT_DEVICE_MAX)
+  {
+    return;
+  }
+  mounted_device &d = devices[dev_addr];
+  if (d.port == 0)
+  {
+    hcd_devtree_info_t info;
+    hcd_devtree_get_info(dev_addr, &info);
+    d.port = info.rhport >= 1 && info.rhport <= HOST_PORT_COUNT ? info.rhport : 1;
+    d.hub_addr = info.hub_addr;
+    d.roles = 0;
+  }
+  d.instances |= 1 << (instance & 7);
+  if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD)
+  {
+    d.roles |= ROLE_KEYBOARD;
+  }
+  else if (itf_protocol == HID_ITF_PROTOCOL_MOUSE)
+  {
+    d.roles |= ROLE_MOUSE;
+  }
+  printf("[%u] on usb host port %u%s\n", dev_addr, d.port, d.hub_addr != 0 ? " through a hub" : "");
+
+  int free_port = host_ports_suggest_port();
+  if (free_port != 0)
+  {
+    printf("keyboard and mouse share usb host port %u through a hub, plug one into port %d\n", d.port, free_port);
+  }
+}
+
+void host_ports_umount(uint8_t dev_addr, uint8_t instance)
+{
+  if (dev_addr >= HOST_PORT_DEVICE_MAX)
+  {
+    return;
+  }
+  mounted_device &d = devices[dev_addr];
+  d.instances &= ~(1 << (instance & 7));
+  if (d.instances == 0)
+  {
+    memset(&d, 0, sizeof(d));
+  }
+}
+
+int host_ports_port_of(uint8_t dev_addr)
+{
+  return dev_addr < HOST_PORT_DEVICE_MAX ? devices[dev_addr].port : 0;
+}
+
+// called from tuh_hid_report_received_cb
+void HOT_FUNC(host_ports_note_report)(uint8_t dev_addr)
+{
+  if (dev_addr < HOST_PORT_DEVICE_MAX && devices[dev_addr].port != 0)
+  {
+    port_reports[devices[dev_addr].port - 1]++;
+  }
+}
+
+host_port_stats host_ports_get(int port)
+{
+  host_port_stats s = {};
+  if (port < 1 || port > HOST_PORT_COUNT)
+  {
+    return s;
+  }
+  for (int i = 0; i < HOST_PORT_DEVICE_MAX; ++i)
+  {
+    if (devices[i].port == port)
+    {
+      s.devices++;
+      s.through_hub += devices[i].hub_addr != 0;
+    }
+  }
+  s.reports = port_reports[port - 1];
+  return s;
+}
+
+void host_ports_reset_stats()
+{
+  memset(port_reports, 0, sizeof(port_reports));
+  measuring = false;
+  memset(&load, 0, sizeof(load));
+}
+
+// starts again from nothing, the figures are complete once LOAD_SAMPLE_US
+// has been sampled
+void host_ports_measure_load()
+{
+  measuring = false;
+  memset(&load, 0, sizeof(load));
+  measuring = true;
+}
+
+// core1, between passes of the loop. The spin does nothing but read the
+// timer so any longer step between two reads was spent in an interrupt.
+void host_ports_load_task()
+{
+  if (!measuring)
+  {
+    return;
+  }
+  uint32_t start = time_us_32();
+  uint32_t last = start;
+  while (last - start < LOAD_SLICE_US)
+  {
+    tight_loop_contents();
+    uint32_t now = time_us_32();
+    uint32_t gap = now - last;
+    if (gap > LOAD_GAP_US)
+    {
+      load.interrupts++;
+      load.interrupt_us += gap;
+      if (gap > load.max_interrupt_us)
+      {
+        load.max_interrupt_us = gap;
+      }
+    }
+    last = now;
+  }
+  load.sampled_us += last - start;
+  if (load.sampled_us >= LOAD_SAMPLE_US)
+  {
+    measuring = false;
+  }
+}
+
+core1_load_stats host_ports_get_load()
+{
+  return load;
+}
+
+// write the ports and the load to the cdc interface
+void host_ports_print()
+{
+  for (int port = 1; port <= HOST_PORT_COUNT; ++port)
+  {
+    host_port_stats s = host_ports_get(port);
+    cdc_printf("usb host port %d devices %lu through hub %lu reports %lu\r\n", port, (unsigned long) s.devices,
+      (unsigned long) s.through_hub, (unsigned long) s.reports);
+  }
+  int free_port = host_ports_suggest_port();
+  if (free_port != 0)
+  {
+    cdc_printf("keyboard and mouse share a port through a hub, plug one into port %d\r\n", free_port);
+  }
+  core1_load_stats l = load;
+  cdc_printf("core1 interrupts %lu.%lu%% of %lu ms sampled%s, %lu interrupts mean %lu max %lu us\r\n",
+    (unsigned long) (l.sampled_us != 0 ? (uint64_t) l.interrupt_us * 100 / l.sampled_us : 0),
+    (unsigned long) (l.sampled_us != 0 ? (uint64_t) l.interrupt_us * 1000 / l.sampled_us % 10 : 0),
+    (unsigned long) (l.sampled_us / 1000), measuring ? " so far" : "", (unsigned long) l.interrupts,
+    (unsigned long) (l.interrupts != 0 ? l.interrupt_us / l.interrupts : 0), (unsigned long) l.max_interrupt_us);
+}
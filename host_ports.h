@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+// The PIO-USB root ports on core1. There is always the one on
+// PIO_USB_DP_PIN_DEFAULT, building with HOST_PORT_COUNT=2 adds a second with
+// D+ on HOST_PORT2_DP_PIN and D- on the pin after it, so a keyboard and a
+// mouse can each have a port instead of sharing one through a hub.
+//
+// Mounted devices are recorded against the root port they came in on and
+// the reports from each port are counted. Ports are numbered as the host
+// stack's root hub ports, from 1.
+//
+// Which port a device is on is up to where it is plugged in, the host stack
+// can't move it to another. When a keyboard and mouse share a port through
+// a hub while another port is empty, host_ports_suggest_port names the
+// empty one, and the firmware prints it so the user can replug a device.
+
+#ifndef HOST_PORT_COUNT
+#define HOST_PORT_COUNT 1
+#endif
+
+#ifndef HOST_PORT2_DP_PIN
+#define HOST_PORT2_DP_PIN 4
+#endif
+
+static const int HOST_PORT_DEVICE_MAX = 8; // device addresses are below this
+
+struct host_port_stats
+{
+  uint32_t devices;     // mounted hid devices
+  uint32_t through_hub; // of those, how many are behind a hub
+  uint32_t reports;
+};
+
+// Core1 time taken by interrupts, which is mostly the PIO-USB SOF handler
+// running the transfers of every port once a millisecond. Sampled by
+// spinning in short slices between passes of the core1 loop and adding up
+// the gaps.
+struct core1_load_stats
+{
+  uint32_t sampled_us;
+  uint32_t interrupt_us;
+  uint32_t interrupts;
+  uint32_t max_interrupt_us;
+};
+
+extern void host_ports_init();
+extern void host_ports_mount(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol);
+extern void host_ports_umount(uint8_t dev_addr, uint8_t instance);
+extern int host_ports_port_of(uint8_t dev_addr); // 0 when not mounted
+extern int host_ports_suggest_port();            // an empty port to replug a device into, 0 if none would help
+extern void host_ports_note_report(uint8_t dev_addr);
+extern host_port_stats host_ports_get(int port);
+extern void host_ports_reset_stats();
+extern void host_ports_print();
+
+// load sampling, host_ports_measure_load is called from core0 and the
+// slices are taken by host_ports_load_task on core1
+extern void host_ports_measure_load();
+extern void host_ports_load_task();
+extern core1_load_stats host_ports_get_load();
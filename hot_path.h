@@ -0,0 +1,28 @@
+#pragma once
+
+// Marks the input forwarding path: the uart interrupt and parser, the usb
+// host report callback and the report builders. Building with
+// RAM_HOT_PATH_ENABLED=1 puts them in SRAM, so a miss in the XIP cache can't
+// stall a report behind a flash fetch. Otherwise, and in the host build and
+// the linux client, the marks do nothing.
+//
+// HOT_FUNC(name) goes around the name in a definition, HOT_DATA(group) in
+// front of a table.
+
+#ifndef RAM_HOT_PATH_ENABLED
+#define RAM_HOT_PATH_ENABLED 0
+#endif
+
+#if RAM_HOT_PATH_ENABLED
+
+#include "pico/platform.h"
+
+#define HOT_FUNC(name) __not_in_flash_func(name)
+#define HOT_DATA(group) __not_in_flash(group)
+
+#else
+
+#define HOT_FUNC(name) name
+#define HOT_DATA(group)
+
+#endif
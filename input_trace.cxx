@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "input_trace.h"
+#include "report_queue.h"
+#include "sched.h"
+
+// Records are captured on core1 into a byte ring which the cdc task empties
+// on core0. Capture never waits: a record that doesn't fit is counted and
+// the count goes out with the next one that does.
+//
+// Replayed records are fed from the cdc task, or straight from the host
+// build, and played on core1 at their recorded spacing. They go into the
+// report queue as tuh_hid_report_received_cb would put them, but are not
+// captured again.
+
+static const uint32_t CAPTURE_BUF_SIZE = 2048; // must be a power of two
+static const int REPLAY_BUF_SIZE = 1024;
+
+static critical_section trace_cs;
+
+static uint8_t capture_buf[CAPTURE_BUF_SIZE];
+static uint32_t capture_head;
+static uint32_t capture_tail;
+static volatile bool capturing;
+static uint64_t last_capture_us;
+static uint32_t lost_since_sent;
+
+static uint8_t replay_buf[REPLAY_BUF_SIZE];
+static int replay_len;
+static int replay_pos;
+static bool replay_running;
+static uint64_t replay_last_us; // when the last record was due
+
+static uint32_t captured;
+static uint32_t lost;
+static uint32_t replayed;
+
+void input_trace_init()
+{
+  critical_section_init(&trace_cs);
+}
+
+// starting again drops anything not yet sent
+void input_trace_capture(bool on)
+{
+  critical_section_enter_blocking(&trace_cs);
+  capture_head = 0;
+  capture_tail = 0;
+  last_capture_us = time_us_64();
+  lost_since_sent = 0;
+  capturing = on;
+  critical_section_exit(&trace_cs);
+}
+
+// called from tuh_hid_report_received_cb once the transfer is re-armed
+void input_trace_note_report(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, bool report_protocol,
+  const uint8_t *report, uint16_t len, uint64_t capture_us)
+{
+  if (!capturing)
+  {
+    return;
+  }
+  trace_record r;
+  r.dev_addr = dev_addr;
+  r.instance = instance;
+  r.itf_protocol = itf_protocol;
+  r.report_protocol = report_protocol;
+  r.len = len > TRACE_MAX_REPORT ? TRACE_MAX_REPORT : len;
+  memcpy(r.report, report, r.len);
+
+  uint8_t encoded[TRACE_MAX_RECORD];
+  critical_section_enter_blocking(&trace_cs);
+  uint64_t delta = capture_us - last_capture_us;
+  r.delta_us = delta > UINT32_MAX ? UINT32_MAX : (uint32_t) delta;
+  r.lost = lost_since_sent;
+  int n = trace_encode(encoded, &r);
+  if (CAPTURE_BUF_SIZE - (capture_head - capture_tail) < (uint32_t) n)
+  {
+    lost++;
+    lost_since_sent++;
+  }
+  else
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      capture_buf[capture_head++ & (CAPTURE_BUF_SIZE - 1)] = encoded[i];
+    }
+    last_capture_us = capture_us;
+    lost_since_sent = 0;
+    captured++;
+  }
+  critical_section_exit(&trace_cs);
+  sched_post(TASK_CDC);
+}
+
+// copies out captured bytes, a record may be split between calls
+int input_trace_take(uint8_t *buffer, int max_len)
+{
+  critical_section_enter_blocking(&trace_cs);
+  int n = 0;
+  while (n < max_len && capture_tail != capture_head)
+  {
+    buffer[n++] = capture_buf[capture_tail++ & (CAPTURE_BUF_SIZE - 1)];
+  }
+  critical_section_exit(&trace_cs);
+  return n;
+}
+
+// takes what fits of the records, returns how many bytes that was
+int input_trace_replay_feed(const uint8_t *data, int len)
+{
+  critical_section_enter_blocking(&trace_cs);
+  if (replay_pos != 0)
+  {
+    memmove(replay_buf, replay_buf + replay_pos, replay_len - replay_pos);
+    replay_len -= replay_pos;
+    replay_pos = 0;
+  }
+  int n = REPLAY_BUF_SIZE - replay_len;
+  if (n > len)
+  {
+    n = len;
+  }
+  memcpy(replay_buf + replay_len, data, n);
+  replay_len += n;
+  critical_section_exit(&trace_cs);
+  return n;
+}
+
+// Runs on core1 between calls to tuh_task. The spacing of records is kept
+// while they keep coming, after running dry the next one plays straight away.
+// Anything that doesn't decode is thrown away.
+void input_trace_replay_task()
+{
+  while (true)
+  {
+    trace_record r;
+    critical_section_enter_blocking(&trace_cs);
+    int n = trace_decode(replay_buf + replay_pos, replay_len - replay_pos, &r);
+    if (n < 0)
+    {
+      replay_pos = 0;
+      replay_len = 0;
+    }
+    critical_section_exit(&trace_cs);
+    if (n <= 0)
+    {
+      replay_running = false;
+      return;
+    }
+
+    uint64_t now = time_us_64();
+    if (!replay_running)
+    {
+      replay_running = true;
+      replay_last_us = now - r.delta_us;
+    }
+    if (now < replay_last_us + r.delta_us)
+    {
+      return;
+    }
+    replay_last_us += r.delta_us;
+    report_queue_push(r.dev_addr, r.instance, r.itf_protocol, r.report_protocol, r.report, r.len, now);
+
+    critical_section_enter_blocking(&trace_cs);
+    replay_pos += n;
+    critical_section_exit(&trace_cs);
+    replayed++;
+  }
+}
+
+bool input_trace_replay_idle()
+{
+  return replay_pos == replay_len;
+}
+
+void input_trace_stats(uint32_t *captured_out, uint32_t *lost_out, uint32_t *replayed_out)
+{
+  *captured_out = captured;
+  *lost_out = lost;
+  *replayed_out = replayed;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Binary trace of the reports received from the usb host stack, written by
+// the firmware and read by the linux client and the host build, so it must
+// not depend on the pico sdk.
+//
+// A trace file is INPUT_TRACE_MAGIC as u32 then records, each:
+//   varint us since the previous record, or since capture started
+//   u8 dev_addr
+//   u8 instance << 4 | TRACE_* flags | itf protocol
+//   varint records lost before this one, only with TRACE_LOST
+//   u8 len, report
+// Varints are 7 bits a byte, low first, top bit set on all but the last.
+
+static const uint32_t INPUT_TRACE_MAGIC = 0x3154424b; // "KBT1"
+
+static const int TRACE_MAX_REPORT = 64; // CFG_TUH_HID_EPIN_BUFSIZE
+static const int TRACE_MAX_RECORD = 5 + 2 + 5 + 1 + TRACE_MAX_REPORT;
+
+enum TraceFlags : uint8_t
+{
+  TRACE_ITF_PROTOCOL = 0x03,   // hid_interface_protocol_enum_t
+  TRACE_REPORT_PROTOCOL = 0x04, // the device was in report protocol, not boot
+  TRACE_LOST = 0x08
+};
+
+struct trace_record
+{
+  uint32_t delta_us;
+  uint32_t lost;
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t itf_protocol;
+  bool report_protocol;
+  uint8_t len;
+  uint8_t report[TRACE_MAX_REPORT];
+};
+
+static inline int trace_put_varint(uint8_t *out, uint32_t v)
+{
+  int n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  out[n++] = v;
+  return n;
+}
+
+// returns the bytes used, 0 if more are needed, -1 if too long
+static inline int trace_get_varint(const uint8_t *in, int len, uint32_t *v)
+{
+  *v = 0;
+  for (int i = 0; i < len && i < 5; ++i)
+  {
+    *v |= (uint32_t) (in[i] & 0x7f) << (7 * i);
+    if ((in[i] & 0x80) == 0)
+    {
+      return i + 1;
+    }
+  }
+  return len < 5 ? 0 : -1;
+}
+
+// writes at most TRACE_MAX_RECORD bytes
+static inline int trace_encode(uint8_t *out, const trace_record *r)
+{
+  int n = trace_put_varint(out, r->delta_us);
+  out[n++] = r->dev_addr;
+  out[n++] = (r->instance << 4) | (r->lost != 0 ? TRACE_LOST : 0) |
+    (r->report_protocol ? TRACE_REPORT_PROTOCOL : 0) | (r->itf_protocol & TRACE_ITF_PROTOCOL);
+  if (r->lost != 0)
+  {
+    n += trace_put_varint(out + n, r->lost);
+  }
+  out[n++] = r->len;
+  memcpy(out + n, r->report, r->len);
+  return n + r->len;
+}
+
+// returns the bytes used, 0 if the record isn't all there yet, -1 if it is
+// not a record
+static inline int trace_decode(const uint8_t *in, int len, trace_record *r)
+{
+  int n = trace_get_varint(in, len, &r->delta_us);
+  if (n <= 0)
+  {
+    return n;
+  }
+  if (len < n + 2)
+  {
+    return 0;
+  }
+  r->dev_addr = in[n++];
+  uint8_t flags = in[n++];
+  r->instance = flags >> 4;
+  r->itf_protocol = flags & TRACE_ITF_PROTOCOL;
+  r->report_protocol = (flags & TRACE_REPORT_PROTOCOL) != 0;
+  r->lost = 0;
+  if ((flags & TRACE_LOST) != 0)
+  {
+    int m = trace_get_varint(in + n, len - n, &r->lost);
+    if (m <= 0)
+    {
+      return m;
+    }
+    n += m;
+  }
+  if (len < n + 1)
+  {
+    return 0;
+  }
+  r->len = in[n++];
+  if (r->len > TRACE_MAX_REPORT)
+  {
+    return -1;
+  }
+  if (len < n + r->len)
+  {
+    return 0;
+  }
+  memcpy(r->report, in + n, r->len);
+  return n + r->len;
+}
+
+// firmware side
+extern void input_trace_init();
+extern void input_trace_capture(bool on);
+extern void input_trace_note_report(uint8_t dev_addr, uint8_t instance, uint8_t itf_protocol, bool report_protocol,
+  const uint8_t *report, uint16_t len, uint64_t capture_us);
+extern int input_trace_take(uint8_t *buffer, int max_len);
+extern int input_trace_replay_feed(const uint8_t *data, int len);
+extern void input_trace_replay_task();
+extern bool input_trace_replay_idle();
+extern void input_trace_stats(uint32_t *captured, uint32_t *lost, uint32_t *replayed);
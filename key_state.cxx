@@ -0,0 +1,107 @@
+#include <string.h>
+
+#include "hot_path.h"
+#include "key_state.h"
+
+// usages below this in a boot report are error codes, not keys
+static const uint8_t FIRST_KEY = HID_KEY_A;
+static const uint8_t ERROR_ROLLOVER = 0x01;
+
+void key_state_clear(key_state *state)
+{
+  memset(state, 0, sizeof(*state));
+}
+
+// left control to right gui go in the modifier byte, anything else past the
+// end of the bitmap is ignored
+void key_state_press(key_state *state, uint8_t keycode)
+{
+  if (keycode >= HID_KEY_CONTROL_LEFT && keycode <= HID_KEY_GUI_RIGHT)
+  {
+    state->modifier |= 1 << (keycode - HID_KEY_CONTROL_LEFT);
+  }
+  else if (keycode >= FIRST_KEY && keycode < NKRO_KEY_COUNT)
+  {
+    state->keys[keycode >> 3] |= 1 << (keycode & 7);
+  }
+}
+
+bool key_state_pressed(const key_state *state, uint8_t keycode)
+{
+  if (keycode >= HID_KEY_CONTROL_LEFT && keycode <= HID_KEY_GUI_RIGHT)
+  {
+    return (state->modifier & (1 << (keycode - HID_KEY_CONTROL_LEFT))) != 0;
+  }
+  return keycode < NKRO_KEY_COUNT && (state->keys[keycode >> 3] & (1 << (keycode & 7))) != 0;
+}
+
+bool key_state_empty(const key_state *state)
+{
+  if (state->modifier != 0)
+  {
+    return false;
+  }
+  for (int i = 0; i < NKRO_KEY_BYTES; ++i)
+  {
+    if (state->keys[i] != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// number of keys down, not counting modifiers
+int key_state_count(const key_state *state)
+{
+  int count = 0;
+  for (int i = 0; i < NKRO_KEY_BYTES; ++i)
+  {
+    for (uint8_t b = state->keys[i]; b != 0; b &= b - 1)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+// Pressed keycodes in ascending order, not counting modifiers. Returns how
+// many there are, which can be more than max.
+int HOT_FUNC(key_state_to_list)(const key_state *state, uint8_t *keycodes, int max)
+{
+  int count = 0;
+  for (int i = 0; i < NKRO_KEY_BYTES; ++i)
+  {
+    for (uint8_t b = state->keys[i]; b != 0; b &= b - 1)
+    {
+      if (count < max)
+      {
+        keycodes[count] = (i << 3) | __builtin_ctz(b);
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+void HOT_FUNC(key_state_from_boot)(key_state *state, const hid_keyboard_report_t *report)
+{
+  key_state_clear(state);
+  state->modifier = report->modifier;
+  for (int i = 0; i < 6; ++i)
+  {
+    key_state_press(state, report->keycode[i]);
+  }
+}
+
+// more than six keys down is reported as a rollover error, as a real boot
+// keyboard would
+void HOT_FUNC(key_state_to_boot)(const key_state *state, hid_keyboard_report_t *report)
+{
+  memset(report, 0, sizeof(*report));
+  report->modifier = state->modifier;
+  if (key_state_to_list(state, report->keycode, 6) > 6)
+  {
+    memset(report->keycode, ERROR_ROLLOVER, sizeof(report->keycode));
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "tusb.h"
+
+// Keyboard state as a bitmap of pressed keys, so any number of keys can be
+// held at once. The same layout is sent to the host as the NKRO report. Boot
+// reports, NKRO reports and the uart message all convert to and from this
+// without allocating.
+
+static const int NKRO_KEY_COUNT = 160; // usages 0 to 0x9f, modifiers are separate
+static const int NKRO_KEY_BYTES = NKRO_KEY_COUNT / 8;
+
+struct key_state
+{
+  uint8_t modifier;
+  uint8_t keys[NKRO_KEY_BYTES];
+};
+
+static_assert(sizeof(key_state) == 1 + NKRO_KEY_BYTES, "key_state is sent as the NKRO report");
+
+extern void key_state_clear(key_state *state);
+extern void key_state_press(key_state *state, uint8_t keycode);
+extern bool key_state_pressed(const key_state *state, uint8_t keycode);
+extern bool key_state_empty(const key_state *state);
+extern int key_state_count(const key_state *state);
+extern int key_state_to_list(const key_state *state, uint8_t *keycodes, int max);
+extern void key_state_from_boot(key_state *state, const hid_keyboard_report_t *report);
+extern void key_state_to_boot(const key_state *state, hid_keyboard_report_t *report);
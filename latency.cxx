@@ -0,0 +1,107 @@
+#include <stdio.h>
+
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "cdc_text.h"
+#include "latency.h"
+#include "tusb.h"
+#include "usb_descriptors.h"
+
+// one report per report id can be waiting for the host to collect it
+struct pending_report
+{
+  uint64_t capture_us;
+  LatencySource source;
+  bool valid;
+};
+
+static critical_section latency_cs;
+static pending_report pending[REPORT_ID_COUNT];
+static latency_stats stats[LATENCY_SOURCE_COUNT];
+
+void latency_init()
+{
+  critical_section_init(&latency_cs);
+  latency_reset();
+}
+
+void latency_report_queued(uint8_t report_id, LatencySource source, uint64_t capture_us)
+{
+  if (report_id == 0 || report_id >= REPORT_ID_COUNT)
+  {
+    return;
+  }
+  critical_section_enter_blocking(&latency_cs);
+  pending[report_id].capture_us = capture_us;
+  pending[report_id].source = source;
+  pending[report_id].valid = true;
+  critical_section_exit(&latency_cs);
+}
+
+// called from tud_hid_report_complete_cb once the host has read the report
+void latency_report_sent(uint8_t report_id)
+{
+  if (report_id == 0 || report_id >= REPORT_ID_COUNT)
+  {
+    return;
+  }
+  uint64_t now = time_us_64();
+  critical_section_enter_blocking(&latency_cs);
+  pending_report p = pending[report_id];
+  pending[report_id].valid = false;
+  if (p.valid)
+  {
+    uint32_t us = (uint32_t) (now - p.capture_us);
+    latency_stats &s = stats[p.source];
+    s.count++;
+    s.total_us += us;
+    if (us < s.min_us)
+    {
+      s.min_us = us;
+    }
+    if (us > s.max_us)
+    {
+      s.max_us = us;
+    }
+  }
+  critical_section_exit(&latency_cs);
+}
+
+void latency_reset()
+{
+  critical_section_enter_blocking(&latency_cs);
+  for (int i = 0; i < LATENCY_SOURCE_COUNT; ++i)
+  {
+    stats[i] = { 0, UINT32_MAX, 0, 0 };
+  }
+  critical_section_exit(&latency_cs);
+}
+
+latency_stats latency_get(LatencySource source)
+{
+  critical_section_enter_blocking(&latency_cs);
+  latency_stats s = stats[source];
+  critical_section_exit(&latency_cs);
+  return s;
+}
+
+// write the stats to the cdc interface
+void latency_print()
+{
+  static const char *names[LATENCY_SOURCE_COUNT] = { "local", "uart" };
+  for (int i = 0; i < LATENCY_SOURCE_COUNT; ++i)
+  {
+    latency_stats s = latency_get((LatencySource) i);
+
+    if (s.count == 0)
+    {
+      cdc_printf("latency %s: no reports\r\n", names[i]);
+    }
+    else
+    {
+      cdc_printf("latency %s: n %lu min %lu avg %lu max %lu us\r\n", names[i],
+        (unsigned long) s.count, (unsigned long) s.min_us, (unsigned long) (s.total_us / s.count), (unsigned long) s.max_us);
+    }
+  }
+}
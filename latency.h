@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Measures the time from an input report being captured to the host
+// collecting the matching device report from the HID endpoint.
+
+enum LatencySource : uint8_t
+{
+  LATENCY_LOCAL, // report captured by the usb host on this board
+  LATENCY_UART,  // report received from the other board
+  LATENCY_SOURCE_COUNT
+};
+
+struct latency_stats
+{
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+};
+
+extern void latency_init();
+extern void latency_report_queued(uint8_t report_id, LatencySource source, uint64_t capture_us);
+extern void latency_report_sent(uint8_t report_id);
+extern void latency_reset();
+extern latency_stats latency_get(LatencySource source);
+extern void latency_print();
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "boot_trace.h"
+#include "cdc_text.h"
+#include "common.h"
+#include "debug_print.h"
+#include "edge_switch.h"
+#include "handoff.h"
+#include "hot_path.h"
+#include "latency.h"
+#include "link_pacing.h"
+#include "report_cache.h"
+#include "sched.h"
+#include "usb_descriptors.h"
+
+// all on core0, from the uart, usb and pace tasks
+
+struct paced_input
+{
+  uint32_t due_us;
+  uint32_t capture_us; // the time received if not placed
+  InputKind kind;
+  bool placed;
+  union
+  {
+    key_state keys;
+    mouse_state mouse;
+    uint16_t usage;
+  };
+};
+
+static link_clock peer_clock;
+static link_pacer pacer;
+static paced_input queue[PACE_QUEUE];
+static int queue_head;
+static int queue_count;
+static int queue_high_water;
+static pace_stats stats[INPUT_CONSUMER + 1];
+
+// the last tick from the peer, echoed in the next one sent
+static bool peer_ticked;
+static uint32_t peer_sent_us;
+static uint32_t peer_received_us;
+
+void link_pacing_tick_time(link_tick_time *t)
+{
+  t->sent_us = time_us_32();
+  t->echo_us = peer_sent_us;
+  t->held_us = peer_ticked ? t->sent_us - peer_received_us : TICK_NO_ECHO;
+}
+
+void link_pacing_tick_received(const link_tick_time *t, uint32_t received_us)
+{
+  peer_ticked = true;
+  peer_sent_us = t->sent_us;
+  peer_received_us = received_us;
+  link_clock_sample(&peer_clock, t, received_us);
+}
+
+// its clock started again, nothing it sends can be placed until it ticks
+void link_pacing_peer_restarted()
+{
+  memset(&peer_clock, 0, sizeof(peer_clock));
+  peer_ticked = false;
+}
+
+// A snapshot holds what is down on the peer now, input from before it still
+// waiting here would undo that once it went out.
+void link_pacing_drop_queued()
+{
+  queue_head = 0;
+  queue_count = 0;
+}
+
+// The endpoint has a report in flight, the next goes out once the host
+// collects it. A host that isn't there takes nothing and the report is
+// passed on to fail as it always did.
+static bool HOT_FUNC(endpoint_busy)(InputKind kind)
+{
+  uint8_t instance = kind == INPUT_MOUSE ? HID_INSTANCE_MOUSE : HID_INSTANCE_KEYBOARD;
+  return tud_mounted() && !tud_suspended() && !tud_hid_n_ready(instance);
+}
+
+static void HOT_FUNC(emitted)(const paced_input &e, uint8_t report_id, uint64_t now)
+{
+  uint64_t capture = now - (uint32_t) ((uint32_t) now - e.capture_us);
+  latency_report_queued(report_id, LATENCY_UART, capture);
+  if (e.placed)
+  {
+    pace_histogram_add(stats[e.kind].hist, (uint32_t) (now - capture));
+  }
+}
+
+static void HOT_FUNC(emit)(const paced_input &e, uint64_t now)
+{
+  if (e.kind == INPUT_KEYBOARD)
+  {
+    if (!should_output())
+    {
+      debug_printf("dropped kb\n");
+      return;
+    }
+    if (report_cache_send_keyboard(&e.keys))
+    {
+      boot_trace_mark(BOOT_FIRST_KEY);
+      emitted(e, report_cache_keyboard_report_id(), now);
+    }
+    else
+    {
+      handoff_resend_keyboard();
+    }
+    if (DEBUG_PRINTS_ENABLED)
+    {
+      print_kbd_report(&e.keys);
+    }
+  }
+  else if (e.kind == INPUT_MOUSE)
+  {
+    if (!should_output())
+    {
+      debug_printf("dropped mouse\n");
+      return;
+    }
+    bool crossed = edge_switch_motion(e.mouse.x, e.mouse.y);
+    if (report_cache_send_mouse(&e.mouse))
+    {
+      emitted(e, report_cache_mouse_report_id(), now);
+    }
+    else
+    {
+      handoff_resend_mouse();
+    }
+    if (DEBUG_PRINTS_ENABLED)
+    {
+      print_mouse_report(&e.mouse);
+    }
+    if (crossed)
+    {
+      edge_switch_crossed();
+    }
+  }
+  else if (should_output())
+  {
+    if (report_cache_send_consumer(e.usage))
+    {
+      emitted(e, REPORT_ID_CONSUMER_CONTROL, now);
+    }
+    else
+    {
+      handoff_resend_consumer();
+    }
+  }
+}
+
+// Places the report on this board's clock and queues it for its due time.
+// When nothing is waiting and it is already due it goes out at once, and a
+// full queue makes room by sending the oldest early.
+static void HOT_FUNC(pace)(paced_input &e, uint16_t stamp, uint32_t received_us)
+{
+  pace_stats &s = stats[e.kind];
+  uint32_t capture;
+  e.placed = link_clock_capture_time(&peer_clock, stamp, received_us, &capture);
+  if (e.placed)
+  {
+    bool late;
+    e.capture_us = capture;
+    e.due_us = link_pacer_due(&pacer, capture, received_us, &late);
+    s.paced++;
+    s.late += late;
+  }
+  else
+  {
+    e.capture_us = received_us;
+    e.due_us = pacer.started && (int32_t) (pacer.last_due_us - received_us) > 0 ? pacer.last_due_us : received_us;
+    s.unpaced++;
+  }
+
+  uint64_t now = time_us_64();
+  if (queue_count == 0 && (int32_t) (e.due_us - (uint32_t) now) <= 0 && !endpoint_busy(e.kind))
+  {
+    emit(e, now);
+    return;
+  }
+  if (queue_count == PACE_QUEUE)
+  {
+    emit(queue[queue_head], now);
+    queue_head = (queue_head + 1) % PACE_QUEUE;
+    queue_count--;
+  }
+  queue[(queue_head + queue_count) % PACE_QUEUE] = e;
+  queue_count++;
+  if (queue_count > queue_high_water)
+  {
+    queue_high_water = queue_count;
+  }
+  link_pacing_task();
+}
+
+void HOT_FUNC(link_pacing_keyboard)(const key_state *state, uint16_t stamp, uint32_t received_us)
+{
+  paced_input e;
+  e.kind = INPUT_KEYBOARD;
+  e.keys = *state;
+  pace(e, stamp, received_us);
+}
+
+void HOT_FUNC(link_pacing_mouse)(const mouse_state *state, uint16_t stamp, uint32_t received_us)
+{
+  paced_input e;
+  e.kind = INPUT_MOUSE;
+  e.mouse = *state;
+  pace(e, stamp, received_us);
+}
+
+void HOT_FUNC(link_pacing_consumer)(uint16_t usage, uint16_t stamp, uint32_t received_us)
+{
+  paced_input e;
+  e.kind = INPUT_CONSUMER;
+  e.usage = usage;
+  pace(e, stamp, received_us);
+}
+
+static bool fits_int8(int v)
+{
+  return v >= INT8_MIN && v <= INT8_MAX;
+}
+
+// A 1000 Hz mouse has no slack against a 1 ms poll, so once a report has
+// waited for the endpoint the motion due behind it goes out in one report
+// instead of falling further behind.
+static void HOT_FUNC(merge_due_motion)(uint32_t now)
+{
+  while (queue_count > 1)
+  {
+    const paced_input &e = queue[queue_head];
+    paced_input &next = queue[(queue_head + 1) % PACE_QUEUE];
+    if (e.kind != INPUT_MOUSE || next.kind != INPUT_MOUSE || next.mouse.buttons != e.mouse.buttons ||
+      (int32_t) (next.due_us - now) > 0 || !fits_int8(e.mouse.x + next.mouse.x) || !fits_int8(e.mouse.y + next.mouse.y))
+    {
+      return;
+    }
+    next.mouse.x += e.mouse.x;
+    next.mouse.y += e.mouse.y;
+    next.mouse.wheel += e.mouse.wheel;
+    next.mouse.pan += e.mouse.pan;
+    queue_head = (queue_head + 1) % PACE_QUEUE;
+    queue_count--;
+    stats[INPUT_MOUSE].merged++;
+  }
+}
+
+// Sends whatever is due, then sleeps until the next one is. Also run when
+// the host collects a report, for one that found the endpoint busy.
+void HOT_FUNC(link_pacing_task)()
+{
+  uint64_t now = time_us_64();
+  while (queue_count > 0)
+  {
+    int32_t wait = (int32_t) (queue[queue_head].due_us - (uint32_t) now);
+    if (wait > 0)
+    {
+      sched_post_at(TASK_PACE, now + wait);
+      return;
+    }
+    if (endpoint_busy(queue[queue_head].kind))
+    {
+      return;
+    }
+    merge_due_motion((uint32_t) now);
+    const paced_input &e = queue[queue_head];
+    emit(e, now);
+    queue_head = (queue_head + 1) % PACE_QUEUE;
+    queue_count--;
+  }
+}
+
+void link_pacing_reset_stats()
+{
+  memset(stats, 0, sizeof(stats));
+  queue_high_water = queue_count;
+}
+
+pace_stats link_pacing_get_stats(InputKind kind)
+{
+  return stats[kind];
+}
+
+link_clock link_pacing_clock()
+{
+  return peer_clock;
+}
+
+uint32_t link_pacing_delay()
+{
+  return pacer.delay_us;
+}
+
+// write the clock estimate and the capture to emit histograms to the cdc
+// interface, as "<2^n:count" in us for each bucket in use
+void link_pacing_print()
+{
+  static const char *const kind_names[] = { "keyboard", "mouse", "consumer" };
+  cdc_printf("link clock %s offset %lu us round trip %lu us from %lu ticks\r\n", peer_clock.valid ? "set" : "not set",
+    (unsigned long) peer_clock.offset_us, (unsigned long) peer_clock.round_trip_us, (unsigned long) peer_clock.samples);
+  cdc_printf("pace delay %lu us queued %d high water %d\r\n", (unsigned long) pacer.delay_us, queue_count,
+    queue_high_water);
+  for (int kind = 0; kind <= INPUT_CONSUMER; ++kind)
+  {
+    const pace_stats &s = stats[kind];
+    char line[128];
+    int pos = snprintf(line, sizeof(line), "%-8s paced %lu late %lu unpaced %lu merged %lu", kind_names[kind],
+      (unsigned long) s.paced, (unsigned long) s.late, (unsigned long) s.unpaced, (unsigned long) s.merged);
+    for (int b = 0; b < PACE_BUCKETS; ++b)
+    {
+      if (s.hist[b] != 0)
+      {
+        pos += snprintf(line + pos, sizeof(line) - pos, " <2^%d:%lu", b, (unsigned long) s.hist[b]);
+        if (pos > (int) sizeof(line) - 24)
+        {
+          cdc_printf("%s\r\n", line);
+          pos = 0;
+        }
+      }
+    }
+    if (pos > 0)
+    {
+      cdc_printf("%s\r\n", line);
+    }
+  }
+}
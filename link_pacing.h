@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cdc_protocol.h"
+#include "key_state.h"
+#include "mouse_state.h"
+
+// Input forwarded over the uart carries the low 16 bits of the microsecond
+// time it was captured on the sending board. The receiving board keeps an
+// estimate of the offset between the two clocks, taken from the ticks, turns
+// each stamp into a time on its own clock and sends the report to its host
+// a set delay after it was captured, so reports keep the spacing they had
+// instead of going out whenever uart_task gets to them.
+//
+// The delay follows the slowest recent crossing, rising at once and falling
+// back slowly, and is never more than PACE_MAX_DELAY_US. A report slower
+// than that, or one with no clock estimate to place it, goes out as it
+// arrives. Reports wait in arrival order, at most PACE_QUEUE of them.
+//
+// The logic is here with the times passed in so the host build can run it
+// on simulated clocks, link_pacing.cxx holds the queue on core0.
+
+static const uint32_t PACE_MAX_DELAY_US = 4000;
+static const int PACE_DECAY_SHIFT = 6;      // the delay falls by 1/64 of the slack per report
+static const uint32_t PACE_AHEAD_US = 2000; // a stamp this far in the future is a bad estimate
+static const uint32_t CLOCK_AGE_US = 20;    // the kept round trip grows by this per tick
+static const uint32_t CLOCK_MAX_ROUND_TRIP_US = 20000; // longer is an echo from before a restart
+static const int PACE_QUEUE = 16;
+static const int PACE_BUCKETS = 16;         // hist[n] counts latencies below 2^n us, the last the rest
+static const uint32_t TICK_NO_ECHO = UINT32_MAX;
+
+// The timing in each tick, NTP style: when it was sent, the sent time of the
+// last tick the sender had from this board and how long it held that one,
+// both on the sender's clock. TICK_NO_ECHO in held_us before it had one.
+struct link_tick_time
+{
+  uint32_t sent_us;
+  uint32_t echo_us;
+  uint32_t held_us;
+};
+
+// the peer's clock less this board's, from the tick with the shortest round
+// trip lately
+struct link_clock
+{
+  bool valid;
+  uint32_t offset_us;
+  uint32_t round_trip_us;
+  uint32_t samples;
+};
+
+struct link_pacer
+{
+  uint32_t delay_us; // capture to emit
+  uint32_t last_due_us;
+  bool started;
+};
+
+struct pace_stats
+{
+  uint32_t paced;
+  uint32_t late;    // slower than PACE_MAX_DELAY_US
+  uint32_t unpaced; // no clock estimate or a stamp it couldn't place
+  uint32_t merged;  // motion sent with the report after it, having fallen behind
+  uint32_t hist[PACE_BUCKETS];
+};
+
+// A tick received at received_us, on this board's clock. The echoed time is
+// this board's own, so the round trip less the time the peer held it is the
+// time on the wire both ways. A shorter round trip gives a better offset, a
+// sample far from the estimate means the peer's clock started again.
+inline void link_clock_sample(link_clock *c, const link_tick_time *t, uint32_t received_us)
+{
+  uint32_t round_trip = received_us - t->echo_us - t->held_us;
+  if (t->held_us == TICK_NO_ECHO || received_us - t->echo_us < t->held_us || round_trip > CLOCK_MAX_ROUND_TRIP_US)
+  {
+    return;
+  }
+  uint32_t offset = t->sent_us + round_trip / 2 - received_us;
+  int32_t moved = (int32_t) (offset - c->offset_us);
+  c->samples++;
+  c->round_trip_us += CLOCK_AGE_US;
+  if (!c->valid || round_trip <= c->round_trip_us || moved > (int32_t) PACE_MAX_DELAY_US ||
+    moved < -(int32_t) PACE_MAX_DELAY_US)
+  {
+    c->valid = true;
+    c->offset_us = offset;
+    c->round_trip_us = round_trip;
+  }
+}
+
+// The capture time on this board's clock of a stamp received at
+// received_us. Stamps wrap every 65 ms so any up to half that old are
+// placed, false if there is no estimate or the stamp is too far ahead.
+inline bool link_clock_capture_time(const link_clock *c, uint16_t stamp, uint32_t received_us, uint32_t *capture_us)
+{
+  if (!c->valid)
+  {
+    return false;
+  }
+  int16_t age = (int16_t) ((uint16_t) (received_us + c->offset_us) - stamp);
+  if (age < -(int32_t) PACE_AHEAD_US)
+  {
+    return false;
+  }
+  *capture_us = received_us - age;
+  return true;
+}
+
+// When a report captured at capture_us and received at received_us goes
+// out, never before one received ahead of it. Sets late for a report slower
+// than PACE_MAX_DELAY_US, which goes out now and leaves the delay as it was.
+inline uint32_t link_pacer_due(link_pacer *p, uint32_t capture_us, uint32_t received_us, bool *late)
+{
+  int32_t transit = (int32_t) (received_us - capture_us);
+  if (transit < 0)
+  {
+    transit = 0;
+  }
+  *late = (uint32_t) transit > PACE_MAX_DELAY_US;
+  if ((uint32_t) transit > p->delay_us && !*late)
+  {
+    p->delay_us = transit;
+  }
+  else if ((uint32_t) transit < p->delay_us)
+  {
+    p->delay_us -= (p->delay_us - transit) >> PACE_DECAY_SHIFT;
+  }
+  uint32_t due = *late ? received_us : capture_us + p->delay_us;
+  if ((int32_t) (due - received_us) < 0)
+  {
+    due = received_us;
+  }
+  if (p->started && (int32_t) (due - p->last_due_us) < 0)
+  {
+    due = p->last_due_us;
+  }
+  p->started = true;
+  p->last_due_us = due;
+  return due;
+}
+
+inline void pace_histogram_add(uint32_t *hist, uint32_t us)
+{
+  int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+  hist[bucket < PACE_BUCKETS ? bucket : PACE_BUCKETS - 1]++;
+}
+
+extern void link_pacing_tick_time(link_tick_time *t);
+extern void link_pacing_tick_received(const link_tick_time *t, uint32_t received_us);
+extern void link_pacing_peer_restarted();
+extern void link_pacing_drop_queued();
+extern void link_pacing_keyboard(const key_state *state, uint16_t stamp, uint32_t received_us);
+extern void link_pacing_mouse(const mouse_state *state, uint16_t stamp, uint32_t received_us);
+extern void link_pacing_consumer(uint16_t usage, uint16_t stamp, uint32_t received_us);
+extern void link_pacing_task();
+extern void link_pacing_reset_stats();
+extern pace_stats link_pacing_get_stats(InputKind kind);
+extern link_clock link_pacing_clock();
+extern uint32_t link_pacing_delay();
+extern void link_pacing_print();
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "cdc_text.h"
+#include "common.h"
+#include "handoff.h"
+#include "link_pacing.h"
+#include "link_sync.h"
+#include "peer_state.h"
+#include "report_cache.h"
+#include "report_filter.h"
+#include "uart_messages.h"
+
+// all on core0, from the uart and link tasks
+
+static bool peer_synced; // a snapshot came from the peer since this board started
+static bool link_up = true;
+static uint32_t quiet_ticks;
+static uint32_t last_frames;
+static uint32_t last_frames_sent;
+static uint32_t skipped_ticks;
+static link_sync_stats stats;
+
+static uint8_t own_flags()
+{
+  return peer_synced ? 0 : LINK_NEED_SNAPSHOT;
+}
+
+static void send_snapshot(bool reply_wanted)
+{
+  link_snapshot s = {};
+  s.output_mask = get_current_output_mask();
+  s.generation = get_output_mask_generation();
+  s.flags = peer_state_local_flags();
+  s.leds = report_cache_leds();
+  peer_state_local_input(&s.keys, &s.buttons);
+  send_uart_snapshot(&s, own_flags() | (reply_wanted ? LINK_REPLY_WANTED : 0));
+  stats.sent++;
+}
+
+// sent once the uart is up, changes before then weren't sent
+void link_sync_start()
+{
+  send_snapshot(true);
+}
+
+// every LINK_TICK_US. Once synced the tick is left out when other frames
+// went to the peer since the last one, they show the link is up and a tick
+// in a stream of reports holds up the next one. One in LINK_TICK_SKIP_MAX
+// still goes to keep the peer's clock estimate fresh.
+void link_sync_task()
+{
+  uart_link_stats link = uart_link_get_stats();
+  uint32_t frames = link.frames;
+  if (frames != last_frames)
+  {
+    last_frames = frames;
+    quiet_ticks = 0;
+    if (!link_up)
+    {
+      printf("uart link up\n");
+      link_up = true;
+      stats.recoveries++;
+      send_snapshot(true);
+    }
+  }
+  else if (link_up && ++quiet_ticks >= LINK_DOWN_TICKS)
+  {
+    printf("uart link down\n");
+    link_up = false;
+  }
+  if (peer_synced && link.frames_sent != last_frames_sent && skipped_ticks < LINK_TICK_SKIP_MAX)
+  {
+    last_frames_sent = link.frames_sent;
+    skipped_ticks++;
+    return;
+  }
+  link_tick_time time;
+  link_pacing_tick_time(&time);
+  send_uart_tick(own_flags(), get_current_output_mask(), get_output_mask_generation(), &time);
+  last_frames_sent = uart_link_get_stats().frames_sent;
+  skipped_ticks = 0;
+}
+
+// the snapshot sent back for a tick that disagrees asks for the peer's
+void link_sync_tick_received(uint8_t flags, uint8_t mask, uint16_t generation)
+{
+  if (!peer_synced || mask != get_current_output_mask() || generation != get_output_mask_generation())
+  {
+    send_snapshot(true);
+  }
+  else if ((flags & LINK_NEED_SNAPSHOT) != 0)
+  {
+    send_snapshot(false);
+  }
+}
+
+void link_sync_snapshot_received(const link_snapshot *s, uint8_t flags)
+{
+  stats.received++;
+  // the peer hasn't had a snapshot from this board since it started
+  bool restarted = (flags & LINK_NEED_SNAPSHOT) != 0;
+  if (restarted && peer_synced)
+  {
+    stats.peer_restarts++;
+  }
+  bool first = !peer_synced;
+  peer_synced = true;
+  bool recovered = !link_up;
+  if (recovered)
+  {
+    printf("uart link up\n");
+    link_up = true;
+    stats.recoveries++;
+  }
+  quiet_ticks = 0;
+  last_frames = uart_link_get_stats().frames;
+
+  printf("snapshot mask %u gen %u flags %x leds %x\n", s->output_mask, s->generation, s->flags, s->leds);
+  peer_state_received(s->flags);
+  handoff_set_peer_leds(s->leds);
+  if (restarted || first || recovered)
+  {
+    link_pacing_drop_queued();
+    handoff_resync_peer(&s->keys, s->buttons);
+  }
+  if (restarted && !first)
+  {
+    link_pacing_peer_restarted();
+  }
+  if (restarted || recovered)
+  {
+    report_filter_restart(FILTER_UART);
+  }
+  bool peer_won = merge_output_mask(s->output_mask, s->generation);
+  bool differs = s->output_mask != get_current_output_mask() || s->generation != get_output_mask_generation();
+  if ((flags & LINK_REPLY_WANTED) != 0 || recovered || (!peer_won && differs))
+  {
+    send_snapshot(false);
+  }
+}
+
+link_sync_stats link_sync_get_stats()
+{
+  return stats;
+}
+
+void link_sync_reset_stats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+void link_sync_print()
+{
+  cdc_printf("link %s%s mask %u gen %u peer leds %x\r\n", link_up ? "up" : "down",
+    peer_synced ? "" : " (no snapshot)", get_current_output_mask(), get_output_mask_generation(), handoff_peer_leds());
+  cdc_printf("snapshots sent %lu received %lu peer restarts %lu link recoveries %lu\r\n", (unsigned long) stats.sent,
+    (unsigned long) stats.received, (unsigned long) stats.peer_restarts, (unsigned long) stats.recoveries);
+}
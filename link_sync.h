@@ -0,0 +1,60 @@
+#pragma once
+
+#include "key_state.h"
+#include "tusb.h"
+
+// Brings the two boards back into step after either one restarts or the
+// uart goes quiet. A snapshot carries everything the other board keeps about
+// this one: the output mask and its generation, the peer flags, the LEDs
+// this board's host set and what is held on its keyboard and mouse.
+//
+// A board sends one asking for one back as soon as its uart is up, and again
+// when a tick from the peer shows the peer restarted or disagrees about the
+// output mask, and when frames arrive after the link was quiet for
+// LINK_DOWN_TICKS ticks. Ticks go both ways every LINK_TICK_US, though up to
+// LINK_TICK_SKIP_MAX in a row are left out when other frames went that way. Until a board has had a snapshot since it started its
+// ticks and snapshots say so, which is how the other board knows it
+// restarted.
+
+static const uint32_t LINK_TICK_US = 100000;
+static const uint32_t LINK_DOWN_TICKS = 3;
+static const uint32_t LINK_TICK_SKIP_MAX = 10;
+
+// tick and snapshot flags
+static const uint8_t LINK_NEED_SNAPSHOT = 1 << 0; // none received since the sender started
+static const uint8_t LINK_REPLY_WANTED = 1 << 1;  // snapshots only
+
+struct link_snapshot
+{
+  uint8_t output_mask;
+  uint16_t generation;
+  uint8_t flags;    // PeerFlag
+  uint8_t leds;     // as set by the sender's host
+  uint8_t buttons;  // held on the sender's mouse
+  key_state keys;   // held on the sender's keyboard
+};
+
+struct link_sync_stats
+{
+  uint32_t sent;
+  uint32_t received;
+  uint32_t peer_restarts;
+  uint32_t recoveries; // the link came back after going quiet
+};
+
+// Each change of the output mask made on a board counts up its generation,
+// in 16 bits that wrap. When the boards disagree the higher generation wins,
+// and board zero on a tie, so both pick the same mask.
+inline bool output_mask_peer_wins(uint16_t local_generation, uint16_t peer_generation, uint8_t local_board)
+{
+  int16_t ahead = (int16_t) (peer_generation - local_generation);
+  return ahead > 0 || (ahead == 0 && local_board != 0);
+}
+
+extern void link_sync_start();
+extern void link_sync_task();
+extern void link_sync_tick_received(uint8_t flags, uint8_t mask, uint16_t generation);
+extern void link_sync_snapshot_received(const link_snapshot *s, uint8_t flags);
+extern link_sync_stats link_sync_get_stats();
+extern void link_sync_reset_stats();
+extern void link_sync_print();
@@ -35,13 +35,31 @@
 #include <string.h>
 
 #include "hardware/pwm.h"
+#include "hardware/structs/scb.h"
 #include "hardware/watchdog.h"
+#include "pico/critical_section.h"
 #include "pico/stdio_uart.h"
 #include "pico/stdlib.h"
 #include "pico/multicore.h"
 #include "pico/bootrom.h"
 
+#include "boot_trace.h"
+#include "cdc_protocol.h"
+#include "cdc_text.h"
 #include "common.h"
+#include "config_store.h"
+#include "edge_switch.h"
+#include "handoff.h"
+#include "input_trace.h"
+#include "latency.h"
+#include "link_pacing.h"
+#include "link_sync.h"
+#include "peer_state.h"
+#include "profile.h"
+#include "report_cache.h"
+#include "report_filter.h"
+#include "sched.h"
+#include "settings.h"
 #include "pio_usb.h"
 #include "tusb.h"
 #include "uart_messages.h"
@@ -49,15 +67,28 @@
 
 /*------------- MAIN -------------*/
 
-// core1: handle host events
-extern void core1_main();
-
 const uint LED_PIN = PICO_DEFAULT_LED_PIN;
 const uint LED2_PIN = 14;
 const uint SENSE_PIN = 13;
 const uint TOGGLE_PIN = 17;
 
-static int click_state;
+// time for the internal pull up to raise the sense pin when it isn't grounded
+static const uint32_t SENSE_SETTLE_US = 1000;
+
+volatile bool core0_ready;
+
+#ifndef EDGE_SWITCH_ENABLED
+#define EDGE_SWITCH_ENABLED 0
+#endif
+#ifndef EDGE_SWITCH_WIDTH
+#define EDGE_SWITCH_WIDTH 1920
+#endif
+#ifndef EDGE_SWITCH_HEIGHT
+#define EDGE_SWITCH_HEIGHT 1080
+#endif
+
+static volatile int click_state;
+static bool debouncing;
 
 static void gpio_callback(uint gpio, uint32_t events)
 {
@@ -76,6 +107,7 @@ static void gpio_callback(uint gpio, uint32_t events)
       if ((click_state & 1) != 0)
       {
         click_state = 2;
+        sched_post(TASK_CLICK);
       }
     }
   }
@@ -83,9 +115,9 @@ static void gpio_callback(uint gpio, uint32_t events)
 
 static int64_t click_timer_callback(alarm_id_t id, void *p)
 {
-  bool *debouncing = static_cast<bool *>(p);
+  (void) p;
   printf("tick click %ld\n", id);
-  *debouncing = false;
+  debouncing = false;
   click_state = 0;
   return 0;
 }
@@ -119,24 +151,97 @@ void set_led(bool on)
   pwm_set_gpio_level(LED2_PIN, on ? 10000 : 0);
 }
 
+static const uint32_t OUTPUT_MASK_STORE_US = 2000000; // the mask is stored once it has held this long
+
+// Only core0 changes the mask, core1 reads it. A toggle from either core is
+// counted under output_cs and run by output_task.
 static uint8_t board_number = 0; // set once at startup
-static uint8_t current_output_mask = 1; // board zero is the default
+static volatile uint8_t current_output_mask = 1; // board zero is the default
+static uint16_t output_mask_generation;  // counts changes made on either board
+static critical_section_t output_cs;
+static int toggles_requested;
+static uint64_t output_mask_changed_us;
+static bool output_mask_unstored;
 
 // save current_output_mask so if watchdog triggers it can be restored
 static void update_watchdog_state()
 {
-  watchdog_hw->scratch[3] = current_output_mask;
+  watchdog_hw->scratch[3] = current_output_mask | output_mask_generation << 8;
+}
+
+static void output_mask_changed(bool was_output)
+{
+  update_watchdog_state();
+  // the scratch register covers a watchdog reset, flash only gets the mask
+  // the switching settles on
+  output_mask_changed_us = time_us_64();
+  output_mask_unstored = true;
+  sched_post_at(TASK_OUTPUT, output_mask_changed_us + OUTPUT_MASK_STORE_US);
+  sched_post(TASK_LED);
+  bool is_output = should_output();
+  if (!was_output && is_output)
+  {
+    edge_switch_enter();
+  }
+  handoff_output_changed(was_output, is_output);
+  peer_state_flush();
 }
 
+// core0 only, as are change_output_mask and merge_output_mask
 void set_current_output_mask(u_int8_t val)
 {
+  bool was_output = should_output();
   current_output_mask = val;
-  update_watchdog_state();
+  output_mask_changed(was_output);
 }
 
-void toggle_output()
+// set the mask here and on the other board
+void change_output_mask(uint8_t val)
+{
+  printf("change output mask %u\n", val);
+  output_mask_generation++;
+  set_current_output_mask(val);
+  send_uart_set_output_mask(current_output_mask, output_mask_generation);
+}
+
+// a mask from the other board, taken if its generation wins
+bool merge_output_mask(uint8_t mask, uint16_t generation)
+{
+  if (!output_mask_peer_wins(output_mask_generation, generation, board_number))
+  {
+    return false;
+  }
+  output_mask_generation = generation;
+  if (mask != current_output_mask)
+  {
+    set_current_output_mask(mask);
+  }
+  else
+  {
+    update_watchdog_state();
+  }
+  return true;
+}
+
+uint8_t get_current_output_mask()
+{
+  return current_output_mask;
+}
+
+uint16_t get_output_mask_generation()
+{
+  return output_mask_generation;
+}
+
+uint8_t get_board_number()
+{
+  return board_number;
+}
+
+static void switch_output()
 {
   printf("toggle output curr %u\n", current_output_mask);
+  bool was_output = should_output();
   if (current_output_mask == 1)
   {
     current_output_mask = 2;
@@ -145,8 +250,51 @@ void toggle_output()
   {
     current_output_mask = 1;
   }
-  update_watchdog_state();
-  send_uart_set_output_mask(current_output_mask);
+  output_mask_generation++;
+  output_mask_changed(was_output);
+  send_uart_set_output_mask(current_output_mask, output_mask_generation);
+}
+
+// from either core, core0 switches on its next pass
+void toggle_output()
+{
+  critical_section_enter_blocking(&output_cs);
+  toggles_requested++;
+  critical_section_exit(&output_cs);
+  sched_post(TASK_OUTPUT);
+}
+
+static void output_task()
+{
+  critical_section_enter_blocking(&output_cs);
+  int toggles = toggles_requested;
+  toggles_requested = 0;
+  critical_section_exit(&output_cs);
+  for (int i = 0; i < toggles; ++i)
+  {
+    switch_output();
+  }
+  if (!output_mask_unstored)
+  {
+    return;
+  }
+  uint64_t store_us = output_mask_changed_us + OUTPUT_MASK_STORE_US;
+  if (time_us_64() < store_us)
+  {
+    sched_post_at(TASK_OUTPUT, store_us);
+    return;
+  }
+  uint8_t mask = current_output_mask;
+  config_store_set(SETTING_OUTPUT_MASK, &mask, 1);
+  output_mask_unstored = false;
+}
+
+// the mouse left over the peer edge, the other board takes the cursor
+// from the matching point on its own edge
+void edge_switch_crossed()
+{
+  send_uart_cursor_entry(edge_switch_exit_position());
+  toggle_output();
 }
 
 bool should_output()
@@ -154,86 +302,196 @@ bool should_output()
   return (current_output_mask & (1 << board_number)) != 0;
 }
 
-// core0: handle device events
-int main(void) {
-  // default 125MHz is not appropreate. Sysclock should be multiple of 12MHz.
-  set_sys_clock_khz(120000, true);
-  stdio_uart_init_full(uart1, 115200, 8, 9);
-  init_gpio();
+bool peer_should_output()
+{
+  return (current_output_mask & (1 << (board_number ^ 1))) != 0;
+}
+
+//--------------------------------------------------------------------+
+// core0 tasks
+//--------------------------------------------------------------------+
 
-  sleep_ms(10);
+static int flash_count = 15;
+static bool led_on = true;
 
-  if (!gpio_get(SENSE_PIN))
-    board_number = 1;
+static void usb_task()
+{
+  {
+    PROFILE_SCOPE(PROBE_TUD_TASK);
+    tud_task(); // tinyusb device task
+  }
+  cdc_text_task();
+  {
+    PROFILE_SCOPE(PROBE_CDC_FLUSH);
+    tud_cdc_write_flush();
+  }
+  if (do_disconnect)
+  {
+    do_disconnect = false;
+    printf("do disconnect\n");
+    tud_disconnect();
+  }
+  if (do_connect)
+  {
+    do_connect = false;
+    printf("do connect\n");
+    tud_connect();
+  }
+}
+
+static void click_task()
+{
+  if (click_state == 2 && !debouncing)
+  {
+    printf("process click %lld ms\n", time_us_64() / 1000ll);
+    debouncing = true;
+    auto id = add_alarm_in_ms(500, click_timer_callback, nullptr, false);
+    printf("alarm id %ld\n", id);
+    switch_output();
+  }
+}
 
-  init_uart();
+static void led_task()
+{
+  set_led(should_output());
+}
+
+static void flash_led_task()
+{
+  flash_count--;
+  led_on = flash_count > 0 && !led_on;
+  gpio_put(LED_PIN, led_on);
+  if (flash_count <= 0)
+  {
+    sched_set_period(TASK_FLASH_LED, 0);
+  }
+}
+
+static void watchdog_task()
+{
+  watchdog_update();
+}
 
+// core0: everything up to the main loop
+void core0_init()
+{
+  // default 125MHz is not appropreate. Sysclock should be multiple of 12MHz.
+  set_sys_clock_khz(120000, true);
+  boot_trace_mark(BOOT_CLOCK);
+
+  // everything interrupts and core1 can reach is set up first
+  profile_init_core();
+  critical_section_init(&output_cs);
+  sched_init();
+  cdc_protocol_init();
+  handoff_init();
+  input_trace_init();
+  latency_init();
+  peer_state_init();
+  report_cache_init();
+  report_filter_init();
+  init_gpio();
+  uint64_t sense_ready_us = time_us_64() + SENSE_SETTLE_US;
+
+  // Start host bring-up on core1 and let the host start enumerating us
+  // while the rest of the setup runs. Core1 enumerates the keyboard and
+  // mouse straight away and holds their reports until core0_ready.
   multicore_reset_core1();
   // all USB task run in core1
   multicore_launch_core1(core1_main);
+  boot_trace_mark(BOOT_CORE1_LAUNCHED);
 
   // init device stack on native usb (roothub port0)
   tud_init(0);
+  boot_trace_mark(BOOT_DEVICE_INIT);
+
+  stdio_uart_init_full(uart1, 115200, 8, 9);
+
+  while (time_us_64() < sense_ready_us)
+  {
+    tight_loop_contents();
+  }
+  if (!gpio_get(SENSE_PIN))
+    board_number = 1;
+
+  // board zero's screen is on the left, so its right edge leads to board one
+  screen_geometry geom = { EDGE_SWITCH_WIDTH, EDGE_SWITCH_HEIGHT, board_number == 0 ? EDGE_RIGHT : EDGE_LEFT };
+  edge_switch_configure(EDGE_SWITCH_ENABLED, &geom);
+
+  // stored settings override the build defaults above, the stored output
+  // mask also lands in the scratch register so read that first
+  uint32_t saved_output = watchdog_hw->scratch[3];
+  config_store_init();
+  settings_load();
+  boot_trace_mark(BOOT_SETTINGS);
 
-  uint64_t led_last_change = time_us_64();
-  bool led_on = true;
   gpio_put(LED_PIN, led_on);
-  int flash_count = 15;
   if (watchdog_enable_caused_reboot())
   {
     flash_count = 36000; // about two hours
-    current_output_mask = watchdog_hw->scratch[3];
+    // nothing was saved if the mask never changed since power on
+    uint8_t mask = saved_output & 0xff;
+    if (mask >= 1 && mask <= 3)
+    {
+      current_output_mask = mask;
+      output_mask_generation = saved_output >> 8;
+    }
     int step = watchdog_hw->scratch[2];
-    printf("watchdog caused reboot at step %d mask %d\n", step, current_output_mask);
+    printf("watchdog caused reboot at step %d mask %d gen %u\n", step, current_output_mask, output_mask_generation);
   }
+  update_watchdog_state();
 
-  watchdog_enable(100, 0);
+  // The peer gets this board's snapshot, with the mask restored above.
+  // Core1 sends flag changes itself once core0_ready is set, so the
+  // snapshot goes after it to carry any that came before.
+  init_uart(settings_uart_baud());
+  boot_trace_mark(BOOT_UART);
+  core0_ready = true;
+  boot_trace_mark(BOOT_CORE0_READY);
+  link_sync_start();
+
+  sched_add(TASK_USB, "usb", usb_task, 0);
+  sched_add(TASK_UART_RX, "uart", uart_task, 0);
+  sched_add(TASK_HANDOFF, "handoff", handoff_task, 0);
+  sched_add(TASK_CLICK, "click", click_task, 0);
+  sched_add(TASK_OUTPUT, "output", output_task, 0);
+  sched_add(TASK_LED, "led", led_task, 0);
+  sched_add(TASK_WATCHDOG, "watchdog", watchdog_task, 10000);
+  sched_add(TASK_FLASH_LED, "flash", flash_led_task, 200000);
+  sched_add(TASK_CDC, "cdc", cdc_protocol_task, 0);
+  sched_add(TASK_CONFIG, "config", config_store_task, 100000);
+  sched_add(TASK_LINK, "link", link_sync_task, LINK_TICK_US);
+  sched_add(TASK_PACE, "pace", link_pacing_task, 0);
+  sched_add(TASK_UART_TX, "uart tx", uart_flow_task, UART_CREDIT_TIMEOUT_US / 5);
+  sched_post(TASK_LED);
+  sched_post(TASK_UART_RX);
+
+  // any interrupt becoming pending wakes the core from WFE, even one that
+  // fires between checking for work and going to sleep
+  scb_hw->scr |= M0PLUS_SCR_SEVONPEND_BITS;
+
+  watchdog_enable(WATCHDOG_TIMEOUT_MS, 0);
+}
+
+// one pass of the main loop, returns false if there was nothing to do
+bool core0_poll()
+{
+  // the usb interrupt queues events for tud_task without telling us
+  if (tud_task_event_ready())
+  {
+    sched_post(TASK_USB);
+  }
+  return sched_run_pending();
+}
 
-  bool debouncing = false;
+// core0: handle device events
+int main(void) {
+  core0_init();
   while (true) {
-    watchdog_hw->scratch[2] = 1;
-    tud_task(); // tinyusb device task
-    watchdog_hw->scratch[2] = 2;
-    tud_cdc_write_flush();
-    watchdog_hw->scratch[2] = 3;
-    uart_task();
-    if (do_disconnect)
+    if (!core0_poll())
     {
-      do_disconnect = false;
-      printf("do disconnect\n");
-      tud_disconnect();
+      sched_wait();
     }
-    if (do_connect)
-    {
-      do_connect = false;
-      printf("do connect\n");
-      tud_connect();
-    }
-    watchdog_hw->scratch[2] = 4;
-    set_led(should_output());
-    if (flash_count > 0)
-    {
-      uint64_t tick = time_us_64();
-      if (tick - led_last_change > 200000)
-      {
-        flash_count--;
-        led_on = flash_count != 0 && !led_on;
-        gpio_put(LED_PIN, led_on);
-        led_last_change = tick;
-      }
-    }
-    watchdog_hw->scratch[2] = 5;
-    if (click_state == 2 && !debouncing)
-    {
-      printf("process click %lld ms\n", time_us_64() / 1000ll);
-      debouncing = true;
-      auto id = add_alarm_in_ms(500, click_timer_callback, &debouncing, false);
-      printf("alarm id %ld\n", id);
-      toggle_output();
-    }
-    watchdog_hw->scratch[2] = 6;
-    watchdog_update();
-    watchdog_hw->scratch[2] = 7;
   }
 
   return 0;
@@ -248,11 +506,45 @@ void tud_cdc_rx_cb(uint8_t itf)
 {
   (void) itf;
 
-  char buf[64];
-  uint32_t count = tud_cdc_read(buf, sizeof(buf));
+  // read by the cdc task, which runs after anything forwarding input
+  sched_post(TASK_CDC);
+}
+
+// Invoked when the host has configured the device
+void tud_mount_cb()
+{
+  boot_trace_mark(BOOT_DEVICE_MOUNTED);
+  report_cache_set_mouse_feature(0);
+  report_filter_restart(FILTER_DEVICE);
+  peer_state_set_local(PEER_DEVICE_MOUNTED, true);
+}
+
+// Invoked when the device is unplugged from the host or reset
+void tud_umount_cb()
+{
+  peer_state_set_local(PEER_DEVICE_MOUNTED | PEER_DEVICE_SUSPENDED, false);
+}
+
+// Invoked when the host suspends the bus, the peer stops forwarding until
+// it resumes
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+  (void) remote_wakeup_en;
+  peer_state_set_local(PEER_DEVICE_SUSPENDED, true);
+}
 
-  // TODO control LED on keyboard of host stack
-  (void) count;
+void tud_resume_cb()
+{
+  report_filter_restart(FILTER_DEVICE);
+  peer_state_set_local(PEER_DEVICE_SUSPENDED, false);
+}
+
+// Invoked when a CDC transfer to the host completes, there may be room for
+// a response or event that didn't fit before
+void tud_cdc_tx_complete_cb(uint8_t itf)
+{
+  (void) itf;
+  sched_post(TASK_CDC);
 }
 
 // Invoked when received SET_REPORT control request or
@@ -260,17 +552,21 @@ void tud_cdc_rx_cb(uint8_t itf)
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
   printf("report itf %d kda %d kitf %d id %d type %d size %d buf %x\n", keyboard_dev_addr, keyboard_instance, instance, report_id, report_type, bufsize, bufsize > 0 ? buffer[0] : 0);
-  if (keyboard_instance == instance && report_type == HID_REPORT_TYPE_OUTPUT && bufsize > 0)
+  if (instance == HID_INSTANCE_KEYBOARD && report_type == HID_REPORT_TYPE_OUTPUT && bufsize > 0)
   {
-    static uint8_t leds;
-    leds = buffer[0];
+    uint8_t leds = buffer[0];
     printf("send leds %x\n", leds);
-    if (keyboard_dev_addr != NO_DEV)
-    {
-      tuh_hid_set_report(keyboard_dev_addr, keyboard_instance, 0, HID_REPORT_TYPE_OUTPUT, &leds, sizeof(leds));
-    }
+    // only reaches the keyboard while this host has the output, the peer
+    // keeps a copy to restore when output switches back
+    report_cache_set_leds(leds);
+    handoff_host_leds_changed();
     send_uart_keyboard_report(leds);
   }
+  else if (instance == HID_INSTANCE_MOUSE && report_type == HID_REPORT_TYPE_FEATURE && report_id == REPORT_ID_MOUSE && bufsize > 0)
+  {
+    printf("mouse resolution %x\n", buffer[0]);
+    report_cache_set_mouse_feature(buffer[0]);
+  }
 }
 
 // Invoked when received GET_REPORT control request
@@ -278,14 +574,26 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_
 // Return zero will cause the stack to STALL request
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
 {
-  printf("get report type %d\n", report_type);
-  // TODO not Implemented
-  (void) instance;
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
-
+  // answered from what was last sent, stalls for anything never sent
+  if (report_type == HID_REPORT_TYPE_INPUT)
+  {
+    // boot protocol requests carry no id
+    if (instance == HID_INSTANCE_KEYBOARD && report_id == 0)
+    {
+      report_id = REPORT_ID_KEYBOARD;
+    }
+    return report_cache_get(report_id, buffer, reqlen);
+  }
+  if (report_type == HID_REPORT_TYPE_OUTPUT && (report_id == REPORT_ID_KEYBOARD || report_id == 0) && reqlen > 0)
+  {
+    buffer[0] = report_cache_leds();
+    return 1;
+  }
+  if (report_type == HID_REPORT_TYPE_FEATURE && instance == HID_INSTANCE_MOUSE && report_id == REPORT_ID_MOUSE && reqlen > 0)
+  {
+    buffer[0] = report_cache_mouse_feature();
+    return 1;
+  }
   return 0;
 }
 
@@ -294,12 +602,25 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
 // Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
 {
-  (void) instance;
-  (void) report;
-  (void) len;
-
+  // the first byte is the id, except for a boot keyboard report
+  bool boot = instance == HID_INSTANCE_KEYBOARD && tud_hid_n_get_protocol(instance) == HID_PROTOCOL_BOOT;
+  if (len > 0 && !boot)
+  {
+    latency_report_sent(report[0]);
+  }
+  handoff_task();
+  link_pacing_task();
+}
 
-  //uint8_t next_report_id = report[0] + 1u;
+// Invoked when the host selects the boot or report protocol, a BIOS asks for
+// boot reports and an OS switches back to the report protocol
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+  printf("hid itf %d protocol %s\n", instance, protocol == HID_PROTOCOL_BOOT ? "boot" : "report");
+  if (instance == HID_INSTANCE_KEYBOARD)
+  {
+    handoff_resend_keyboard();
+  }
 }
 
 
@@ -37,7 +37,23 @@
 #include "pico/multicore.h"
 #include "pico/bootrom.h"
 
+#include "boot_trace.h"
+#include "cdc_protocol.h"
 #include "common.h"
+#include "debug_print.h"
+#include "edge_switch.h"
+#include "peer_state.h"
+#include "handoff.h"
+#include "host_ports.h"
+#include "hot_path.h"
+#include "hid_parser.h"
+#include "key_state.h"
+#include "input_trace.h"
+#include "latency.h"
+#include "profile.h"
+#include "report_cache.h"
+#include "report_filter.h"
+#include "report_queue.h"
 #include "pio_usb.h"
 #include "tusb.h"
 #include "uart_messages.h"
@@ -51,6 +67,7 @@ uint8_t keyboard_instance;
 uint8_t mouse_instance;
 
 bool connected = true;
+uint8_t toggle_hotkey = HID_KEY_SCROLL_LOCK; // pressed twice quickly switches output
 bool do_connect = false;
 bool do_disconnect = false;
 
@@ -67,10 +84,30 @@ const int SEND_TO_UART = 2;
 
 int destination = SEND_TO_HOST | SEND_TO_UART;
 
+// layout of the keyboard's own report, used once it is in report protocol
+static hid_keyboard_layout keyboard_layout;
+static bool keyboard_layout_valid;
 
-// core1: handle host events
-void core1_main() {
-  sleep_ms(10);
+// mouse report layout, used once it is in report protocol, and whether its
+// resolution multiplier has been set
+static hid_mouse_layout mouse_layout;
+static bool mouse_layout_valid;
+static bool mouse_high_resolution;
+static motion_accumulator mouse_motion;
+
+// interface the media keys come from, usually a second one on the keyboard
+static uint8_t consumer_dev_addr = NO_DEV;
+static uint8_t consumer_instance;
+static hid_consumer_layout consumer_layout;
+
+static void hid_task();
+
+// core1: host stack set up, enumeration starts while core0 is still setting up
+void core1_init()
+{
+  // lets core0 park this core while it writes the config store to flash
+  multicore_lockout_victim_init();
+  profile_init_core();
 
   // Use tuh_configure() to pass pio configuration to the host stack
   // Note: tuh_configure() must be called before
@@ -80,10 +117,38 @@ void core1_main() {
   // To run USB SOF interrupt in core1, init host stack for pio_usb (roothub
   // port1) on core1
   tuh_init(1);
+  host_ports_init();
+  boot_trace_mark(BOOT_HOST_INIT);
+}
 
-  while (true) {
+// one pass of the core1 loop
+void core1_poll()
+{
+  {
+    PROFILE_SCOPE(PROBE_TUH_TASK);
     tuh_task(); // tinyusb host task
   }
+  // forwarding uses the uart and the stored settings, until core0 has them
+  // up the reports wait with only the latest of each kind kept
+  if (core0_ready)
+  {
+    input_trace_replay_task();
+    hid_task();
+  }
+  else
+  {
+    report_queue_keep_latest();
+  }
+  host_ports_load_task();
+}
+
+// core1: handle host events
+void core1_main() {
+  core1_init();
+
+  while (true) {
+    core1_poll();
+  }
 }
 
 //--------------------------------------------------------------------+
@@ -103,29 +168,58 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_re
   // Interface protocol (hid_interface_protocol_enum_t)
   const char* protocol_str[] = { "None", "Keyboard", "Mouse" };
   uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
+  boot_trace_mark(BOOT_HOST_MOUNTED);
+  host_ports_mount(dev_addr, instance, itf_protocol);
 
   if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD)
   {
     keyboard_dev_addr = dev_addr;
     keyboard_instance = instance;
-    send_uart_keyboard_connected(true);
+    // boot reports stop at six keys, switch to the keyboard's own report
+    // when it can be read
+    keyboard_layout_valid = desc_report != nullptr && hid_parse_keyboard(desc_report, desc_len, &keyboard_layout);
+    if (keyboard_layout_valid)
+    {
+      tuh_hid_set_protocol(dev_addr, instance, HID_PROTOCOL_REPORT);
+    }
+    peer_state_set_local(PEER_KEYBOARD_ATTACHED, true);
   }
   else if (itf_protocol == HID_ITF_PROTOCOL_MOUSE)
   {
     mouse_dev_addr = dev_addr;
     mouse_instance = instance;
-    send_uart_mouse_connected(true);
+    // the boot report only has whole wheel detents
+    mouse_high_resolution = false;
+    mouse_motion = {};
+    mouse_layout_valid = desc_report != nullptr && hid_parse_mouse(desc_report, desc_len, &mouse_layout);
+    if (mouse_layout_valid)
+    {
+      tuh_hid_set_protocol(dev_addr, instance, HID_PROTOCOL_REPORT);
+    }
+    peer_state_set_local(PEER_MOUSE_ATTACHED, true);
+  }
+
+  if (itf_protocol != HID_ITF_PROTOCOL_MOUSE && consumer_dev_addr == NO_DEV && desc_report != nullptr &&
+      hid_parse_consumer(desc_report, desc_len, &consumer_layout))
+  {
+    consumer_dev_addr = dev_addr;
+    consumer_instance = instance;
   }
 
   uint16_t vid, pid;
   tuh_vid_pid_get(dev_addr, &vid, &pid);
 
+  // a device can mount before core0 has the device stack up
+  bool cdc = core0_ready;
   char tempbuf[256];
   int count = sprintf(tempbuf, "[%04x:%04x][%u] HID Interface%u, Protocol = %s, Desc len %d\r\n", vid, pid, dev_addr, instance, protocol_str[itf_protocol], desc_len);
   printf("%s\n", tempbuf);
 
-  tud_cdc_write(tempbuf, count);
-  tud_cdc_write_flush();
+  if (cdc)
+  {
+    tud_cdc_write(tempbuf, count);
+    tud_cdc_write_flush();
+  }
 
   while (desc_len > 0)
   {
@@ -144,35 +238,66 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_re
     *p++ = '\n';
     *p++ = '\0';
     printf("%s", tempbuf);
-    tud_cdc_write(tempbuf, p - 1 - tempbuf);
-    tud_cdc_write_flush();
+    if (cdc)
+    {
+      tud_cdc_write(tempbuf, p - 1 - tempbuf);
+      tud_cdc_write_flush();
+    }
     desc_len -= max;
     desc_report += max;
   }
 
-  // Receive report from boot keyboard & mouse only
+  // Receive report from boot keyboard & mouse and the media keys only
   // tuh_hid_report_received_cb() will be invoked when report is available
-  if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD || itf_protocol == HID_ITF_PROTOCOL_MOUSE)
+  bool consumer = dev_addr == consumer_dev_addr && instance == consumer_instance;
+  if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD || itf_protocol == HID_ITF_PROTOCOL_MOUSE || consumer)
   {
-    if ( !tuh_hid_receive_report(dev_addr, instance) )
+    if ( !tuh_hid_receive_report(dev_addr, instance) && cdc)
     {
       tud_cdc_write_str("Error: cannot request report\r\n");
     }
   }
 }
 
+// Invoked when a SET_PROTOCOL request completes, the mouse's resolution
+// multiplier can be set once it is in report protocol
+void tuh_hid_set_protocol_complete_cb(uint8_t dev_addr, uint8_t instance, uint8_t protocol)
+{
+  if (dev_addr == mouse_dev_addr && instance == mouse_instance && protocol == HID_PROTOCOL_REPORT &&
+      mouse_layout_valid && mouse_layout.feature_len > 0)
+  {
+    tuh_hid_set_report(dev_addr, instance, mouse_layout.feature_report_id, HID_REPORT_TYPE_FEATURE,
+      mouse_layout.feature, mouse_layout.feature_len);
+  }
+}
+
+// Invoked when a SET_REPORT request completes
+void tuh_hid_set_report_complete_cb(uint8_t dev_addr, uint8_t instance, uint8_t report_id, uint8_t report_type, uint16_t len)
+{
+  if (dev_addr == mouse_dev_addr && instance == mouse_instance && report_type == HID_REPORT_TYPE_FEATURE && len > 0)
+  {
+    printf("mouse wheel multiplier %u pan %u\n", mouse_layout.wheel_multiplier, mouse_layout.pan_multiplier);
+    mouse_high_resolution = true;
+  }
+}
+
 // Invoked when device with hid interface is un-mounted
 void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance)
 {
+  host_ports_umount(dev_addr, instance);
+  if (dev_addr == consumer_dev_addr)
+  {
+    consumer_dev_addr = NO_DEV;
+  }
   if (dev_addr == keyboard_dev_addr)
   {
     keyboard_dev_addr = NO_DEV;
-    send_uart_keyboard_connected(false);
+    peer_state_set_local(PEER_KEYBOARD_ATTACHED, false);
   }
   else if (dev_addr == mouse_dev_addr)
   {
     mouse_dev_addr = NO_DEV;
-    send_uart_mouse_connected(false);
+    peer_state_set_local(PEER_MOUSE_ATTACHED, false);
   }
 
   printf("[%u] HID Interface%u is unmounted\r\n", dev_addr, instance);
@@ -189,19 +314,19 @@ static inline bool find_key_in_report(hid_keyboard_report_t const *report, uint8
   return false;
 }
 
-void check_kbd_report(const hid_keyboard_report_t *report)
+void check_kbd_report(const key_state *state)
 {
-  static hid_keyboard_report_t prev_report = { 0, 0, {0} }; // previous report to check key state changed
+  static uint8_t prev_keycode = 0; // previous first key to check key state changed
   static int key_count = 0;
   static uint64_t key_time;
-  uint8_t keycode = report->keycode[0];
-  uint8_t prev_keycode = prev_report.keycode[0];
-  printf("check keycode %u %u %u\n", keycode, prev_keycode, HID_KEY_SCROLL_LOCK);
+  uint8_t keycode = 0;
+  key_state_to_list(state, &keycode, 1);
+  debug_printf("check keycode %u %u %u\n", keycode, prev_keycode, toggle_hotkey);
   if (prev_keycode != keycode)
   {
     if (keycode == 0)
     {
-      if (prev_keycode == HID_KEY_SCROLL_LOCK)
+      if (prev_keycode == toggle_hotkey)
       {
         prev_keycode = 0;
         key_count++;
@@ -236,15 +361,17 @@ void check_kbd_report(const hid_keyboard_report_t *report)
       }
     }
   }
-  prev_report = *report;
+  prev_keycode = keycode;
 }
 
 // convert hid keycode to ascii and print via usb device CDC (ignore non-printable)
-void print_kbd_report(const hid_keyboard_report_t *report)
+void print_kbd_report(const key_state *report)
 {
   char buf[64];
   int pos = 0;
   bool is_shift = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+  uint8_t keycodes[6] = {};
+  key_state_to_list(report, keycodes, 6);
 
   buf[pos++] = (report->modifier & KEYBOARD_MODIFIER_LEFTSHIFT) != 0 ? 'L' : ' ';
   buf[pos++] = (report->modifier & KEYBOARD_MODIFIER_LEFTCTRL) != 0 ? 'l' : ' ';
@@ -257,9 +384,9 @@ void print_kbd_report(const hid_keyboard_report_t *report)
   buf[pos++] = ' ';
   for(uint8_t i=0; i<6; i++)
   {
-    uint8_t keycode = report->keycode[i];
+    uint8_t keycode = keycodes[i];
     pos += snprintf(buf + pos, 6, "[%02x] ", keycode & 0xff);
-    if ( keycode )
+    if ( keycode && keycode < 128 )
     {
       uint8_t ch = keycode2ascii[keycode][is_shift ? 1 : 0];
 
@@ -279,33 +406,48 @@ void print_kbd_report(const hid_keyboard_report_t *report)
   printf("%s\n", buf);
 }
 
-static void process_kbd_report(uint8_t dev_addr, hid_keyboard_report_t *report)
+static void HOT_FUNC(process_kbd_report)(uint8_t dev_addr, const key_state *report, uint64_t capture_us)
 {
   (void) dev_addr;
   //bool flush = false;
 
+  handoff_note_keyboard(report);
+  cdc_protocol_note_input(INPUT_LOCAL, INPUT_KEYBOARD, report, sizeof(*report), capture_us);
   if (connected)
   {
-    if (should_output())
+    if (should_output() && report_filter_keyboard(FILTER_DEVICE, report))
     {
-      tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report->modifier, report->keycode);
+      if (report_cache_send_keyboard(report))
+      {
+        boot_trace_mark(BOOT_FIRST_KEY);
+        latency_report_queued(report_cache_keyboard_report_id(), LATENCY_LOCAL, capture_us);
+      }
+      else
+      {
+        handoff_resend_keyboard();
+      }
     }
 
-    if ((destination & SEND_TO_UART) != 0)
+    // peer_state keeps what is held even for a repeat, only the send is filtered
+    if ((destination & SEND_TO_UART) != 0 && peer_forward_keyboard(report) &&
+      report_filter_keyboard(FILTER_UART, report))
     {
-      send_uart_kb_report(report);
+      send_uart_kb_report(report, capture_us);
     }
   }
   else
   {
-    printf("not connected\n");
+    debug_printf("not connected\n");
   }
   
   check_kbd_report(report);
-  print_kbd_report(report);
+  if (DEBUG_PRINTS_ENABLED)
+  {
+    print_kbd_report(report);
+  }
 }
 
-void print_mouse_report(const hid_mouse_report_t *report)
+void print_mouse_report(const mouse_state *report)
 {
   //------------- button state  -------------//
   //uint8_t button_changed_mask = report->buttons ^ prev_report.buttons;
@@ -317,52 +459,177 @@ void print_mouse_report(const hid_mouse_report_t *report)
 }
 
 // send mouse report to usb device CDC
-static void process_mouse_report(uint8_t /*dev_addr*/, hid_mouse_report_t const * report)
+static void HOT_FUNC(process_mouse_report)(uint8_t /*dev_addr*/, const mouse_state *report, uint64_t capture_us)
 {
+  handoff_note_mouse_buttons(report->buttons);
+  cdc_protocol_note_input(INPUT_LOCAL, INPUT_MOUSE, report, sizeof(*report), capture_us);
   if (connected)
   {
-    if (should_output())
+    bool crossed = false;
+    if (should_output() && report_filter_mouse(FILTER_DEVICE, report))
     {
-      tud_hid_mouse_report(REPORT_ID_MOUSE, report->buttons, report->x, report->y, report->wheel, report->pan);
+      crossed = edge_switch_motion(report->x, report->y);
+      if (report_cache_send_mouse(report))
+      {
+        latency_report_queued(report_cache_mouse_report_id(), LATENCY_LOCAL, capture_us);
+      }
+      else
+      {
+        handoff_resend_mouse();
+      }
     }
 
-    if ((destination & SEND_TO_UART) != 0)
+    if ((destination & SEND_TO_UART) != 0 && peer_forward_mouse(report) && report_filter_mouse(FILTER_UART, report))
     {
-      send_uart_mouse_report(report);
+      send_uart_mouse_report(report, capture_us);
+    }
+
+    if (crossed)
+    {
+      edge_switch_crossed();
     }
   }
   else
   {
-    printf("not connected\n");
+    debug_printf("not connected\n");
   }
 
-  print_mouse_report(report);
+  if (DEBUG_PRINTS_ENABLED)
+  {
+    print_mouse_report(report);
+  }
 }
 
-// Invoked when received report from device via interrupt endpoint
-void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len)
+static void HOT_FUNC(process_consumer_report)(uint16_t usage, uint64_t capture_us)
 {
-  (void) len;
-  uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
-
-  printf("got report %d\n", itf_protocol);
-  switch(itf_protocol)
+  handoff_note_consumer(usage);
+  cdc_protocol_note_input(INPUT_LOCAL, INPUT_CONSUMER, &usage, sizeof(usage), capture_us);
+  if (connected)
   {
-    case HID_ITF_PROTOCOL_KEYBOARD:
-      process_kbd_report(dev_addr, (hid_keyboard_report_t *) report );
-    break;
+    if (should_output())
+    {
+      if (report_cache_send_consumer(usage))
+      {
+        latency_report_queued(REPORT_ID_CONSUMER_CONTROL, LATENCY_LOCAL, capture_us);
+      }
+      else
+      {
+        handoff_resend_consumer();
+      }
+    }
 
-    case HID_ITF_PROTOCOL_MOUSE:
-      process_mouse_report(dev_addr, (hid_mouse_report_t const*) report );
-    break;
+    if ((destination & SEND_TO_UART) != 0 && peer_forward_consumer(usage))
+    {
+      send_uart_consumer_report(usage, capture_us);
+    }
+  }
+  debug_printf("consumer %04x\n", usage);
+}
 
-    default: break;
+// a report that isn't boot keyboard or mouse, only media keys are used
+static void process_other_report(const queued_report *q)
+{
+  static uint16_t prev_usage;
+  uint16_t usage;
+  if (q->dev_addr != consumer_dev_addr || q->instance != consumer_instance ||
+      !hid_consumer_to_usage(&consumer_layout, q->data, q->len, &usage))
+  {
+    return;
+  }
+  // some keyboards repeat the report while a key is held
+  if (usage != prev_usage)
+  {
+    prev_usage = usage;
+    process_consumer_report(usage, q->capture_us);
   }
+}
+
+// Invoked when received report from device via interrupt endpoint
+// The report is only copied here, the transfer is re-armed straight away so no
+// poll of the device is missed while the previous report is being forwarded.
+void HOT_FUNC(tuh_hid_report_received_cb)(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len)
+{
+  PROFILE_SCOPE(PROBE_HID_REPORT_CB);
+  uint64_t capture_us = time_us_64();
+  uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
+  bool const report_protocol = tuh_hid_get_protocol(dev_addr, instance) == HID_PROTOCOL_REPORT;
+
+  report_queue_push(dev_addr, instance, itf_protocol, report_protocol, report, len, capture_us);
 
   // continue to request to receive report
   if ( !tuh_hid_receive_report(dev_addr, instance) )
   {
     printf("Error: cannot request report\n");
   }
+  report_queue_note_poll(dev_addr, instance, capture_us, (uint32_t) (time_us_64() - capture_us));
+  host_ports_note_report(dev_addr);
+  input_trace_note_report(dev_addr, instance, itf_protocol, report_protocol, report, len, capture_us);
+}
+
+// process reports queued by tuh_hid_report_received_cb, runs on core1 between
+// calls to tuh_task, which gets its turn again after HID_TASK_REPORTS of them
+static const int HID_TASK_REPORTS = 4;
+
+static void HOT_FUNC(hid_task)()
+{
+  queued_report q;
+  for (int i = 0; i < HID_TASK_REPORTS && report_queue_pop(&q); ++i)
+  {
+    PROFILE_SCOPE(PROBE_HID_PROCESS);
+    switch(q.protocol)
+    {
+      case HID_ITF_PROTOCOL_KEYBOARD:
+      {
+        key_state state;
+        if (keyboard_layout_valid && q.report_protocol)
+        {
+          if (!hid_keyboard_to_state(&keyboard_layout, q.data, q.len, &state))
+          {
+            process_other_report(&q); // some other report from the keyboard
+            break;
+          }
+        }
+        else if (q.len >= sizeof(hid_keyboard_report_t))
+        {
+          key_state_from_boot(&state, (const hid_keyboard_report_t *) q.data);
+        }
+        else
+        {
+          break;
+        }
+        process_kbd_report(q.dev_addr, &state, q.capture_us);
+      }
+      break;
+
+      case HID_ITF_PROTOCOL_MOUSE:
+      {
+        mouse_state state;
+        if (mouse_layout_valid && q.report_protocol)
+        {
+          if (!hid_mouse_to_state(&mouse_layout, q.data, q.len, mouse_high_resolution, &mouse_motion, &state))
+          {
+            process_other_report(&q);
+            break;
+          }
+        }
+        else if (q.len >= 3)
+        {
+          hid_mouse_report_t report = {};
+          memcpy(&report, q.data, q.len < sizeof(report) ? q.len : sizeof(report));
+          mouse_state_from_boot(&state, &report);
+        }
+        else
+        {
+          break;
+        }
+        process_mouse_report(q.dev_addr, &state, q.capture_us);
+      }
+      break;
+
+      default:
+        process_other_report(&q);
+      break;
+    }
+  }
 }
 
@@ -0,0 +1,90 @@
+#include <string.h>
+
+#include "hot_path.h"
+#include "mouse_state.h"
+
+static int16_t clamp16(int32_t v)
+{
+  return v > INT16_MAX ? INT16_MAX : v < -INT16_MAX ? -INT16_MAX : v;
+}
+
+// boot reports only have whole detents
+void HOT_FUNC(mouse_state_from_boot)(mouse_state *state, const hid_mouse_report_t *report)
+{
+  memset(state, 0, sizeof(*state));
+  state->buttons = report->buttons;
+  state->x = report->x;
+  state->y = report->y;
+  state->wheel = wheel_to_units(report->wheel, 1);
+  state->pan = wheel_to_units(report->pan, 1);
+}
+
+// wheel counts from a mouse reporting multiplier counts per detent
+int16_t wheel_to_units(int32_t counts, int multiplier)
+{
+  if (multiplier < 1)
+  {
+    multiplier = 1;
+  }
+  return clamp16(counts * WHEEL_UNITS_PER_DETENT / multiplier);
+}
+
+static int32_t wheel_step(int multiplier)
+{
+  if (multiplier < 1 || multiplier > WHEEL_UNITS_PER_DETENT)
+  {
+    multiplier = 1;
+  }
+  return WHEEL_UNITS_PER_DETENT / multiplier;
+}
+
+// Turning the other way drops the part detent so it doesn't cancel the
+// first step back. Whole detents not sent yet are kept, up to what an int16
+// of units holds.
+void HOT_FUNC(wheel_add)(wheel_accumulator *acc, int32_t units, int multiplier)
+{
+  if ((units > 0 && acc->units < 0) || (units < 0 && acc->units > 0))
+  {
+    acc->units -= acc->units % wheel_step(multiplier);
+  }
+  acc->units = clamp16(acc->units + units);
+}
+
+// the whole counts held at multiplier counts per detent, left in place
+int32_t HOT_FUNC(wheel_counts)(const wheel_accumulator *acc, int multiplier)
+{
+  return acc->units / wheel_step(multiplier);
+}
+
+// takes out counts once they have been sent
+void HOT_FUNC(wheel_take)(wheel_accumulator *acc, int32_t counts, int multiplier)
+{
+  acc->units -= counts * wheel_step(multiplier);
+}
+
+// Adds units and returns the counts to send at multiplier counts per
+// detent, keeping what is left over for next time.
+int32_t wheel_accumulate(wheel_accumulator *acc, int32_t units, int multiplier)
+{
+  wheel_add(acc, units, multiplier);
+  int32_t counts = wheel_counts(acc, multiplier);
+  wheel_take(acc, counts, multiplier);
+  return counts;
+}
+
+static int8_t HOT_FUNC(take8)(int32_t *v)
+{
+  int32_t sent = *v > INT8_MAX ? INT8_MAX : *v < -INT8_MAX ? -INT8_MAX : *v;
+  *v -= sent;
+  return sent;
+}
+
+// Adds the motion of a report from a mouse with wider x and y and sets what
+// state can carry, the rest goes with the next report instead of being lost.
+void HOT_FUNC(motion_accumulate)(motion_accumulator *acc, int32_t x, int32_t y, mouse_state *state)
+{
+  acc->x = clamp16(acc->x + x);
+  acc->y = clamp16(acc->y + y);
+  state->x = take8(&acc->x);
+  state->y = take8(&acc->y);
+}
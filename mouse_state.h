@@ -0,0 +1,44 @@
+#pragma once
+
+#include "tusb.h"
+
+// Mouse state passed between the usb host side, the uart link and the usb
+// device side. Wheel and pan are in fractions of a detent so high resolution
+// scrolling survives the trip, whatever multiplier the mouse and the
+// computer each use. Also the layout of a mouse cdc event.
+
+static const int WHEEL_UNITS_PER_DETENT = 120;
+
+struct mouse_state
+{
+  uint8_t buttons;
+  int8_t x;
+  int8_t y;
+  uint8_t reserved;
+  int16_t wheel; // WHEEL_UNITS_PER_DETENT per detent
+  int16_t pan;
+};
+
+static_assert(sizeof(mouse_state) == 8, "mouse_state is sent as a cdc event");
+
+// the remainder of a detent not yet sent on, kept per axis
+struct wheel_accumulator
+{
+  int32_t units;
+};
+
+// motion past what the int8 x and y of one report carry, sent on with the
+// reports after it
+struct motion_accumulator
+{
+  int32_t x;
+  int32_t y;
+};
+
+extern void mouse_state_from_boot(mouse_state *state, const hid_mouse_report_t *report);
+extern int16_t wheel_to_units(int32_t counts, int multiplier);
+extern void wheel_add(wheel_accumulator *acc, int32_t units, int multiplier);
+extern int32_t wheel_counts(const wheel_accumulator *acc, int multiplier);
+extern void wheel_take(wheel_accumulator *acc, int32_t counts, int multiplier);
+extern int32_t wheel_accumulate(wheel_accumulator *acc, int32_t units, int multiplier);
+extern void motion_accumulate(motion_accumulator *acc, int32_t x, int32_t y, mouse_state *state);
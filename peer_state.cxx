@@ -0,0 +1,217 @@
+#include <stdio.h>
+
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "cdc_text.h"
+#include "common.h"
+#include "peer_state.h"
+#include "uart_messages.h"
+
+enum HeldInput : uint8_t
+{
+  HELD_KEYBOARD = 1 << 0,
+  HELD_MOUSE = 1 << 1,
+  HELD_CONSUMER = 1 << 2
+};
+
+// the flags change on both cores, input is routed on core1
+static critical_section peer_cs;
+static uint8_t local_flags;
+static uint8_t peer_flags;
+static bool peer_known;
+
+// the latest input not forwarded, sent once the peer can use it
+static uint8_t held;
+static key_state held_keyboard;
+static uint8_t held_buttons;
+static uint16_t held_consumer;
+
+// the latest input, for the snapshot
+static key_state local_keyboard;
+static uint8_t local_buttons;
+
+struct peer_stats
+{
+  uint32_t forwarded;
+  uint32_t held_back;
+  uint32_t flushed;
+};
+
+static peer_stats stats;
+
+void peer_state_init()
+{
+  critical_section_init(&peer_cs);
+}
+
+void peer_state_set_local(uint8_t flag, bool on)
+{
+  critical_section_enter_blocking(&peer_cs);
+  uint8_t was = local_flags;
+  local_flags = on ? (local_flags | flag) : (local_flags & ~flag);
+  uint8_t flags = local_flags;
+  critical_section_exit(&peer_cs);
+  // before the uart is up the snapshot core0 sends first carries the flags
+  if (flags != was && core0_ready)
+  {
+    send_uart_peer_state(flags);
+  }
+}
+
+// Forward input only while the peer has the output and a host awake to
+// take it. The host side ignores a suspended device's reports and this
+// firmware never wakes the host itself.
+bool peer_route(bool known, uint8_t flags, bool peer_output)
+{
+  if (!known)
+  {
+    return true;
+  }
+  return peer_output && (flags & PEER_DEVICE_MOUNTED) != 0 && (flags & PEER_DEVICE_SUSPENDED) == 0;
+}
+
+static bool route()
+{
+  return peer_route(peer_known, peer_flags, peer_should_output());
+}
+
+void peer_state_received(uint8_t flags)
+{
+  critical_section_enter_blocking(&peer_cs);
+  bool first = !peer_known;
+  peer_known = true;
+  peer_flags = flags;
+  uint8_t mine = local_flags;
+  critical_section_exit(&peer_cs);
+  printf("peer state %x\n", flags);
+  if (first)
+  {
+    // the peer may have started after this board last sent its state
+    send_uart_peer_state(mine);
+  }
+  peer_state_flush();
+}
+
+bool peer_state_known()
+{
+  return peer_known;
+}
+
+uint8_t peer_state_flags()
+{
+  return peer_flags;
+}
+
+uint8_t peer_state_local_flags()
+{
+  return local_flags;
+}
+
+void peer_state_local_input(key_state *keys, uint8_t *buttons)
+{
+  critical_section_enter_blocking(&peer_cs);
+  *keys = local_keyboard;
+  *buttons = local_buttons;
+  critical_section_exit(&peer_cs);
+}
+
+bool peer_forward_keyboard(const key_state *state)
+{
+  critical_section_enter_blocking(&peer_cs);
+  local_keyboard = *state;
+  bool forward = route();
+  if (forward)
+  {
+    held &= ~HELD_KEYBOARD;
+    stats.forwarded++;
+  }
+  else
+  {
+    held |= HELD_KEYBOARD;
+    held_keyboard = *state;
+    stats.held_back++;
+  }
+  critical_section_exit(&peer_cs);
+  return forward;
+}
+
+// only the buttons are kept, motion the peer missed doesn't matter
+bool peer_forward_mouse(const mouse_state *state)
+{
+  critical_section_enter_blocking(&peer_cs);
+  local_buttons = state->buttons;
+  bool forward = route();
+  if (forward)
+  {
+    held &= ~HELD_MOUSE;
+    stats.forwarded++;
+  }
+  else
+  {
+    held |= HELD_MOUSE;
+    held_buttons = state->buttons;
+    stats.held_back++;
+  }
+  critical_section_exit(&peer_cs);
+  return forward;
+}
+
+bool peer_forward_consumer(uint16_t usage)
+{
+  critical_section_enter_blocking(&peer_cs);
+  bool forward = route();
+  if (forward)
+  {
+    held &= ~HELD_CONSUMER;
+    stats.forwarded++;
+  }
+  else
+  {
+    held |= HELD_CONSUMER;
+    held_consumer = usage;
+    stats.held_back++;
+  }
+  critical_section_exit(&peer_cs);
+  return forward;
+}
+
+// Sends the input held back if the peer can now use it. Called whenever the
+// peer state or output mask changes, before this board sends a new mask so
+// the peer restores the right keys when it takes the output.
+void peer_state_flush()
+{
+  critical_section_enter_blocking(&peer_cs);
+  uint8_t send = route() ? held : 0;
+  held &= ~send;
+  key_state keyboard = held_keyboard;
+  mouse_state mouse = {};
+  mouse.buttons = held_buttons;
+  uint16_t consumer = held_consumer;
+  critical_section_exit(&peer_cs);
+
+  // stamped now, the peer only paces them from here on
+  uint64_t now = time_us_64();
+  if ((send & HELD_KEYBOARD) != 0)
+  {
+    send_uart_kb_report(&keyboard, now);
+    stats.flushed++;
+  }
+  if ((send & HELD_MOUSE) != 0)
+  {
+    send_uart_mouse_report(&mouse, now);
+    stats.flushed++;
+  }
+  if ((send & HELD_CONSUMER) != 0)
+  {
+    send_uart_consumer_report(consumer, now);
+    stats.flushed++;
+  }
+}
+
+void peer_state_print()
+{
+  cdc_printf("local %x peer %x%s forwarding %d\r\n", local_flags, peer_flags,
+    peer_known ? "" : " (unknown)", route() ? 1 : 0);
+  cdc_printf("forwarded %lu held back %lu flushed %lu\r\n", stats.forwarded, stats.held_back, stats.flushed);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "key_state.h"
+#include "mouse_state.h"
+#include "tusb.h"
+
+// What each board knows about the other: whether its usb device side is
+// mounted and awake and which input devices are plugged into it. Both boards
+// send their own state whenever it changes, along with the output mask that
+// is already shared, and input is only forwarded over the uart when the
+// other board would pass it on to its host.
+//
+// Input held back while the peer can't use it is kept, and whatever is
+// still held is sent over when forwarding starts again, ahead of the output
+// mask when this board gives the output away. A peer that hasn't said
+// anything yet gets everything, as before.
+//
+// The latest keyboard and mouse buttons are kept whether forwarded or not,
+// they go in this board's snapshot, see link_sync.h.
+
+enum PeerFlag : uint8_t
+{
+  PEER_DEVICE_MOUNTED = 1 << 0,
+  PEER_DEVICE_SUSPENDED = 1 << 1,
+  PEER_KEYBOARD_ATTACHED = 1 << 2,
+  PEER_MOUSE_ATTACHED = 1 << 3
+};
+
+extern void peer_state_init();
+extern void peer_state_set_local(uint8_t flag, bool on);
+extern void peer_state_received(uint8_t flags);
+extern bool peer_state_known();
+extern uint8_t peer_state_flags();
+extern uint8_t peer_state_local_flags();
+extern void peer_state_local_input(key_state *keys, uint8_t *buttons);
+extern bool peer_route(bool peer_known, uint8_t peer_flags, bool peer_output);
+extern bool peer_forward_keyboard(const key_state *state);
+extern bool peer_forward_mouse(const mouse_state *state);
+extern bool peer_forward_consumer(uint16_t usage);
+extern void peer_state_flush();
+extern void peer_state_print();
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+
+#include "cdc_text.h"
+#include "hot_path.h"
+#include "profile.h"
+
+// each probe is only ever recorded from one core so no locking is needed,
+// a dump taken while a probe is being updated can be slightly inconsistent
+static profile_probe probes[PROBE_COUNT];
+
+static const char *probe_names[PROBE_COUNT] =
+{
+  "tud_task",
+  "cdc_flush",
+  "uart_task",
+  "tuh_task",
+  "hid_report_cb",
+  "hid_process",
+  "uart_irq"
+};
+
+// SysTick is per core, so this is called on each core that records probes
+void profile_init_core()
+{
+#if PROFILE_ENABLED
+  systick_hw->csr = 0; // disable while setting up
+  systick_hw->rvr = 0xffffff;
+  systick_hw->cvr = 0;
+  systick_hw->csr = 0x5; // enable, count processor clock cycles, no interrupt
+#endif
+}
+
+#if PROFILE_ENABLED
+void HOT_FUNC(profile_record)(ProfileProbe probe, uint32_t cycles)
+{
+  profile_probe &p = probes[probe];
+  if (p.count == 0 || cycles < p.min_cycles)
+  {
+    p.min_cycles = cycles;
+  }
+  if (cycles > p.max_cycles)
+  {
+    p.max_cycles = cycles;
+  }
+  p.count++;
+  p.total_cycles += cycles;
+  int bucket = cycles == 0 ? 0 : 32 - __builtin_clz(cycles);
+  if (bucket >= PROFILE_BUCKETS)
+  {
+    bucket = PROFILE_BUCKETS - 1;
+  }
+  p.hist[bucket]++;
+}
+#endif
+
+void profile_reset()
+{
+  memset(probes, 0, sizeof(probes));
+}
+
+const profile_probe *profile_get(ProfileProbe probe)
+{
+  return &probes[probe];
+}
+
+// write all the probes to the cdc interface
+void profile_print()
+{
+#if PROFILE_ENABLED
+  uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+  for (int i = 0; i < PROBE_COUNT; ++i)
+  {
+    profile_probe p = probes[i];
+    cdc_printf("%-13s n %lu min %lu mean %lu max %lu cycles (max %lu us)\r\n",
+      probe_names[i], (unsigned long) p.count, (unsigned long) p.min_cycles,
+      (unsigned long) (p.count != 0 ? p.total_cycles / p.count : 0), (unsigned long) p.max_cycles,
+      (unsigned long) (p.max_cycles / mhz));
+
+    // histogram as "<2^n:count" for each bucket in use, a few to a line
+    char line[128];
+    int pos = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; ++b)
+    {
+      if (p.hist[b] != 0)
+      {
+        pos += snprintf(line + pos, sizeof(line) - pos, " <2^%d:%lu", b, (unsigned long) p.hist[b]);
+        if (pos > (int) sizeof(line) - 24)
+        {
+          cdc_printf("%s\r\n", line);
+          pos = 0;
+        }
+      }
+    }
+    if (pos > 0)
+    {
+      cdc_printf("%s\r\n", line);
+    }
+  }
+#else
+  cdc_printf("profiling not enabled\r\n");
+#endif
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+// Scoped probes timing the main loop stages of both cores in SysTick cycles.
+// Each probe keeps min/max/mean and a log2 histogram. Building with
+// PROFILE_ENABLED=0 compiles the probes away.
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+
+enum ProfileProbe : uint8_t
+{
+  PROBE_TUD_TASK,
+  PROBE_CDC_FLUSH,
+  PROBE_UART_TASK,
+  PROBE_TUH_TASK,
+  PROBE_HID_REPORT_CB,
+  PROBE_HID_PROCESS,
+  PROBE_UART_IRQ,
+  PROBE_COUNT
+};
+
+// SysTick is 24 bits so that is the longest time a probe can see
+static const int PROFILE_BUCKETS = 25;
+
+struct profile_probe
+{
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t hist[PROFILE_BUCKETS]; // hist[n] counts times below 2^n cycles
+};
+
+extern void profile_init_core();
+extern void profile_reset();
+extern void profile_print();
+extern const profile_probe *profile_get(ProfileProbe probe);
+
+#if PROFILE_ENABLED
+
+#include "hardware/structs/systick.h"
+
+extern void profile_record(ProfileProbe probe, uint32_t cycles);
+
+class profile_scope
+{
+public:
+  explicit profile_scope(ProfileProbe probe) : m_probe(probe), m_start(systick_hw->cvr)
+  {
+  }
+  ~profile_scope()
+  {
+    // SysTick counts down
+    profile_record(m_probe, (m_start - systick_hw->cvr) & 0xffffff);
+  }
+private:
+  ProfileProbe m_probe;
+  uint32_t m_start;
+};
+
+#define PROFILE_SCOPE(probe) profile_scope profile_scope_##probe(probe)
+
+#else
+
+#define PROFILE_SCOPE(probe) do {} while (0)
+
+#endif
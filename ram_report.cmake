@@ -0,0 +1,40 @@
+# Lists the functions and tables the link put in SRAM through the sdk's
+# .time_critical sections, from the link map, with their sizes.
+#
+# cmake -DMAP=<map file> [-DOUT=<report file>] -P ram_report.cmake
+
+if (NOT MAP)
+  message(FATAL_ERROR "usage: cmake -DMAP=<map file> [-DOUT=<report file>] -P ram_report.cmake")
+endif()
+
+file(READ ${MAP} map)
+# an input section is its name, then address, size and object file, split
+# over two lines when the name is long
+string(REGEX MATCHALL "\n \\.time_critical\\.[^ \t\r\n]+[ \t\r\n]+0x[0-9a-fA-F]+[ \t]+0x[0-9a-fA-F]+[ \t]+[^\r\n]+" sections "${map}")
+
+set(report "")
+set(total 0)
+set(count 0)
+foreach(section IN LISTS sections)
+  string(REGEX REPLACE "^\n \\.time_critical\\.([^ \t\r\n]+)[ \t\r\n]+(0x[0-9a-fA-F]+)[ \t]+(0x[0-9a-fA-F]+)[ \t]+([^\r\n]+)$"
+    "\\1;\\2;\\3;\\4" fields "${section}")
+  list(GET fields 0 name)
+  list(GET fields 1 address)
+  list(GET fields 2 size)
+  list(GET fields 3 object)
+  math(EXPR size "${size}")
+  if (size EQUAL 0)
+    continue()
+  endif()
+  get_filename_component(object ${object} NAME)
+  string(REGEX REPLACE "\\.(c|cxx)\\.obj$" "" object ${object})
+  math(EXPR total "${total} + ${size}")
+  math(EXPR count "${count} + 1")
+  string(APPEND report "${address} ${size}\t${object}\t${name}\n")
+endforeach()
+string(APPEND report "${count} sections, ${total} bytes in ram\n")
+
+message("${report}")
+if (OUT)
+  file(WRITE ${OUT} "${report}")
+endif()
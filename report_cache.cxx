@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include "pico/critical_section.h"
+
+#include "edge_switch.h"
+#include "hot_path.h"
+#include "report_cache.h"
+#include "report_filter.h"
+#include "usb_descriptors.h"
+
+static const int MAX_REPORT_SIZE = sizeof(key_state);
+
+struct TU_ATTR_PACKED mouse_report
+{
+  uint8_t buttons;
+  int8_t x;
+  int8_t y;
+  int16_t wheel;
+  int16_t pan;
+};
+
+struct TU_ATTR_PACKED absolute_pointer_report
+{
+  uint8_t buttons;
+  uint16_t x;
+  uint16_t y;
+  int8_t wheel;
+  int8_t pan;
+};
+
+struct cached_report
+{
+  uint8_t len;
+  uint8_t data[MAX_REPORT_SIZE];
+};
+
+// reports are sent from both cores
+static critical_section cache_cs;
+static cached_report reports[REPORT_ID_COUNT];
+static volatile uint8_t host_leds;
+static volatile uint8_t mouse_feature;
+// Mouse input the host hasn't had yet. A report that finds the endpoint busy
+// leaves its motion and wheel here for the next report or the handoff
+// retry, only what a queued report carried is taken out.
+static motion_accumulator pending_motion;
+static wheel_accumulator wheel_acc;
+static wheel_accumulator pan_acc;
+
+static void HOT_FUNC(store)(uint8_t report_id, const void *data, uint8_t len)
+{
+  critical_section_enter_blocking(&cache_cs);
+  reports[report_id].len = len;
+  memcpy(reports[report_id].data, data, len);
+  critical_section_exit(&cache_cs);
+}
+
+// nothing sent yet reads as nothing pressed
+void report_cache_init()
+{
+  critical_section_init(&cache_cs);
+  reports[REPORT_ID_KEYBOARD].len = sizeof(hid_keyboard_report_t);
+  reports[REPORT_ID_MOUSE].len = sizeof(mouse_report);
+  reports[REPORT_ID_NKRO].len = sizeof(key_state);
+  reports[REPORT_ID_CONSUMER_CONTROL].len = sizeof(uint16_t);
+  reports[REPORT_ID_ABSOLUTE_POINTER].len = sizeof(absolute_pointer_report);
+}
+
+static bool keyboard_boot_protocol()
+{
+  return tud_hid_n_get_protocol(HID_INSTANCE_KEYBOARD) == HID_PROTOCOL_BOOT;
+}
+
+bool HOT_FUNC(report_cache_send_keyboard)(const key_state *state)
+{
+  if (keyboard_boot_protocol())
+  {
+    hid_keyboard_report_t report;
+    key_state_to_boot(state, &report);
+    if (!tud_hid_n_report(HID_INSTANCE_KEYBOARD, 0, &report, sizeof(report)))
+    {
+      return false;
+    }
+    store(REPORT_ID_KEYBOARD, &report, sizeof(report));
+    report_filter_keyboard_sent(FILTER_DEVICE, state);
+    return true;
+  }
+  if (!tud_hid_n_report(HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO, state, sizeof(*state)))
+  {
+    return false;
+  }
+  store(REPORT_ID_NKRO, state, sizeof(*state));
+  report_filter_keyboard_sent(FILTER_DEVICE, state);
+  return true;
+}
+
+// the id the next keyboard report goes out with, 0 for a boot report
+uint8_t report_cache_keyboard_report_id()
+{
+  return keyboard_boot_protocol() ? 0 : REPORT_ID_NKRO;
+}
+
+// a boot keyboard interface can't carry the mouse report as well
+bool report_cache_mouse_available()
+{
+  return HID_SPLIT_INTERFACES || !keyboard_boot_protocol();
+}
+
+static int16_t clamp16(int32_t v)
+{
+  return v > INT16_MAX ? INT16_MAX : v < -INT16_MAX ? -INT16_MAX : v;
+}
+
+static bool absolute_pointer()
+{
+  return ABSOLUTE_POINTER && edge_switch_enabled();
+}
+
+static int8_t clamp8(int32_t v)
+{
+  return v > INT8_MAX ? INT8_MAX : v < -INT8_MAX ? -INT8_MAX : v;
+}
+
+// the edge switch cursor has already been moved by this report
+static bool HOT_FUNC(send_absolute)(const mouse_state *state)
+{
+  uint16_t x, y;
+  edge_switch_absolute(&x, &y);
+  absolute_pointer_report report;
+  report.buttons = state->buttons;
+  report.x = x;
+  report.y = y;
+  critical_section_enter_blocking(&cache_cs);
+  wheel_add(&wheel_acc, state->wheel, 1);
+  wheel_add(&pan_acc, state->pan, 1);
+  report.wheel = clamp8(wheel_counts(&wheel_acc, 1));
+  report.pan = clamp8(wheel_counts(&pan_acc, 1));
+  critical_section_exit(&cache_cs);
+  if (!tud_hid_n_report(HID_INSTANCE_MOUSE, REPORT_ID_ABSOLUTE_POINTER, &report, sizeof(report)))
+  {
+    return false;
+  }
+  critical_section_enter_blocking(&cache_cs);
+  wheel_take(&wheel_acc, report.wheel, 1);
+  wheel_take(&pan_acc, report.pan, 1);
+  critical_section_exit(&cache_cs);
+  store(REPORT_ID_ABSOLUTE_POINTER, &report, sizeof(report));
+  return true;
+}
+
+static int wheel_multiplier(uint8_t feature, uint8_t high_res)
+{
+  return (feature & high_res) != 0 ? MOUSE_WHEEL_MULTIPLIER : 1;
+}
+
+// Returns false if the endpoint was busy, the report's motion and wheel are
+// then kept and go out with the next one.
+bool HOT_FUNC(report_cache_send_mouse)(const mouse_state *state)
+{
+  if (!report_cache_mouse_available())
+  {
+    return false;
+  }
+  if (absolute_pointer())
+  {
+    if (!send_absolute(state))
+    {
+      return false;
+    }
+    report_filter_mouse_sent(FILTER_DEVICE, state);
+    return true;
+  }
+  uint8_t feature = mouse_feature;
+  int wheel_mul = wheel_multiplier(feature, MOUSE_FEATURE_WHEEL_HIGH_RES);
+  int pan_mul = wheel_multiplier(feature, MOUSE_FEATURE_PAN_HIGH_RES);
+  mouse_report report;
+  report.buttons = state->buttons;
+  critical_section_enter_blocking(&cache_cs);
+  pending_motion.x = clamp16(pending_motion.x + state->x);
+  pending_motion.y = clamp16(pending_motion.y + state->y);
+  wheel_add(&wheel_acc, state->wheel, wheel_mul);
+  wheel_add(&pan_acc, state->pan, pan_mul);
+  report.x = clamp8(pending_motion.x);
+  report.y = clamp8(pending_motion.y);
+  report.wheel = clamp16(wheel_counts(&wheel_acc, wheel_mul));
+  report.pan = clamp16(wheel_counts(&pan_acc, pan_mul));
+  critical_section_exit(&cache_cs);
+  if (!tud_hid_n_report(HID_INSTANCE_MOUSE, REPORT_ID_MOUSE, &report, sizeof(report)))
+  {
+    return false;
+  }
+  critical_section_enter_blocking(&cache_cs);
+  pending_motion.x -= report.x;
+  pending_motion.y -= report.y;
+  wheel_take(&wheel_acc, report.wheel, wheel_mul);
+  wheel_take(&pan_acc, report.pan, pan_mul);
+  critical_section_exit(&cache_cs);
+  store(REPORT_ID_MOUSE, &report, sizeof(report));
+  report_filter_mouse_sent(FILTER_DEVICE, state);
+  return true;
+}
+
+// motion or whole wheel steps left over that no report has carried yet
+bool report_cache_mouse_pending()
+{
+  uint8_t feature = mouse_feature;
+  bool absolute = absolute_pointer();
+  int wheel_mul = absolute ? 1 : wheel_multiplier(feature, MOUSE_FEATURE_WHEEL_HIGH_RES);
+  int pan_mul = absolute ? 1 : wheel_multiplier(feature, MOUSE_FEATURE_PAN_HIGH_RES);
+  critical_section_enter_blocking(&cache_cs);
+  bool pending = pending_motion.x != 0 || pending_motion.y != 0 || wheel_counts(&wheel_acc, wheel_mul) != 0 ||
+    wheel_counts(&pan_acc, pan_mul) != 0;
+  critical_section_exit(&cache_cs);
+  return pending;
+}
+
+// what was left for a host this board has since given the output away
+void report_cache_drop_mouse_pending()
+{
+  critical_section_enter_blocking(&cache_cs);
+  pending_motion = {};
+  wheel_acc = {};
+  pan_acc = {};
+  critical_section_exit(&cache_cs);
+}
+
+uint8_t report_cache_mouse_report_id()
+{
+  return absolute_pointer() ? REPORT_ID_ABSOLUTE_POINTER : REPORT_ID_MOUSE;
+}
+
+// media keys share the keyboard interface
+bool report_cache_consumer_available()
+{
+  return !keyboard_boot_protocol();
+}
+
+bool HOT_FUNC(report_cache_send_consumer)(uint16_t usage)
+{
+  if (!report_cache_consumer_available())
+  {
+    return false;
+  }
+  if (!tud_hid_n_report(HID_INSTANCE_KEYBOARD, REPORT_ID_CONSUMER_CONTROL, &usage, sizeof(usage)))
+  {
+    return false;
+  }
+  store(REPORT_ID_CONSUMER_CONTROL, &usage, sizeof(usage));
+  return true;
+}
+
+// copies the cached input report without its id, returns 0 if there is none
+uint16_t report_cache_get(uint8_t report_id, uint8_t *buffer, uint16_t max_len)
+{
+  if (report_id >= REPORT_ID_COUNT)
+  {
+    return 0;
+  }
+  critical_section_enter_blocking(&cache_cs);
+  uint16_t len = reports[report_id].len;
+  if (len > max_len)
+  {
+    len = max_len;
+  }
+  memcpy(buffer, reports[report_id].data, len);
+  critical_section_exit(&cache_cs);
+  return len;
+}
+
+void report_cache_set_leds(uint8_t leds)
+{
+  host_leds = leds;
+}
+
+uint8_t report_cache_leds()
+{
+  return host_leds;
+}
+
+// resolution multipliers set by the host, cleared when the bus resets
+void report_cache_set_mouse_feature(uint8_t feature)
+{
+  mouse_feature = feature & (MOUSE_FEATURE_WHEEL_HIGH_RES | MOUSE_FEATURE_PAN_HIGH_RES);
+}
+
+uint8_t report_cache_mouse_feature()
+{
+  return mouse_feature;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "key_state.h"
+#include "mouse_state.h"
+#include "tusb.h"
+
+// The last report sent to the host for each report id and the LED state the
+// host last set. Reports to the host go through here so the cache is always
+// current, GET_REPORT is answered from it and a switch can push state from
+// it without asking the usb host side.
+//
+// The keyboard goes out as the NKRO report, or as a boot report with no id
+// while the host has selected the boot protocol. The mouse wheel is sent in
+// whole detents or in the finer counts the host asked for with the
+// resolution multiplier feature, with any part detent carried over. Motion
+// and wheel a busy endpoint kept from going out are carried over too. While
+// the absolute pointer is in use the mouse goes out as the edge switch
+// cursor position instead.
+
+extern void report_cache_init();
+extern bool report_cache_send_keyboard(const key_state *state);
+extern uint8_t report_cache_keyboard_report_id();
+extern bool report_cache_mouse_available();
+extern bool report_cache_consumer_available();
+extern bool report_cache_send_mouse(const mouse_state *state);
+extern bool report_cache_mouse_pending();
+extern void report_cache_drop_mouse_pending();
+extern uint8_t report_cache_mouse_report_id();
+extern bool report_cache_send_consumer(uint16_t usage);
+extern uint16_t report_cache_get(uint8_t report_id, uint8_t *buffer, uint16_t max_len);
+extern void report_cache_set_leds(uint8_t leds);
+extern uint8_t report_cache_leds();
+extern void report_cache_set_mouse_feature(uint8_t feature);
+extern uint8_t report_cache_mouse_feature();
@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "cdc_text.h"
+#include "hot_path.h"
+#include "report_filter.h"
+
+// what last went out on a path, valid once something has
+struct filter_state
+{
+  bool keyboard_valid;
+  bool mouse_valid;
+  key_state keyboard;
+  uint8_t buttons;
+  uint64_t keyboard_us;
+  uint64_t mouse_us;
+};
+
+// local input is filtered on core1, the device path is noted from both
+static critical_section filter_cs;
+static filter_state paths[FILTER_PATHS];
+static report_filter_stats stats[FILTER_PATHS];
+
+void report_filter_init()
+{
+  critical_section_init(&filter_cs);
+}
+
+// false to leave the report out on this path
+bool HOT_FUNC(report_filter_keyboard)(FilterPath path, const key_state *state)
+{
+  uint64_t now = time_us_64();
+  critical_section_enter_blocking(&filter_cs);
+  const filter_state &f = paths[path];
+  bool send = true;
+  if (f.keyboard_valid && keyboard_report_repeats(&f.keyboard, state))
+  {
+    send = now - f.keyboard_us >= FILTER_REFRESH_US;
+    if (send)
+    {
+      stats[path].refreshed++;
+    }
+    else
+    {
+      stats[path].keyboard_dropped++;
+    }
+  }
+  critical_section_exit(&filter_cs);
+  return send;
+}
+
+bool HOT_FUNC(report_filter_mouse)(FilterPath path, const mouse_state *state)
+{
+  uint64_t now = time_us_64();
+  critical_section_enter_blocking(&filter_cs);
+  const filter_state &f = paths[path];
+  bool send = true;
+  if (f.mouse_valid && mouse_report_repeats(f.buttons, state))
+  {
+    send = now - f.mouse_us >= FILTER_REFRESH_US;
+    if (send)
+    {
+      stats[path].refreshed++;
+    }
+    else
+    {
+      stats[path].mouse_dropped++;
+    }
+  }
+  critical_section_exit(&filter_cs);
+  return send;
+}
+
+void HOT_FUNC(report_filter_keyboard_sent)(FilterPath path, const key_state *state)
+{
+  uint64_t now = time_us_64();
+  critical_section_enter_blocking(&filter_cs);
+  filter_state &f = paths[path];
+  f.keyboard_valid = true;
+  f.keyboard = *state;
+  f.keyboard_us = now;
+  critical_section_exit(&filter_cs);
+}
+
+void HOT_FUNC(report_filter_mouse_sent)(FilterPath path, const mouse_state *state)
+{
+  uint64_t now = time_us_64();
+  critical_section_enter_blocking(&filter_cs);
+  filter_state &f = paths[path];
+  f.mouse_valid = true;
+  f.buttons = state->buttons;
+  f.mouse_us = now;
+  critical_section_exit(&filter_cs);
+}
+
+// the other end may have lost what was sent, the next report goes anyway
+void report_filter_restart(FilterPath path)
+{
+  critical_section_enter_blocking(&filter_cs);
+  paths[path].keyboard_valid = false;
+  paths[path].mouse_valid = false;
+  critical_section_exit(&filter_cs);
+}
+
+report_filter_stats report_filter_get_stats(FilterPath path)
+{
+  critical_section_enter_blocking(&filter_cs);
+  report_filter_stats s = stats[path];
+  critical_section_exit(&filter_cs);
+  return s;
+}
+
+void report_filter_reset_stats()
+{
+  critical_section_enter_blocking(&filter_cs);
+  memset(stats, 0, sizeof(stats));
+  critical_section_exit(&filter_cs);
+}
+
+void report_filter_print()
+{
+  static const char *const path_names[] = { "device", "uart" };
+  for (int path = 0; path < FILTER_PATHS; ++path)
+  {
+    report_filter_stats s = report_filter_get_stats((FilterPath) path);
+    cdc_printf("repeats left out on %s keyboard %lu mouse %lu refreshed %lu\r\n", path_names[path],
+      (unsigned long) s.keyboard_dropped, (unsigned long) s.mouse_dropped, (unsigned long) s.refreshed);
+  }
+}
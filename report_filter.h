@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string.h>
+
+#include "key_state.h"
+#include "mouse_state.h"
+
+// Many keyboards send the same report again for as long as a key is held,
+// and some mice report at their full rate without moving. Local input that
+// repeats what was last sent on a path, the usb device endpoint or the uart,
+// is left out on that path. A mouse report repeats when it doesn't move,
+// scroll or change the buttons; motion always goes. A repeat still goes
+// FILTER_REFRESH_US after the last report on its path, in case that one was
+// lost.
+//
+// The device path is noted by report_cache for every report sent to the
+// host, whether local, from the peer or from a switch, and the uart path by
+// the senders in uart_messages, so each compares against what really went
+// out. A path starts over, letting the next report through, when the host
+// mounts or resumes and when the peer restarts or the link comes back.
+
+enum FilterPath : uint8_t
+{
+  FILTER_DEVICE,
+  FILTER_UART,
+  FILTER_PATHS
+};
+
+static const uint64_t FILTER_REFRESH_US = 50000;
+
+struct report_filter_stats
+{
+  uint32_t keyboard_dropped;
+  uint32_t mouse_dropped;
+  uint32_t refreshed; // repeats sent because FILTER_REFRESH_US had passed
+};
+
+inline bool keyboard_report_repeats(const key_state *last, const key_state *state)
+{
+  return memcmp(last, state, sizeof(key_state)) == 0;
+}
+
+inline bool mouse_report_repeats(uint8_t last_buttons, const mouse_state *state)
+{
+  return state->buttons == last_buttons && state->x == 0 && state->y == 0 && state->wheel == 0 && state->pan == 0;
+}
+
+extern void report_filter_init();
+extern bool report_filter_keyboard(FilterPath path, const key_state *state);
+extern bool report_filter_mouse(FilterPath path, const mouse_state *state);
+extern void report_filter_keyboard_sent(FilterPath path, const key_state *state);
+extern void report_filter_mouse_sent(FilterPath path, const mouse_state *state);
+extern void report_filter_restart(FilterPath path);
+extern report_filter_stats report_filter_get_stats(FilterPath path);
+extern void report_filter_reset_stats();
+extern void report_filter_print();
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cdc_text.h"
+#include "hot_path.h"
+#include "report_queue.h"
+
+// Producer and consumer both run on core1, the callback inside tuh_task and the
+// processing after it returns, so the indices need no locking.
+static const uint32_t QUEUE_SIZE = 16; // must be a power of two
+static queued_report queue[QUEUE_SIZE];
+static volatile uint32_t queue_head;
+static volatile uint32_t queue_tail;
+
+// A 1000Hz mouse in motion reports every 1ms, a longer gap means a poll was
+// missed. Much longer gaps are just the device having nothing to say.
+static const uint32_t POLL_GAP_US = 1500;
+static const uint32_t POLL_IDLE_US = 16000;
+static const int POLL_SLOTS = 32;
+static uint64_t last_poll_us[POLL_SLOTS];
+
+static report_queue_stats stats;
+
+bool HOT_FUNC(report_queue_push)(uint8_t dev_addr, uint8_t instance, uint8_t protocol, bool report_protocol, const uint8_t *report, uint16_t len, uint64_t capture_us)
+{
+  uint32_t head = queue_head;
+  uint32_t used = head - queue_tail;
+  if (used >= QUEUE_SIZE)
+  {
+    stats.overflows++;
+    return false;
+  }
+  if (used + 1 > stats.high_water)
+  {
+    stats.high_water = used + 1;
+  }
+
+  queued_report &q = queue[head & (QUEUE_SIZE - 1)];
+  q.capture_us = capture_us;
+  q.dev_addr = dev_addr;
+  q.instance = instance;
+  q.protocol = protocol;
+  q.report_protocol = report_protocol;
+  q.len = len > REPORT_QUEUE_DATA_SIZE ? REPORT_QUEUE_DATA_SIZE : len;
+  memcpy(q.data, report, q.len);
+  queue_head = head + 1;
+  stats.reports++;
+  return true;
+}
+
+// a later report from the interface replaces this one, the id is the first
+// byte when it has one
+static bool same_kind(const queued_report &a, const queued_report &b)
+{
+  return a.dev_addr == b.dev_addr && a.instance == b.instance && a.report_protocol == b.report_protocol &&
+    a.len == b.len && (!a.report_protocol || a.len == 0 || a.data[0] == b.data[0]);
+}
+
+// Drops each report followed by another of the same kind, for while nothing
+// can be forwarded. Keyboard, media key and button states are whole in each
+// report so only mouse motion is lost, and the queue doesn't overflow and
+// drop the last state instead.
+void report_queue_keep_latest()
+{
+  uint32_t head = queue_head;
+  uint32_t kept = queue_tail;
+  for (uint32_t i = queue_tail; i != head; ++i)
+  {
+    const queued_report &q = queue[i & (QUEUE_SIZE - 1)];
+    bool replaced = false;
+    for (uint32_t j = i + 1; j != head && !replaced; ++j)
+    {
+      replaced = same_kind(q, queue[j & (QUEUE_SIZE - 1)]);
+    }
+    if (!replaced)
+    {
+      if (kept != i)
+      {
+        queue[kept & (QUEUE_SIZE - 1)] = q;
+      }
+      kept++;
+    }
+  }
+  queue_head = kept;
+}
+
+bool HOT_FUNC(report_queue_pop)(queued_report *report)
+{
+  uint32_t tail = queue_tail;
+  if (tail == queue_head)
+  {
+    return false;
+  }
+  *report = queue[tail & (QUEUE_SIZE - 1)];
+  queue_tail = tail + 1;
+  return true;
+}
+
+// record when a report arrived and how long it took to ask for the next one
+void report_queue_note_poll(uint8_t dev_addr, uint8_t instance, uint64_t capture_us, uint32_t rearm_us)
+{
+  int slot = ((dev_addr << 2) | (instance & 3)) & (POLL_SLOTS - 1);
+  uint64_t last = last_poll_us[slot];
+  last_poll_us[slot] = capture_us;
+  if (last != 0)
+  {
+    uint32_t gap = (uint32_t) (capture_us - last);
+    if (gap > POLL_GAP_US && gap < POLL_IDLE_US)
+    {
+      stats.poll_gaps++;
+      if (gap > stats.max_gap_us)
+      {
+        stats.max_gap_us = gap;
+      }
+    }
+  }
+  if (rearm_us > stats.max_rearm_us)
+  {
+    stats.max_rearm_us = rearm_us;
+  }
+}
+
+void report_queue_reset_stats()
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+report_queue_stats report_queue_get_stats()
+{
+  return stats;
+}
+
+// write the stats to the cdc interface
+void report_queue_print()
+{
+  report_queue_stats s = stats;
+  cdc_printf("host reports %lu overflows %lu high water %lu poll gaps %lu max gap %lu us max rearm %lu us\r\n",
+    (unsigned long) s.reports, (unsigned long) s.overflows, (unsigned long) s.high_water,
+    (unsigned long) s.poll_gaps, (unsigned long) s.max_gap_us, (unsigned long) s.max_rearm_us);
+}
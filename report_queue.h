@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// Reports received from the usb host stack are copied here so the transfer can
+// be re-armed straight away and the report processed outside the callback.
+
+static const int REPORT_QUEUE_DATA_SIZE = 32; // room for a report protocol keyboard
+
+struct queued_report
+{
+  uint64_t capture_us;
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t protocol;     // interface protocol
+  bool report_protocol; // the device was in report protocol, not boot
+  uint8_t len;
+  uint8_t data[REPORT_QUEUE_DATA_SIZE];
+};
+
+struct report_queue_stats
+{
+  uint32_t reports;
+  uint32_t overflows;
+  uint32_t high_water;
+  uint32_t poll_gaps;
+  uint32_t max_gap_us;
+  uint32_t max_rearm_us;
+};
+
+extern bool report_queue_push(uint8_t dev_addr, uint8_t instance, uint8_t protocol, bool report_protocol, const uint8_t *report, uint16_t len, uint64_t capture_us);
+extern bool report_queue_pop(queued_report *report);
+extern void report_queue_keep_latest();
+extern void report_queue_note_poll(uint8_t dev_addr, uint8_t instance, uint64_t capture_us, uint32_t rearm_us);
+extern void report_queue_reset_stats();
+extern report_queue_stats report_queue_get_stats();
+extern void report_queue_print();
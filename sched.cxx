@@ -0,0 +1,218 @@
+#include <stdio.h>
+
+#include "hardware/watchdog.h"
+#include "pico/critical_section.h"
+#include "pico/stdlib.h"
+
+#include "cdc_text.h"
+#include "hot_path.h"
+#include "sched.h"
+
+// never sleep longer than this, keeps the watchdog fed even with no periodic task
+static const uint32_t MAX_SLEEP_US = 10000;
+
+struct sched_task
+{
+  const char *name;
+  sched_fn fn;
+  uint32_t period_us;
+  uint64_t due_us;     // next deadline, 0 if none
+  uint32_t posted_us;  // when it became pending
+  uint32_t runs;
+  uint64_t total_run_us;
+  uint32_t max_run_us;
+  uint32_t max_wait_us;
+};
+
+static critical_section sched_cs;
+static sched_task tasks[TASK_COUNT];
+static volatile uint32_t pending;
+
+void sched_init()
+{
+  critical_section_init(&sched_cs);
+  pending = 0;
+}
+
+// a period of zero means the task only runs when posted
+void sched_add(SchedTask id, const char *name, sched_fn fn, uint32_t period_us)
+{
+  tasks[id].name = name;
+  tasks[id].fn = fn;
+  sched_set_period(id, period_us);
+}
+
+// core0 only
+void sched_set_period(SchedTask id, uint32_t period_us)
+{
+  tasks[id].period_us = period_us;
+  tasks[id].due_us = period_us != 0 ? time_us_64() + period_us : 0;
+}
+
+// safe from interrupts and from core1
+void HOT_FUNC(sched_post)(SchedTask id)
+{
+  uint32_t bit = 1u << id;
+  critical_section_enter_blocking(&sched_cs);
+  if ((pending & bit) == 0)
+  {
+    tasks[id].posted_us = time_us_32();
+    pending |= bit;
+  }
+  critical_section_exit(&sched_cs);
+  __sev();
+}
+
+// core0 only, for a task with no period: runs it once at due_us, or at an
+// earlier time already asked for
+void sched_post_at(SchedTask id, uint64_t due_us)
+{
+  sched_task &t = tasks[id];
+  if (t.due_us == 0 || due_us < t.due_us)
+  {
+    t.due_us = due_us;
+  }
+}
+
+static void check_deadlines(uint64_t now)
+{
+  for (int id = 0; id < TASK_COUNT; ++id)
+  {
+    sched_task &t = tasks[id];
+    if (t.due_us == 0 || now < t.due_us)
+    {
+      continue;
+    }
+    critical_section_enter_blocking(&sched_cs);
+    if ((pending & (1u << id)) == 0)
+    {
+      t.posted_us = (uint32_t) t.due_us;
+      pending |= 1u << id;
+    }
+    critical_section_exit(&sched_cs);
+    if (t.period_us == 0)
+    {
+      t.due_us = 0;
+    }
+    else
+    {
+      t.due_us += t.period_us;
+      if (t.due_us <= now)
+      {
+        t.due_us = now + t.period_us; // fell behind, don't run a burst to catch up
+      }
+    }
+  }
+}
+
+// run everything that is pending or due, returns false if there was nothing
+bool sched_run_pending()
+{
+  check_deadlines(time_us_64());
+
+  critical_section_enter_blocking(&sched_cs);
+  uint32_t run = pending;
+  pending = 0;
+  critical_section_exit(&sched_cs);
+
+  if (run == 0)
+  {
+    return false;
+  }
+
+  for (int id = 0; run != 0; ++id)
+  {
+    uint32_t bit = 1u << id;
+    if ((run & bit) == 0)
+    {
+      continue;
+    }
+    run &= ~bit;
+    sched_task &t = tasks[id];
+    if (t.fn == nullptr)
+    {
+      continue;
+    }
+    // saved so a watchdog reboot can report which task hung
+    watchdog_hw->scratch[2] = id + 1;
+    uint32_t start = time_us_32();
+    t.fn();
+    uint32_t end = time_us_32();
+    uint32_t run_us = end - start;
+    uint32_t wait_us = start - t.posted_us;
+    t.runs++;
+    t.total_run_us += run_us;
+    if (run_us > t.max_run_us)
+    {
+      t.max_run_us = run_us;
+    }
+    if (wait_us > t.max_wait_us)
+    {
+      t.max_wait_us = wait_us;
+    }
+  }
+  watchdog_hw->scratch[2] = 0;
+  return true;
+}
+
+// sleep until something is posted, an interrupt fires or the next deadline
+void sched_wait()
+{
+  uint64_t now = time_us_64();
+  uint64_t wake = now + MAX_SLEEP_US;
+  for (int id = 0; id < TASK_COUNT; ++id)
+  {
+    if (tasks[id].due_us != 0 && tasks[id].due_us < wake)
+    {
+      wake = tasks[id].due_us;
+    }
+  }
+  if (pending != 0 || wake <= now)
+  {
+    return;
+  }
+  best_effort_wfe_or_timeout(from_us_since_boot(wake));
+}
+
+void sched_reset_stats()
+{
+  for (int id = 0; id < TASK_COUNT; ++id)
+  {
+    sched_task &t = tasks[id];
+    t.runs = 0;
+    t.total_run_us = 0;
+    t.max_run_us = 0;
+    t.max_wait_us = 0;
+  }
+}
+
+// returns false for a task that was never added
+bool sched_get_stats(SchedTask id, sched_stats *stats)
+{
+  const sched_task &t = tasks[id];
+  if (t.fn == nullptr)
+  {
+    return false;
+  }
+  stats->runs = t.runs;
+  stats->avg_run_us = t.runs != 0 ? t.total_run_us / t.runs : 0;
+  stats->max_run_us = t.max_run_us;
+  stats->max_wait_us = t.max_wait_us;
+  return true;
+}
+
+// write the per task stats to the cdc interface
+void sched_print()
+{
+  for (int id = 0; id < TASK_COUNT; ++id)
+  {
+    const sched_task &t = tasks[id];
+    if (t.fn == nullptr)
+    {
+      continue;
+    }
+    cdc_printf("task %-8s runs %lu avg %lu max %lu us max wait %lu us\r\n",
+      t.name, (unsigned long) t.runs, (unsigned long) (t.runs != 0 ? t.total_run_us / t.runs : 0),
+      (unsigned long) t.max_run_us, (unsigned long) t.max_wait_us);
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+// Cooperative scheduler for core0. Interrupts and core1 post work, periodic
+// jobs run from deadlines, and core0 sleeps in WFE when there is nothing to do.
+// Lower numbered tasks run first when several are pending.
+
+enum SchedTask : uint8_t
+{
+  TASK_USB,
+  TASK_UART_RX,
+  TASK_HANDOFF,
+  TASK_CLICK,
+  TASK_OUTPUT,
+  TASK_LED,
+  TASK_WATCHDOG,
+  TASK_FLASH_LED,
+  TASK_CDC,
+  TASK_CONFIG,
+  TASK_LINK,
+  TASK_PACE,
+  TASK_UART_TX,
+  TASK_COUNT
+};
+
+typedef void (*sched_fn)();
+
+struct sched_stats
+{
+  uint32_t runs;
+  uint32_t avg_run_us;
+  uint32_t max_run_us;
+  uint32_t max_wait_us;
+};
+
+extern void sched_init();
+extern void sched_add(SchedTask id, const char *name, sched_fn fn, uint32_t period_us);
+extern void sched_set_period(SchedTask id, uint32_t period_us);
+extern void sched_post(SchedTask id);
+extern void sched_post_at(SchedTask id, uint64_t due_us);
+extern bool sched_run_pending();
+extern void sched_wait();
+extern void sched_reset_stats();
+extern bool sched_get_stats(SchedTask id, sched_stats *stats);
+extern void sched_print();
@@ -0,0 +1,148 @@
+#include <stdio.h>
+
+#include "common.h"
+#include "config_store.h"
+#include "edge_switch.h"
+#include "framing.h"
+#include "settings.h"
+
+static_assert(SETTING_MAX_LEN <= CONFIG_STORE_MAX_LEN, "settings must fit a config store record");
+static_assert(SETTING_COUNT <= CONFIG_STORE_KEYS, "settings keys are config store keys");
+
+static const uint32_t DEFAULT_UART_BAUD = 115200;
+static uint32_t uart_baud = DEFAULT_UART_BAUD;
+
+// returns the length of the value or -1 for an unknown key
+int settings_get(uint8_t key, uint8_t *value, int max_len)
+{
+  if (max_len < SETTING_MAX_LEN)
+  {
+    return -1;
+  }
+  switch (key)
+  {
+    case SETTING_OUTPUT_MASK:
+      value[0] = get_current_output_mask();
+      return 1;
+    case SETTING_EDGE_SWITCH:
+    {
+      const screen_geometry *geom = edge_switch_geometry();
+      value[0] = edge_switch_enabled() ? 1 : 0;
+      value[1] = geom->width & 0xff;
+      value[2] = geom->width >> 8;
+      value[3] = geom->height & 0xff;
+      value[4] = geom->height >> 8;
+      value[5] = geom->peer_edge;
+      return 6;
+    }
+    case SETTING_TOGGLE_HOTKEY:
+      value[0] = toggle_hotkey;
+      return 1;
+    case SETTING_UART_BAUD:
+    {
+      // report what will be used from the next boot
+      uint32_t baud = uart_baud;
+      if (config_store_get(SETTING_UART_BAUD, value, max_len) != 4)
+      {
+        value[0] = baud & 0xff;
+        value[1] = (baud >> 8) & 0xff;
+        value[2] = (baud >> 16) & 0xff;
+        value[3] = baud >> 24;
+      }
+      return 4;
+    }
+    default:
+      return -1;
+  }
+}
+
+// returns false for an unknown key or a value that doesn't fit it, at boot
+// nothing is sent to the other board
+static bool apply(uint8_t key, const uint8_t *value, int len, bool booting)
+{
+  switch (key)
+  {
+    case SETTING_OUTPUT_MASK:
+      if (len != 1 || value[0] == 0 || value[0] > 3)
+      {
+        return false;
+      }
+      if (booting)
+      {
+        set_current_output_mask(value[0]);
+      }
+      else
+      {
+        change_output_mask(value[0]);
+      }
+      return true;
+    case SETTING_EDGE_SWITCH:
+    {
+      if (len != 6 || value[5] > EDGE_BOTTOM)
+      {
+        return false;
+      }
+      screen_geometry geom;
+      geom.width = get_u16(value + 1);
+      geom.height = get_u16(value + 3);
+      geom.peer_edge = (ScreenEdge) value[5];
+      if (geom.width <= 0 || geom.height <= 0)
+      {
+        return false;
+      }
+      edge_switch_configure(value[0] != 0, &geom);
+      return true;
+    }
+    case SETTING_TOGGLE_HOTKEY:
+      if (len != 1)
+      {
+        return false;
+      }
+      toggle_hotkey = value[0];
+      return true;
+    case SETTING_UART_BAUD:
+    {
+      if (len != 4)
+      {
+        return false;
+      }
+      uint32_t baud = get_u32(value);
+      if (baud < 9600 || baud > 921600)
+      {
+        return false;
+      }
+      if (booting)
+      {
+        uart_baud = baud;
+      }
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+// applies the stored values, called at boot before core1 and the uart start
+void settings_load()
+{
+  uint8_t value[SETTING_MAX_LEN];
+  for (uint8_t key = 1; key < SETTING_COUNT; ++key)
+  {
+    int len = config_store_get(key, value, sizeof(value));
+    if (len >= 0 && !apply(key, value, len, true))
+    {
+      printf("ignoring stored setting %u len %d\n", key, len);
+    }
+  }
+}
+
+uint32_t settings_uart_baud()
+{
+  return uart_baud;
+}
+
+bool settings_set(uint8_t key, const uint8_t *value, int len)
+{
+  printf("set setting %u len %d\n", key, len);
+  return apply(key, value, len, false) && config_store_set(key, value, len);
+}
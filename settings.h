@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Run time settings that can be read and written from the cdc interface and
+// are kept in the flash config store. Values are little endian byte strings,
+// at most SETTING_MAX_LEN long.
+
+enum SettingKey : uint8_t
+{
+  SETTING_OUTPUT_MASK = 1,  // u8
+  SETTING_EDGE_SWITCH,      // u8 enabled, u16 width, u16 height, u8 peer edge
+  SETTING_TOGGLE_HOTKEY,    // u8 hid keycode
+  SETTING_UART_BAUD,        // u32, used from the next boot, both boards must match
+  SETTING_COUNT
+};
+
+static const int SETTING_MAX_LEN = 12;
+
+extern void settings_load();
+extern uint32_t settings_uart_baud();
+extern int settings_get(uint8_t key, uint8_t *value, int max_len);
+extern bool settings_set(uint8_t key, const uint8_t *value, int len);
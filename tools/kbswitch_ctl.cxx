@@ -0,0 +1,312 @@
+// Linux client for the binary protocol on the cdc port, see cdc_protocol.h
+//
+// build: g++ -std=c++17 -O2 -I.. -o kbswitch_ctl kbswitch_ctl.cxx
+//
+// usage: kbswitch_ctl <tty> ping
+//        kbswitch_ctl <tty> mask [value]
+//        kbswitch_ctl <tty> counters <group> [index]
+//        kbswitch_ctl <tty> hist <probe>
+//        kbswitch_ctl <tty> pacehist <kind>
+//        kbswitch_ctl <tty> stream
+//        kbswitch_ctl <tty> trace <file>
+//        kbswitch_ctl <tty> replay <file>
+//        kbswitch_ctl <tty> get <key>
+//        kbswitch_ctl <tty> set <key> <byte>...
+//        kbswitch_ctl <tty> reset
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "cdc_protocol.h"
+#include "framing.h"
+#include "input_trace.h"
+
+static int fd = -1;
+static uint8_t next_seq;
+static frame_decoder<CDC_MAX_PAYLOAD + 1> decoder;
+
+static int open_tty(const char *path)
+{
+  int f = open(path, O_RDWR | O_NOCTTY);
+  if (f < 0)
+  {
+    perror(path);
+    exit(1);
+  }
+  termios t;
+  if (tcgetattr(f, &t) == 0)
+  {
+    cfmakeraw(&t);
+    tcsetattr(f, TCSANOW, &t);
+  }
+  return f;
+}
+
+static void send_request(uint8_t command, const std::vector<uint8_t> &args)
+{
+  frame_encoder<frame_encoded_size(CDC_MAX_PAYLOAD)> f;
+  f.put_sentinel();
+  f.put(command);
+  f.put(next_seq);
+  for (uint8_t b : args)
+  {
+    f.put(b);
+  }
+  f.set_crc();
+  f.put_sentinel();
+  if (write(fd, f.data(), f.size()) != f.size())
+  {
+    perror("write");
+    exit(1);
+  }
+}
+
+// waits for the next complete frame, returns false on timeout
+static bool read_frame(int timeout_ms)
+{
+  for (;;)
+  {
+    pollfd p = { fd, POLLIN, 0 };
+    int r = poll(&p, 1, timeout_ms);
+    if (r <= 0)
+    {
+      return false;
+    }
+    // one byte at a time so nothing after the frame is lost
+    uint8_t b;
+    if (read(fd, &b, 1) == 1 && decoder.feed(b) == FRAME_COMPLETE)
+    {
+      return true;
+    }
+  }
+}
+
+static void print_event(const uint8_t *d, int len)
+{
+  if (len < 11)
+  {
+    return;
+  }
+  uint32_t capture_us = get_u32(d + 2);
+  uint16_t dropped = get_u16(d + 6);
+  static const char *kinds[] = { "kbd  ", "mouse", "media" };
+  printf("%10u %s %s", capture_us, d[8] == INPUT_LOCAL ? "local" : "uart ", d[9] <= INPUT_CONSUMER ? kinds[d[9]] : "?    ");
+  int n = d[10] < len - 11 ? d[10] : len - 11;
+  if (d[9] == INPUT_KEYBOARD && n > 0)
+  {
+    // modifier then the usages that are down
+    printf(" %02x:", d[11]);
+    for (int i = 0; i < (n - 1) * 8; ++i)
+    {
+      if (d[12 + i / 8] & (1 << (i % 8)))
+      {
+        printf(" %02x", i);
+      }
+    }
+  }
+  else
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      printf(" %02x", d[11 + i]);
+    }
+  }
+  if (dropped != 0)
+  {
+    printf(" (%u dropped)", dropped);
+  }
+  printf("\n");
+}
+
+// sends a request and returns the response data, exits on error
+static std::vector<uint8_t> transact(uint8_t command, const std::vector<uint8_t> &args = {})
+{
+  send_request(command, args);
+  uint8_t seq = next_seq++;
+  while (read_frame(1000))
+  {
+    const uint8_t *d = decoder.data();
+    int len = decoder.size();
+    if (len >= 3 && d[0] == (command | CDC_RESPONSE) && d[1] == seq)
+    {
+      if (d[2] != CDC_OK)
+      {
+        fprintf(stderr, "error status %u\n", d[2]);
+        exit(1);
+      }
+      return std::vector<uint8_t>(d + 3, d + len);
+    }
+    if (len >= 1 && d[0] == CDC_EVENT_INPUT)
+    {
+      print_event(d, len);
+    }
+  }
+  fprintf(stderr, "no response\n");
+  exit(1);
+}
+
+static void print_u32s(const std::vector<uint8_t> &v)
+{
+  for (size_t i = 0; i + 4 <= v.size(); i += 4)
+  {
+    printf("%s%u", i == 0 ? "" : " ", get_u32(&v[i]));
+  }
+  printf("\n");
+}
+
+static uint8_t arg_u8(const char *s)
+{
+  return (uint8_t) strtoul(s, nullptr, 0);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s <tty> ping|mask|counters|hist|pacehist|stream|trace|replay|get|set|reset [args]\n", argv[0]);
+    return 1;
+  }
+  fd = open_tty(argv[1]);
+  const char *cmd = argv[2];
+
+  if (!strcmp(cmd, "ping"))
+  {
+    std::vector<uint8_t> r = transact(CDC_PING);
+    if (r.size() >= 2)
+    {
+      printf("protocol %u board %u\n", r[0], r[1]);
+    }
+  }
+  else if (!strcmp(cmd, "mask"))
+  {
+    if (argc > 3)
+    {
+      transact(CDC_SET_OUTPUT_MASK, { arg_u8(argv[3]) });
+    }
+    std::vector<uint8_t> r = transact(CDC_GET_OUTPUT_MASK);
+    if (!r.empty())
+    {
+      printf("mask %u\n", r[0]);
+    }
+  }
+  else if (!strcmp(cmd, "counters") && argc > 3)
+  {
+    print_u32s(transact(CDC_GET_COUNTERS, { arg_u8(argv[3]), argc > 4 ? arg_u8(argv[4]) : (uint8_t) 0 }));
+  }
+  else if ((!strcmp(cmd, "hist") || !strcmp(cmd, "pacehist")) && argc > 3)
+  {
+    std::vector<uint8_t> r = transact(!strcmp(cmd, "hist") ? CDC_GET_HISTOGRAM : CDC_GET_PACE_HISTOGRAM,
+      { arg_u8(argv[3]) });
+    if (!r.empty())
+    {
+      r.erase(r.begin());
+    }
+    print_u32s(r);
+  }
+  else if (!strcmp(cmd, "stream"))
+  {
+    transact(CDC_STREAM_INPUT, { 1 });
+    for (;;)
+    {
+      if (read_frame(-1) && decoder.size() >= 1 && decoder.data()[0] == CDC_EVENT_INPUT)
+      {
+        print_event(decoder.data(), decoder.size());
+        fflush(stdout);
+      }
+    }
+  }
+  else if (!strcmp(cmd, "trace") && argc > 3)
+  {
+    // captures until interrupted, the file is flushed as it goes
+    FILE *f = fopen(argv[3], "wb");
+    if (f == nullptr)
+    {
+      perror(argv[3]);
+      return 1;
+    }
+    uint8_t magic[4] = { INPUT_TRACE_MAGIC & 0xff, (INPUT_TRACE_MAGIC >> 8) & 0xff,
+      (INPUT_TRACE_MAGIC >> 16) & 0xff, INPUT_TRACE_MAGIC >> 24 };
+    fwrite(magic, 1, sizeof(magic), f);
+    transact(CDC_TRACE_CAPTURE, { 1 });
+    for (;;)
+    {
+      if (read_frame(-1) && decoder.size() >= 2 && decoder.data()[0] == CDC_EVENT_TRACE)
+      {
+        fwrite(decoder.data() + 2, 1, decoder.size() - 2, f);
+        fflush(f);
+      }
+    }
+  }
+  else if (!strcmp(cmd, "replay") && argc > 3)
+  {
+    FILE *f = fopen(argv[3], "rb");
+    if (f == nullptr)
+    {
+      perror(argv[3]);
+      return 1;
+    }
+    std::vector<uint8_t> trace;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+      trace.insert(trace.end(), buf, buf + n);
+    }
+    fclose(f);
+    if (trace.size() < 4 || get_u32(trace.data()) != INPUT_TRACE_MAGIC)
+    {
+      fprintf(stderr, "%s is not a trace\n", argv[3]);
+      return 1;
+    }
+    // the board takes what fits in its replay buffer, the rest is sent again
+    size_t pos = 4;
+    while (pos < trace.size())
+    {
+      size_t len = std::min(trace.size() - pos, (size_t) CDC_MAX_PAYLOAD - 2);
+      std::vector<uint8_t> r = transact(CDC_TRACE_REPLAY, std::vector<uint8_t>(&trace[pos], &trace[pos] + len));
+      uint16_t taken = r.size() >= 2 ? get_u16(r.data()) : 0;
+      pos += taken;
+      if (taken < len)
+      {
+        usleep(10000);
+      }
+    }
+  }
+  else if (!strcmp(cmd, "get") && argc > 3)
+  {
+    std::vector<uint8_t> r = transact(CDC_CONFIG_READ, { arg_u8(argv[3]) });
+    for (uint8_t b : r)
+    {
+      printf("%02x ", b);
+    }
+    printf("\n");
+  }
+  else if (!strcmp(cmd, "set") && argc > 3)
+  {
+    std::vector<uint8_t> args;
+    for (int i = 3; i < argc; ++i)
+    {
+      args.push_back(arg_u8(argv[i]));
+    }
+    transact(CDC_CONFIG_WRITE, args);
+  }
+  else if (!strcmp(cmd, "reset"))
+  {
+    transact(CDC_RESET_COUNTERS);
+  }
+  else
+  {
+    fprintf(stderr, "unknown command %s\n", cmd);
+    return 1;
+  }
+  close(fd);
+  return 0;
+}
@@ -71,8 +71,18 @@
 #endif
 
 //------------- CLASS -------------//
+// keyboard and mouse on separate interfaces so each has its own endpoint
+#ifndef HID_SPLIT_INTERFACES
+#define HID_SPLIT_INTERFACES      0
+#endif
+
+// absolute pointer report next to the mouse, used while edge switching
+#ifndef ABSOLUTE_POINTER
+#define ABSOLUTE_POINTER          0
+#endif
+
 #define CFG_TUD_CDC              1
-#define CFG_TUD_HID               1
+#define CFG_TUD_HID               (HID_SPLIT_INTERFACES ? 2 : 1)
 
 // CDC FIFO size of TX and RX
 #define CFG_TUD_CDC_RX_BUFSIZE   256
@@ -82,7 +92,7 @@
 #define CFG_TUD_CDC_EP_BUFSIZE   64
 
 
-#define CFG_TUD_HID_EP_BUFSIZE    16
+#define CFG_TUD_HID_EP_BUFSIZE    32
 
 //--------------------------------------------------------------------
 // HOST CONFIGURATION
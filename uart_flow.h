@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+
+// Flow control on the uart between the boards, so a board that falls behind
+// holds the other one back instead of losing bytes from a full receive ring.
+//
+// Built with UART_RTS_CTS_ENABLED=1 the uart does it itself, with CTS on
+// UART_CTS_PIN and RTS on UART_RTS_PIN crossed over to the other board's
+// RTS and CTS. The receive interrupt stops reading while the ring is full,
+// the rx fifo fills up and RTS stops the peer. The sender only writes what
+// the tx fifo has room for and leaves the rest of a frame to TASK_UART_TX, so
+// a peer holding CTS never stalls the core. uart0 only has CTS on gpio 2 or
+// 18 and RTS on 3 or 19, and 2 and 3 are the PIO-USB port.
+//
+// Without the wires the receiver hands out credit, but only while it falls
+// behind, so a board that keeps up costs the link nothing. A board starts by
+// sending CREDIT with the reset flag, and each CREDIT carries the count of
+// bytes uart_task has taken from the ring since, in 16 bits that wrap. The
+// peer counts what it sends from the reset. Once the receive interrupt finds
+// UART_CREDIT_GATE_AT bytes unread it sends CREDIT with the gate flag, and
+// until a CREDIT without it the peer keeps at most UART_CREDIT_WINDOW bytes
+// beyond the count on the wire or unread; meanwhile CREDIT goes for every
+// UART_CREDIT_STEP bytes taken, and the gate is lifted once uart_task has
+// emptied the ring. A CREDIT lost with a bad frame costs nothing once the
+// next arrives. What doesn't fit waits in the tx queue and goes out as credit
+// comes back. A full queue holds the newest frame of each kind, merging mouse
+// motion. A CREDIT frame may dip into the rest of the ring so the two boards
+// can't both wait for each other. A peer that hasn't sent the reset gets
+// everything as before.
+//
+// When bytes have waited UART_CREDIT_TIMEOUT_US with no CREDIT the sender
+// asks for one with the query flag, which goes whatever the credit, and the
+// receiver answers with its count at once. Credit is never more than the
+// window, so a count from before a restart can't overrun the ring.
+
+#ifndef UART_RTS_CTS_ENABLED
+#define UART_RTS_CTS_ENABLED 0
+#endif
+
+#ifndef UART_CTS_PIN
+#define UART_CTS_PIN 18
+#endif
+
+#ifndef UART_RTS_PIN
+#define UART_RTS_PIN 19
+#endif
+
+static const int UART_RX_RING = 512;
+static const int UART_CREDIT_WINDOW = UART_RX_RING / 2;
+static const int UART_CREDIT_STEP = UART_CREDIT_WINDOW / 2; // handed back in at least this much
+static const int UART_CREDIT_RESERVE = 16;                  // below zero, for CREDIT frames
+static const int UART_CREDIT_GATE_AT = UART_RX_RING / 4;    // unread bytes that hold the peer back
+static const uint64_t UART_CREDIT_TIMEOUT_US = 250000;
+static const int UART_TX_QUEUE = 512;
+
+static const uint8_t CREDIT_RESET = 1 << 0;
+static const uint8_t CREDIT_ASK = 1 << 1;   // the peer should send its own reset
+static const uint8_t CREDIT_QUERY = 1 << 2; // the peer should send its count now
+static const uint8_t CREDIT_GATE = 1 << 3;  // hold back to the window
+
+// both counts in the peer's terms, since its last reset
+struct uart_credit
+{
+  bool active; // the peer sent a reset
+  bool gated;  // and is falling behind
+  uint16_t sent;
+  uint16_t taken;
+};
+
+// the window less what is on the wire or unread, may be below zero after CREDIT frames
+inline int32_t uart_credit_left(const uart_credit *c)
+{
+  return UART_CREDIT_WINDOW - (int16_t) (c->sent - c->taken);
+}
+
+// how many bytes may go now, all of them for a peer that doesn't use credit
+inline int uart_credit_allowed(const uart_credit *c, int wanted, bool grant_frame)
+{
+  if (!c->active || !c->gated)
+  {
+    return wanted;
+  }
+  int32_t allowed = uart_credit_left(c) + (grant_frame ? UART_CREDIT_RESERVE : 0);
+  return allowed <= 0 ? 0 : allowed < wanted ? allowed : wanted;
+}
+
+inline void uart_credit_spent(uart_credit *c, int bytes)
+{
+  if (c->active)
+  {
+    c->sent += bytes;
+  }
+}
+
+// taken is the peer's count, the link keeps them in order
+inline void uart_credit_returned(uart_credit *c, uint16_t taken, uint8_t flags)
+{
+  if ((flags & CREDIT_RESET) != 0)
+  {
+    c->active = true;
+    c->sent = taken;
+  }
+  else if (!c->active)
+  {
+    return;
+  }
+  c->gated = (flags & CREDIT_GATE) != 0;
+  c->taken = taken;
+  // more taken than sent is a count from before a restart
+  if ((int16_t) (c->sent - taken) < 0)
+  {
+    c->sent = taken;
+  }
+}
+
+struct uart_flow_stats
+{
+  uint32_t waited;   // frames queued behind the peer's credit
+  uint32_t timeouts; // CREDIT asked for after UART_CREDIT_TIMEOUT_US
+  uint32_t merged;   // frames held for a full tx queue that a newer one of their kind replaced
+  uint32_t rx_full;  // times the receive ring filled, overruns without flow control
+  int32_t queue_high_water;
+};
@@ -1,9 +1,29 @@
+#include <string.h>
+
 #include "hardware/gpio.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "hardware/sync.h"
 #include "hardware/uart.h"
 #include "pico/critical_section.h"
 
 #include "common.h"
-#include "cppcrc.h"
+#include "boot_trace.h"
+#include "debug_print.h"
+#include "cdc_protocol.h"
+#include "cdc_text.h"
+#include "edge_switch.h"
+#include "peer_state.h"
+#include "framing.h"
+#include "handoff.h"
+#include "hot_path.h"
+#include "key_state.h"
+#include "latency.h"
+#include "link_pacing.h"
+#include "link_sync.h"
+#include "profile.h"
+#include "report_cache.h"
+#include "report_filter.h"
+#include "sched.h"
 #include "tusb.h"
 #include "uart_messages.h"
 #include "usb_descriptors.h"
@@ -13,9 +33,6 @@
 #define UART_RX_PIN 1
 #define UART_IRQ UART0_IRQ 
 
-const uint8_t SENTINEL = 0x7e;
-const uint8_t ESCAPE = 0x7d;
-
 enum MessageType : uint8_t
 {
   KEYBOARD,
@@ -23,17 +40,88 @@ enum MessageType : uint8_t
   KEYBOARD_REPORT,
   CONNECTION_CHANGED,
   SET_OUTPUT_MASK,
-  TICK
+  TICK,
+  KEYBOARD_BITMAP,
+  CONSUMER,
+  CURSOR_ENTRY,
+  PEER_STATE,
+  SNAPSHOT,
+  MOUSE_MOTION,
+  CREDIT
 };
 
+
 static critical_section rx_cs;
-static const int RX_BUF_SIZE = 64;
+static const int RX_BUF_SIZE = UART_RX_RING;
 static uint8_t rx_buf[RX_BUF_SIZE];
 static volatile int rx_rptr;
 static volatile int rx_wptr;
-static volatile bool had_interrupt;
+static volatile bool rx_paused; // the ring filled, the fifo is left to fill behind it
+
+// payload and crc, the snapshot is the longest message
+static const int MAX_UART_FRAME = 32;
+static const int TX_FRAME_MAX = frame_encoded_size(MAX_UART_FRAME - 1);
+static const int TX_PUMP_BYTES = 32; // the uart's tx fifo
+static frame_decoder<MAX_UART_FRAME> decoder;
+static uart_link_stats link_stats;
+
+// Frames waiting for credit, each after a length byte. Frames are sent from
+// both cores, whichever core is writing also sends what the other queued.
+static critical_section tx_cs;
+static uint8_t tx_queue[UART_TX_QUEUE];
+static int tx_head;
+static int tx_count;
+static bool tx_writing;
+static uart_credit peer_credit;
+static uint64_t last_credit_us;
+static uint16_t rx_taken;    // from the ring since this board's reset, the count in CREDIT
+static uint16_t grant_bytes; // taken from the ring and not yet handed back
+static uint8_t grant_flags;
+static bool grant_pending;
+static volatile bool rx_gating; // the peer is asked to hold back
+static bool gate_repeated;
+static uart_flow_stats flow_stats;
+
+// With RTS/CTS the peer can hold the tx fifo full for as long as it falls
+// behind, so only what fits is written and the rest of the frame waits here
+// for TASK_UART_TX, which looks again every tx_retry_us.
+static uint8_t tx_rest[TX_FRAME_MAX];
+static int tx_rest_pos;
+static int tx_rest_len;
+static uint32_t tx_retry_us;
 
-static void read_pending()
+// A frame that finds the queue full is held instead, only the newest of its
+// kind as every message but the mouse's carries the whole of its state.
+// Mouse motion, wheel and pan add up under the latest buttons. Held frames go
+// into the queue oldest first as it empties, and while any are held new ones
+// are held too so none overtakes them. Nothing is lost.
+struct tx_held_frame
+{
+  uint32_t seq;
+  uint8_t len; // 0 when none is held
+  uint8_t data[TX_FRAME_MAX];
+};
+
+struct tx_held_mouse
+{
+  uint32_t seq;
+  bool valid;
+  uint16_t stamp;
+  uint8_t buttons;
+  int32_t x;
+  int32_t y;
+  int32_t wheel;
+  int32_t pan;
+};
+
+static tx_held_frame tx_held[MessageType::CREDIT]; // by message type, the mouse's unused
+static tx_held_mouse tx_mouse;
+static int tx_held_count;
+static uint32_t tx_seq;
+
+static void hold_back_peer(int unread);
+
+static void HOT_FUNC(read_pending)()
 {
   critical_section_enter_blocking(&rx_cs);
   int wlimit = rx_rptr - 1;
@@ -46,7 +134,15 @@ static void read_pending()
   {
     if (rx_wptr == wlimit)
     {
-      printf("oh dear buffer collision wlimit %d orig %d\n", wlimit, orig_wptr);
+      // uart_task turns the interrupt back on once it has made room, with
+      // RTS/CTS the peer waits meanwhile
+      if (!UART_RTS_CTS_ENABLED)
+      {
+        printf("oh dear buffer collision wlimit %d orig %d\n", wlimit, orig_wptr);
+      }
+      uart_set_irq_enables(UART_ID, false, false);
+      rx_paused = true;
+      flow_stats.rx_full++;
       break;
     }
     uint8_t ch = uart_getc(UART_ID);
@@ -56,26 +152,59 @@ static void read_pending()
       rx_wptr = 0;
     }
   }
+  int unread = (rx_wptr - rx_rptr + RX_BUF_SIZE) % RX_BUF_SIZE;
   critical_section_exit(&rx_cs);
+  if (!UART_RTS_CTS_ENABLED && unread >= UART_CREDIT_GATE_AT)
+  {
+    hold_back_peer(unread);
+  }
 }
 
-static void on_uart_rx()
+static void HOT_FUNC(on_uart_rx)()
 {
-  had_interrupt = true;
+  PROFILE_SCOPE(PROBE_UART_IRQ);
   read_pending();
+  sched_post(TASK_UART_RX);
 }
 
-void init_uart()
+static void tx_pump();
+
+void init_uart(uint32_t baud_rate)
 {
   rx_rptr = 0;
   rx_wptr = 0;
+  rx_paused = false;
+  decoder.reset();
   critical_section_init(&rx_cs);
+  tx_head = 0;
+  tx_count = 0;
+  tx_writing = false;
+  tx_rest_pos = 0;
+  tx_rest_len = 0;
+  memset(tx_held, 0, sizeof(tx_held));
+  tx_mouse = {};
+  tx_held_count = 0;
+  peer_credit = {};
+  critical_section_init(&tx_cs);
   gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
   gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
 
-  uint baud = uart_init(UART_ID, 115200);
+  uint baud = uart_init(UART_ID, baud_rate);
+  tx_retry_us = 10 * 1000000 / baud * (TX_PUMP_BYTES / 2); // half the fifo
 
+#if UART_RTS_CTS_ENABLED
+  gpio_set_function(UART_CTS_PIN, GPIO_FUNC_UART);
+  gpio_set_function(UART_RTS_PIN, GPIO_FUNC_UART);
+  uart_set_hw_flow(UART_ID, true, true);
+#else
   uart_set_hw_flow(UART_ID, false, false);
+  // the whole ring is free, and the peer is asked for its own window
+  rx_taken = 0;
+  rx_gating = false;
+  grant_bytes = 0;
+  grant_flags = CREDIT_RESET | CREDIT_ASK;
+  grant_pending = true;
+#endif
 
   uart_set_format(UART_ID, 8, 1, UART_PARITY_NONE);
 
@@ -85,70 +214,485 @@ void init_uart()
   irq_set_enabled(UART_IRQ, true);
 
   uart_set_irq_enables(UART_ID, true, false);
+  tx_pump();
 }
 
-template <int N>
-class uart_buffer
+// false if the queue is full, under tx_cs
+static bool HOT_FUNC(tx_enqueue)(const uint8_t *data, int len)
 {
-public:
-  void put_sentinel()
+  if (tx_count + 1 + len > UART_TX_QUEUE)
   {
-    m_buf[m_ptr++] = SENTINEL;
+    return false;
   }
-  void put(uint8_t b)
+  if (tx_count == 0)
   {
-    m_crc = CRC8::CRC8::calc(&b, 1, m_crc);
-    putbyte(b);
+    last_credit_us = time_us_64(); // waiting for credit starts now
   }
-  void set_crc() 
+  tx_queue[(tx_head + tx_count++) % UART_TX_QUEUE] = (uint8_t) len;
+  for (int i = 0; i < len; ++i)
   {
-    putbyte(m_crc);
+    tx_queue[(tx_head + tx_count++) % UART_TX_QUEUE] = data[i];
   }
-  void send()
+  if (tx_count > flow_stats.queue_high_water)
+  {
+    flow_stats.queue_high_water = tx_count;
+  }
+  return true;
+}
+
+static void HOT_FUNC(put_mouse)(frame_encoder<32> *b, const mouse_state *state, uint16_t stamp);
+
+static int32_t clamp_to(int32_t v, int32_t limit)
+{
+  return v < -limit ? -limit : v > limit ? limit : v;
+}
+
+// holds a frame that didn't fit, see tx_held_frame, under tx_cs
+static void tx_hold(const uint8_t *data, int len)
+{
+  uint8_t type = data[1]; // after the sentinel, message types are never escaped
+  if (type == MessageType::MOUSE || type == MessageType::MOUSE_MOTION)
+  {
+    frame_decoder<MAX_UART_FRAME> d;
+    for (int i = 0; i < len; ++i)
+    {
+      d.feed(data[i]);
+    }
+    const uint8_t *p = d.data();
+    flow_stats.merged += tx_mouse.valid;
+    tx_held_count += !tx_mouse.valid;
+    tx_mouse.valid = true;
+    tx_mouse.seq = tx_seq++;
+    tx_mouse.stamp = get_u16(p + 1);
+    tx_mouse.buttons = p[3];
+    tx_mouse.x = clamp_to(tx_mouse.x + (int8_t) p[4], INT16_MAX);
+    tx_mouse.y = clamp_to(tx_mouse.y + (int8_t) p[5], INT16_MAX);
+    if (type == MessageType::MOUSE)
+    {
+      tx_mouse.wheel = clamp_to(tx_mouse.wheel + (int16_t) get_u16(p + 6), INT16_MAX * 8);
+      tx_mouse.pan = clamp_to(tx_mouse.pan + (int16_t) get_u16(p + 8), INT16_MAX * 8);
+    }
+    return;
+  }
+  tx_held_frame &h = tx_held[type == MessageType::KEYBOARD_BITMAP ? (uint8_t) MessageType::KEYBOARD : type];
+  flow_stats.merged += h.len != 0;
+  tx_held_count += h.len == 0;
+  h.seq = tx_seq++;
+  h.len = (uint8_t) len;
+  memcpy(h.data, data, len);
+}
+
+// queues the held mouse input, what doesn't fit in one message stays held
+static bool tx_unhold_mouse()
+{
+  mouse_state m = {};
+  m.buttons = tx_mouse.buttons;
+  m.x = (int8_t) clamp_to(tx_mouse.x, INT8_MAX);
+  m.y = (int8_t) clamp_to(tx_mouse.y, INT8_MAX);
+  m.wheel = (int16_t) clamp_to(tx_mouse.wheel, INT16_MAX);
+  m.pan = (int16_t) clamp_to(tx_mouse.pan, INT16_MAX);
+  frame_encoder<32> b;
+  put_mouse(&b, &m, tx_mouse.stamp);
+  if (!tx_enqueue(b.data(), b.size()))
   {
-    uart_write_blocking(UART_ID, m_buf, m_ptr);
+    return false;
+  }
+  tx_mouse.x -= m.x;
+  tx_mouse.y -= m.y;
+  tx_mouse.wheel -= m.wheel;
+  tx_mouse.pan -= m.pan;
+  if (tx_mouse.x == 0 && tx_mouse.y == 0 && tx_mouse.wheel == 0 && tx_mouse.pan == 0)
+  {
+    tx_mouse.valid = false;
+    tx_held_count--;
   }
-private:
-  void putbyte(uint8_t b)
+  else
   {
-    if (b == SENTINEL || b == ESCAPE)
+    tx_mouse.seq = tx_seq++;
+  }
+  return true;
+}
+
+// moves held frames into the queue, oldest first, while they fit, under tx_cs
+static void HOT_FUNC(tx_unhold)()
+{
+  while (tx_held_count > 0)
+  {
+    int oldest = -1;
+    uint32_t oldest_seq = 0;
+    for (int type = 0; type < MessageType::CREDIT; ++type)
     {
-      m_buf[m_ptr++] = ESCAPE;
+      bool held = type == MessageType::MOUSE ? tx_mouse.valid : tx_held[type].len != 0;
+      uint32_t seq = type == MessageType::MOUSE ? tx_mouse.seq : tx_held[type].seq;
+      if (held && (oldest < 0 || (int32_t) (seq - oldest_seq) < 0))
+      {
+        oldest = type;
+        oldest_seq = seq;
+      }
     }
-    m_buf[m_ptr++] = b;
+    if (oldest == MessageType::MOUSE)
+    {
+      if (!tx_unhold_mouse())
+      {
+        return;
+      }
+      continue;
+    }
+    tx_held_frame &h = tx_held[oldest];
+    if (!tx_enqueue(h.data, h.len))
+    {
+      return;
+    }
+    h.len = 0;
+    tx_held_count--;
+  }
+}
+
+// the credit due to the peer, ahead of anything queued, under tx_cs. A
+// query goes whatever the credit, lost credit would otherwise leave both
+// boards waiting.
+static int HOT_FUNC(take_grant)(uint8_t *frame)
+{
+  frame_encoder<frame_encoded_size(4)> b;
+  b.put_sentinel();
+  b.put(MessageType::CREDIT);
+  b.put(grant_flags | (rx_gating ? CREDIT_GATE : 0));
+  b.put_u16(rx_taken);
+  b.set_crc();
+  b.put_sentinel();
+  if ((grant_flags & CREDIT_QUERY) == 0 && uart_credit_allowed(&peer_credit, b.size(), true) < b.size())
+  {
+    return 0;
+  }
+  memcpy(frame, b.data(), b.size());
+  grant_pending = false;
+  grant_bytes = 0;
+  grant_flags = 0;
+  return b.size();
+}
+
+// With RTS/CTS, writes what the tx fifo has room for and keeps the rest in
+// tx_rest. Returns the bytes written.
+static int HOT_FUNC(write_fitting)(const uint8_t *data, int len, bool from_rest)
+{
+  int n = 0;
+  while (n < len && uart_is_writable(UART_ID))
+  {
+    uart_putc_raw(UART_ID, (char) data[n++]);
+  }
+  if (from_rest)
+  {
+    tx_rest_pos += n;
+  }
+  else if (n < len)
+  {
+    memcpy(tx_rest, data + n, len - n);
+    tx_rest_pos = 0;
+    tx_rest_len = len - n;
+  }
+  return n;
+}
+
+// Writes whole frames while the peer has credit for them. Only one core
+// writes at a time, the other leaves its frames in the queue for it. Past
+// TX_PUMP_BYTES the rest is left to TASK_UART_TX, so a backlog doesn't keep
+// the core from reading the uart, where the peer may be asking it to stop.
+static void HOT_FUNC(tx_pump)()
+{
+  uint8_t frame[TX_FRAME_MAX];
+  int written = 0;
+  while (true)
+  {
+    critical_section_enter_blocking(&tx_cs);
+    tx_unhold();
+    bool rest = tx_rest_pos < tx_rest_len;
+    if (written >= TX_PUMP_BYTES)
+    {
+      bool more = grant_pending || tx_count > 0 || rest;
+      critical_section_exit(&tx_cs);
+      if (more)
+      {
+        sched_post(TASK_UART_TX);
+      }
+      return;
+    }
+    if (rest)
+    {
+      // the frame the fifo had no room for goes first, its credit is spent
+      if (tx_writing)
+      {
+        critical_section_exit(&tx_cs);
+        return;
+      }
+      tx_writing = true;
+      critical_section_exit(&tx_cs);
+      int len = tx_rest_len - tx_rest_pos;
+      int n = write_fitting(tx_rest + tx_rest_pos, len, true);
+      written += n;
+      critical_section_enter_blocking(&tx_cs);
+      tx_writing = false;
+      critical_section_exit(&tx_cs);
+      if (n < len)
+      {
+        sched_post(TASK_UART_TX);
+        return;
+      }
+      continue;
+    }
+    int len = 0;
+    if (!tx_writing && grant_pending)
+    {
+      len = take_grant(frame);
+    }
+    if (!tx_writing && len == 0 && tx_count > 0)
+    {
+      int next = tx_queue[tx_head];
+      if (uart_credit_allowed(&peer_credit, next, false) == next)
+      {
+        for (int i = 0; i < next; ++i)
+        {
+          frame[i] = tx_queue[(tx_head + 1 + i) % UART_TX_QUEUE];
+        }
+        tx_head = (tx_head + 1 + next) % UART_TX_QUEUE;
+        tx_count -= 1 + next;
+        len = next;
+      }
+    }
+    if (len == 0)
+    {
+      critical_section_exit(&tx_cs);
+      return;
+    }
+    uart_credit_spent(&peer_credit, len);
+    tx_writing = true;
+    critical_section_exit(&tx_cs);
+
+    int n = len;
+    if (UART_RTS_CTS_ENABLED)
+    {
+      n = write_fitting(frame, len, false);
+    }
+    else
+    {
+      uart_write_blocking(UART_ID, frame, len);
+    }
+    written += n;
+
+    critical_section_enter_blocking(&tx_cs);
+    tx_writing = false;
+    critical_section_exit(&tx_cs);
+    if (n < len)
+    {
+      sched_post(TASK_UART_TX);
+      return;
+    }
+  }
+}
+
+// Goes straight out when nothing is waiting and the peer has room. Behind a
+// backlog it is left to TASK_UART_TX, so core1 gets back to polling usb
+// instead of waiting on the fifo.
+static void HOT_FUNC(tx_send)(const uint8_t *data, int len)
+{
+  critical_section_enter_blocking(&tx_cs);
+  bool waiting = tx_count > 0 || tx_held_count > 0;
+  if (waiting || uart_credit_allowed(&peer_credit, len, false) < len)
+  {
+    flow_stats.waited++;
+  }
+  tx_unhold();
+  if (tx_held_count > 0 || !tx_enqueue(data, len))
+  {
+    tx_hold(data, len);
+  }
+  critical_section_exit(&tx_cs);
+  if (waiting)
+  {
+    sched_post(TASK_UART_TX);
+  }
+  else
+  {
+    tx_pump();
+  }
+}
+
+template <int N>
+class uart_buffer : public frame_encoder<N>
+{
+public:
+  void send()
+  {
+    static_assert(N <= TX_FRAME_MAX, "frame too long for the tx queue");
+    tx_send(this->data(), this->size());
+    link_stats.frames_sent++;
   }
-  uint8_t m_crc = 0;
-  uint8_t m_ptr = 0;
-  uint8_t m_buf[N];
 };
 
-void send_uart_kb_report(const hid_keyboard_report_t *report)
+// every UART_CREDIT_TIMEOUT_US / 5, asks for the peer's count when bytes
+// have waited that long with none, the last CREDIT may have been lost
+void uart_flow_task()
 {
-  printf("send kb on uart\n");
-  uart_buffer<32> b;
+  uint64_t now = time_us_64();
+  critical_section_enter_blocking(&tx_cs);
+  if ((tx_count > 0 || grant_pending) && peer_credit.active && peer_credit.gated &&
+    now - last_credit_us >= UART_CREDIT_TIMEOUT_US)
+  {
+    grant_flags |= CREDIT_QUERY;
+    grant_pending = true;
+    last_credit_us = now;
+    flow_stats.timeouts++;
+  }
+  critical_section_exit(&tx_cs);
+  // the peer is holding CTS, try again once it could have taken half the fifo
+  if (UART_RTS_CTS_ENABLED && !uart_is_writable(UART_ID))
+  {
+    sched_post_at(TASK_UART_TX, now + tx_retry_us);
+    return;
+  }
+  tx_pump();
+}
+
+static void credit_received(uint8_t flags, uint16_t taken)
+{
+  critical_section_enter_blocking(&tx_cs);
+  uart_credit_returned(&peer_credit, taken, flags);
+  last_credit_us = time_us_64();
+  if ((flags & CREDIT_ASK) != 0 && !UART_RTS_CTS_ENABLED)
+  {
+    grant_flags |= CREDIT_RESET;
+    grant_pending = true;
+  }
+  // answered whatever has been taken
+  if ((flags & CREDIT_QUERY) != 0 && !UART_RTS_CTS_ENABLED)
+  {
+    grant_pending = true;
+  }
+  critical_section_exit(&tx_cs);
+  tx_pump();
+}
+
+// From the receive interrupt once the ring has UART_CREDIT_GATE_AT unread,
+// the gate goes again at twice that in case the first was lost. Sent from
+// the interrupt as the loop that would send it is the one falling behind.
+static void hold_back_peer(int unread)
+{
+  if (rx_gating && (gate_repeated || unread < 2 * UART_CREDIT_GATE_AT))
+  {
+    return;
+  }
+  critical_section_enter_blocking(&tx_cs);
+  gate_repeated = rx_gating;
+  rx_gating = true;
+  grant_pending = true;
+  critical_section_exit(&tx_cs);
+  tx_pump();
+}
+
+// While the peer is held back, hands back what uart_task took from the ring
+// once there is enough of it, and lets the peer go once the ring is empty.
+static void HOT_FUNC(grant)(int taken)
+{
+  if (UART_RTS_CTS_ENABLED || taken == 0)
+  {
+    return;
+  }
+  critical_section_enter_blocking(&rx_cs);
+  bool empty = rx_rptr == rx_wptr;
+  critical_section_exit(&rx_cs);
+  critical_section_enter_blocking(&tx_cs);
+  rx_taken += taken;
+  grant_bytes = grant_bytes + taken > UINT16_MAX ? UINT16_MAX : grant_bytes + taken;
+  bool send = false;
+  if (rx_gating)
+  {
+    rx_gating = !empty;
+    gate_repeated = false;
+    send = empty || grant_bytes >= UART_CREDIT_STEP;
+  }
+  grant_pending |= send;
+  critical_section_exit(&tx_cs);
+  if (send)
+  {
+    tx_pump();
+  }
+}
+
+// A keyboard message lists the pressed keys, which is shorter for the usual
+// handful. Past that the whole bitmap is sent instead. Input messages carry
+// the low 16 bits of the capture time after the type, see link_pacing.h.
+void HOT_FUNC(send_uart_kb_report)(const key_state *state, uint64_t capture_us)
+{
+  debug_printf("send kb on uart\n");
+  uart_buffer<frame_encoded_size(4 + NKRO_KEY_BYTES)> b;
+  uint8_t keycodes[NKRO_KEY_BYTES];
+  int count = key_state_to_list(state, keycodes, NKRO_KEY_BYTES);
   b.put_sentinel();
-  b.put(MessageType::KEYBOARD);
-  b.put(report->modifier);
-  for (int i = 0; i < 6; ++i)
+  if (count < NKRO_KEY_BYTES)
+  {
+    b.put(MessageType::KEYBOARD);
+    b.put_u16((uint16_t) capture_us);
+    b.put(state->modifier);
+    for (int i = 0; i < count; ++i)
+    {
+      b.put(keycodes[i]);
+    }
+  }
+  else
   {
-    b.put(report->keycode[i]);
+    b.put(MessageType::KEYBOARD_BITMAP);
+    b.put_u16((uint16_t) capture_us);
+    b.put(state->modifier);
+    for (int i = 0; i < NKRO_KEY_BYTES; ++i)
+    {
+      b.put(state->keys[i]);
+    }
   }
   b.set_crc();
   b.put_sentinel();
+  // queued or held, it goes out either way
   b.send();
+  report_filter_keyboard_sent(FILTER_UART, state);
 }
 
-void send_uart_mouse_report(const hid_mouse_report_t *report)
+// wheel and pan go as 16 bits in fractions of a detent, and are left out
+// when neither moved. A 1000 Hz mouse fills most of the uart at the default
+// baud rate, the short message leaves room for the stamp.
+static void HOT_FUNC(put_mouse)(frame_encoder<32> *b, const mouse_state *state, uint16_t stamp)
 {
-  printf("send mouse on uart\n");
+  bool motion = state->wheel == 0 && state->pan == 0;
+  b->put_sentinel();
+  b->put(motion ? MessageType::MOUSE_MOTION : MessageType::MOUSE);
+  b->put_u16(stamp);
+  b->put(state->buttons);
+  b->put(state->x);
+  b->put(state->y);
+  if (!motion)
+  {
+    b->put_u16(state->wheel);
+    b->put_u16(state->pan);
+  }
+  b->set_crc();
+  b->put_sentinel();
+}
+
+void HOT_FUNC(send_uart_mouse_report)(const mouse_state *state, uint64_t capture_us)
+{
+  debug_printf("send mouse on uart\n");
   uart_buffer<32> b;
+  put_mouse(&b, state, (uint16_t) capture_us);
+  b.send();
+  report_filter_mouse_sent(FILTER_UART, state);
+}
+
+// the media key down, 0 once it is released
+void HOT_FUNC(send_uart_consumer_report)(uint16_t usage, uint64_t capture_us)
+{
+  debug_printf("send consumer on uart\n");
+  uart_buffer<16> b;
   b.put_sentinel();
-  b.put(MessageType::MOUSE);
-  b.put(report->buttons);
-  b.put(report->x);
-  b.put(report->y);
-  b.put(report->wheel);
-  b.put(report->pan);
+  b.put(MessageType::CONSUMER);
+  b.put_u16((uint16_t) capture_us);
+  b.put_u16(usage);
   b.set_crc();
   b.put_sentinel();
   b.send();
@@ -166,37 +710,80 @@ void send_uart_keyboard_report(uint8_t leds)
   b.send();
 }
 
-void send_uart_keyboard_connected(bool connected)
+// replaces CONNECTION_CHANGED, which only had the attached devices
+void send_uart_peer_state(uint8_t flags)
 {
-  printf("send kb connected %d on uart\n", connected);
-  uart_buffer<32> b;
+  printf("send peer state %x on uart\n", flags);
+  uart_buffer<16> b;
   b.put_sentinel();
-  b.put(MessageType::CONNECTION_CHANGED);
-  b.put(connected ? 1 : 0);
+  b.put(MessageType::PEER_STATE);
+  b.put(flags);
   b.set_crc();
   b.put_sentinel();
   b.send();
 }
 
-void send_uart_mouse_connected(bool connected)
+// the generation decides between two masks crossing on the wire
+void send_uart_set_output_mask(uint8_t mask, uint16_t generation)
 {
-  printf("send mouse connected %d on uart\n", connected);
+  printf("send output mask %u gen %u\n", mask, generation);
   uart_buffer<32> b;
   b.put_sentinel();
-  b.put(MessageType::CONNECTION_CHANGED);
-  b.put(connected ? 3 : 2);
+  b.put(MessageType::SET_OUTPUT_MASK);
+  b.put(mask);
+  b.put_u16(generation);
   b.set_crc();
   b.put_sentinel();
   b.send();
 }
 
-void send_uart_set_output_mask(uint8_t mask)
+// sent just before the output mask so the peer enters at the same point
+void send_uart_cursor_entry(uint16_t position)
 {
-  printf("send output mask %u\n", mask);
-  uart_buffer<32> b;
+  uart_buffer<16> b;
   b.put_sentinel();
-  b.put(MessageType::SET_OUTPUT_MASK);
+  b.put(MessageType::CURSOR_ENTRY);
+  b.put_u16(position);
+  b.set_crc();
+  b.put_sentinel();
+  b.send();
+}
+
+// the TICK message was never used before, it now keeps the link alive and
+// the two clocks compared
+void send_uart_tick(uint8_t flags, uint8_t mask, uint16_t generation, const link_tick_time *time)
+{
+  uart_buffer<frame_encoded_size(17)> b;
+  b.put_sentinel();
+  b.put(MessageType::TICK);
+  b.put(flags);
   b.put(mask);
+  b.put_u16(generation);
+  b.put_u32(time->sent_us);
+  b.put_u32(time->echo_us);
+  b.put_u32(time->held_us);
+  b.set_crc();
+  b.put_sentinel();
+  b.send();
+}
+
+void send_uart_snapshot(const link_snapshot *s, uint8_t flags)
+{
+  printf("send snapshot mask %u gen %u flags %x\n", s->output_mask, s->generation, flags);
+  uart_buffer<frame_encoded_size(9 + NKRO_KEY_BYTES)> b;
+  b.put_sentinel();
+  b.put(MessageType::SNAPSHOT);
+  b.put(flags);
+  b.put(s->output_mask);
+  b.put_u16(s->generation);
+  b.put(s->flags);
+  b.put(s->leds);
+  b.put(s->buttons);
+  b.put(s->keys.modifier);
+  for (int i = 0; i < NKRO_KEY_BYTES; ++i)
+  {
+    b.put(s->keys.keys[i]);
+  }
   b.set_crc();
   b.put_sentinel();
   b.send();
@@ -212,74 +799,115 @@ static void print_pkt(const uint8_t *pbuf, int plen)
   printf("\n");
 }
 
-static bool process_pkt(const uint8_t *pbuf, int plen)
+static bool HOT_FUNC(process_pkt)(const uint8_t *pbuf, int plen)
 {
+  uint64_t receive_us = time_us_64();
   //printf("got packet type %d, len %d\n", pbuf[0], plen);
   if (plen == 0)
   {
     printf("empty packet\n");
     return false;
   }
-  if (pbuf[0] == MessageType::KEYBOARD)
+  boot_trace_mark(BOOT_LINK_RX);
+  if (pbuf[0] == MessageType::KEYBOARD || pbuf[0] == MessageType::KEYBOARD_BITMAP)
   {
-    if (plen != 9)
+    bool bitmap = pbuf[0] == MessageType::KEYBOARD_BITMAP;
+    if (bitmap ? plen != 5 + NKRO_KEY_BYTES : plen < 5 || plen > 4 + NKRO_KEY_BYTES)
     {
       printf("invalid kb packet %d\n", plen);
       return false;
     }
-    uint8_t c = CRC8::CRC8::calc(pbuf, plen - 1);
-    if (c != pbuf[8])
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[plen - 1])
     {
-      printf("bad kb crc %x != %x ptrs %d %d\n", c, pbuf[8], rx_rptr, rx_wptr);
+      printf("bad kb crc %x != %x ptrs %d %d\n", c, pbuf[plen - 1], rx_rptr, rx_wptr);
       print_pkt(pbuf, plen);
       return false;
     }
-    hid_keyboard_report_t report;
-    report.modifier = pbuf[1];
-    for (int i = 0; i < 6; i++)
+    uint16_t stamp = get_u16(pbuf + 1);
+    key_state report;
+    key_state_clear(&report);
+    report.modifier = pbuf[3];
+    if (bitmap)
     {
-      report.keycode[i] = pbuf[i + 2];
-    }
-    if (should_output())
-    {
-      tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report.modifier, report.keycode);
-      print_kbd_report(&report);
+      memcpy(report.keys, pbuf + 4, NKRO_KEY_BYTES);
     }
     else
     {
-      printf("dropped kb\n");
+      for (int i = 4; i < plen - 1; i++)
+      {
+        key_state_press(&report, pbuf[i]);
+      }
     }
+    handoff_note_keyboard(&report);
+    cdc_protocol_note_input(INPUT_UART, INPUT_KEYBOARD, &report, sizeof(report), receive_us);
+    link_pacing_keyboard(&report, stamp, (uint32_t) receive_us);
     return true;
   }
-  else if (pbuf[0] == MessageType::MOUSE)
+  else if (pbuf[0] == MessageType::MOUSE || pbuf[0] == MessageType::MOUSE_MOTION)
   {
-    if (plen != 7)
+    bool motion = pbuf[0] == MessageType::MOUSE_MOTION;
+    if (plen != (motion ? 7 : 11))
     {
       printf("invalid mouse packet %d\n", plen);
       return false;
     }
-    uint8_t c = CRC8::CRC8::calc(pbuf, plen - 1);
-    if (c != pbuf[6])
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[plen - 1])
     {
       printf("bad mouse crc %x %d %d\n", c, rx_rptr, rx_wptr);
       print_pkt(pbuf, plen);
       return false;
     }
-    hid_mouse_report_t report;
-    report.buttons = pbuf[1];
-    report.x = pbuf[2];
-    report.y = pbuf[3];
-    report.wheel = pbuf[4];
-    report.pan = pbuf[5];
-    if (should_output())
+    uint16_t stamp = get_u16(pbuf + 1);
+    mouse_state report = {};
+    report.buttons = pbuf[3];
+    report.x = pbuf[4];
+    report.y = pbuf[5];
+    if (!motion)
     {
-      tud_hid_mouse_report(REPORT_ID_MOUSE, report.buttons, report.x, report.y, report.wheel, report.pan);
-      print_mouse_report(&report);
+      report.wheel = pbuf[6] | (pbuf[7] << 8);
+      report.pan = pbuf[8] | (pbuf[9] << 8);
     }
-    else
+    handoff_note_mouse_buttons(report.buttons);
+    cdc_protocol_note_input(INPUT_UART, INPUT_MOUSE, &report, sizeof(report), receive_us);
+    link_pacing_mouse(&report, stamp, (uint32_t) receive_us);
+    return true;
+  }
+  else if (pbuf[0] == MessageType::CONSUMER)
+  {
+    if (plen != 6)
     {
-      printf("dropped mouse\n");
+      printf("invalid consumer packet %d\n", plen);
+      return false;
+    }
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[5])
+    {
+      printf("bad consumer crc %x\n", c);
+      return false;
     }
+    uint16_t stamp = get_u16(pbuf + 1);
+    uint16_t usage = pbuf[3] | (pbuf[4] << 8);
+    handoff_note_consumer(usage);
+    cdc_protocol_note_input(INPUT_UART, INPUT_CONSUMER, &usage, sizeof(usage), receive_us);
+    link_pacing_consumer(usage, stamp, (uint32_t) receive_us);
+    return true;
+  }
+  else if (pbuf[0] == MessageType::CURSOR_ENTRY)
+  {
+    if (plen != 4)
+    {
+      printf("invalid cursor entry packet %d\n", plen);
+      return false;
+    }
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[3])
+    {
+      printf("bad cursor entry crc %x\n", c);
+      return false;
+    }
+    edge_switch_set_entry_position(pbuf[1] | (pbuf[2] << 8));
     return true;
   }
   else if (pbuf[0] == MessageType::KEYBOARD_REPORT)
@@ -289,19 +917,14 @@ static bool process_pkt(const uint8_t *pbuf, int plen)
       printf("invalid kb report packet %d\n", plen);
       return false;
     }
-    uint8_t c = CRC8::CRC8::calc(pbuf, plen - 1);
+    uint8_t c = frame_crc8(pbuf, plen - 1);
     if (c != pbuf[2])
     {
       printf(" bad kb report crc %x\n", c);
       return false;
     }
-    static uint8_t leds;
-    leds = pbuf[1];
-    printf("got kb report %d via uart\n", leds);
-    if (keyboard_dev_addr != NO_DEV)
-    {
-      tuh_hid_set_report(keyboard_dev_addr, keyboard_instance, 0, HID_REPORT_TYPE_OUTPUT, &leds, sizeof(leds));
-    }
+    printf("got kb report %d via uart\n", pbuf[1]);
+    handoff_set_peer_leds(pbuf[1]);
     return true;
   }
   else if (pbuf[0] == MessageType::CONNECTION_CHANGED)
@@ -311,7 +934,7 @@ static bool process_pkt(const uint8_t *pbuf, int plen)
       printf("invalid conn changed packet %d\n", plen);
       return false;
     }
-    uint8_t c = CRC8::CRC8::calc(pbuf, plen - 1);
+    uint8_t c = frame_crc8(pbuf, plen - 1);
     if (c != pbuf[2])
     {
       printf(" bad conn changed crc %x\n", c);
@@ -320,21 +943,96 @@ static bool process_pkt(const uint8_t *pbuf, int plen)
     printf("got conn changed %d via uart\n", pbuf[1]);
     return true;
   }
-  else if (pbuf[0] == MessageType::SET_OUTPUT_MASK)
+  else if (pbuf[0] == MessageType::PEER_STATE)
   {
     if (plen != 3)
     {
-      printf("invalid output mask packet %d\n", plen);
+      printf("invalid peer state packet %d\n", plen);
       return false;
     }
-    uint8_t c = CRC8::CRC8::calc(pbuf, plen - 1);
+    uint8_t c = frame_crc8(pbuf, plen - 1);
     if (c != pbuf[2])
+    {
+      printf("bad peer state crc %x\n", c);
+      return false;
+    }
+    peer_state_received(pbuf[1]);
+    return true;
+  }
+  else if (pbuf[0] == MessageType::SET_OUTPUT_MASK)
+  {
+    if (plen != 5)
+    {
+      printf("invalid output mask packet %d\n", plen);
+      return false;
+    }
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[4])
     {
       printf(" bad set output mask crc %x\n", c);
       return false;
     }
-    printf("got set output mask %u via uart\n", pbuf[1]);
-    set_current_output_mask(pbuf[1]);
+    uint16_t generation = pbuf[2] | (pbuf[3] << 8);
+    printf("got set output mask %u gen %u via uart\n", pbuf[1], generation);
+    merge_output_mask(pbuf[1], generation);
+    return true;
+  }
+  else if (pbuf[0] == MessageType::TICK)
+  {
+    if (plen != 18)
+    {
+      printf("invalid tick packet %d\n", plen);
+      return false;
+    }
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[17])
+    {
+      printf("bad tick crc %x\n", c);
+      return false;
+    }
+    link_tick_time time = { get_u32(pbuf + 5), get_u32(pbuf + 9), get_u32(pbuf + 13) };
+    link_pacing_tick_received(&time, (uint32_t) receive_us);
+    link_sync_tick_received(pbuf[1], pbuf[2], pbuf[3] | (pbuf[4] << 8));
+    return true;
+  }
+  else if (pbuf[0] == MessageType::SNAPSHOT)
+  {
+    if (plen != 10 + NKRO_KEY_BYTES)
+    {
+      printf("invalid snapshot packet %d\n", plen);
+      return false;
+    }
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[plen - 1])
+    {
+      printf("bad snapshot crc %x\n", c);
+      return false;
+    }
+    link_snapshot s = {};
+    s.output_mask = pbuf[2];
+    s.generation = pbuf[3] | (pbuf[4] << 8);
+    s.flags = pbuf[5];
+    s.leds = pbuf[6];
+    s.buttons = pbuf[7];
+    s.keys.modifier = pbuf[8];
+    memcpy(s.keys.keys, pbuf + 9, NKRO_KEY_BYTES);
+    link_sync_snapshot_received(&s, pbuf[1]);
+    return true;
+  }
+  else if (pbuf[0] == MessageType::CREDIT)
+  {
+    if (plen != 5)
+    {
+      printf("invalid credit packet %d\n", plen);
+      return false;
+    }
+    uint8_t c = frame_crc8(pbuf, plen - 1);
+    if (c != pbuf[plen - 1])
+    {
+      printf("bad credit crc %x\n", c);
+      return false;
+    }
+    credit_received(pbuf[1], get_u16(pbuf + 2));
     return true;
   }
   else
@@ -344,114 +1042,171 @@ static bool process_pkt(const uint8_t *pbuf, int plen)
   }
 }
 
-void uart_task()
+// Bytes are fed to the decoder as they arrive, so a frame split across
+// interrupts isn't parsed again. A bad or overlong frame costs that frame
+// and the decoder starts again at its closing sentinel, so the next good
+// frame gets through whatever the line noise left behind.
+void HOT_FUNC(uart_task)()
 {
-  had_interrupt = false;
+  PROFILE_SCOPE(PROBE_UART_TASK);
   read_pending();
-  if (rx_rptr == rx_wptr)
-  {
-    return;
-  }
-
   int r = rx_rptr;
-  int orig_r = r;
-  int w = rx_wptr;
-  bool in_pkt = false;
-  uint8_t pbuf[32];
-  int plen = 0;
-  while (r != w)
+  int taken = 0;
+  while (r != rx_wptr)
   {
-    //printf("buf[%d] = %x, r %d w %d\n", r, rx_buf[r], r, w);
-    if (r > RX_BUF_SIZE)
-    {
-      printf("dearie me! r = %d w = %d\n", r, w);
-      break;
-    }
-    if (in_pkt && rx_buf[r] == ESCAPE)
-    {
-      r++;
-      if (r == RX_BUF_SIZE)
-      {
-        r = 0;
-      }
-      if (r == w)
-      {
-        break;
-      }
-      pbuf[plen++] = rx_buf[r];
-      r++;
-    }
-    else if (rx_buf[r] == SENTINEL)
+    uint8_t b = rx_buf[r];
+    r = r + 1 == RX_BUF_SIZE ? 0 : r + 1;
+    rx_rptr = r;
+    taken++;
+    switch (decoder.feed(b))
     {
-      r++;
-      if (r == RX_BUF_SIZE)
-      {
-        r = 0;
-      }
-      if (in_pkt)
-      {
-        int save_rx_rptr = rx_rptr;
-        if (!process_pkt(pbuf, plen))
-        {
-          printf("process pkt failed r %d orig %d save_rx_rptr %d rx_rptr %d rx_wptr %d w %d plen %d\n", 
-              r, orig_r, save_rx_rptr, rx_rptr, rx_wptr, w, plen);
-          for (int i = 0; i < plen; ++i)
-          {
-            printf(" %02x", pbuf[i]);
-          }
-          printf("\nbuf\n");
-          for (int i = 0; i < RX_BUF_SIZE / 32; ++i)
-          {
-            printf("%3d: ", i * 32);
-            char line[128];
-            int lptr = 0;
-            for (int j = 0; j < 32; ++j)
-            {
-              static const char *hexdigits = "0123456789abcdef";
-              uint8_t b = rx_buf[i * 32 + j];
-              line[lptr++] = hexdigits[b >> 4];
-              line[lptr++] = hexdigits[b & 0xf];
-              line[lptr++] = ' ';
-            }
-            line[lptr++] = '\n';
-            line[lptr++] = '\0';
-            puts(line);
-          }
-        }
-        else if (w == 0)
+      case FRAME_COMPLETE:
+        link_stats.frames++;
+        if (!process_pkt(decoder.data(), decoder.size() + 1))
         {
-          printf("process pkt ok r %d orig %d rx_rptr %d w %d plen %d\n", r, orig_r, save_rx_rptr, w, plen);
+          link_stats.rejected++;
+          printf("process pkt failed\n");
+          print_pkt(decoder.data(), decoder.size() + 1);
         }
-        if (had_interrupt)
-        {
-          printf("had interrupt\n");
-        }
-        plen = 0;
-        in_pkt = false;
-        rx_rptr = r;
-      }
-      else
-      {
-        in_pkt = true;
-      }
+        break;
+      case FRAME_BAD:
+        link_stats.bad_frames++;
+        printf("bad uart frame\n");
+        break;
+      case FRAME_OUTSIDE:
+        link_stats.bytes_outside++;
+        break;
+      default:
+        break;
     }
-    else if (in_pkt)
+  }
+  if (rx_paused)
+  {
+    // what waited in the fifo is read on the next run
+    critical_section_enter_blocking(&rx_cs);
+    rx_paused = false;
+    uart_set_irq_enables(UART_ID, true, false);
+    critical_section_exit(&rx_cs);
+    sched_post(TASK_UART_RX);
+  }
+  grant(taken);
+}
+
+uart_link_stats uart_link_get_stats()
+{
+  return link_stats;
+}
+
+void uart_link_reset_stats()
+{
+  memset(&link_stats, 0, sizeof(link_stats));
+}
+
+uart_flow_stats uart_flow_get_stats()
+{
+  critical_section_enter_blocking(&tx_cs);
+  uart_flow_stats s = flow_stats;
+  critical_section_exit(&tx_cs);
+  return s;
+}
+
+void uart_flow_reset_stats()
+{
+  critical_section_enter_blocking(&tx_cs);
+  memset(&flow_stats, 0, sizeof(flow_stats));
+  flow_stats.queue_high_water = tx_count;
+  critical_section_exit(&tx_cs);
+}
+
+void uart_flow_print()
+{
+  critical_section_enter_blocking(&tx_cs);
+  uart_flow_stats s = flow_stats;
+  uart_credit credit = peer_credit;
+  int queued = tx_count;
+  int held = tx_held_count;
+  bool gating = rx_gating;
+  critical_section_exit(&tx_cs);
+  if (UART_RTS_CTS_ENABLED)
+  {
+    cdc_printf("uart flow rts/cts on gpio %d/%d", UART_RTS_PIN, UART_CTS_PIN);
+  }
+  else if (credit.active && credit.gated)
+  {
+    cdc_printf("uart flow credit %ld of %d", (long) uart_credit_left(&credit), UART_CREDIT_WINDOW);
+  }
+  else if (credit.active)
+  {
+    cdc_printf("uart flow credit, the peer keeps up");
+  }
+  else
+  {
+    cdc_printf("uart flow none, the peer sent no credit");
+  }
+  cdc_printf("%s queued %d held %d high water %ld waited %lu timeouts %lu merged %lu rx full %lu\r\n",
+    gating ? ", holding the peer back" : "", queued, held, (long) s.queue_high_water, (unsigned long) s.waited,
+    (unsigned long) s.timeouts, (unsigned long) s.merged, (unsigned long) s.rx_full);
+}
+
+#if PROFILE_ENABLED
+// decodes a frame as uart_task does, placed where uart_task is
+static uint32_t HOT_FUNC(time_decode)(const uint8_t *bytes, int len)
+{
+  frame_decoder<MAX_UART_FRAME> d;
+  FrameResult r = FRAME_NONE;
+  uint32_t start = systick_hw->cvr;
+  for (int i = 0; i < len; ++i)
+  {
+    r = d.feed(bytes[i]);
+  }
+  uint32_t cycles = (start - systick_hw->cvr) & 0xffffff;
+  return r == FRAME_COMPLETE ? cycles : 0;
+}
+#endif
+
+// Times decoding the longest frame with the XIP cache flushed first, so any
+// of the decoder and crc table left in flash has to be fetched, then warm.
+// The cold figures are the worst a frame can meet, compare them between
+// builds with and without RAM_HOT_PATH.
+void uart_link_bench()
+{
+#if PROFILE_ENABLED
+  static const int RUNS = 32;
+  frame_encoder<frame_encoded_size(MAX_UART_FRAME - 1)> frame;
+  frame.put_sentinel();
+  for (int i = 0; i < MAX_UART_FRAME - 1; ++i)
+  {
+    frame.put((uint8_t) (i * 37));
+  }
+  frame.set_crc();
+  frame.put_sentinel();
+
+  uint32_t min_cycles[2] = {UINT32_MAX, UINT32_MAX};
+  uint32_t max_cycles[2] = {0, 0};
+  for (int run = 0; run < 2 * RUNS; ++run)
+  {
+    int cold = run % 2;
+    uint32_t status = save_and_disable_interrupts();
+    if (cold)
     {
-      pbuf[plen++] = rx_buf[r++];
+      xip_ctrl_hw->flush = 1;
+      (void) xip_ctrl_hw->flush; // reading waits for the flush to finish
     }
-    else
+    uint32_t cycles = time_decode(frame.data(), frame.size());
+    restore_interrupts(status);
+    if (cycles < min_cycles[cold])
     {
-      printf("drop byte %02x r %d w %d %d %d\n", rx_buf[r], r, w, rx_rptr, rx_wptr);
-      r++; // drop
-      if (r == RX_BUF_SIZE)
-      {
-        r = 0;
-      }
-      rx_rptr = r;
+      min_cycles[cold] = cycles;
     }
-    if (r == RX_BUF_SIZE)
+    if (cycles > max_cycles[cold])
     {
-      r = 0;
+      max_cycles[cold] = cycles;
     }
   }
+  cdc_printf("uart frame decode, %d bytes, ram hot path %s\r\n", frame.size(), RAM_HOT_PATH_ENABLED ? "on" : "off");
+  cdc_printf("  cold min %lu max %lu cycles\r\n", (unsigned long) min_cycles[1], (unsigned long) max_cycles[1]);
+  cdc_printf("  warm min %lu max %lu cycles\r\n", (unsigned long) min_cycles[0], (unsigned long) max_cycles[0]);
+#else
+  cdc_printf("built without PROFILE\r\n");
+#endif
 }
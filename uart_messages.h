@@ -1,13 +1,37 @@
 #pragma once
 
+#include "key_state.h"
+#include "link_pacing.h"
+#include "link_sync.h"
+#include "mouse_state.h"
+#include "uart_flow.h"
 #include "tusb.h"
 
+struct uart_link_stats
+{
+  uint32_t frames;        // good crc
+  uint32_t bad_frames;    // bad crc or too long
+  uint32_t rejected;      // good crc, not a valid message
+  uint32_t bytes_outside; // line noise between frames
+  uint32_t frames_sent;   // from either core, the count may slip
+};
+
 extern void uart_task();
-extern void init_uart();
-extern void send_uart_kb_report(const hid_keyboard_report_t *report);
-extern void send_uart_mouse_report(const hid_mouse_report_t *report);
+extern uart_link_stats uart_link_get_stats();
+extern void uart_link_reset_stats();
+extern void uart_link_bench();
+extern void uart_flow_task();
+extern uart_flow_stats uart_flow_get_stats();
+extern void uart_flow_reset_stats();
+extern void uart_flow_print();
+extern void init_uart(uint32_t baud_rate);
+extern void send_uart_kb_report(const key_state *state, uint64_t capture_us);
+extern void send_uart_mouse_report(const mouse_state *state, uint64_t capture_us);
+extern void send_uart_consumer_report(uint16_t usage, uint64_t capture_us);
 extern void send_uart_keyboard_report(uint8_t leds);
-extern void send_uart_keyboard_connected(bool connected);
-extern void send_uart_mouse_connected(bool connected);
+extern void send_uart_peer_state(uint8_t flags);
 extern void send_uart_enable_board(int number);
-extern void send_uart_set_output_mask(uint8_t mask);
+extern void send_uart_set_output_mask(uint8_t mask, uint16_t generation);
+extern void send_uart_cursor_entry(uint16_t position);
+extern void send_uart_tick(uint8_t flags, uint8_t mask, uint16_t generation, const link_tick_time *time);
+extern void send_uart_snapshot(const link_snapshot *s, uint8_t flags);
@@ -24,6 +24,8 @@
  *
  */
 
+#include "edge_switch.h"
+#include "key_state.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
 
@@ -84,6 +86,9 @@ enum
   ITF_NUM_CDC = 0,
   ITF_NUM_CDC_DATA,
   ITF_NUM_HID,
+#if HID_SPLIT_INTERFACES
+  ITF_NUM_HID_MOUSE,
+#endif
   ITF_NUM_TOTAL
 };
 
@@ -91,15 +96,183 @@ enum
 #define EPNUM_CDC_OUT     0x02
 #define EPNUM_CDC_IN      0x82
 #define EPNUM_HID   0x83
+#define EPNUM_HID_MOUSE   0x84
+
+// full speed interrupt endpoints can be polled every frame, the host reads a
+// new report at most this many ms after it is queued
+#ifndef HID_POLL_INTERVAL_MS
+#define HID_POLL_INTERVAL_MS 1
+#endif
+
+// Key bitmap with the same layout as key_state, one bit per usage so any
+// number of keys can be down. The keyboard report above stays for its LED
+// output and is what gets sent while the host asks for the boot protocol.
+#define HID_REPORT_DESC_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP                ) ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD            ) ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION            ) ,\
+    __VA_ARGS__ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD             ) ,\
+    HID_USAGE_MIN  ( 224                                 ) ,\
+    HID_USAGE_MAX  ( 231                                 ) ,\
+    HID_LOGICAL_MIN( 0                                   ) ,\
+    HID_LOGICAL_MAX( 1                                   ) ,\
+    HID_REPORT_COUNT( 8                                  ) ,\
+    HID_REPORT_SIZE( 1                                   ) ,\
+    HID_INPUT      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+    HID_USAGE_MIN  ( 0                                   ) ,\
+    HID_USAGE_MAX  ( NKRO_KEY_COUNT - 1                  ) ,\
+    HID_REPORT_COUNT( NKRO_KEY_COUNT                     ) ,\
+    HID_REPORT_SIZE( 1                                   ) ,\
+    HID_INPUT      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+  HID_COLLECTION_END
+
+// Boot mouse layout with 16 bit wheel and pan, each in a logical collection
+// with its own resolution multiplier so the host can ask for fractions of a
+// detent. Without that the counts are whole detents.
+#define HID_REPORT_DESC_MOUSE_HIGH_RES(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP                ) ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_MOUSE               ) ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION            ) ,\
+    __VA_ARGS__ \
+    HID_USAGE      ( HID_USAGE_DESKTOP_POINTER           ) ,\
+    HID_COLLECTION ( HID_COLLECTION_PHYSICAL             ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_BUTTON            ) ,\
+        HID_USAGE_MIN   ( 1                              ) ,\
+        HID_USAGE_MAX   ( 5                              ) ,\
+        HID_LOGICAL_MIN ( 0                              ) ,\
+        HID_LOGICAL_MAX ( 1                              ) ,\
+        HID_REPORT_COUNT( 5                              ) ,\
+        HID_REPORT_SIZE ( 1                              ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_REPORT_COUNT( 1                              ) ,\
+        HID_REPORT_SIZE ( 3                              ) ,\
+        HID_INPUT       ( HID_CONSTANT                   ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_DESKTOP           ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_X            ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_Y            ) ,\
+        HID_LOGICAL_MIN ( 0x81                           ) ,\
+        HID_LOGICAL_MAX ( 0x7f                           ) ,\
+        HID_REPORT_COUNT( 2                              ) ,\
+        HID_REPORT_SIZE ( 8                              ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION ( HID_COLLECTION_LOGICAL            ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER ) ,\
+        HID_LOGICAL_MIN ( 0                              ) ,\
+        HID_LOGICAL_MAX ( 1                              ) ,\
+        HID_PHYSICAL_MIN( 1                              ) ,\
+        HID_PHYSICAL_MAX( MOUSE_WHEEL_MULTIPLIER         ) ,\
+        HID_REPORT_COUNT( 1                              ) ,\
+        HID_REPORT_SIZE ( 2                              ) ,\
+        HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL        ) ,\
+        HID_LOGICAL_MIN_N( -32767, 2                     ) ,\
+        HID_LOGICAL_MAX_N( 32767, 2                      ) ,\
+        HID_PHYSICAL_MIN( 0                              ) ,\
+        HID_PHYSICAL_MAX( 0                              ) ,\
+        HID_REPORT_SIZE ( 16                             ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION_END ,\
+      HID_COLLECTION ( HID_COLLECTION_LOGICAL            ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER ) ,\
+        HID_LOGICAL_MIN ( 0                              ) ,\
+        HID_LOGICAL_MAX ( 1                              ) ,\
+        HID_PHYSICAL_MIN( 1                              ) ,\
+        HID_PHYSICAL_MAX( MOUSE_WHEEL_MULTIPLIER         ) ,\
+        HID_REPORT_SIZE ( 2                              ) ,\
+        HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_PHYSICAL_MIN( 0                              ) ,\
+        HID_PHYSICAL_MAX( 0                              ) ,\
+        HID_REPORT_SIZE ( 4                              ) ,\
+        HID_FEATURE     ( HID_CONSTANT                   ) ,\
+        HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER        ) ,\
+        HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2   ) ,\
+        HID_LOGICAL_MIN_N( -32767, 2                     ) ,\
+        HID_LOGICAL_MAX_N( 32767, 2                      ) ,\
+        HID_REPORT_SIZE ( 16                             ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION_END ,\
+    HID_COLLECTION_END ,\
+  HID_COLLECTION_END
+
+// Buttons, a 16 bit absolute position and a plain wheel, sent in place of the
+// mouse report while edge switching places the cursor itself
+#define HID_REPORT_DESC_ABSOLUTE_POINTER(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP                ) ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_MOUSE               ) ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION            ) ,\
+    __VA_ARGS__ \
+    HID_USAGE      ( HID_USAGE_DESKTOP_POINTER           ) ,\
+    HID_COLLECTION ( HID_COLLECTION_PHYSICAL             ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_BUTTON            ) ,\
+        HID_USAGE_MIN   ( 1                              ) ,\
+        HID_USAGE_MAX   ( 5                              ) ,\
+        HID_LOGICAL_MIN ( 0                              ) ,\
+        HID_LOGICAL_MAX ( 1                              ) ,\
+        HID_REPORT_COUNT( 5                              ) ,\
+        HID_REPORT_SIZE ( 1                              ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_REPORT_COUNT( 1                              ) ,\
+        HID_REPORT_SIZE ( 3                              ) ,\
+        HID_INPUT       ( HID_CONSTANT                   ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_DESKTOP           ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_X            ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_Y            ) ,\
+        HID_LOGICAL_MIN ( 0                              ) ,\
+        HID_LOGICAL_MAX_N( EDGE_SWITCH_ABSOLUTE_MAX, 2   ) ,\
+        HID_REPORT_COUNT( 2                              ) ,\
+        HID_REPORT_SIZE ( 16                             ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL        ) ,\
+        HID_LOGICAL_MIN ( 0x81                           ) ,\
+        HID_LOGICAL_MAX ( 0x7f                           ) ,\
+        HID_REPORT_COUNT( 1                              ) ,\
+        HID_REPORT_SIZE ( 8                              ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER          ) ,\
+        HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2   ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+    HID_COLLECTION_END ,\
+  HID_COLLECTION_END
+
+#if ABSOLUTE_POINTER
+#define DESC_ABSOLUTE_POINTER HID_REPORT_DESC_ABSOLUTE_POINTER( HID_REPORT_ID(REPORT_ID_ABSOLUTE_POINTER) ),
+#else
+#define DESC_ABSOLUTE_POINTER
+#endif
+
+#if HID_SPLIT_INTERFACES
+
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + 2 * TUD_HID_DESC_LEN)
+
+uint8_t const desc_hid_report[] =
+{
+  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD      )),
+  HID_REPORT_DESC_NKRO(         HID_REPORT_ID(REPORT_ID_NKRO          )),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL ))
+};
+
+uint8_t const desc_hid_mouse_report[] =
+{
+  DESC_ABSOLUTE_POINTER
+  HID_REPORT_DESC_MOUSE_HIGH_RES( HID_REPORT_ID(REPORT_ID_MOUSE       ))
+};
+
+#else
 
 #define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_HID_DESC_LEN)
 
 uint8_t const desc_hid_report[] =
 {
   TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD      )),
-  TUD_HID_REPORT_DESC_MOUSE(    HID_REPORT_ID(REPORT_ID_MOUSE         ))
+  HID_REPORT_DESC_NKRO(         HID_REPORT_ID(REPORT_ID_NKRO          )),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
+  DESC_ABSOLUTE_POINTER
+  HID_REPORT_DESC_MOUSE_HIGH_RES( HID_REPORT_ID(REPORT_ID_MOUSE       ))
 };
 
+#endif
+
 // full speed configuration
 uint8_t const desc_fs_configuration[] =
 {
@@ -109,7 +282,11 @@ uint8_t const desc_fs_configuration[] =
   // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
   TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
     // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+    // boot keyboard so a BIOS can ask for the boot protocol
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS),
+#if HID_SPLIT_INTERFACES
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_MOUSE, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_mouse_report), EPNUM_HID_MOUSE, CFG_TUD_HID_EP_BUFSIZE, HID_POLL_INTERVAL_MS)
+#endif
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -183,8 +360,13 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t itf)
 {
-  printf("get hid report\n");
-    (void) itf;
+  printf("get hid report %u\n", itf);
+#if HID_SPLIT_INTERFACES
+  if (itf == HID_INSTANCE_MOUSE)
+  {
+    return desc_hid_mouse_report;
+  }
+#endif
   return desc_hid_report;
 }
 
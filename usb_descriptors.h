@@ -31,7 +31,25 @@ enum
   REPORT_ID_MOUSE,
   REPORT_ID_CONSUMER_CONTROL,
   REPORT_ID_GAMEPAD,
+  REPORT_ID_NKRO,
+  REPORT_ID_ABSOLUTE_POINTER,
   REPORT_ID_COUNT
 };
 
+// The mouse wheel and pan each have a resolution multiplier in the mouse
+// feature report. Once the host sets one it gets this many counts per detent.
+enum
+{
+  MOUSE_WHEEL_MULTIPLIER = 120,
+  MOUSE_FEATURE_WHEEL_HIGH_RES = 0x01,
+  MOUSE_FEATURE_PAN_HIGH_RES = 0x04
+};
+
+// HID interface instances for tud_hid_n_*()
+enum
+{
+  HID_INSTANCE_KEYBOARD = 0,
+  HID_INSTANCE_MOUSE = HID_SPLIT_INTERFACES ? 1 : 0
+};
+
 #endif /* USB_DESCRIPTORS_H_ */
\ No newline at end of file